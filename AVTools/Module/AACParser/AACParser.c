@@ -5,11 +5,29 @@
 //  Created by WorkSpace_Sun on 2021/7/27.
 //
 
+#if defined(__linux__)
+#define _GNU_SOURCE     // copy_file_range
+#endif
+
 #include "AACParser.h"
 #include <getopt.h>
 #include <stdlib.h>
 #include <string.h>
 #include <stdbool.h>
+#include <stdint.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <errno.h>
+#include <math.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
 
 /* ADTS 格式的帧结构包含固定头、可变头和crc检验，crc校验不一定有，所以整体头部占7字节或9字节
    adts_header = adts_fixed_header (28bit) + adts_variable_header (28bit) + *adts_error_check (16bit)
@@ -48,7 +66,13 @@
     码率 = header字段aac_frame_length * 8 * 采样率 / 单帧sample个数  单位bps
  */
 
-#define AAC_BUFFER_SIZE  10 * 1024
+#define ADTS_HEADER_SIZE            7                // 无crc校验时的header长度
+#define ADTS_MAX_FRAME_LENGTH       8191             // aac_frame_length 13bit 最大值
+#define ADTS_SAMPLES_PER_BLOCK      1024             // ADTS 每个原始帧的采样点个数  HE-AAC 在ADTS中同样按 AAC-LC 的1024标识
+#define ADTS_HISTOGRAM_BIN_SIZE     128              // 帧大小直方图每个区间的字节跨度
+#define ADTS_HISTOGRAM_BINS         ((ADTS_MAX_FRAME_LENGTH + ADTS_HISTOGRAM_BIN_SIZE) / ADTS_HISTOGRAM_BIN_SIZE)
+#define ADTS_MAX_RESYNC_EVENTS      16               // summary 中最多记录的失步事件个数
+#define ADTS_INDEX_MAGIC            "ADTSIDX1"      // 索引文件标识
 
 static struct option tool_long_options[] = {
     {"help", no_argument, NULL, '`'}
@@ -101,6 +125,8 @@ const static char *aac_profile[] = {"AAC Main", "AAC LC", "AAC SSR", "Reserved"}
 const static char *aac_sample_frequency[] = {"96000", "88200", "64000", "48000", "44100", "32000", "24000", "22050", "16000", "12000", "11025", "8000", "7350", "Reserved1", "Reserved2", "escape value"};
 const static char *aac_channel_config[] = {"0", "1", "2", "3", "4", "5", "5+1", "7+1"};
 
+const static uint32_t aac_sample_rate[] = {96000, 88200, 64000, 48000, 44100, 32000, 24000, 22050, 16000, 12000, 11025, 8000, 7350};
+
 typedef struct {
     AAC_ID id;
     bool protection_absent;
@@ -111,9 +137,79 @@ typedef struct {
     uint32_t number_of_raw_data_blocks_in_frame;
 } ADTS_HEADER;
 
-static void parse(char *url);
-static int get_adts_header(ADTS_HEADER *adts, FILE *aac_bit_stream);
-static int find_start_code(unsigned char *buffer, size_t buffer_size);
+// 基于 mmap 的单遍扫描器  顺着 aac_frame_length 从一帧跳到下一帧
+typedef struct {
+    const uint8_t *data;        // 文件映射起始地址
+    size_t size;                // 文件大小
+    size_t pos;                 // 下一帧的预期偏移
+} ADTS_SCANNER;
+
+typedef struct {
+    size_t offset;              // 重新锁定后第一帧的偏移
+    size_t skipped;             // 失步跳过的字节数
+} ADTS_RESYNC_EVENT;
+
+// summary 模式的统计信息
+typedef struct {
+    ADTS_HEADER first_header;                       // 第一帧头部  用于输出格式信息
+    uint64_t format_changes;                        // profile/采样率/声道 与第一帧不一致的帧数
+    uint64_t frame_count;                           // ADTS 帧数
+    uint64_t total_bytes;                           // ADTS 帧总字节数
+    uint64_t total_samples;                         // 总采样点个数
+    double duration;                                // 总时长  单位s
+    uint32_t min_frame_length;                      // 最小帧长度
+    uint32_t max_frame_length;                      // 最大帧长度
+    uint64_t histogram[ADTS_HISTOGRAM_BINS];        // 帧大小直方图
+    uint64_t window_bytes;                          // 当前 1s 窗口内的字节数
+    double window_duration;                         // 当前窗口时长
+    double peak_bitrate;                            // 1s 窗口峰值码率
+    uint64_t resync_count;                          // 失步次数
+    uint64_t resync_bytes;                          // 失步跳过的总字节数
+    ADTS_RESYNC_EVENT resync_events[ADTS_MAX_RESYNC_EVENTS];
+    size_t tail_bytes;                              // 文件末尾不完整帧的字节数
+} ADTS_STATS;
+
+/* 索引文件结构：ADTS_INDEX_HEADER + (frame_count + 1) 个帧偏移
+   第 n 项为第 n 帧在 aac 文件中的字节偏移  最后一项为最后一帧的结束位置
+   aac 文件小于 4GB 时偏移按 4 字节存储  否则按 8 字节存储
+   帧号 n 对应的时间 = n * samples_per_frame / sample_rate */
+typedef struct {
+    char magic[8];                  // "ADTSIDX1"
+    uint32_t sample_rate;           // 第一帧的采样率
+    uint32_t samples_per_frame;     // 第一帧的采样点个数
+    uint32_t offset_size;           // 单个偏移的字节数  4 或 8
+    uint32_t reserved;
+    uint64_t frame_count;           // 帧数
+    uint64_t file_size;             // 建索引时 aac 文件大小  用于校验索引是否过期
+} ADTS_INDEX_HEADER;
+
+typedef struct {
+    ADTS_INDEX_HEADER header;
+    uint8_t *table;                 // 偏移表
+    size_t table_capacity;          // 偏移表容量  单位字节
+    void *mapping;                  // 从文件加载时的映射地址
+    size_t mapping_size;            // 映射大小
+} ADTS_INDEX;
+
+static void parse(char *url, bool summary);
+static int map_input_file(const char *url, const uint8_t **data, size_t *size);
+static bool check_adts_header(const uint8_t *buffer, size_t buffer_size, uint32_t *frame_length);
+static void parse_adts_header(const uint8_t *buffer, ADTS_HEADER *adts);
+static int next_adts_frame(ADTS_SCANNER *scanner, ADTS_HEADER *adts, size_t *offset, size_t *skipped);
+static size_t find_sync_word(const uint8_t *buffer, size_t buffer_size);
+static void update_adts_stats(ADTS_STATS *stats, const ADTS_HEADER *adts);
+static void record_resync_event(ADTS_STATS *stats, size_t offset, size_t skipped);
+static void print_adts_stats(ADTS_STATS *stats, size_t file_size, double elapsed);
+static double get_time_seconds(void);
+static void build_index(const char *url, const char *index_url);
+static void cut(const char *url, const char *index_url, double start, double duration, const char *output_url);
+static int build_adts_index(const uint8_t *data, size_t size, ADTS_INDEX *index);
+static int append_index_offset(ADTS_INDEX *index, uint64_t offset);
+static uint64_t get_index_offset(const ADTS_INDEX *index, uint64_t frame);
+static int write_adts_index(const char *index_url, const ADTS_INDEX *index);
+static int load_adts_index(const char *index_url, uint64_t file_size, ADTS_INDEX *index);
+static void free_adts_index(ADTS_INDEX *index);
+static int copy_range(int input_fd, uint64_t offset, uint64_t length, int output_fd);
 
 /**
  * Print Module Help
@@ -124,9 +220,18 @@ static void show_module_help() {
     printf("\n");
     printf("Param:\n\n");
     printf("  -i:   Input File Local Path\n");
+    printf("  -s:   Summary Mode, Print Duration / Bitrate / Frame Size Histogram / Resync Events Instead Of Frame Table\n");
+    printf("  -x:   Frame Index File Path. Build The Index When Used Alone, Reuse It When Cutting\n");
+    printf("  -b:   Cut Start Time In Seconds, Default 0\n");
+    printf("  -d:   Cut Duration In Seconds, Default To End Of File\n");
+    printf("  -o:   Cut Output File Path\n");
     printf("\n");
     printf("Usage:\n\n");
-    printf("  AVTools AACParser -i input.aac\n\n");
+    printf("  AVTools AACParser -i input.aac\n");
+    printf("  AVTools AACParser -i input.aac -s\n");
+    printf("  AVTools AACParser -i input.aac -x input.idx\n");
+    printf("  AVTools AACParser -i input.aac -x input.idx -b 3600 -d 30 -o output.aac\n\n");
+    printf("Cut Points Are Aligned To ADTS Frames (1024 Samples Per Raw Data Block).\n\n");
     printf("Get Raw AAC With FFMPEG From Mp4 File:\n\n");
     printf("  ffmpeg -i video.mp4 -vn -acodec copy raw.aac\n");
 }
@@ -139,8 +244,13 @@ static void show_module_help() {
 void aac_parser_parse_cmd(int argc, char *argv[]) {
     int option = 0;   // getopt_long的返回值，返回匹配到字符的ascii码，没有匹配到可读参数时返回-1
     char *url = NULL;   // 输入文件路径
+    bool summary = false;   // 是否只输出统计信息
+    char *index_url = NULL;   // 索引文件路径
+    char *output_url = NULL;   // 剪切输出路径
+    double start = 0;   // 剪切起始时间  单位s
+    double duration = -1;   // 剪切时长  小于0表示直到文件末尾
     
-    while (EOF != (option = getopt_long(argc, argv, "i:", tool_long_options, NULL))) {
+    while (EOF != (option = getopt_long(argc, argv, "i:sx:b:d:o:", tool_long_options, NULL))) {
         switch (option) {
             case '`':
                 show_module_help();
@@ -149,6 +259,21 @@ void aac_parser_parse_cmd(int argc, char *argv[]) {
             case 'i':
                 url = optarg;
                 break;
+            case 's':
+                summary = true;
+                break;
+            case 'x':
+                index_url = optarg;
+                break;
+            case 'b':
+                start = atof(optarg);
+                break;
+            case 'd':
+                duration = atof(optarg);
+                break;
+            case 'o':
+                output_url = optarg;
+                break;
             case '?':
                 printf("Use 'AVTools %s --help' To Show Detail Usage.\n", argv[1]);
                 return;
@@ -163,154 +288,819 @@ void aac_parser_parse_cmd(int argc, char *argv[]) {
         return;
     }
     
-    parse(url);
+    if (output_url) {
+        cut(url, index_url, start, duration, output_url);
+    } else if (index_url) {
+        build_index(url, index_url);
+    } else {
+        parse(url, summary);
+    }
 }
 
 /**
  * Parse
- * @param url    aac file path
+ * @param url           aac file path
+ * @param summary     true: 只输出统计信息  false: 逐帧输出ADTS表
  */
-static void parse(char *url) {
+static void parse(char *url, bool summary) {
     
-    ADTS_HEADER *adts = NULL;
-    FILE *aac_bit_stream = NULL;
+    ADTS_HEADER adts = {};
+    ADTS_SCANNER scanner = {};
+    ADTS_STATS *stats = NULL;
     FILE *myout = stdout;
+    const uint8_t *data = NULL;
+    size_t size = 0;
+    size_t offset = 0;
+    size_t skipped = 0;
     int index = 0;
+    double start_time = 0;
     
-    // 打开输入文件
-    aac_bit_stream = fopen(url, "rb");
-    if (aac_bit_stream == NULL) {
-        printf("Open File Error.\n");
+    // 映射输入文件  整个解析过程只顺序访问一遍
+    if (map_input_file(url, &data, &size) < 0) {
         return;
     }
     
-    // 初始化ADTS实例
-    adts = (ADTS_HEADER *)calloc(1, sizeof(ADTS_HEADER));
-    if (adts == NULL) {
-        printf("Alloc ADTS Error.\n");
-        fclose(aac_bit_stream);
-        return;
+    scanner.data = data;
+    scanner.size = size;
+    scanner.pos = 0;
+    
+    if (summary) {
+        stats = (ADTS_STATS *)calloc(1, sizeof(ADTS_STATS));
+        if (stats == NULL) {
+            printf("Alloc ADTS Stats Error.\n");
+            goto __END;
+        }
+        
+        start_time = get_time_seconds();
+        while (next_adts_frame(&scanner, &adts, &offset, &skipped) == 0) {
+            if (skipped > 0) {
+                record_resync_event(stats, offset, skipped);
+            }
+            update_adts_stats(stats, &adts);
+        }
+        stats->tail_bytes = skipped;
+        print_adts_stats(stats, size, get_time_seconds() - start_time);
+        goto __END;
     }
     
     printf("-------+----------+-----------+-------- ADTS Table -------+--------------+---------------+\n");
     printf("  NUM  |    ID    |  PROFILE  |   FREQUENCY   |  CHANNEL  |  FRAME SIZE  |  FRAME COUNT  \n");
     printf("-------+----------+-----------+---------------+-----------+--------------+---------------+\n");
     
-    while (!feof(aac_bit_stream)) {
-        if (get_adts_header(adts, aac_bit_stream) == 0) {
-            char mpeg_id[10] = {0};
-            char profile[10] = {0};
-            char frequency[15] = {0};
-            char channel[4] = {0};
-            int frame_size = 0;
-            int frame_count = 0;
-            
-            sprintf(mpeg_id, "%s", aac_id[adts->id]);
-            sprintf(profile, "%s", aac_profile[adts->profile]);
-            sprintf(frequency, "%s", aac_sample_frequency[adts->sampling_frequency_index]);
-            sprintf(channel, "%s", aac_channel_config[adts->channel_configuration]);
-            frame_size = adts->aac_frame_length;
-            frame_count = adts->number_of_raw_data_blocks_in_frame;
-            
-            fprintf(myout, " %5d | %8s | %9s | %13s | %9s | %12d | %13d \n", index, mpeg_id, profile, frequency, channel, frame_size, frame_count);
-            index++;
-        } else {
-            continue;
+    while (next_adts_frame(&scanner, &adts, &offset, &skipped) == 0) {
+        if (skipped > 0) {
+            fprintf(myout, " Resync: skipped %zu bytes, locked at offset %zu\n", skipped, offset);
         }
+        fprintf(myout, " %5d | %8s | %9s | %13s | %9s | %12d | %13d \n", index, aac_id[adts.id], aac_profile[adts.profile], aac_sample_frequency[adts.sampling_frequency_index], aac_channel_config[adts.channel_configuration], adts.aac_frame_length, adts.number_of_raw_data_blocks_in_frame);
+        index++;
+    }
+    
+    if (skipped > 0) {
+        fprintf(myout, " Incomplete tail: %zu bytes\n", skipped);
     }
     
-    if (adts) {
-        free(adts);
+__END:
+    if (stats) {
+        free(stats);
     }
     
-    if (aac_bit_stream) {
-        fclose(aac_bit_stream);
+    if (data) {
+        munmap((void *)data, size);
     }
 }
 
 /**
- * Get adts header
- * @param adts    current instance of ADTS_HEADER
- * @param aac_bit_stream   input file
+ * 只读映射输入文件
+ * @param url          file path
+ * @param data        输出映射地址
+ * @param size         输出文件大小
+ * @return 0: success  -1: failed
+ */
+static int map_input_file(const char *url, const uint8_t **data, size_t *size) {
+    
+    struct stat st = {};
+    void *addr = NULL;
+    int fd = open(url, O_RDONLY);
+    
+    if (fd < 0) {
+        printf("Open File Error.\n");
+        return -1;
+    }
+    
+    if (fstat(fd, &st) < 0 || st.st_size == 0) {
+        printf("Empty Or Unreadable File.\n");
+        close(fd);
+        return -1;
+    }
+    
+    addr = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    // 映射建立后 fd 可以直接关闭
+    close(fd);
+    if (addr == MAP_FAILED) {
+        printf("Map File Error.\n");
+        return -1;
+    }
+    
+    // 顺序扫描  提示内核加大预读
+    madvise(addr, (size_t)st.st_size, MADV_SEQUENTIAL);
+    
+    *data = (const uint8_t *)addr;
+    *size = (size_t)st.st_size;
+    return 0;
+}
+
+/**
+ * 检查 buffer 起始处是否是一个完整的合法 ADTS 帧
+ * @param buffer                 待检查数据
+ * @param buffer_size          剩余数据大小
+ * @param frame_length       输出 aac_frame_length
+ * @return true: 合法帧头且整帧都在 buffer 内
+ */
+static inline bool check_adts_header(const uint8_t *buffer, size_t buffer_size, uint32_t *frame_length) {
+    
+    uint32_t length = 0;
+    uint32_t header_size = 0;
+    
+    if (buffer_size < ADTS_HEADER_SIZE) {
+        return false;
+    }
+    
+    // syncword 0xFFF + layer '00'
+    if (buffer[0] != 0xff || (buffer[1] & 0xf6) != 0xf0) {
+        return false;
+    }
+    
+    // sampling_frequency_index 13 ~ 15 为保留值
+    if (((buffer[2] & 0x3c) >> 2) > AAC_SAMPLE_FREQUENCY_7350) {
+        return false;
+    }
+    
+    length = ((buffer[3] & 0x03) << 11) | (buffer[4] << 3) | ((buffer[5] & 0xe0) >> 5);
+    header_size = (buffer[1] & 0x01) ? ADTS_HEADER_SIZE : ADTS_HEADER_SIZE + 2;
+    if (length < header_size || length > buffer_size) {
+        return false;
+    }
+    
+    *frame_length = length;
+    return true;
+}
+
+/**
+ * 解析 ADTS header  调用前需先经过 check_adts_header 检查
+ * @param buffer    header 起始地址
+ * @param adts      current instance of ADTS_HEADER
+ */
+static inline void parse_adts_header(const uint8_t *buffer, ADTS_HEADER *adts) {
+    
+    adts->id = (buffer[1] & 0x08) >> 3;
+    adts->protection_absent = buffer[1] & 0x01;
+    adts->profile = (buffer[2] & 0xc0) >> 6;
+    adts->sampling_frequency_index = (buffer[2] & 0x3c) >> 2;
+    adts->channel_configuration = ((buffer[2] & 0x01) << 2) | ((buffer[3] & 0xc0) >> 6);
+    adts->aac_frame_length = ((buffer[3] & 0x03) << 11) | (buffer[4] << 3) | ((buffer[5] & 0xe0) >> 5);
+    adts->number_of_raw_data_blocks_in_frame = buffer[6] & 0x03;
+}
+
+/**
+ * 读取下一个 ADTS 帧
+ * 正常情况下按 aac_frame_length 直接跳到下一帧  只有当前位置不是合法帧头时才回退到 syncword 搜索
+ * @param scanner         ADTS_SCANNER Instance
+ * @param adts              current instance of ADTS_HEADER
+ * @param offset           输出当前帧在文件中的偏移
+ * @param skipped         输出当前帧之前因失步跳过的字节数  返回EOF时表示文件末尾不完整数据的字节数
  * @return 0: success  -1: EOF
  */
-static int get_adts_header(ADTS_HEADER *adts, FILE *aac_bit_stream) {
-
-    unsigned char *buffer = (unsigned char *)calloc(1, AAC_BUFFER_SIZE);
-    int ret = 0;
-    size_t data_size = 0;
-    
-    while (!feof(aac_bit_stream)) {
-        // 每次从文件当前位置读取10k的数据
-        data_size = fread(buffer, 1, AAC_BUFFER_SIZE, aac_bit_stream);
-        // 如果读到的数据小于7  说明不会包含完整header
-        if (data_size < 7) {
-            return EOF;
+static int next_adts_frame(ADTS_SCANNER *scanner, ADTS_HEADER *adts, size_t *offset, size_t *skipped) {
+    
+    const uint8_t *data = scanner->data;
+    size_t size = scanner->size;
+    size_t pos = scanner->pos;
+    size_t candidate = 0;
+    size_t next = 0;
+    uint32_t frame_length = 0;
+    
+    *skipped = 0;
+    if (pos >= size) {
+        return EOF;
+    }
+    
+    if (!check_adts_header(data + pos, size - pos, &frame_length)) {
+        // 失步  从下一字节开始搜索 syncword
+        candidate = pos;
+        while (1) {
+            candidate++;
+            candidate += find_sync_word(data + candidate, size - candidate);
+            if (candidate >= size) {
+                *skipped = size - pos;
+                scanner->pos = size;
+                return EOF;
+            }
+            if (check_adts_header(data + candidate, size - candidate, &frame_length)) {
+                // 0xFFF 在音频数据中并不罕见  要求下一帧同样以 syncword 开头或者刚好到文件末尾  才认为重新锁定
+                next = candidate + frame_length;
+                if (next == size || (next + 1 < size && data[next] == 0xff && (data[next + 1] & 0xf6) == 0xf0)) {
+                    break;
+                }
+            }
         }
-        
-        // 查找start code 即0xfff
-        ret = find_start_code(buffer, data_size);
-        if (ret == EOF) {
-            // 没有读到start_code 需要将文件seek -1位  避免start_code刚好在buffer边界的极端情况
-            fseek(aac_bit_stream, -1, SEEK_CUR);
+        *skipped = candidate - pos;
+        pos = candidate;
+    }
+    
+    parse_adts_header(data + pos, adts);
+    *offset = pos;
+    scanner->pos = pos + frame_length;
+    return 0;
+}
+
+/**
+ * Find Sync Word  查找 buffer[i] == 0xff && (buffer[i + 1] & 0xf0) == 0xf0 的位置
+ * 支持 SSE2 / NEON 时每次比较16字节
+ * @param buffer              aac buffer
+ * @param buffer_size       size
+ * @return syncword 下标  找不到时返回 buffer_size
+ */
+static size_t find_sync_word(const uint8_t *buffer, size_t buffer_size) {
+    
+    size_t i = 0;
+    
+    if (buffer_size < 2) {
+        return buffer_size;
+    }
+    
+#if defined(__SSE2__)
+    const __m128i ff = _mm_set1_epi8((char)0xff);
+    const __m128i f0 = _mm_set1_epi8((char)0xf0);
+    // 同时加载 [i, i + 16) 和 [i + 1, i + 17)  分别比较 0xff 和高4位 0xf
+    for (; i + 17 <= buffer_size; i += 16) {
+        __m128i current = _mm_loadu_si128((const __m128i *)(buffer + i));
+        __m128i next = _mm_loadu_si128((const __m128i *)(buffer + i + 1));
+        __m128i hit = _mm_and_si128(_mm_cmpeq_epi8(current, ff), _mm_cmpeq_epi8(_mm_and_si128(next, f0), f0));
+        int mask = _mm_movemask_epi8(hit);
+        if (mask) {
+            return i + __builtin_ctz(mask);
+        }
+    }
+#elif defined(__ARM_NEON)
+    const uint8x16_t ff = vdupq_n_u8(0xff);
+    const uint8x16_t f0 = vdupq_n_u8(0xf0);
+    for (; i + 17 <= buffer_size; i += 16) {
+        uint8x16_t current = vld1q_u8(buffer + i);
+        uint8x16_t next = vld1q_u8(buffer + i + 1);
+        uint8x16_t hit = vandq_u8(vceqq_u8(current, ff), vceqq_u8(vandq_u8(next, f0), f0));
+        // 每个字节压缩为4bit  得到64bit掩码
+        uint64_t mask = vget_lane_u64(vreinterpret_u64_u8(vshrn_n_u16(vreinterpretq_u16_u8(hit), 4)), 0);
+        if (mask) {
+            return i + (__builtin_ctzll(mask) >> 2);
+        }
+    }
+#endif
+    
+    for (; i + 1 < buffer_size; i++) {
+        if (buffer[i] == 0xff && (buffer[i + 1] & 0xf0) == 0xf0) {
+            return i;
+        }
+    }
+    
+    return buffer_size;
+}
+
+/**
+ * 累加一帧的统计信息
+ * @param stats     ADTS_STATS Instance
+ * @param adts      current instance of ADTS_HEADER
+ */
+static inline void update_adts_stats(ADTS_STATS *stats, const ADTS_HEADER *adts) {
+    
+    uint32_t sample_rate = aac_sample_rate[adts->sampling_frequency_index];
+    uint32_t samples = ADTS_SAMPLES_PER_BLOCK * (adts->number_of_raw_data_blocks_in_frame + 1);
+    uint32_t frame_length = adts->aac_frame_length;
+    double frame_duration = (double)samples / sample_rate;
+    
+    if (stats->frame_count == 0) {
+        stats->first_header = *adts;
+        stats->min_frame_length = frame_length;
+    } else if (adts->profile != stats->first_header.profile
+               || adts->sampling_frequency_index != stats->first_header.sampling_frequency_index
+               || adts->channel_configuration != stats->first_header.channel_configuration) {
+        stats->format_changes++;
+    }
+    
+    stats->frame_count++;
+    stats->total_bytes += frame_length;
+    stats->total_samples += samples;
+    stats->duration += frame_duration;
+    if (frame_length < stats->min_frame_length) {
+        stats->min_frame_length = frame_length;
+    }
+    if (frame_length > stats->max_frame_length) {
+        stats->max_frame_length = frame_length;
+    }
+    stats->histogram[frame_length / ADTS_HISTOGRAM_BIN_SIZE]++;
+    
+    // 峰值码率按 1s 媒体时长的窗口统计
+    stats->window_bytes += frame_length;
+    stats->window_duration += frame_duration;
+    if (stats->window_duration >= 1.0) {
+        double bitrate = stats->window_bytes * 8 / stats->window_duration;
+        if (bitrate > stats->peak_bitrate) {
+            stats->peak_bitrate = bitrate;
+        }
+        stats->window_bytes = 0;
+        stats->window_duration = 0;
+    }
+}
+
+/**
+ * 记录失步事件
+ * @param stats         ADTS_STATS Instance
+ * @param offset        重新锁定后的帧偏移
+ * @param skipped      跳过的字节数
+ */
+static void record_resync_event(ADTS_STATS *stats, size_t offset, size_t skipped) {
+    
+    if (stats->resync_count < ADTS_MAX_RESYNC_EVENTS) {
+        stats->resync_events[stats->resync_count].offset = offset;
+        stats->resync_events[stats->resync_count].skipped = skipped;
+    }
+    stats->resync_count++;
+    stats->resync_bytes += skipped;
+}
+
+/**
+ * 输出统计信息
+ * @param stats          ADTS_STATS Instance
+ * @param file_size     input file size
+ * @param elapsed      扫描耗时  单位s
+ */
+static void print_adts_stats(ADTS_STATS *stats, size_t file_size, double elapsed) {
+    
+    FILE *myout = stdout;
+    double average_bitrate = 0;
+    int hours = 0, minutes = 0;
+    double seconds = 0;
+    
+    if (stats->frame_count == 0) {
+        fprintf(myout, "No ADTS Frame Found.\n");
+        return;
+    }
+    
+    average_bitrate = stats->duration > 0 ? stats->total_bytes * 8 / stats->duration : 0;
+    // 不足 1s 的文件没有完整窗口  峰值码率取平均码率
+    if (stats->peak_bitrate < average_bitrate) {
+        stats->peak_bitrate = average_bitrate;
+    }
+    
+    hours = (int)(stats->duration / 3600);
+    minutes = (int)(stats->duration / 60) % 60;
+    seconds = stats->duration - hours * 3600 - minutes * 60;
+    
+    fprintf(myout, "============================ ADTS Summary ============================\n");
+    fprintf(myout, "Format:            %s | %s | %s Hz | %s ch\n",
+            aac_id[stats->first_header.id], aac_profile[stats->first_header.profile],
+            aac_sample_frequency[stats->first_header.sampling_frequency_index],
+            aac_channel_config[stats->first_header.channel_configuration]);
+    if (stats->format_changes > 0) {
+        fprintf(myout, "Format Changes:    %llu frames differ from the first frame\n", (unsigned long long)stats->format_changes);
+    }
+    fprintf(myout, "Frames:            %llu\n", (unsigned long long)stats->frame_count);
+    fprintf(myout, "Samples:           %llu\n", (unsigned long long)stats->total_samples);
+    fprintf(myout, "Duration:          %02d:%02d:%06.3f (%.3f s)\n", hours, minutes, seconds, stats->duration);
+    fprintf(myout, "Average Bitrate:   %.2f kbps\n", average_bitrate / 1000);
+    fprintf(myout, "Peak Bitrate:      %.2f kbps (1s window)\n", stats->peak_bitrate / 1000);
+    fprintf(myout, "Frame Size:        min %u / avg %.1f / max %u bytes\n", stats->min_frame_length, (double)stats->total_bytes / stats->frame_count, stats->max_frame_length);
+    fprintf(myout, "Resync Events:     %llu (%llu bytes skipped)\n", (unsigned long long)stats->resync_count, (unsigned long long)stats->resync_bytes);
+    for (uint64_t i = 0; i < stats->resync_count && i < ADTS_MAX_RESYNC_EVENTS; i++) {
+        fprintf(myout, "    offset %12zu  skipped %8zu bytes\n", stats->resync_events[i].offset, stats->resync_events[i].skipped);
+    }
+    if (stats->resync_count > ADTS_MAX_RESYNC_EVENTS) {
+        fprintf(myout, "    ... %llu more\n", (unsigned long long)(stats->resync_count - ADTS_MAX_RESYNC_EVENTS));
+    }
+    if (stats->tail_bytes > 0) {
+        fprintf(myout, "Incomplete Tail:   %zu bytes\n", stats->tail_bytes);
+    }
+    
+    fprintf(myout, "---------------------- Frame Size Histogram -------------------------\n");
+    for (int i = 0; i < ADTS_HISTOGRAM_BINS; i++) {
+        if (stats->histogram[i] == 0) {
             continue;
-        } else {
-            // 找到start_code位置  需要seek
-            break;
         }
+        double percent = stats->histogram[i] * 100.0 / stats->frame_count;
+        char bar[51] = {0};
+        memset(bar, '#', (size_t)(percent / 2));
+        fprintf(myout, "  [%4d, %4d]  %10llu  %6.2f%%  %s\n", i * ADTS_HISTOGRAM_BIN_SIZE, (i + 1) * ADTS_HISTOGRAM_BIN_SIZE - 1, (unsigned long long)stats->histogram[i], percent, bar);
     }
-        
-    // 找到syncword，开始读header
-    adts->id = (buffer[ret + 1] & 0x08) >> 3;
-    adts->protection_absent = buffer[ret + 1] & 0x01;
-    adts->profile = (buffer[ret + 2] & 0xc0) >> 6;
-    adts->sampling_frequency_index = (buffer[ret + 2] & 0x3c) >> 2;
     
-    int channel_config = 0;
-    channel_config |= (buffer[ret + 2] & 0x01) << 2;
-    channel_config |= (buffer[ret + 3] & 0xc0) >> 6;
-    adts->channel_configuration = channel_config;
+    fprintf(myout, "----------------------------------------------------------------------\n");
+    if (elapsed > 0) {
+        fprintf(myout, "Scan Speed:        %.0f frames/s, %.2f MB/s (%.3f s)\n", stats->frame_count / elapsed, file_size / elapsed / (1024 * 1024), elapsed);
+    }
+}
+
+/**
+ * 获取单调时钟  单位s
+ */
+static double get_time_seconds(void) {
+    
+    struct timespec ts = {};
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/**
+ * 建立帧索引并写入文件
+ * @param url                 aac file path
+ * @param index_url        index file path
+ */
+static void build_index(const char *url, const char *index_url) {
+    
+    ADTS_INDEX index = {};
+    const uint8_t *data = NULL;
+    size_t size = 0;
+    double start_time = get_time_seconds();
+    
+    if (map_input_file(url, &data, &size) < 0) {
+        return;
+    }
+    
+    if (build_adts_index(data, size, &index) < 0) {
+        printf("No ADTS Frame Found.\n");
+        goto __END;
+    }
+    
+    if (write_adts_index(index_url, &index) < 0) {
+        goto __END;
+    }
+    
+    printf("Index Written: %s\n", index_url);
+    printf("  Frames:            %llu\n", (unsigned long long)index.header.frame_count);
+    printf("  Samples Per Frame: %u\n", index.header.samples_per_frame);
+    printf("  Sample Rate:       %u\n", index.header.sample_rate);
+    printf("  Index Size:        %llu bytes\n", (unsigned long long)(sizeof(ADTS_INDEX_HEADER) + (index.header.frame_count + 1) * index.header.offset_size));
+    printf("  Elapsed:           %.3f ms\n", (get_time_seconds() - start_time) * 1000);
+    
+__END:
+    free_adts_index(&index);
+    munmap((void *)data, size);
+}
+
+/**
+ * 按时间范围剪切 aac 文件  剪切点对齐到 ADTS 帧
+ * 有索引时只需查表和一次区间拷贝  耗时与文件长度无关
+ * @param url                  aac file path
+ * @param index_url         index file path  可以为NULL
+ * @param start               起始时间  单位s
+ * @param duration          时长  单位s  小于0表示直到文件末尾
+ * @param output_url       output file path
+ */
+static void cut(const char *url, const char *index_url, double start, double duration, const char *output_url) {
+    
+    ADTS_INDEX index = {};
+    struct stat st = {};
+    const uint8_t *data = NULL;
+    size_t size = 0;
+    int input_fd = -1;
+    int output_fd = -1;
+    uint64_t frame_count = 0;
+    uint64_t first_frame = 0;
+    uint64_t last_frame = 0;
+    uint64_t begin = 0;
+    uint64_t end = 0;
+    double frames_per_second = 0;
+    double start_time = get_time_seconds();
+    
+    input_fd = open(url, O_RDONLY);
+    if (input_fd < 0 || fstat(input_fd, &st) < 0) {
+        printf("Open File Error.\n");
+        goto __END;
+    }
+    
+    // 优先使用已有索引  索引不存在或已过期时扫描一遍  并顺便写出索引供下次使用
+    if (index_url == NULL || load_adts_index(index_url, (uint64_t)st.st_size, &index) < 0) {
+        if (map_input_file(url, &data, &size) < 0) {
+            goto __END;
+        }
+        if (build_adts_index(data, size, &index) < 0) {
+            printf("No ADTS Frame Found.\n");
+            goto __END;
+        }
+        if (index_url && write_adts_index(index_url, &index) == 0) {
+            printf("Index Written: %s\n", index_url);
+        }
+    }
+    
+    // 时间 -> 帧号
+    frame_count = index.header.frame_count;
+    frames_per_second = (double)index.header.sample_rate / index.header.samples_per_frame;
+    if (start < 0) {
+        start = 0;
+    }
+    first_frame = (uint64_t)floor(start * frames_per_second + 1e-9);
+    last_frame = duration < 0 ? frame_count : (uint64_t)ceil((start + duration) * frames_per_second - 1e-9);
+    if (first_frame > frame_count) {
+        first_frame = frame_count;
+    }
+    if (last_frame > frame_count) {
+        last_frame = frame_count;
+    }
+    if (first_frame >= last_frame) {
+        printf("Cut Range Is Out Of File Duration (%.3f s).\n", frame_count / frames_per_second);
+        goto __END;
+    }
+    
+    // 帧号 -> 字节区间
+    begin = get_index_offset(&index, first_frame);
+    end = get_index_offset(&index, last_frame);
+    
+    output_fd = open(output_url, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (output_fd < 0) {
+        printf("Open Output File Error.\n");
+        goto __END;
+    }
+    
+    if (copy_range(input_fd, begin, end - begin, output_fd) < 0) {
+        printf("Copy Range Error: %s\n", strerror(errno));
+        goto __END;
+    }
+    
+    printf("Cut Succeeded: %s\n", output_url);
+    printf("  Frames:    [%llu, %llu)\n", (unsigned long long)first_frame, (unsigned long long)last_frame);
+    printf("  Samples:   [%llu, %llu)\n", (unsigned long long)(first_frame * index.header.samples_per_frame), (unsigned long long)(last_frame * index.header.samples_per_frame));
+    printf("  Time:      [%.6f s, %.6f s)\n", first_frame / frames_per_second, last_frame / frames_per_second);
+    printf("  Bytes:     [%llu, %llu) %llu bytes\n", (unsigned long long)begin, (unsigned long long)end, (unsigned long long)(end - begin));
+    printf("  Elapsed:   %.3f ms\n", (get_time_seconds() - start_time) * 1000);
+    
+__END:
+    free_adts_index(&index);
+    
+    if (data) {
+        munmap((void *)data, size);
+    }
+    
+    if (input_fd >= 0) {
+        close(input_fd);
+    }
+    
+    if (output_fd >= 0) {
+        close(output_fd);
+    }
+}
+
+/**
+ * 扫描 aac 文件建立内存索引
+ * @param data          mmap 后的文件起始地址
+ * @param size           文件大小
+ * @param index         ADTS_INDEX Instance
+ * @return 0: success  -1: failed
+ */
+static int build_adts_index(const uint8_t *data, size_t size, ADTS_INDEX *index) {
+    
+    ADTS_SCANNER scanner = {};
+    ADTS_HEADER adts = {};
+    size_t offset = 0;
+    size_t skipped = 0;
+    uint64_t end = 0;
+    
+    memset(index, 0, sizeof(ADTS_INDEX));
+    memcpy(index->header.magic, ADTS_INDEX_MAGIC, sizeof(index->header.magic));
+    index->header.offset_size = size < UINT32_MAX ? sizeof(uint32_t) : sizeof(uint64_t);
+    index->header.file_size = size;
+    
+    scanner.data = data;
+    scanner.size = size;
+    scanner.pos = 0;
+    
+    while (next_adts_frame(&scanner, &adts, &offset, &skipped) == 0) {
+        if (index->header.frame_count == 0) {
+            index->header.sample_rate = aac_sample_rate[adts.sampling_frequency_index];
+            index->header.samples_per_frame = ADTS_SAMPLES_PER_BLOCK * (adts.number_of_raw_data_blocks_in_frame + 1);
+        }
+        if (append_index_offset(index, offset) < 0) {
+            return -1;
+        }
+        end = offset + adts.aac_frame_length;
+    }
+    
+    if (index->header.frame_count == 0) {
+        return -1;
+    }
+    
+    // 结尾哨兵  最后一帧的结束位置  append 会把它计入 frame_count  这里还原
+    if (append_index_offset(index, end) < 0) {
+        return -1;
+    }
+    index->header.frame_count--;
+    return 0;
+}
+
+/**
+ * 向偏移表追加一项
+ * @param index         ADTS_INDEX Instance
+ * @param offset        帧偏移
+ * @return 0: success  -1: failed
+ */
+static int append_index_offset(ADTS_INDEX *index, uint64_t offset) {
+    
+    size_t position = index->header.frame_count * index->header.offset_size;
+    
+    if (position + index->header.offset_size > index->table_capacity) {
+        size_t capacity = index->table_capacity ? index->table_capacity * 2 : 4096 * index->header.offset_size;
+        uint8_t *table = (uint8_t *)realloc(index->table, capacity);
+        if (table == NULL) {
+            printf("Alloc ADTS Index Error.\n");
+            return -1;
+        }
+        index->table = table;
+        index->table_capacity = capacity;
+    }
+    
+    if (index->header.offset_size == sizeof(uint32_t)) {
+        uint32_t value = (uint32_t)offset;
+        memcpy(index->table + position, &value, sizeof(value));
+    } else {
+        memcpy(index->table + position, &offset, sizeof(offset));
+    }
+    index->header.frame_count++;
+    return 0;
+}
+
+/**
+ * 查询帧偏移
+ * @param index         ADTS_INDEX Instance
+ * @param frame         帧号  frame_count 表示文件中最后一帧的结束位置
+ * @return 字节偏移
+ */
+static uint64_t get_index_offset(const ADTS_INDEX *index, uint64_t frame) {
+    
+    if (index->header.offset_size == sizeof(uint32_t)) {
+        uint32_t value = 0;
+        memcpy(&value, index->table + frame * sizeof(uint32_t), sizeof(value));
+        return value;
+    } else {
+        uint64_t value = 0;
+        memcpy(&value, index->table + frame * sizeof(uint64_t), sizeof(value));
+        return value;
+    }
+}
+
+/**
+ * 写出索引文件
+ * @param index_url        index file path
+ * @param index              ADTS_INDEX Instance
+ * @return 0: success  -1: failed
+ */
+static int write_adts_index(const char *index_url, const ADTS_INDEX *index) {
+    
+    size_t table_size = (index->header.frame_count + 1) * index->header.offset_size;
+    FILE *index_file = fopen(index_url, "wb");
+    
+    if (index_file == NULL) {
+        printf("Open Index File Error.\n");
+        return -1;
+    }
+    
+    if (fwrite(&index->header, sizeof(ADTS_INDEX_HEADER), 1, index_file) != 1
+        || fwrite(index->table, 1, table_size, index_file) != table_size) {
+        printf("Write Index File Error.\n");
+        fclose(index_file);
+        return -1;
+    }
+    
+    fclose(index_file);
+    return 0;
+}
+
+/**
+ * 映射并校验索引文件
+ * @param index_url        index file path
+ * @param file_size          当前 aac 文件大小
+ * @param index              ADTS_INDEX Instance
+ * @return 0: success  -1: 索引不存在、损坏或已过期
+ */
+static int load_adts_index(const char *index_url, uint64_t file_size, ADTS_INDEX *index) {
+    
+    struct stat st = {};
+    void *addr = NULL;
+    ADTS_INDEX_HEADER header = {};
+    int fd = open(index_url, O_RDONLY);
+    
+    memset(index, 0, sizeof(ADTS_INDEX));
+    if (fd < 0) {
+        return -1;
+    }
     
-    int frame_size = 0;
-    frame_size |= (buffer[ret + 3] & 0x03) << 11;
-    frame_size |= buffer[ret + 4] << 3;
-    frame_size |= (buffer[ret + 5] & 0xe0) >> 5;
-    adts->aac_frame_length = frame_size;
+    if (fstat(fd, &st) < 0 || (size_t)st.st_size < sizeof(ADTS_INDEX_HEADER)) {
+        close(fd);
+        return -1;
+    }
     
-    adts->number_of_raw_data_blocks_in_frame = buffer[ret + 6] & 0x03;
+    addr = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (addr == MAP_FAILED) {
+        return -1;
+    }
     
-    fseek(aac_bit_stream, -(data_size - ret - frame_size), SEEK_CUR);
+    memcpy(&header, addr, sizeof(ADTS_INDEX_HEADER));
+    if (memcmp(header.magic, ADTS_INDEX_MAGIC, sizeof(header.magic)) != 0
+        || (header.offset_size != sizeof(uint32_t) && header.offset_size != sizeof(uint64_t))
+        || header.sample_rate == 0 || header.samples_per_frame == 0 || header.frame_count == 0
+        || (uint64_t)st.st_size != sizeof(ADTS_INDEX_HEADER) + (header.frame_count + 1) * header.offset_size) {
+        printf("Invalid Index File, Rebuilding.\n");
+        munmap(addr, (size_t)st.st_size);
+        return -1;
+    }
     
-    if (buffer) {
-        free(buffer);
+    if (header.file_size != file_size) {
+        printf("Index Is Out Of Date, Rebuilding.\n");
+        munmap(addr, (size_t)st.st_size);
+        return -1;
     }
     
+    index->header = header;
+    index->table = (uint8_t *)addr + sizeof(ADTS_INDEX_HEADER);
+    index->mapping = addr;
+    index->mapping_size = (size_t)st.st_size;
     return 0;
 }
 
 /**
- * Find Start Code
- * @param buffer    aac buffer
- * @param buffer_size   size
- * @return -1: EOF  other: start code index
+ * 释放索引
+ * @param index              ADTS_INDEX Instance
  */
-static int find_start_code(unsigned char *buffer, size_t buffer_size) {
+static void free_adts_index(ADTS_INDEX *index) {
     
-    int ret = 0;
+    if (index->mapping) {
+        munmap(index->mapping, index->mapping_size);
+    } else if (index->table) {
+        free(index->table);
+    }
+    memset(index, 0, sizeof(ADTS_INDEX));
+}
+
+/**
+ * 将 input_fd 的 [offset, offset + length) 拷贝到 output_fd 当前位置
+ * Linux 下使用 copy_file_range 由内核直接拷贝  其他平台映射源区间后一次 write
+ * @param input_fd          源文件
+ * @param offset              源偏移
+ * @param length             拷贝长度
+ * @param output_fd        目标文件
+ * @return 0: success  -1: failed
+ */
+static int copy_range(int input_fd, uint64_t offset, uint64_t length, int output_fd) {
+    
+    size_t page_size = (size_t)sysconf(_SC_PAGESIZE);
+    uint64_t aligned_offset = 0;
+    size_t delta = 0;
+    const uint8_t *buffer = NULL;
+    void *addr = NULL;
     
-    while (1) {
-        if (buffer[ret] == 0xff && (buffer[ret + 1] & 0xf0) == 0xf0) {
+#if defined(__linux__)
+    loff_t input_offset = (loff_t)offset;
+    while (length > 0) {
+        ssize_t ret = copy_file_range(input_fd, &input_offset, output_fd, NULL, length, 0);
+        if (ret > 0) {
+            length -= ret;
+        } else if (ret == 0) {
+            // 源文件在拷贝过程中被截断
+            errno = EIO;
+            return -1;
+        } else if (errno == EINTR) {
+            continue;
+        } else if (errno == EXDEV || errno == ENOSYS || errno == EINVAL || errno == EOPNOTSUPP) {
+            // 跨文件系统或内核不支持  回退到 mmap + write
+            offset = (uint64_t)input_offset;
             break;
+        } else {
+            return -1;
         }
-        
-        ret++;
-        
-        // 如果滑动到buffer倒数第二位还是找不到  重新读buffer
-        if (ret == buffer_size - 1) {
-            ret = EOF;
-            break;
+    }
+    if (length == 0) {
+        return 0;
+    }
+#endif
+    
+    // mmap 的偏移必须按页对齐
+    aligned_offset = offset - offset % page_size;
+    delta = (size_t)(offset - aligned_offset);
+    addr = mmap(NULL, (size_t)length + delta, PROT_READ, MAP_PRIVATE, input_fd, (off_t)aligned_offset);
+    if (addr == MAP_FAILED) {
+        return -1;
+    }
+    
+    buffer = (const uint8_t *)addr + delta;
+    while (length > 0) {
+        ssize_t ret = write(output_fd, buffer, (size_t)length);
+        if (ret < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            munmap(addr, (size_t)(buffer - (const uint8_t *)addr) + (size_t)length);
+            return -1;
         }
+        buffer += ret;
+        length -= ret;
     }
     
-    return ret;
+    munmap(addr, (size_t)(buffer - (const uint8_t *)addr));
+    return 0;
 }
@@ -9,37 +9,146 @@
 #include <getopt.h>
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <sys/wait.h>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
 
 extern "C" {
+#include "libavutil/avstring.h"
 #include "libavutil/imgutils.h"
+#include "libavutil/pixdesc.h"
 #include "libavutil/samplefmt.h"
 #include "libavutil/timestamp.h"
+#include "libavutil/time.h"
+#include "libavutil/intreadwrite.h"
+#include "libavcodec/avcodec.h"
 #include "libavformat/avformat.h"
 #include "CPrint.h"
 }
 
-static AVFormatContext *fmt_ctx = NULL;                                             // format上下文   用于解复用
-static AVCodecContext *video_dec_ctx = NULL, *audio_dec_ctx;                // 解码器上下文   用于decode
-static enum AVPixelFormat pix_fmt;                                                      // 视频帧像素格式
-static AVStream *video_stream = NULL, *audio_stream = NULL;                 // stream 区分音视频track
-static AVPacket *packet = NULL;                                                         // 解码前一帧数据
-static AVFrame *frame = NULL;                                                           // 解码后一帧数据
+#define PACKET_QUEUE_CAPACITY  64          // threaded 模式下每个解码线程的 packet 队列长度
+#define MMAP_IO_BUFFER_SIZE    (256 * 1024)  // mmap 输入时 AVIOContext 的缓冲区大小
+#define VIDEO_IOV_BATCH        256          // 原始视频逐行 writev 时每批的 iovec 数量
 
-static FILE *video_output_file = NULL, *audio_output_file = NULL;               // 输出文件路径
-static int video_width, video_height = 0;                                               // 视频分辨率宽高
-static uint8_t *video_dst_data[4] = {NULL};                                           // 视频帧缓冲区
-static int video_dst_linesize[4];                                                           // 视频帧缓冲区长度
-static int video_dst_bufsize = 0;                                                          // 视频帧数据整体长度
+// 一次解复用任务的全部状态  每个 session 互相独立  可以在同一进程的多个线程中并发运行
+typedef struct DemuxSession {
+    const char *input_url;                                      // 输入文件路径
+    const char *video_output_url;                             // 视频数据输出路径
+    const char *audio_output_url;                             // 音频数据输出路径
+    bool quiet;                                                     // 不输出逐帧日志和媒体信息  多任务模式下使用
+    bool stream_copy;                                             // 直接输出压缩数据  不打开解码器
+    bool threaded;                                                 // 读取和音视频解码分别在独立线程中运行
+    
+    AVFormatContext *fmt_ctx;                                   // format上下文   用于解复用
+    AVCodecContext *video_dec_ctx, *audio_dec_ctx;      // 解码器上下文   用于decode
+    enum AVPixelFormat pix_fmt;                                // 视频帧像素格式
+    AVStream *video_stream, *audio_stream;               // stream 区分音视频track
+    AVPacket *packet;                                             // 解码前一帧数据
+    AVFrame *frame;                                                // 解码后一帧数据
+    
+    FILE *video_output_file, *audio_output_file;          // 输出文件
+    int video_width, video_height;                              // 视频分辨率宽高
+    int video_plane_count;                                       // 视频帧 plane 数量
+    int video_plane_linesize[4];                                // 每个 plane 紧凑排列时一行的长度
+    int video_plane_height[4];                                  // 每个 plane 的行数
+    int video_dst_bufsize;                                        // 视频帧数据整体长度
+    uint8_t *video_dst_buffer;                                  // 调色板格式才需要的中间缓冲区
+    char video_segment_url[1024];                               // 当前视频输出分段路径  分辨率变化时切换到新分段
+    int video_segment_index;                                     // 当前视频输出分段序号
+    int video_segment_frames;                                   // 当前分段已写入的帧数
+    
+    int video_stream_index, audio_stream_index;         // 当前解码的stream在AVFormatContext->streams里的index
+    int video_frame_count, audio_frame_count;           // 音视频帧数量
+    
+    AVBSFContext *video_bsf;                                    // stream copy: H.264/HEVC 转 AnnexB 的 bitstream filter
+    int aac_profile;                                                // stream copy: ADTS profile  小于0表示不补ADTS头
+    int aac_sample_index;                                        // stream copy: ADTS sampling_frequency_index
+    int aac_channels;                                              // stream copy: ADTS channel_configuration
+    int64_t video_bytes, audio_bytes;                          // 输出数据量
+    
+    int64_t range_start, range_duration;                      // 截取区间  单位us  AV_NOPTS_VALUE 表示不限制
+    int64_t video_start_pts, video_end_pts;                   // 截取区间换算到视频流 time_base
+    int64_t audio_start_pts, audio_end_pts;                   // 截取区间换算到音频流 time_base
+    bool video_ended, audio_ended;                              // 已读到截取区间结束点之后的 packet
+    
+    bool use_mmap;                                                // 通过 mmap + 自定义 AVIOContext 读取输入
+    int64_t readahead;                                            // mmap 输入时每次 MADV_WILLNEED 预读的长度  0表示只用 MADV_SEQUENTIAL
+    AVIOContext *avio_ctx;                                        // mmap 输入的自定义 AVIOContext
+    uint8_t *mmap_data;                                          // 输入文件映射地址
+    int64_t mmap_size;                                            // 输入文件映射长度
+    int64_t mmap_pos;                                             // 当前读取位置
+    int64_t mmap_advised;                                       // 已经 MADV_WILLNEED 的位置
+    
+    int64_t input_size;                                            // 输入文件大小  用于统计吞吐量
+    int64_t start_time, end_time;                              // 任务起止时间  单位us
+    int result;                                                       // 任务结果  0: success  <0: failed
+} DemuxSession;
+
+// 有界 packet 队列  reader 线程生产  解码线程消费
+typedef struct PacketQueue {
+    std::deque<AVPacket *> packets;
+    size_t capacity;
+    bool finished;                                                  // 生产者已结束
+    bool aborted;                                                   // 消费者出错  生产者不再继续投递
+    std::mutex mutex;
+    std::condition_variable not_empty;
+    std::condition_variable not_full;
+} PacketQueue;
 
-static int video_stream_index = -1, audio_stream_index = -1;                    // 当前解码的stream在AVFormatContext->streams里的index
-static int video_frame_count = 0, audio_frame_count = 0;                        // 音视频帧数量
+// threaded 模式下每个阶段的利用率统计
+typedef struct StageStats {
+    const char *name;
+    int64_t packets;                                                // 处理的 packet 数
+    int64_t busy_time;                                            // 读取或解码+写文件耗时  单位us
+    int64_t wait_time;                                            // 阻塞在队列上的耗时  单位us
+    int result;                                                       // 阶段结果
+} StageStats;
 
-static void demux(const char *input_url, const char *video_output_url, const char *audio_output_url);
+static DemuxSession *alloc_demux_session(const char *input_url, const char *video_output_url, const char *audio_output_url, bool quiet);
+static void free_demux_session(DemuxSession **session);
+static int open_input(DemuxSession *session);
+static int open_mmap_input(DemuxSession *session);
+static void close_input(DemuxSession *session);
+static int mmap_read_packet(void *opaque, uint8_t *buf, int buf_size);
+static int64_t mmap_seek(void *opaque, int64_t offset, int whence);
+static void benchmark_input(const char *input_url, int64_t readahead);
+static int benchmark_read(DemuxSession *session, int64_t *packet_count, int64_t *packet_bytes);
+static void demux(DemuxSession *session);
+static void demux_stream_copy(DemuxSession *session);
+static void demux_multiple(std::vector<DemuxSession *> &sessions, int thread_count, bool compare);
+static int64_t run_in_thread_pool(std::vector<DemuxSession *> &sessions, int thread_count);
+static int64_t run_in_processes(std::vector<DemuxSession *> &sessions);
 static int open_codec_context(AVFormatContext *fmt_ctx, enum AVMediaType type, AVCodecContext **context, int *stream_index);
-static int decode_packet(AVCodecContext *context, AVPacket *packet, AVFrame *frame);
-static int output_video_frame(AVFrame *frame);
-static int output_audio_frame(AVFrame *frame);
+static int decode_packet(DemuxSession *session, AVCodecContext *context, AVPacket *packet, AVFrame *frame);
+static int decode_threaded(DemuxSession *session);
+static void decode_thread(DemuxSession *session, AVCodecContext *context, PacketQueue *queue, StageStats *stats);
+static bool packet_queue_push(PacketQueue *queue, AVPacket *packet, int64_t *wait_time);
+static AVPacket *packet_queue_pop(PacketQueue *queue, int64_t *wait_time);
+static void packet_queue_finish(PacketQueue *queue);
+static void packet_queue_abort(PacketQueue *queue);
+static void packet_queue_clear(PacketQueue *queue);
+static int output_video_frame(DemuxSession *session, AVFrame *frame);
+static int init_video_layout(DemuxSession *session, int width, int height, enum AVPixelFormat pix_fmt);
+static int rotate_video_segment(DemuxSession *session, AVFrame *frame);
+static int write_iovec(int fd, struct iovec *iov, int count);
+static int output_audio_frame(DemuxSession *session, AVFrame *frame);
 static int get_format_from_sample_fmt(const char **fmt, enum AVSampleFormat sample_fmt);
+static int open_annexb_filter(DemuxSession *session);
+static int parse_audio_specific_config(DemuxSession *session);
+static int write_video_packet(DemuxSession *session, AVPacket *packet);
+static int write_audio_packet(DemuxSession *session, AVPacket *packet);
+static int seek_to_range(DemuxSession *session);
+static bool packet_after_range(DemuxSession *session, AVPacket *packet);
+static bool frame_out_of_range(DemuxSession *session, AVCodecContext *context, AVFrame *frame);
 
 static struct option tool_long_options[] = {
     {"help", no_argument, NULL, '`'}
@@ -55,12 +164,28 @@ static void show_module_help() {
     printf("  - TS\n");
     printf("\n");
     printf("Param:\n\n");
-    printf("  -i:   Input File Local Path\n");
-    printf("  -a:   Output Audio File Path\n");
-    printf("  -v:   Output Video File Path\n");
+    printf("  -i:   Input File Local Path, Repeat For Multiple Inputs\n");
+    printf("  -a:   Output Audio File Path, One For Each Input\n");
+    printf("  -v:   Output Video File Path, One For Each Input\n");
+    printf("  -j:   Thread Pool Size For Multiple Inputs, Default Number Of CPU Cores\n");
+    printf("  -c:   Compare Thread Pool Throughput With Running Each Input In A Separate Process\n");
+    printf("  -e:   Stream Copy Mode, Write Elementary Streams Without Decoding\n");
+    printf("        H.264/HEVC -> AnnexB, AAC -> ADTS, Other Codecs -> Raw Packets\n");
+    printf("  -t:   Threaded Mode, One Reader Thread And One Decode Thread Per Stream, Print Stage Utilisation\n");
+    printf("  -b:   Start Time In Seconds, Seek To The Preceding Keyframe And Drop Frames Before It\n");
+    printf("  -d:   Duration In Seconds, Stop Reading After The End Time\n");
+    printf("  -m:   Read Input Through mmap And A Custom AVIOContext\n");
+    printf("  -r:   mmap Readahead In KB, Issue MADV_WILLNEED Ahead Of The Read Position, Default Only MADV_SEQUENTIAL\n");
+    printf("  -B:   Benchmark Demux-Only Packet Throughput, Default File Protocol vs mmap, No Output Needed\n");
     printf("\n");
     printf("Usage:\n\n");
-    printf("  AVTools Demuxer -i input.flv -a output.pcm -v output.yuv\n\n");
+    printf("  AVTools Demuxer -i input.flv -a output.pcm -v output.yuv\n");
+    printf("  AVTools Demuxer -i 1.mp4 -a 1.pcm -v 1.yuv -i 2.mp4 -a 2.pcm -v 2.yuv -j 2 -c\n");
+    printf("  AVTools Demuxer -i input.mp4 -a output.aac -v output.h264 -e\n");
+    printf("  AVTools Demuxer -i input.mp4 -a output.pcm -v output.yuv -t\n");
+    printf("  AVTools Demuxer -i input.mp4 -a output.pcm -v output.yuv -b 3600 -d 10\n");
+    printf("  AVTools Demuxer -i input.mp4 -a output.aac -v output.h264 -e -m -r 4096\n");
+    printf("  AVTools Demuxer -i input.mp4 -i input.ts -B -r 4096\n\n");
 }
 
 /**
@@ -70,24 +195,60 @@ static void show_module_help() {
  */
 void demuxer_parse_cmd(int argc, char *argv[]) {
     int option = 0;   // getopt_long的返回值，返回匹配到字符的ascii码，没有匹配到可读参数时返回-1
-    const char *input_url = NULL;   // 输入文件路径
-    const char *video_output_url = NULL;  // 视频数据输出路径
-    const char *audio_output_url = NULL;  // 音频数据输出路径
+    std::vector<const char *> input_urls;   // 输入文件路径
+    std::vector<const char *> video_output_urls;  // 视频数据输出路径
+    std::vector<const char *> audio_output_urls;  // 音频数据输出路径
+    int thread_count = 0;  // 线程池大小  0表示按CPU核数
+    bool compare = false;  // 是否与多进程方式对比
+    bool stream_copy = false;  // 是否直接输出压缩数据
+    bool threaded = false;  // 是否读取和解码分线程
+    int64_t range_start = AV_NOPTS_VALUE;  // 截取起点  单位us
+    int64_t range_duration = AV_NOPTS_VALUE;  // 截取时长  单位us
+    bool use_mmap = false;  // 是否通过 mmap 读取输入
+    int64_t readahead = 0;  // mmap 预读长度  单位字节
+    bool benchmark = false;  // 是否只对比两种读取方式的解复用吞吐量
     
-    while (EOF != (option = getopt_long(argc, argv, "i:v:a:", tool_long_options, NULL))) {
+    while (EOF != (option = getopt_long(argc, argv, "i:v:a:j:cetb:d:mr:B", tool_long_options, NULL))) {
         switch (option) {
             case '`':
                 show_module_help();
                 return;
                 break;
             case 'i':
-                input_url = optarg;
+                input_urls.push_back(optarg);
                 break;
             case 'v':
-                video_output_url = optarg;
+                video_output_urls.push_back(optarg);
                 break;
             case 'a':
-                audio_output_url = optarg;
+                audio_output_urls.push_back(optarg);
+                break;
+            case 'j':
+                thread_count = atoi(optarg);
+                break;
+            case 'c':
+                compare = true;
+                break;
+            case 'e':
+                stream_copy = true;
+                break;
+            case 't':
+                threaded = true;
+                break;
+            case 'b':
+                range_start = (int64_t)(atof(optarg) * AV_TIME_BASE);
+                break;
+            case 'd':
+                range_duration = (int64_t)(atof(optarg) * AV_TIME_BASE);
+                break;
+            case 'm':
+                use_mmap = true;
+                break;
+            case 'r':
+                readahead = atoll(optarg) * 1024;
+                break;
+            case 'B':
+                benchmark = true;
                 break;
             case '?':
                 printf("Use 'AVTools %s --help' To Show Detail Usage.\n", argv[1]);
@@ -98,221 +259,1040 @@ void demuxer_parse_cmd(int argc, char *argv[]) {
         }
     }
     
-    if (NULL == input_url || NULL == video_output_url || NULL == audio_output_url) {
+    if (benchmark && !input_urls.empty()) {
+        for (size_t i = 0; i < input_urls.size(); i++) {
+            benchmark_input(input_urls[i], readahead);
+        }
+        return;
+    }
+    
+    if (input_urls.empty() || video_output_urls.size() != input_urls.size() || audio_output_urls.size() != input_urls.size()) {
         printf("Demuxer Param Error, Use 'AVTools %s --help' To Show Detail Usage.\n", argv[1]);
         return;
     }
     
-    demux(input_url, video_output_url, audio_output_url);
+    if ((range_start != AV_NOPTS_VALUE && range_start < 0) || (range_duration != AV_NOPTS_VALUE && range_duration <= 0)) {
+        printf("Demuxer Param Error, Start Time Must Be >= 0 And Duration Must Be > 0.\n");
+        return;
+    }
+    
+    // 单个输入保持原有的逐帧输出
+    if (input_urls.size() == 1 && thread_count == 0 && !compare) {
+        DemuxSession *session = alloc_demux_session(input_urls[0], video_output_urls[0], audio_output_urls[0], false);
+        if (session) {
+            session->stream_copy = stream_copy;
+            session->threaded = threaded;
+            session->range_start = range_start;
+            session->range_duration = range_duration;
+            session->use_mmap = use_mmap;
+            session->readahead = readahead;
+            demux(session);
+            free_demux_session(&session);
+        }
+        return;
+    }
+    
+    std::vector<DemuxSession *> sessions;
+    for (size_t i = 0; i < input_urls.size(); i++) {
+        DemuxSession *session = alloc_demux_session(input_urls[i], video_output_urls[i], audio_output_urls[i], true);
+        if (!session) {
+            break;
+        }
+        session->stream_copy = stream_copy;
+        session->threaded = threaded;
+        session->range_start = range_start;
+        session->range_duration = range_duration;
+        session->use_mmap = use_mmap;
+        session->readahead = readahead;
+        sessions.push_back(session);
+    }
+    
+    if (sessions.size() == input_urls.size()) {
+        if (thread_count <= 0) {
+            thread_count = (int)std::thread::hardware_concurrency();
+        }
+        demux_multiple(sessions, thread_count > 0 ? thread_count : 1, compare);
+    }
+    
+    for (size_t i = 0; i < sessions.size(); i++) {
+        free_demux_session(&sessions[i]);
+    }
 }
 
 /**
- * Start Demuxing
+ * 创建解复用任务
  * @param input_url               Input File Path
  * @param video_output_url     Video Output File Path
  * @param audio_output_url     Audio Output File Path
+ * @param quiet                      不输出逐帧日志
+ * @return DemuxSession Instance
+ */
+static DemuxSession *alloc_demux_session(const char *input_url, const char *video_output_url, const char *audio_output_url, bool quiet) {
+    
+    DemuxSession *session = (DemuxSession *)calloc(1, sizeof(DemuxSession));
+    if (!session) {
+        fprintf(stderr, "Could not allocate demux session\n");
+        return NULL;
+    }
+    
+    session->input_url = input_url;
+    session->video_output_url = video_output_url;
+    session->audio_output_url = audio_output_url;
+    session->quiet = quiet;
+    session->video_stream_index = -1;
+    session->audio_stream_index = -1;
+    session->range_start = AV_NOPTS_VALUE;
+    session->range_duration = AV_NOPTS_VALUE;
+    return session;
+}
+
+/**
+ * 释放解复用任务
+ * @param session                  DemuxSession Instance
+ */
+static void free_demux_session(DemuxSession **session) {
+    
+    if (*session) {
+        free(*session);
+        *session = NULL;
+    }
+}
+
+/**
+ * 打开输入文件并检索流信息
+ * @param session                  DemuxSession Instance
+ * @return ret
  */
-static void demux(const char *input_url, const char *video_output_url, const char *audio_output_url) {
+static int open_input(DemuxSession *session) {
     
     int ret = 0;
-        
+    
+    // mmap 输入  AVFormatContext 通过自定义 AVIOContext 读取映射内存
+    if (session->use_mmap && (ret = open_mmap_input(session)) < 0) {
+        return ret;
+    }
+    
     // 使用 AVFormatContext 打开输入文件
-    if (avformat_open_input(&fmt_ctx, input_url, NULL, NULL) < 0) {
-        fprintf(stderr, "Could not open source file %s\n", video_output_url);
-        goto __END;
+    if ((ret = avformat_open_input(&session->fmt_ctx, session->input_url, NULL, NULL)) < 0) {
+        fprintf(stderr, "Could not open source file %s\n", session->input_url);
+        return ret;
     }
     
     // 检索文件信息
-    if (avformat_find_stream_info(fmt_ctx, NULL) < 0) {
+    if ((ret = avformat_find_stream_info(session->fmt_ctx, NULL)) < 0) {
         fprintf(stderr, "Could not find stream information\n");
+        return ret;
+    }
+    
+    session->input_size = avio_size(session->fmt_ctx->pb);
+    return 0;
+}
+
+/**
+ * 映射输入文件并创建自定义 AVIOContext
+ * 默认的 file protocol 每次 read() 一小段再拷贝进 AVIO 缓冲区  mmap 后 read 回调直接从映射内存拷贝  省去系统调用
+ * @param session                  DemuxSession Instance
+ * @return ret
+ */
+static int open_mmap_input(DemuxSession *session) {
+    
+    int fd = -1;
+    struct stat st;
+    uint8_t *buffer = NULL;
+    
+    fd = open(session->input_url, O_RDONLY);
+    if (fd < 0) {
+        fprintf(stderr, "Could not open source file %s\n", session->input_url);
+        return AVERROR(errno);
+    }
+    
+    if (fstat(fd, &st) < 0 || st.st_size <= 0) {
+        fprintf(stderr, "Could not get size of source file %s\n", session->input_url);
+        close(fd);
+        return AVERROR(EINVAL);
+    }
+    
+    session->mmap_data = (uint8_t *)mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (session->mmap_data == MAP_FAILED) {
+        session->mmap_data = NULL;
+        fprintf(stderr, "Could not mmap source file %s\n", session->input_url);
+        close(fd);
+        return AVERROR(ENOMEM);
+    }
+    close(fd);
+    session->mmap_size = st.st_size;
+    session->mmap_pos = 0;
+    session->mmap_advised = 0;
+    
+    // 解复用基本是顺序读  让内核加大预读
+    madvise(session->mmap_data, session->mmap_size, MADV_SEQUENTIAL);
+    
+    buffer = (uint8_t *)av_malloc(MMAP_IO_BUFFER_SIZE);
+    if (!buffer) {
+        return AVERROR(ENOMEM);
+    }
+    
+    session->avio_ctx = avio_alloc_context(buffer, MMAP_IO_BUFFER_SIZE, 0, session, mmap_read_packet, NULL, mmap_seek);
+    if (!session->avio_ctx) {
+        av_free(buffer);
+        return AVERROR(ENOMEM);
+    }
+    
+    session->fmt_ctx = avformat_alloc_context();
+    if (!session->fmt_ctx) {
+        return AVERROR(ENOMEM);
+    }
+    session->fmt_ctx->pb = session->avio_ctx;
+    return 0;
+}
+
+/**
+ * 关闭输入  mmap 输入时还要释放自定义 AVIOContext 并解除映射
+ * @param session                  DemuxSession Instance
+ */
+static void close_input(DemuxSession *session) {
+    
+    if (session->fmt_ctx) {
+        avformat_close_input(&session->fmt_ctx);
+    }
+    
+    // avformat_close_input 不会释放自定义的 AVIOContext
+    if (session->avio_ctx) {
+        av_freep(&session->avio_ctx->buffer);
+        avio_context_free(&session->avio_ctx);
+    }
+    
+    if (session->mmap_data) {
+        munmap(session->mmap_data, session->mmap_size);
+        session->mmap_data = NULL;
+        session->mmap_size = 0;
+    }
+}
+
+/**
+ * 自定义 AVIOContext read 回调  从映射内存拷贝到 AVIO 缓冲区
+ * @param opaque                  DemuxSession Instance
+ * @param buf                       AVIO 缓冲区
+ * @param buf_size                缓冲区长度
+ * @return 读取长度  AVERROR_EOF 表示读完
+ */
+static int mmap_read_packet(void *opaque, uint8_t *buf, int buf_size) {
+    
+    DemuxSession *session = (DemuxSession *)opaque;
+    int64_t left = session->mmap_size - session->mmap_pos;
+    int size = (int)FFMIN((int64_t)buf_size, left);
+    
+    if (size <= 0) {
+        return AVERROR_EOF;
+    }
+    
+    // 读取位置越过已预读区间的一半时  提前预读下一段
+    if (session->readahead > 0 && session->mmap_pos + session->readahead / 2 >= session->mmap_advised) {
+        int64_t page_size = sysconf(_SC_PAGESIZE);
+        int64_t begin = FFMAX(session->mmap_advised, session->mmap_pos) & ~(page_size - 1);
+        int64_t end = FFMIN(session->mmap_pos + session->readahead, session->mmap_size);
+        if (end > begin) {
+            madvise(session->mmap_data + begin, end - begin, MADV_WILLNEED);
+        }
+        session->mmap_advised = end;
+    }
+    
+    memcpy(buf, session->mmap_data + session->mmap_pos, size);
+    session->mmap_pos += size;
+    return size;
+}
+
+/**
+ * 自定义 AVIOContext seek 回调
+ * @param opaque                  DemuxSession Instance
+ * @param offset                  偏移
+ * @param whence                  SEEK_SET / SEEK_CUR / SEEK_END / AVSEEK_SIZE
+ * @return 新的读取位置  AVSEEK_SIZE 时返回文件大小
+ */
+static int64_t mmap_seek(void *opaque, int64_t offset, int whence) {
+    
+    DemuxSession *session = (DemuxSession *)opaque;
+    int64_t pos = 0;
+    
+    switch (whence & ~AVSEEK_FORCE) {
+        case AVSEEK_SIZE:
+            return session->mmap_size;
+        case SEEK_SET:
+            pos = offset;
+            break;
+        case SEEK_CUR:
+            pos = session->mmap_pos + offset;
+            break;
+        case SEEK_END:
+            pos = session->mmap_size + offset;
+            break;
+        default:
+            return AVERROR(EINVAL);
+    }
+    
+    if (pos < 0 || pos > session->mmap_size) {
+        return AVERROR(EINVAL);
+    }
+    
+    // 向后 seek 时预读位置跟着移动
+    if (pos < session->mmap_advised - session->readahead || pos > session->mmap_advised) {
+        session->mmap_advised = pos;
+    }
+    session->mmap_pos = pos;
+    return pos;
+}
+
+/**
+ * Benchmark  只解复用不解码  对比默认 file protocol 和 mmap 两种读取方式的 packet 吞吐量
+ * 正式计时前先完整读一遍  保证两种方式都在 page cache 命中的条件下比较
+ * @param input_url               Input File Path
+ * @param readahead              mmap 预读长度
+ */
+static void benchmark_input(const char *input_url, int64_t readahead) {
+    
+    const char *names[] = {"default", "mmap"};
+    int64_t packet_count = 0, packet_bytes = 0;
+    int64_t start_time = 0, elapsed = 0;
+    DemuxSession *session = NULL;
+    
+    printf("============================== Demux Benchmark ==============================\n");
+    printf("Input: %s\n", input_url);
+    
+    // warm up
+    session = alloc_demux_session(input_url, NULL, NULL, true);
+    if (!session) {
+        return;
+    }
+    if (benchmark_read(session, &packet_count, &packet_bytes) < 0) {
+        free_demux_session(&session);
+        return;
+    }
+    free_demux_session(&session);
+    
+    printf("  MODE    |   PACKETS   |  PACKET MB  |   TIME (s)  |   PACKETS/s   |    MB/s   \n");
+    printf("----------+-------------+-------------+-------------+---------------+-----------\n");
+    for (int i = 0; i < 2; i++) {
+        session = alloc_demux_session(input_url, NULL, NULL, true);
+        if (!session) {
+            return;
+        }
+        session->use_mmap = i == 1;
+        session->readahead = readahead;
+        
+        start_time = av_gettime_relative();
+        if (benchmark_read(session, &packet_count, &packet_bytes) >= 0) {
+            elapsed = av_gettime_relative() - start_time;
+            printf(" %8s | %11lld | %11.2f | %11.3f | %13.0f | %9.2f \n", names[i], (long long)packet_count,
+                   packet_bytes / (1024.0 * 1024.0), elapsed / 1000000.0, elapsed > 0 ? packet_count * 1000000.0 / elapsed : 0,
+                   elapsed > 0 ? session->input_size / (1024.0 * 1024.0) / (elapsed / 1000000.0) : 0);
+        }
+        free_demux_session(&session);
+    }
+    printf("-----------------------------------------------------------------------------\n");
+}
+
+/**
+ * Benchmark 单次读取  打开输入并 av_read_frame 到文件结束
+ * @param session                  DemuxSession Instance
+ * @param packet_count          读到的 packet 数
+ * @param packet_bytes          读到的 packet 总长度
+ * @return ret
+ */
+static int benchmark_read(DemuxSession *session, int64_t *packet_count, int64_t *packet_bytes) {
+    
+    int ret = 0;
+    AVPacket *packet = NULL;
+    
+    *packet_count = 0;
+    *packet_bytes = 0;
+    
+    if ((ret = open_input(session)) < 0) {
+        goto __END;
+    }
+    
+    packet = av_packet_alloc();
+    if (!packet) {
+        ret = AVERROR(ENOMEM);
+        goto __END;
+    }
+    
+    while (av_read_frame(session->fmt_ctx, packet) >= 0) {
+        (*packet_count)++;
+        *packet_bytes += packet->size;
+        av_packet_unref(packet);
+    }
+    
+__END:
+    av_packet_free(&packet);
+    close_input(session);
+    return ret;
+}
+
+/**
+ * Start Demuxing
+ * @param session                  DemuxSession Instance
+ */
+static void demux(DemuxSession *session) {
+    
+    int ret = 0;
+    
+    if (session->stream_copy) {
+        demux_stream_copy(session);
+        return;
+    }
+    
+    session->start_time = av_gettime_relative();
+    
+    if ((ret = open_input(session)) < 0) {
         goto __END;
     }
     
     // 查找视频 AVStream  初始化解码器上下文
-    if (open_codec_context(fmt_ctx, AVMEDIA_TYPE_VIDEO, &video_dec_ctx, &video_stream_index) >= 0) {
-        video_stream = fmt_ctx->streams[video_stream_index];
-        video_output_file = fopen(video_output_url, "wb+");
-        if (!video_output_file) {
-            fprintf(stderr, "Could not open destination file %s\n", video_output_url);
+    if (open_codec_context(session->fmt_ctx, AVMEDIA_TYPE_VIDEO, &session->video_dec_ctx, &session->video_stream_index) >= 0) {
+        session->video_stream = session->fmt_ctx->streams[session->video_stream_index];
+        session->video_output_file = fopen(session->video_output_url, "wb+");
+        if (!session->video_output_file) {
+            fprintf(stderr, "Could not open destination file %s\n", session->video_output_url);
+            ret = AVERROR(EIO);
             goto __END;
         }
+        av_strlcpy(session->video_segment_url, session->video_output_url, sizeof(session->video_segment_url));
         
-        video_width = video_dec_ctx->width;
-        video_height = video_dec_ctx->height;
-        pix_fmt = video_dec_ctx->pix_fmt;
-        ret = av_image_alloc(video_dst_data, video_dst_linesize, video_width, video_height, pix_fmt, 1);
-        if (ret < 0) {
-            fprintf(stderr, "Could not allocate raw video buffer\n");
-            goto __END;
+        // 解码器还没有确定像素格式时  等第一帧再计算
+        if (session->video_dec_ctx->pix_fmt != AV_PIX_FMT_NONE) {
+            ret = init_video_layout(session, session->video_dec_ctx->width, session->video_dec_ctx->height, session->video_dec_ctx->pix_fmt);
+            if (ret < 0) {
+                fprintf(stderr, "Could not get raw video layout\n");
+                goto __END;
+            }
         }
-        video_dst_bufsize = ret;
     }
     
     // 查找音频 AVStream  初始化解码器上下文
-    if (open_codec_context(fmt_ctx, AVMEDIA_TYPE_AUDIO, &audio_dec_ctx, &audio_stream_index) >= 0) {
-        audio_stream = fmt_ctx->streams[audio_stream_index];
-        audio_output_file = fopen(audio_output_url, "wb+");
-        if (!audio_output_file) {
-            fprintf(stderr, "Could not open destination file %s\n", audio_output_url);
+    if (open_codec_context(session->fmt_ctx, AVMEDIA_TYPE_AUDIO, &session->audio_dec_ctx, &session->audio_stream_index) >= 0) {
+        session->audio_stream = session->fmt_ctx->streams[session->audio_stream_index];
+        session->audio_output_file = fopen(session->audio_output_url, "wb+");
+        if (!session->audio_output_file) {
+            fprintf(stderr, "Could not open destination file %s\n", session->audio_output_url);
+            ret = AVERROR(EIO);
             goto __END;
         }
     }
     
     // 输出媒体信息
-    av_dump_format(fmt_ctx, 0, input_url, 0);
+    if (!session->quiet) {
+        av_dump_format(session->fmt_ctx, 0, session->input_url, 0);
+    }
     
-    if (!audio_stream && !video_stream) {
+    if (!session->audio_stream && !session->video_stream) {
         fprintf(stderr, "Could not find audio or video stream in the input, aborting\n");
+        ret = AVERROR_STREAM_NOT_FOUND;
         goto __END;
     }
-
+    
+    // 指定了截取区间时先 seek 到起点之前的关键帧
+    seek_to_range(session);
+    
     // 初始化AVFrame
-    frame = av_frame_alloc();
-    if (!frame) {
+    session->frame = av_frame_alloc();
+    if (!session->frame) {
         fprintf(stderr, "Could not allocate frame\n");
+        ret = AVERROR(ENOMEM);
         goto __END;
     }
     
     // 初始化AVPacket
-    packet = av_packet_alloc();
-    if (!packet) {
+    session->packet = av_packet_alloc();
+    if (!session->packet) {
         fprintf(stderr, "Could not allocate packet\n");
+        ret = AVERROR(ENOMEM);
         goto __END;
     }
     
-    while (av_read_frame(fmt_ctx, packet) >= 0) {
-        if (packet->stream_index == video_stream_index) {
-            ret = decode_packet(video_dec_ctx, packet, frame);
-        } else if (packet->stream_index == audio_stream_index) {
-            ret = decode_packet(audio_dec_ctx, packet, frame);
+    ret = 0;
+    if (session->threaded) {
+        ret = decode_threaded(session);
+    } else {
+        while (av_read_frame(session->fmt_ctx, session->packet) >= 0) {
+            if (packet_after_range(session, session->packet)) {
+                av_packet_unref(session->packet);
+                // 所有流都已读过结束点
+                if ((!session->video_stream || session->video_ended) && (!session->audio_stream || session->audio_ended)) {
+                    break;
+                }
+                continue;
+            }
+            if (session->packet->stream_index == session->video_stream_index) {
+                ret = decode_packet(session, session->video_dec_ctx, session->packet, session->frame);
+            } else if (session->packet->stream_index == session->audio_stream_index) {
+                ret = decode_packet(session, session->audio_dec_ctx, session->packet, session->frame);
+            }
+            av_packet_unref(session->packet);
+            if (ret < 0) {
+                break;
+            }
         }
-        av_packet_unref(packet);
-        if (ret < 0) {
-            break;
+        
+        // flush the decoders
+        if (session->video_dec_ctx) {
+            decode_packet(session, session->video_dec_ctx, NULL, session->frame);
+        }
+        if (session->audio_dec_ctx) {
+            decode_packet(session, session->audio_dec_ctx, NULL, session->frame);
         }
     }
     
-    // flush the decoders
-    if (video_dec_ctx) {
-        decode_packet(video_dec_ctx, NULL, frame);
-    }
-    if (audio_dec_ctx) {
-        decode_packet(audio_dec_ctx, NULL, frame);
+    if (session->quiet) {
+        goto __END;
     }
     
     color_print(COLOR_FT_WHITE, COLOR_BG_NONE, "\nDemuxing succeeded.\n");
     
-    if (video_stream) {
+    if (session->video_stream) {
         printf("Play the output video file with the command:\n"
                "  - ffplay -f rawvideo -pixel_format %s -video_size %dx%d %s\n",
-               av_get_pix_fmt_name(pix_fmt), video_width, video_height, video_output_url);
+               av_get_pix_fmt_name(session->pix_fmt), session->video_width, session->video_height, session->video_segment_url);
     }
     
-    if (audio_stream) {
-        enum AVSampleFormat sfmt = av_get_packed_sample_fmt(audio_dec_ctx->sample_fmt);
-        int n_channels = audio_dec_ctx->channels;
+    if (session->audio_stream) {
+        enum AVSampleFormat sfmt = av_get_packed_sample_fmt(session->audio_dec_ctx->sample_fmt);
+        int n_channels = session->audio_dec_ctx->channels;
         const char *fmt = NULL;
         if ((ret = get_format_from_sample_fmt(&fmt, sfmt)) < 0) {
             goto __END;
         }
         printf("Play the output audio file with the command:\n"
                "  - ffplay -f %s -ac %d -ar %d %s\n",
-               fmt, n_channels, audio_dec_ctx->sample_rate, audio_output_url);
+               fmt, n_channels, session->audio_dec_ctx->sample_rate, session->audio_output_url);
     }
-
+    
 __END:
-    if (video_output_file) {
-        fclose(video_output_file);
-    }
+    session->result = ret < 0 ? ret : 0;
     
-    if (audio_output_file) {
-        fclose(audio_output_file);
+    if (session->video_output_file) {
+        fclose(session->video_output_file);
+        session->video_output_file = NULL;
     }
     
-    if (video_dec_ctx) {
-        avcodec_free_context(&video_dec_ctx);
+    if (session->audio_output_file) {
+        fclose(session->audio_output_file);
+        session->audio_output_file = NULL;
     }
     
-    if (audio_dec_ctx) {
-        avcodec_free_context(&audio_dec_ctx);
+    if (session->video_dec_ctx) {
+        avcodec_free_context(&session->video_dec_ctx);
     }
     
-    if (fmt_ctx) {
-        avformat_close_input(&fmt_ctx);
+    if (session->audio_dec_ctx) {
+        avcodec_free_context(&session->audio_dec_ctx);
     }
     
-    if (packet) {
-        av_packet_free(&packet);
+    close_input(session);
+    
+    if (session->packet) {
+        av_packet_free(&session->packet);
     }
     
-    if (frame) {
-        av_frame_free(&frame);
+    if (session->frame) {
+        av_frame_free(&session->frame);
     }
-        
-    av_free(video_dst_data[0]);
+    
+    av_freep(&session->video_dst_buffer);
+    
+    session->video_stream = NULL;
+    session->audio_stream = NULL;
+    session->end_time = av_gettime_relative();
 }
 
 /**
- * 根据 AVFormatContext 找到音视频的 AVStream 并初始化 AVCodecContext
- * @param fmt_ctx                 AVFormatContext
- * @param type                     媒体类型
- * @param context                 解码器上下文指针的地址
- * @param stream_index         stream 在 AVFormatContext中的下标
- * @return ret
+ * Stream Copy  只解复用不解码  直接输出音视频基本流
+ * @param session                  DemuxSession Instance
  */
-static int open_codec_context(AVFormatContext *fmt_ctx, enum AVMediaType type, AVCodecContext **context, int *stream_index) {
+static void demux_stream_copy(DemuxSession *session) {
     
-    int ret, inner_stream_index = 0;
-    AVStream *stream = NULL;
-    AVCodec *codec = NULL;
-    AVDictionary *opts = NULL;
+    int ret = 0;
+    double elapsed = 0;
     
-    ret = av_find_best_stream(fmt_ctx, type, -1, -1, NULL, 0);
-    if (ret < 0) {
-        fprintf(stderr, "Could not find %s stream in input file.\n", av_get_media_type_string(type));
-        return ret;
-    } else {
-        inner_stream_index = ret;
-        stream = fmt_ctx->streams[inner_stream_index];
-        
-        // 通过 AVStream 的 codec id 查找解码器
-        codec = avcodec_find_decoder(stream->codecpar->codec_id);
-        if (!codec) {
-            fprintf(stderr, "Failed to find %s codec\n", av_get_media_type_string(type));
-            return AVERROR(EINVAL);
-        }
-        
-        // 初始化 codec context
-        *context = avcodec_alloc_context3(codec);
-        if (!*context) {
-            fprintf(stderr, "Failed to allocate the %s codec context\n", av_get_media_type_string(type));
-            return AVERROR(ENOMEM);
+    session->start_time = av_gettime_relative();
+    
+    if ((ret = open_input(session)) < 0) {
+        goto __END;
+    }
+    
+    // 查找视频 AVStream  H.264/HEVC 需要转成 AnnexB
+    ret = av_find_best_stream(session->fmt_ctx, AVMEDIA_TYPE_VIDEO, -1, -1, NULL, 0);
+    if (ret >= 0) {
+        session->video_stream_index = ret;
+        session->video_stream = session->fmt_ctx->streams[ret];
+        if ((ret = open_annexb_filter(session)) < 0) {
+            goto __END;
         }
-        
-        // Copy解码参数  AVStream -> AVCodecContext
-        if ((ret = avcodec_parameters_to_context(*context, stream->codecpar)) < 0) {
-            fprintf(stderr, "Failed to copy %s codec parameters to decoder context\n", av_get_media_type_string(type));
-            return ret;
+        session->video_output_file = fopen(session->video_output_url, "wb+");
+        if (!session->video_output_file) {
+            fprintf(stderr, "Could not open destination file %s\n", session->video_output_url);
+            ret = AVERROR(EIO);
+            goto __END;
         }
-        
-        // 根据上下文 context 初始化解码器
-        if ((ret = avcodec_open2(*context, codec, &opts)) < 0) {
-            fprintf(stderr, "Failed to open %s codec\n", av_get_media_type_string(type));
-            return ret;
+    }
+    
+    // 查找音频 AVStream  AAC 需要补 ADTS 头
+    ret = av_find_best_stream(session->fmt_ctx, AVMEDIA_TYPE_AUDIO, -1, -1, NULL, 0);
+    if (ret >= 0) {
+        session->audio_stream_index = ret;
+        session->audio_stream = session->fmt_ctx->streams[ret];
+        parse_audio_specific_config(session);
+        session->audio_output_file = fopen(session->audio_output_url, "wb+");
+        if (!session->audio_output_file) {
+            fprintf(stderr, "Could not open destination file %s\n", session->audio_output_url);
+            ret = AVERROR(EIO);
+            goto __END;
         }
-        *stream_index = inner_stream_index;
     }
-    return 0;
-}
-
-/**
- * AVPacket 解码 AVFrame
- * @param context                 解码器上下文指针的地址
+    
+    // 输出媒体信息
+    if (!session->quiet) {
+        av_dump_format(session->fmt_ctx, 0, session->input_url, 0);
+    }
+    
+    if (!session->audio_stream && !session->video_stream) {
+        fprintf(stderr, "Could not find audio or video stream in the input, aborting\n");
+        ret = AVERROR_STREAM_NOT_FOUND;
+        goto __END;
+    }
+    
+    // 指定了截取区间时先 seek 到起点之前的关键帧
+    seek_to_range(session);
+    
+    // 初始化AVPacket
+    session->packet = av_packet_alloc();
+    if (!session->packet) {
+        fprintf(stderr, "Could not allocate packet\n");
+        ret = AVERROR(ENOMEM);
+        goto __END;
+    }
+    
+    ret = 0;
+    while (av_read_frame(session->fmt_ctx, session->packet) >= 0) {
+        if (packet_after_range(session, session->packet)) {
+            av_packet_unref(session->packet);
+            if ((!session->video_stream || session->video_ended) && (!session->audio_stream || session->audio_ended)) {
+                break;
+            }
+            continue;
+        }
+        if (session->packet->stream_index == session->video_stream_index) {
+            // 视频从 seek 到的关键帧开始输出  否则起点之后的帧无法解码
+            ret = write_video_packet(session, session->packet);
+        } else if (session->packet->stream_index == session->audio_stream_index) {
+            // 音频每个 packet 都可以独立解码  直接丢弃起点之前的 packet
+            if (session->audio_start_pts == AV_NOPTS_VALUE || session->packet->pts == AV_NOPTS_VALUE || session->packet->pts >= session->audio_start_pts) {
+                ret = write_audio_packet(session, session->packet);
+            }
+        }
+        av_packet_unref(session->packet);
+        if (ret < 0) {
+            break;
+        }
+    }
+    
+    // flush the bitstream filter
+    if (session->video_bsf) {
+        write_video_packet(session, NULL);
+    }
+    
+    if (session->quiet) {
+        goto __END;
+    }
+    
+    elapsed = (av_gettime_relative() - session->start_time) / 1000000.0;
+    color_print(COLOR_FT_WHITE, COLOR_BG_NONE, "\nStream copy succeeded.\n");
+    if (session->video_stream) {
+        printf("  Video: %s%s, %d packets, %lld bytes -> %s\n", avcodec_get_name(session->video_stream->codecpar->codec_id),
+               session->video_bsf ? " (AnnexB)" : " (raw packets)", session->video_frame_count, (long long)session->video_bytes, session->video_output_url);
+    }
+    if (session->audio_stream) {
+        printf("  Audio: %s%s, %d packets, %lld bytes -> %s\n", avcodec_get_name(session->audio_stream->codecpar->codec_id),
+               session->aac_profile >= 0 ? " (ADTS)" : " (raw packets)", session->audio_frame_count, (long long)session->audio_bytes, session->audio_output_url);
+    }
+    printf("  Elapsed: %.3f s, %.2f MB/s\n", elapsed, elapsed > 0 ? session->input_size / (1024.0 * 1024.0) / elapsed : 0);
+    
+__END:
+    session->result = ret < 0 ? ret : 0;
+    
+    if (session->video_output_file) {
+        fclose(session->video_output_file);
+        session->video_output_file = NULL;
+    }
+    
+    if (session->audio_output_file) {
+        fclose(session->audio_output_file);
+        session->audio_output_file = NULL;
+    }
+    
+    if (session->video_bsf) {
+        av_bsf_free(&session->video_bsf);
+    }
+    
+    close_input(session);
+    
+    if (session->packet) {
+        av_packet_free(&session->packet);
+    }
+    
+    session->video_stream = NULL;
+    session->audio_stream = NULL;
+    session->end_time = av_gettime_relative();
+}
+
+/**
+ * H.264/HEVC 初始化 mp4toannexb bitstream filter  将 avcC/hvcC 中的参数集和长度前缀转换为 AnnexB 起始码
+ * 输入本身已经是 AnnexB（如 TS）时 filter 会直接透传
+ * @param session                  DemuxSession Instance
+ * @return ret
+ */
+static int open_annexb_filter(DemuxSession *session) {
+    
+    int ret = 0;
+    const AVBitStreamFilter *filter = NULL;
+    AVCodecParameters *codecpar = session->video_stream->codecpar;
+    
+    if (codecpar->codec_id == AV_CODEC_ID_H264) {
+        filter = av_bsf_get_by_name("h264_mp4toannexb");
+    } else if (codecpar->codec_id == AV_CODEC_ID_HEVC) {
+        filter = av_bsf_get_by_name("hevc_mp4toannexb");
+    } else {
+        // 其他编码直接输出原始 packet
+        return 0;
+    }
+    
+    if (!filter) {
+        fprintf(stderr, "Could not find mp4toannexb bitstream filter\n");
+        return AVERROR_BSF_NOT_FOUND;
+    }
+    
+    if ((ret = av_bsf_alloc(filter, &session->video_bsf)) < 0) {
+        fprintf(stderr, "Could not allocate bitstream filter\n");
+        return ret;
+    }
+    
+    if ((ret = avcodec_parameters_copy(session->video_bsf->par_in, codecpar)) < 0) {
+        return ret;
+    }
+    session->video_bsf->time_base_in = session->video_stream->time_base;
+    
+    if ((ret = av_bsf_init(session->video_bsf)) < 0) {
+        fprintf(stderr, "Could not initialize bitstream filter (%s)\n", av_err2str(ret));
+        return ret;
+    }
+    return 0;
+}
+
+/**
+ * 解析 AAC AudioSpecificConfig  得到生成 ADTS 头需要的 profile、sampling_frequency_index、channel_configuration
+ * AudioSpecificConfig = audioObjectType(5bit, 31时再扩展6bit) + samplingFrequencyIndex(4bit, 15时后跟24bit采样率) + channelConfiguration(4bit) + ...
+ * @param session                  DemuxSession Instance
+ * @return 0: 需要补ADTS头  -1: 非AAC或无法用ADTS描述  按原始packet输出
+ */
+static int parse_audio_specific_config(DemuxSession *session) {
+    
+    static const int sample_rates[] = {96000, 88200, 64000, 48000, 44100, 32000, 24000, 22050, 16000, 12000, 11025, 8000, 7350};
+    AVCodecParameters *codecpar = session->audio_stream->codecpar;
+    int object_type = 0;
+    int sample_index = -1;
+    int sample_rate = codecpar->sample_rate;
+    int channels = codecpar->channels;
+    
+    session->aac_profile = -1;
+    if (codecpar->codec_id != AV_CODEC_ID_AAC) {
+        return -1;
+    }
+    
+    if (codecpar->extradata_size >= 2) {
+        // extradata 尾部有 AV_INPUT_BUFFER_PADDING_SIZE 字节的0填充  可以直接按64bit读取
+        uint64_t bits = AV_RB64(codecpar->extradata);
+        int position = 5;
+        object_type = (int)(bits >> 59);
+        if (object_type == 31) {
+            object_type = 32 + (int)((bits >> 53) & 0x3f);
+            position += 6;
+        }
+        sample_index = (int)((bits >> (60 - position)) & 0x0f);
+        position += 4;
+        if (sample_index == 15) {
+            sample_rate = (int)((bits >> (40 - position)) & 0xffffff);
+            sample_index = -1;
+            position += 24;
+        }
+        channels = (int)((bits >> (60 - position)) & 0x0f);
+    } else if (codecpar->profile != FF_PROFILE_UNKNOWN) {
+        object_type = codecpar->profile + 1;
+    }
+    
+    // SBR/PS 显式信令时  ADTS 只能描述核心层  按 LC 输出  由解码器隐式识别 SBR/PS
+    if (object_type == 5 || object_type == 29) {
+        object_type = 2;
+    }
+    
+    if (sample_index < 0) {
+        for (size_t i = 0; i < FF_ARRAY_ELEMS(sample_rates); i++) {
+            if (sample_rates[i] == sample_rate) {
+                sample_index = (int)i;
+                break;
+            }
+        }
+    }
+    
+    // ADTS profile 只有2bit  只能描述 Main/LC/SSR/LTP
+    if (object_type < 1 || object_type > 4 || sample_index < 0 || channels > 7) {
+        fprintf(stderr, "AAC object type %d / sample rate %d can not be described by ADTS, write raw packets\n", object_type, sample_rate);
+        return -1;
+    }
+    
+    session->aac_profile = object_type - 1;
+    session->aac_sample_index = sample_index;
+    session->aac_channels = channels;
+    return 0;
+}
+
+/**
+ * Video Packet 写入本地文件  有 bitstream filter 时先转换为 AnnexB
+ * @param session                 DemuxSession Instance
+ * @param packet                  AVPacket Instance  NULL 表示 flush bitstream filter
+ * @return ret
+ */
+static int write_video_packet(DemuxSession *session, AVPacket *packet) {
+    
+    int ret = 0;
+    
+    if (!session->video_bsf) {
+        fwrite(packet->data, 1, packet->size, session->video_output_file);
+        session->video_bytes += packet->size;
+        session->video_frame_count++;
+        return 0;
+    }
+    
+    // send 成功后 packet 的引用被 filter 接管  可以复用 session->packet 接收输出
+    ret = av_bsf_send_packet(session->video_bsf, packet);
+    if (ret < 0) {
+        fprintf(stderr, "Error submitting a packet for filtering (%s)\n", av_err2str(ret));
+        return ret;
+    }
+    
+    while ((ret = av_bsf_receive_packet(session->video_bsf, session->packet)) == 0) {
+        fwrite(session->packet->data, 1, session->packet->size, session->video_output_file);
+        session->video_bytes += session->packet->size;
+        session->video_frame_count++;
+        av_packet_unref(session->packet);
+    }
+    
+    if (ret == AVERROR(EAGAIN) || ret == AVERROR_EOF) {
+        return 0;
+    }
+    fprintf(stderr, "Error during filtering (%s)\n", av_err2str(ret));
+    return ret;
+}
+
+/**
+ * Audio Packet 写入本地文件  AAC 在 packet 前补7字节 ADTS 头
+ * @param session                 DemuxSession Instance
+ * @param packet                  AVPacket Instance
+ * @return ret
+ */
+static int write_audio_packet(DemuxSession *session, AVPacket *packet) {
+    
+    uint8_t adts_header[7] = {0};
+    int frame_length = packet->size + sizeof(adts_header);
+    
+    // 输入本身已经是 ADTS（如 TS）时不再重复添加
+    bool has_adts = packet->size >= 2 && packet->data[0] == 0xff && (packet->data[1] & 0xf6) == 0xf0;
+    
+    if (session->aac_profile >= 0 && !has_adts && frame_length <= 0x1fff) {
+        // syncword 0xFFF, MPEG-4, layer 00, protection_absent 1
+        adts_header[0] = 0xff;
+        adts_header[1] = 0xf1;
+        adts_header[2] = (session->aac_profile << 6) | (session->aac_sample_index << 2) | ((session->aac_channels >> 2) & 0x01);
+        adts_header[3] = ((session->aac_channels & 0x03) << 6) | ((frame_length >> 11) & 0x03);
+        adts_header[4] = (frame_length >> 3) & 0xff;
+        // adts_buffer_fullness 0x7FF  number_of_raw_data_blocks_in_frame 0
+        adts_header[5] = ((frame_length & 0x07) << 5) | 0x1f;
+        adts_header[6] = 0xfc;
+        fwrite(adts_header, 1, sizeof(adts_header), session->audio_output_file);
+        session->audio_bytes += sizeof(adts_header);
+    }
+    
+    fwrite(packet->data, 1, packet->size, session->audio_output_file);
+    session->audio_bytes += packet->size;
+    session->audio_frame_count++;
+    return 0;
+}
+
+/**
+ * 多输入解复用  N 个 session 在线程池中并发运行  可选与 N 个独立进程的方式对比吞吐量
+ * @param sessions                DemuxSession List
+ * @param thread_count          线程池大小
+ * @param compare                 是否与多进程方式对比
+ */
+static void demux_multiple(std::vector<DemuxSession *> &sessions, int thread_count, bool compare) {
+    
+    int64_t total_size = 0;
+    int64_t total_frames = 0;
+    int64_t pool_time = 0;
+    int64_t process_time = 0;
+    
+    pool_time = run_in_thread_pool(sessions, thread_count);
+    
+    printf("============================== Multi Input Demux ==============================\n");
+    printf(" JOB |   RESULT  |  VIDEO FRAMES  |  AUDIO FRAMES  |   SIZE (MB)  |   TIME (s)  | INPUT\n");
+    printf("-----+-----------+----------------+----------------+--------------+-------------+------\n");
+    for (size_t i = 0; i < sessions.size(); i++) {
+        DemuxSession *session = sessions[i];
+        total_size += session->input_size > 0 ? session->input_size : 0;
+        total_frames += session->video_frame_count + session->audio_frame_count;
+        printf(" %3zu | %9s | %14d | %14d | %12.2f | %11.3f | %s\n", i, session->result < 0 ? "FAILED" : "OK",
+               session->video_frame_count, session->audio_frame_count, session->input_size / (1024.0 * 1024.0),
+               (session->end_time - session->start_time) / 1000000.0, session->input_url);
+    }
+    printf("-------------------------------------------------------------------------------\n");
+    printf("Thread Pool (%d threads, %zu jobs): %.3f s, %.2f MB/s, %.0f frames/s\n", thread_count, sessions.size(),
+           pool_time / 1000000.0, total_size / (1024.0 * 1024.0) / (pool_time / 1000000.0), total_frames / (pool_time / 1000000.0));
+    
+    if (!compare) {
+        return;
+    }
+    
+    process_time = run_in_processes(sessions);
+    printf("Separate Processes (%zu processes): %.3f s, %.2f MB/s, %.0f frames/s\n", sessions.size(),
+           process_time / 1000000.0, total_size / (1024.0 * 1024.0) / (process_time / 1000000.0), total_frames / (process_time / 1000000.0));
+    printf("Thread Pool / Processes Throughput: %.2fx\n", (double)process_time / pool_time);
+}
+
+/**
+ * 在线程池中运行所有 session  每个线程从任务队列中依次领取下一个任务
+ * @param sessions                DemuxSession List
+ * @param thread_count          线程池大小
+ * @return 总耗时  单位us
+ */
+static int64_t run_in_thread_pool(std::vector<DemuxSession *> &sessions, int thread_count) {
+    
+    std::atomic<size_t> next_job(0);
+    std::vector<std::thread> workers;
+    int64_t start_time = av_gettime_relative();
+    
+    if ((size_t)thread_count > sessions.size()) {
+        thread_count = (int)sessions.size();
+    }
+    
+    for (int i = 0; i < thread_count; i++) {
+        workers.emplace_back([&sessions, &next_job]() {
+            size_t job = 0;
+            while ((job = next_job.fetch_add(1)) < sessions.size()) {
+                demux(sessions[job]);
+            }
+        });
+    }
+    
+    for (size_t i = 0; i < workers.size(); i++) {
+        workers[i].join();
+    }
+    
+    return av_gettime_relative() - start_time;
+}
+
+/**
+ * 每个 session fork 一个独立进程运行  用于与线程池方式对比
+ * @param sessions                DemuxSession List
+ * @return 总耗时  单位us
+ */
+static int64_t run_in_processes(std::vector<DemuxSession *> &sessions) {
+    
+    std::vector<pid_t> pids;
+    int64_t start_time = av_gettime_relative();
+    
+    // fork 前刷新 stdout  避免子进程重复输出缓冲区内容
+    fflush(stdout);
+    
+    for (size_t i = 0; i < sessions.size(); i++) {
+        pid_t pid = fork();
+        if (pid == 0) {
+            demux(sessions[i]);
+            _exit(sessions[i]->result < 0 ? 1 : 0);
+        } else if (pid < 0) {
+            fprintf(stderr, "Could not fork process for %s\n", sessions[i]->input_url);
+        } else {
+            pids.push_back(pid);
+        }
+    }
+    
+    for (size_t i = 0; i < pids.size(); i++) {
+        int status = 0;
+        waitpid(pids[i], &status, 0);
+    }
+    
+    return av_gettime_relative() - start_time;
+}
+
+/**
+ * 根据 AVFormatContext 找到音视频的 AVStream 并初始化 AVCodecContext
+ * @param fmt_ctx                 AVFormatContext
+ * @param type                     媒体类型
+ * @param context                 解码器上下文指针的地址
+ * @param stream_index         stream 在 AVFormatContext中的下标
+ * @return ret
+ */
+static int open_codec_context(AVFormatContext *fmt_ctx, enum AVMediaType type, AVCodecContext **context, int *stream_index) {
+    
+    int ret, inner_stream_index = 0;
+    AVStream *stream = NULL;
+    AVCodec *codec = NULL;
+    AVDictionary *opts = NULL;
+    
+    ret = av_find_best_stream(fmt_ctx, type, -1, -1, NULL, 0);
+    if (ret < 0) {
+        fprintf(stderr, "Could not find %s stream in input file.\n", av_get_media_type_string(type));
+        return ret;
+    } else {
+        inner_stream_index = ret;
+        stream = fmt_ctx->streams[inner_stream_index];
+        
+        // 通过 AVStream 的 codec id 查找解码器
+        codec = avcodec_find_decoder(stream->codecpar->codec_id);
+        if (!codec) {
+            fprintf(stderr, "Failed to find %s codec\n", av_get_media_type_string(type));
+            return AVERROR(EINVAL);
+        }
+        
+        // 初始化 codec context
+        *context = avcodec_alloc_context3(codec);
+        if (!*context) {
+            fprintf(stderr, "Failed to allocate the %s codec context\n", av_get_media_type_string(type));
+            return AVERROR(ENOMEM);
+        }
+        
+        // Copy解码参数  AVStream -> AVCodecContext
+        if ((ret = avcodec_parameters_to_context(*context, stream->codecpar)) < 0) {
+            fprintf(stderr, "Failed to copy %s codec parameters to decoder context\n", av_get_media_type_string(type));
+            return ret;
+        }
+        
+        // 根据上下文 context 初始化解码器
+        if ((ret = avcodec_open2(*context, codec, &opts)) < 0) {
+            fprintf(stderr, "Failed to open %s codec\n", av_get_media_type_string(type));
+            return ret;
+        }
+        *stream_index = inner_stream_index;
+    }
+    return 0;
+}
+
+/**
+ * AVPacket 解码 AVFrame
+ * @param session                 DemuxSession Instance
+ * @param context                 解码器上下文指针的地址
  * @param packet                  AVPacket Instance
  * @param frame                   AVFrame Instance
  * @return ret
  */
-static int decode_packet(AVCodecContext *context, AVPacket *packet, AVFrame *frame) {
+static int decode_packet(DemuxSession *session, AVCodecContext *context, AVPacket *packet, AVFrame *frame) {
     
     int ret = 0;
     
@@ -336,11 +1316,17 @@ static int decode_packet(AVCodecContext *context, AVPacket *packet, AVFrame *fra
             return ret;
         }
         
+        // seek 到关键帧后  起点之前和结束点之后的帧只解码不输出
+        if (frame_out_of_range(session, context, frame)) {
+            av_frame_unref(frame);
+            continue;
+        }
+        
         // 将 AVFrame 写入 output file
         if (context->codec->type == AVMEDIA_TYPE_VIDEO) {
-            ret = output_video_frame(frame);
+            ret = output_video_frame(session, frame);
         } else {
-            ret = output_audio_frame(frame);
+            ret = output_audio_frame(session, frame);
         }
         
         av_frame_unref(frame);
@@ -351,45 +1337,571 @@ static int decode_packet(AVCodecContext *context, AVPacket *packet, AVFrame *fra
     return 0;
 }
 
+/**
+ * Threaded 解码  当前线程负责 av_read_frame  音视频各自的解码线程通过有界队列接收 packet 并写入各自的输出文件
+ * @param session                 DemuxSession Instance
+ * @return ret
+ */
+static int decode_threaded(DemuxSession *session) {
+    
+    int ret = 0;
+    int64_t start_time = av_gettime_relative();
+    int64_t wall_time = 0;
+    int64_t read_start = 0;
+    PacketQueue video_queue, audio_queue;
+    StageStats read_stats = {"read", 0, 0, 0, 0};
+    StageStats video_stats = {"video decode", 0, 0, 0, 0};
+    StageStats audio_stats = {"audio decode", 0, 0, 0, 0};
+    std::thread video_thread, audio_thread;
+    
+    video_queue.capacity = audio_queue.capacity = PACKET_QUEUE_CAPACITY;
+    video_queue.finished = audio_queue.finished = false;
+    video_queue.aborted = audio_queue.aborted = false;
+    
+    if (session->video_dec_ctx) {
+        video_thread = std::thread(decode_thread, session, session->video_dec_ctx, &video_queue, &video_stats);
+    }
+    if (session->audio_dec_ctx) {
+        audio_thread = std::thread(decode_thread, session, session->audio_dec_ctx, &audio_queue, &audio_stats);
+    }
+    
+    while (1) {
+        read_start = av_gettime_relative();
+        ret = av_read_frame(session->fmt_ctx, session->packet);
+        read_stats.busy_time += av_gettime_relative() - read_start;
+        if (ret < 0) {
+            // AVERROR_EOF 或读取错误  都结束读取
+            ret = 0;
+            break;
+        }
+        
+        if (packet_after_range(session, session->packet)) {
+            av_packet_unref(session->packet);
+            if ((!session->video_stream || session->video_ended) && (!session->audio_stream || session->audio_ended)) {
+                break;
+            }
+            continue;
+        }
+        
+        PacketQueue *queue = NULL;
+        if (session->packet->stream_index == session->video_stream_index) {
+            queue = &video_queue;
+        } else if (session->packet->stream_index == session->audio_stream_index) {
+            queue = &audio_queue;
+        }
+        if (!queue) {
+            av_packet_unref(session->packet);
+            continue;
+        }
+        
+        // 把 packet 的引用转移给队列  session->packet 可以直接复用
+        AVPacket *item = av_packet_alloc();
+        if (!item) {
+            av_packet_unref(session->packet);
+            ret = AVERROR(ENOMEM);
+            break;
+        }
+        av_packet_move_ref(item, session->packet);
+        if (!packet_queue_push(queue, item, &read_stats.wait_time)) {
+            // 解码线程出错
+            av_packet_free(&item);
+            break;
+        }
+        read_stats.packets++;
+    }
+    
+    packet_queue_finish(&video_queue);
+    packet_queue_finish(&audio_queue);
+    if (video_thread.joinable()) {
+        video_thread.join();
+    }
+    if (audio_thread.joinable()) {
+        audio_thread.join();
+    }
+    packet_queue_clear(&video_queue);
+    packet_queue_clear(&audio_queue);
+    
+    wall_time = av_gettime_relative() - start_time;
+    if (ret >= 0) {
+        ret = video_stats.result < 0 ? video_stats.result : audio_stats.result;
+    }
+    
+    if (session->quiet || wall_time <= 0) {
+        return ret;
+    }
+    
+    // 利用率 = 忙碌时间 / 总时长  利用率最高的阶段就是瓶颈
+    StageStats *stages[] = {&read_stats, &video_stats, &audio_stats};
+    StageStats *bottleneck = &read_stats;
+    printf("\n============================ Pipeline Utilisation ============================\n");
+    printf("      STAGE      |   PACKETS   |   BUSY (s)   |   WAIT (s)   |  UTILISATION \n");
+    printf("-----------------+-------------+--------------+--------------+--------------\n");
+    for (size_t i = 0; i < FF_ARRAY_ELEMS(stages); i++) {
+        StageStats *stats = stages[i];
+        if (stats != &read_stats && stats->packets == 0) {
+            continue;
+        }
+        printf(" %15s | %11lld | %12.3f | %12.3f | %11.1f%% \n", stats->name, (long long)stats->packets,
+               stats->busy_time / 1000000.0, stats->wait_time / 1000000.0, stats->busy_time * 100.0 / wall_time);
+        if (stats->busy_time > bottleneck->busy_time) {
+            bottleneck = stats;
+        }
+    }
+    printf("------------------------------------------------------------------------------\n");
+    printf("Wall Time: %.3f s, Bottleneck: %s\n", wall_time / 1000000.0, bottleneck->name);
+    return ret;
+}
+
+/**
+ * 解码线程  从队列中取 packet 解码并写入输出文件  队列结束后 flush 解码器
+ * @param session                 DemuxSession Instance
+ * @param context                 解码器上下文
+ * @param queue                   PacketQueue Instance
+ * @param stats                    StageStats Instance
+ */
+static void decode_thread(DemuxSession *session, AVCodecContext *context, PacketQueue *queue, StageStats *stats) {
+    
+    int ret = 0;
+    int64_t decode_start = 0;
+    AVPacket *packet = NULL;
+    AVFrame *frame = av_frame_alloc();
+    
+    if (!frame) {
+        fprintf(stderr, "Could not allocate frame\n");
+        packet_queue_abort(queue);
+        stats->result = AVERROR(ENOMEM);
+        return;
+    }
+    
+    while ((packet = packet_queue_pop(queue, &stats->wait_time)) != NULL) {
+        decode_start = av_gettime_relative();
+        ret = decode_packet(session, context, packet, frame);
+        stats->busy_time += av_gettime_relative() - decode_start;
+        stats->packets++;
+        av_packet_free(&packet);
+        if (ret < 0) {
+            packet_queue_abort(queue);
+            break;
+        }
+    }
+    
+    // flush the decoder
+    if (ret >= 0) {
+        decode_start = av_gettime_relative();
+        ret = decode_packet(session, context, NULL, frame);
+        stats->busy_time += av_gettime_relative() - decode_start;
+    }
+    
+    av_frame_free(&frame);
+    stats->result = ret;
+}
+
+/**
+ * Packet 入队  队列满时阻塞
+ * @param queue                   PacketQueue Instance
+ * @param packet                  AVPacket Instance
+ * @param wait_time              累加阻塞时长  单位us
+ * @return false: 消费者已出错  packet 未入队
+ */
+static bool packet_queue_push(PacketQueue *queue, AVPacket *packet, int64_t *wait_time) {
+    
+    std::unique_lock<std::mutex> lock(queue->mutex);
+    if (queue->packets.size() >= queue->capacity && !queue->aborted) {
+        int64_t wait_start = av_gettime_relative();
+        queue->not_full.wait(lock, [queue]() { return queue->packets.size() < queue->capacity || queue->aborted; });
+        *wait_time += av_gettime_relative() - wait_start;
+    }
+    if (queue->aborted) {
+        return false;
+    }
+    queue->packets.push_back(packet);
+    queue->not_empty.notify_one();
+    return true;
+}
+
+/**
+ * Packet 出队  队列空时阻塞
+ * @param queue                   PacketQueue Instance
+ * @param wait_time              累加阻塞时长  单位us
+ * @return AVPacket Instance  NULL 表示生产者已结束且队列为空
+ */
+static AVPacket *packet_queue_pop(PacketQueue *queue, int64_t *wait_time) {
+    
+    AVPacket *packet = NULL;
+    std::unique_lock<std::mutex> lock(queue->mutex);
+    if (queue->packets.empty() && !queue->finished) {
+        int64_t wait_start = av_gettime_relative();
+        queue->not_empty.wait(lock, [queue]() { return !queue->packets.empty() || queue->finished; });
+        *wait_time += av_gettime_relative() - wait_start;
+    }
+    if (queue->packets.empty()) {
+        return NULL;
+    }
+    packet = queue->packets.front();
+    queue->packets.pop_front();
+    queue->not_full.notify_one();
+    return packet;
+}
+
+/**
+ * 生产者结束  唤醒等待中的消费者
+ * @param queue                   PacketQueue Instance
+ */
+static void packet_queue_finish(PacketQueue *queue) {
+    
+    std::lock_guard<std::mutex> lock(queue->mutex);
+    queue->finished = true;
+    queue->not_empty.notify_all();
+}
+
+/**
+ * 消费者出错  唤醒等待中的生产者
+ * @param queue                   PacketQueue Instance
+ */
+static void packet_queue_abort(PacketQueue *queue) {
+    
+    std::lock_guard<std::mutex> lock(queue->mutex);
+    queue->aborted = true;
+    queue->not_full.notify_all();
+}
+
+/**
+ * 释放队列中剩余的 packet
+ * @param queue                   PacketQueue Instance
+ */
+static void packet_queue_clear(PacketQueue *queue) {
+    
+    std::lock_guard<std::mutex> lock(queue->mutex);
+    while (!queue->packets.empty()) {
+        AVPacket *packet = queue->packets.front();
+        queue->packets.pop_front();
+        av_packet_free(&packet);
+    }
+}
+
+/**
+ * 按截取区间 seek  并把区间换算到音视频流各自的 time_base
+ * 起点取 AVFormatContext->start_time 之后的相对时间  seek 到不晚于起点的关键帧  之后的工作量只和截取时长相关
+ * @param session                 DemuxSession Instance
+ * @return ret  seek 失败时从头读取  结果不变只是更慢
+ */
+static int seek_to_range(DemuxSession *session) {
+    
+    int ret = 0;
+    int64_t base = session->fmt_ctx->start_time != AV_NOPTS_VALUE ? session->fmt_ctx->start_time : 0;
+    int64_t start = session->range_start != AV_NOPTS_VALUE ? base + session->range_start : AV_NOPTS_VALUE;
+    int64_t end = AV_NOPTS_VALUE;
+    
+    session->video_start_pts = session->video_end_pts = AV_NOPTS_VALUE;
+    session->audio_start_pts = session->audio_end_pts = AV_NOPTS_VALUE;
+    session->video_ended = session->audio_ended = false;
+    
+    if (session->range_duration != AV_NOPTS_VALUE) {
+        end = (start != AV_NOPTS_VALUE ? start : base) + session->range_duration;
+    }
+    
+    if (session->video_stream) {
+        if (start != AV_NOPTS_VALUE) {
+            session->video_start_pts = av_rescale_q(start, AV_TIME_BASE_Q, session->video_stream->time_base);
+        }
+        if (end != AV_NOPTS_VALUE) {
+            session->video_end_pts = av_rescale_q(end, AV_TIME_BASE_Q, session->video_stream->time_base);
+        }
+    }
+    if (session->audio_stream) {
+        if (start != AV_NOPTS_VALUE) {
+            session->audio_start_pts = av_rescale_q(start, AV_TIME_BASE_Q, session->audio_stream->time_base);
+        }
+        if (end != AV_NOPTS_VALUE) {
+            session->audio_end_pts = av_rescale_q(end, AV_TIME_BASE_Q, session->audio_stream->time_base);
+        }
+    }
+    
+    if (start == AV_NOPTS_VALUE || session->range_start == 0) {
+        return 0;
+    }
+    
+    // stream_index = -1 时时间戳单位为 AV_TIME_BASE  max_ts = start 保证落在起点之前的关键帧上
+    ret = avformat_seek_file(session->fmt_ctx, -1, INT64_MIN, start, start, 0);
+    if (ret < 0) {
+        fprintf(stderr, "Could not seek to %.3f s (%s), reading from the beginning\n", session->range_start / (double)AV_TIME_BASE, av_err2str(ret));
+        return ret;
+    }
+    
+    if (!session->quiet) {
+        printf("Seek to keyframe before %.3f s\n", session->range_start / (double)AV_TIME_BASE);
+    }
+    return 0;
+}
+
+/**
+ * 判断 packet 是否已经在截取区间结束点之后
+ * 按解码顺序 dts 单调递增且 pts >= dts  dts 到达结束点后该流后续所有帧的 pts 都不会早于结束点
+ * @param session                 DemuxSession Instance
+ * @param packet                  AVPacket Instance
+ * @return true: 丢弃该 packet  并标记对应的流已结束
+ */
+static bool packet_after_range(DemuxSession *session, AVPacket *packet) {
+    
+    int64_t timestamp = packet->dts != AV_NOPTS_VALUE ? packet->dts : packet->pts;
+    
+    if (packet->stream_index == session->video_stream_index) {
+        if (session->video_ended) {
+            return true;
+        }
+        if (session->video_end_pts != AV_NOPTS_VALUE && timestamp != AV_NOPTS_VALUE && timestamp >= session->video_end_pts) {
+            session->video_ended = true;
+            return true;
+        }
+    } else if (packet->stream_index == session->audio_stream_index) {
+        if (session->audio_ended) {
+            return true;
+        }
+        if (session->audio_end_pts != AV_NOPTS_VALUE && timestamp != AV_NOPTS_VALUE && timestamp >= session->audio_end_pts) {
+            session->audio_ended = true;
+            return true;
+        }
+    }
+    return false;
+}
+
+/**
+ * 判断解码后的帧是否在截取区间之外
+ * @param session                 DemuxSession Instance
+ * @param context                 解码器上下文
+ * @param frame                   解码后的 AVFrame
+ * @return true: 丢弃该帧
+ */
+static bool frame_out_of_range(DemuxSession *session, AVCodecContext *context, AVFrame *frame) {
+    
+    int64_t pts = frame->best_effort_timestamp;
+    int64_t start_pts = AV_NOPTS_VALUE, end_pts = AV_NOPTS_VALUE;
+    
+    if (pts == AV_NOPTS_VALUE) {
+        return false;
+    }
+    
+    if (context == session->video_dec_ctx) {
+        start_pts = session->video_start_pts;
+        end_pts = session->video_end_pts;
+    } else {
+        start_pts = session->audio_start_pts;
+        end_pts = session->audio_end_pts;
+    }
+    
+    // flush 解码器时可能吐出结束点之后的帧  一并丢弃
+    return (start_pts != AV_NOPTS_VALUE && pts < start_pts) || (end_pts != AV_NOPTS_VALUE && pts >= end_pts);
+}
+
 /**
  * Video Frame 写入本地文件
+ * @param session                 DemuxSession Instance
  * @param frame                   Video Frame
  * @return ret
  */
-static int output_video_frame(AVFrame *frame) {
-    
-    if (frame->width != video_width || frame->height != video_height || frame->format != pix_fmt) {
-        /* To handle this change, one could call av_image_alloc again and
-         * decode the following frames into another rawvideo file. */
-        fprintf(stderr, "Error: Width, height and pixel format have to be "
-                "constant in a rawvideo file, but the width, height or "
-                "pixel format of the input video changed:\n"
-                "old: width = %d, height = %d, format = %s\n"
-                "new: width = %d, height = %d, format = %s\n",
-                video_width, video_height, av_get_pix_fmt_name(pix_fmt),
-                frame->width, frame->height,
-                av_get_pix_fmt_name((AVPixelFormat)frame->format));
-        return -1;
+static int output_video_frame(DemuxSession *session, AVFrame *frame) {
+    
+    int ret = 0;
+    int fd = fileno(session->video_output_file);
+    int count = 0;
+    bool packed = true;
+    struct iovec iov[VIDEO_IOV_BATCH];
+    
+    // 分辨率或像素格式变化  rawvideo 文件中帧大小必须一致  切换到新的输出分段
+    if (frame->width != session->video_width || frame->height != session->video_height || frame->format != session->pix_fmt) {
+        if ((ret = rotate_video_segment(session, frame)) < 0) {
+            return ret;
+        }
+        fd = fileno(session->video_output_file);
+    }
+    
+    if (!session->quiet) {
+        printf("video_frame n:%d coded_n:%d\n", session->video_frame_count, frame->coded_picture_number);
+    }
+    session->video_frame_count++;
+    session->video_segment_frames++;
+    
+    // 调色板格式还要写 palette  仍然走 av_image_copy_to_buffer
+    if (session->video_dst_buffer) {
+        ret = av_image_copy_to_buffer(session->video_dst_buffer, session->video_dst_bufsize, (const uint8_t * const *)frame->data, frame->linesize,
+                                      session->pix_fmt, session->video_width, session->video_height, 1);
+        if (ret < 0) {
+            return ret;
+        }
+        iov[0].iov_base = session->video_dst_buffer;
+        iov[0].iov_len = session->video_dst_bufsize;
+        return write_iovec(fd, iov, 1);
+    }
+    
+    for (int i = 0; i < session->video_plane_count; i++) {
+        if (frame->linesize[i] != session->video_plane_linesize[i]) {
+            packed = false;
+            break;
+        }
+    }
+    
+    // 解码器输出的 linesize 已经是紧凑宽度  每个 plane 直接整块写出
+    if (packed) {
+        for (int i = 0; i < session->video_plane_count; i++) {
+            iov[i].iov_base = frame->data[i];
+            iov[i].iov_len = (size_t)session->video_plane_linesize[i] * session->video_plane_height[i];
+        }
+        return write_iovec(fd, iov, session->video_plane_count);
+    }
+    
+    // 有对齐填充  逐行跳过填充部分  攒满一批 iovec 写一次  不经过中间缓冲区
+    for (int i = 0; i < session->video_plane_count; i++) {
+        for (int y = 0; y < session->video_plane_height[i]; y++) {
+            iov[count].iov_base = frame->data[i] + (ptrdiff_t)y * frame->linesize[i];
+            iov[count].iov_len = session->video_plane_linesize[i];
+            if (++count == VIDEO_IOV_BATCH) {
+                if ((ret = write_iovec(fd, iov, count)) < 0) {
+                    return ret;
+                }
+                count = 0;
+            }
+        }
+    }
+    return count > 0 ? write_iovec(fd, iov, count) : 0;
+}
+
+/**
+ * 计算原始视频帧紧凑排列时每个 plane 的行长度和行数
+ * @param session                 DemuxSession Instance
+ * @param width                    视频宽
+ * @param height                   视频高
+ * @param pix_fmt                 像素格式
+ * @return ret
+ */
+static int init_video_layout(DemuxSession *session, int width, int height, enum AVPixelFormat pix_fmt) {
+    
+    int ret = 0;
+    const AVPixFmtDescriptor *desc = av_pix_fmt_desc_get(pix_fmt);
+    
+    if (!desc || (desc->flags & AV_PIX_FMT_FLAG_HWACCEL)) {
+        return AVERROR(EINVAL);
+    }
+    
+    if ((ret = av_image_fill_linesizes(session->video_plane_linesize, pix_fmt, width)) < 0) {
+        return ret;
+    }
+    
+    session->video_plane_count = 0;
+    for (int i = 0; i < 4 && session->video_plane_linesize[i] > 0; i++) {
+        // 色度 plane 行数按 log2_chroma_h 向上取整
+        bool chroma = (i == 1 || i == 2) && !(desc->flags & AV_PIX_FMT_FLAG_PAL);
+        session->video_plane_height[i] = chroma ? AV_CEIL_RSHIFT(height, desc->log2_chroma_h) : height;
+        session->video_plane_count++;
+    }
+    
+    session->video_dst_bufsize = av_image_get_buffer_size(pix_fmt, width, height, 1);
+    if (session->video_dst_bufsize < 0) {
+        return session->video_dst_bufsize;
+    }
+    
+    av_freep(&session->video_dst_buffer);
+    if (desc->flags & AV_PIX_FMT_FLAG_PAL) {
+        session->video_dst_buffer = (uint8_t *)av_malloc(session->video_dst_bufsize);
+        if (!session->video_dst_buffer) {
+            return AVERROR(ENOMEM);
+        }
+    }
+    
+    session->video_width = width;
+    session->video_height = height;
+    session->pix_fmt = pix_fmt;
+    return 0;
+}
+
+/**
+ * 视频分辨率或像素格式变化时切换到新的输出分段  output.yuv -> output_1.yuv、output_2.yuv ...
+ * 当前分段还没写入任何帧时直接沿用  只更新帧布局
+ * @param session                 DemuxSession Instance
+ * @param frame                   新格式的第一帧
+ * @return ret
+ */
+static int rotate_video_segment(DemuxSession *session, AVFrame *frame) {
+    
+    int ret = 0;
+    const char *url = session->video_output_url;
+    const char *ext = strrchr(url, '.');
+    const char *slash = strrchr(url, '/');
+    
+    if ((ret = init_video_layout(session, frame->width, frame->height, (AVPixelFormat)frame->format)) < 0) {
+        fprintf(stderr, "Could not get raw video layout for %dx%d %s\n", frame->width, frame->height, av_get_pix_fmt_name((AVPixelFormat)frame->format));
+        return ret;
     }
     
-    printf("video_frame n:%d coded_n:%d\n", video_frame_count++, frame->coded_picture_number);
-    /* copy decoded frame to destination buffer:
-     * this is required since rawvideo expects non aligned data */
-    av_image_copy(video_dst_data, video_dst_linesize, (const uint8_t **)(frame->data), frame->linesize, pix_fmt, video_width, video_height);
+    if (session->video_segment_frames == 0) {
+        return 0;
+    }
+    
+    if (!ext || (slash && ext < slash)) {
+        ext = url + strlen(url);
+    }
+    session->video_segment_index++;
+    session->video_segment_frames = 0;
+    snprintf(session->video_segment_url, sizeof(session->video_segment_url), "%.*s_%d%s", (int)(ext - url), url, session->video_segment_index, ext);
     
-    /* write to rawvideo file */
-    fwrite(video_dst_data[0], 1, video_dst_bufsize, video_output_file);
+    fclose(session->video_output_file);
+    session->video_output_file = fopen(session->video_segment_url, "wb+");
+    if (!session->video_output_file) {
+        fprintf(stderr, "Could not open destination file %s\n", session->video_segment_url);
+        return AVERROR(EIO);
+    }
+    
+    if (!session->quiet) {
+        printf("Video format changed to %dx%d %s, new segment: %s\n", session->video_width, session->video_height,
+               av_get_pix_fmt_name(session->pix_fmt), session->video_segment_url);
+    }
+    return 0;
+}
+
+/**
+ * writev 写完全部 iovec  处理部分写入和 EINTR
+ * @param fd                        输出文件描述符
+ * @param iov                       iovec 数组  部分写入时会被修改
+ * @param count                    iovec 数量
+ * @return ret
+ */
+static int write_iovec(int fd, struct iovec *iov, int count) {
+    
+    while (count > 0) {
+        ssize_t written = writev(fd, iov, count);
+        if (written < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            fprintf(stderr, "Could not write raw video frame (%s)\n", strerror(errno));
+            return AVERROR(errno);
+        }
+        
+        // 跳过已经写完的 iovec
+        while (count > 0 && (size_t)written >= iov->iov_len) {
+            written -= iov->iov_len;
+            iov++;
+            count--;
+        }
+        if (count > 0) {
+            iov->iov_base = (uint8_t *)iov->iov_base + written;
+            iov->iov_len -= written;
+        }
+    }
     return 0;
 }
 
 /**
  * Audio Frame 写入本地文件
+ * @param session                 DemuxSession Instance
  * @param frame                   Audio Frame
  * @return ret
  */
-static int output_audio_frame(AVFrame *frame) {
+static int output_audio_frame(DemuxSession *session, AVFrame *frame) {
     
-    printf("audio_frame n:%d nb_samples:%d pts:%s\n", audio_frame_count++, frame->nb_samples, av_ts2timestr(frame->pts, &audio_dec_ctx->time_base));
+    if (!session->quiet) {
+        printf("audio_frame n:%d nb_samples:%d pts:%s\n", session->audio_frame_count, frame->nb_samples, av_ts2timestr(frame->pts, &session->audio_dec_ctx->time_base));
+    }
+    session->audio_frame_count++;
     
     // 获取每个采样的字节大小
     int data_size = av_get_bytes_per_sample((AVSampleFormat)frame->format);
@@ -399,12 +1911,12 @@ static int output_audio_frame(AVFrame *frame) {
         // planer: 多个channel数据分开存储  frame->data[0]、frame->data[1]...
         for (int i = 0; i < frame->nb_samples; i++) {
             for (int j = 0; j < frame->channels; j++) {
-                fwrite(frame->data[j] + data_size * i, 1, data_size, audio_output_file);
+                fwrite(frame->data[j] + data_size * i, 1, data_size, session->audio_output_file);
             }
         }
     } else {
         // packed: 所有channel在frame->data[0]中交替存储
-        fwrite(frame->data[0], 1, data_size * frame->nb_samples * frame->channels, audio_output_file);
+        fwrite(frame->data[0], 1, data_size * frame->nb_samples * frame->channels, session->audio_output_file);
     }
     return 0;
 }
@@ -7,28 +7,28 @@
 
 /*
  FLV（Flash Video）是Adobe公司设计开发的一种流行的流媒体格式，由于其视频文件体积轻巧、封装简单等特点，使其很适合在互联网上进行应用。此外，FLV可以使用Flash Player进行播放，而Flash Player插件已经安装在全世界绝大部分浏览器上，这使得通过网页播放FLV视频十分容易。目前主流的视频网站如优酷网，土豆网，乐视网等网站无一例外地使用了FLV格式。FLV封装格式的文件后缀通常为“.flv”。
- 
+
  官方文档：https://rtmp.veriskope.com/pdf/video_file_format_spec_v10.pdf
 
  FLV包含两部分  FLV Header和FLV Body：
- 
+
   - FLV Header（9字节）：
     1.Signature（3字节） 文件表示  总为"FLV"（0x46, 0x4c, 0x56）
     2.Version（1字节） 版本号   目前为0x01
     3.Flags（1字节） 前5位保留  必须为0   第6位标识是否存在音频Tag   第7位保留  必须为0  第8位标识是否存在视频Tag
     4.Headersize（4字节） 从FLV Header开始到FLV Body开始的字节数  版本1中总是9
- 
+
   - FLV Body：由一系列Tag组成  每个Tag前面还包含一个Previous Tag Size字段（4字节）  表示前面一个Tag的大小
- 
+
  Tag包含两部分  Tag Header和Tag Data：
- 
+
   - Tag Header（11字节）：
     1.Type（1字节） 表示Tag类型  包括音频(0x08)  视频(0x09)和script data(0x12)
     2.Datasize（3字节） 表示该Tag Data部分的大小
     3.Timestamp（3字节） 表示该Tag的时间戳
     4.Timestamp_ex（1字节） 表示时间戳的扩展字节  当24位数值不够时  该字节作为最高位将时间戳扩展为32位数值
     5.StreamID（3字节） 表示stream id  总是0
- 
+
  - Tag Data  Tag数据部分  不同类型Tag的data部分结构各不相同
    Audio Tag：
     音频编码类型（4bit）+ 采样率（2bit）+ 采样精度（1bit）+ 声道类型（1bit）+ *data
@@ -49,37 +49,209 @@
         后面跟着为长度为L的字符串。
         第L+3个字节表示元素值的类型。
         后面跟着为对应值，占用字节数取决于值的类型。（0，Number ；1，Boolean；2，String........8，ECMA array........）
-    * 由于Script Tag的metadata涉及多种数据格式，这里暂不做解析
+    AMF0 值类型：0x00 Number(8字节double)  0x01 Boolean(1字节)  0x02 String(2字节长度+数据)  0x03 Object(名称值对  以0x000009结束)
+               0x05 Null  0x06 Undefined  0x07 Reference(2字节)  0x08 ECMA Array(4字节个数+名称值对  以0x000009结束)
+               0x0A Strict Array(4字节个数+值)  0x0B Date(8字节double毫秒+2字节时区)  0x0C Long String(4字节长度+数据)
+    onMetaData 解析为扁平的键值表  嵌套对象的键用'.'连接  如 keyframes.times
+    很多封装器会在 keyframes.filepositions / keyframes.times 中写入每个关键帧的文件偏移和时间  有这两个数组时查找关键帧不需要遍历全部Tag
  */
 
 #include "FLVMediainfo.h"
 #include <getopt.h>
+#include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#if defined(__linux__)
+#include <poll.h>
+#include <sys/inotify.h>
+#else
+#include <sys/event.h>
+#endif
 
 #define TAG_TYPE_AUDIO  0x08
 #define TAG_TYPE_VIDEO  0x09
 #define TAG_TYPE_SCRIPT 0x12
 
-#pragma pack(1)
+#define FLV_HEADER_SIZE             9                // FLV Header 长度
+#define FLV_TAG_HEADER_SIZE         11               // Tag Header 长度
+#define FLV_PREVIOUS_TAG_SIZE       4                // Previous Tag Size 字段长度
+#define FLV_MAX_GAP_EVENTS          16               // summary 中最多记录的时间戳断档个数
+#define FLV_GAP_THRESHOLD_MS        1000             // 同类型相邻 tag 时间戳差超过该值视为断档
+#define FLV_KEYFRAME_BIN_MS         500              // 关键帧间隔直方图每个区间的时间跨度
+#define FLV_KEYFRAME_BINS           21               // 关键帧间隔直方图区间个数  最后一个区间统计 >= 10s
+#define FLV_BITRATE_WINDOWS         20               // 未指定窗口大小时  码率曲线按时长分成的窗口个数
+#define FLV_AMF_MAX_ENTRIES         128              // onMetaData 键值表最多保存的条目数
+#define FLV_AMF_MAX_KEY             64               // 键的最大长度  含嵌套路径
+#define FLV_AMF_MAX_DEPTH           8                // 对象/数组最大嵌套层数
+
+#define FLV_IOV_BATCH               512              // 提取基本流时每次 writev 的 iovec 数量
+#define FLV_MAX_PARAMETER_SETS      32               // AVCDecoderConfigurationRecord 中最多保存的 SPS/PPS 个数
+#define ADTS_HEADER_SIZE            7                // 无crc校验时的 ADTS header 长度
+#define FLV_FOLLOW_INTERVAL_MS      1000             // follow 模式两次解析之间的最小间隔  写入很碎时合并成一批处理
+
+#define AMF0_NUMBER                 0x00
+#define AMF0_BOOLEAN                0x01
+#define AMF0_STRING                 0x02
+#define AMF0_OBJECT                 0x03
+#define AMF0_NULL                   0x05
+#define AMF0_UNDEFINED              0x06
+#define AMF0_REFERENCE              0x07
+#define AMF0_ECMA_ARRAY             0x08
+#define AMF0_OBJECT_END             0x09
+#define AMF0_STRICT_ARRAY           0x0A
+#define AMF0_DATE                   0x0B
+#define AMF0_LONG_STRING            0x0C
+
+#define FLV_RB24(p) (((uint32_t)(p)[0] << 16) | ((uint32_t)(p)[1] << 8) | (uint32_t)(p)[2])
+#define FLV_RB32(p) (((uint32_t)(p)[0] << 24) | ((uint32_t)(p)[1] << 16) | ((uint32_t)(p)[2] << 8) | (uint32_t)(p)[3])
+#define FLV_MIN(a, b) ((a) < (b) ? (a) : (b))
+
+// Tag 索引项  16字节  多小时的录制文件也只占几十MB
+typedef struct {
+    uint64_t offset;                    // Tag Header 在文件中的偏移
+    uint32_t timestamp;                 // Timestamp_ex 扩展后的32位时间戳  单位ms
+    uint32_t data_size : 24;            // Tag Data 长度
+    uint32_t type : 5;                  // Tag 类型
+    uint32_t keyframe : 1;              // 视频关键帧
+    uint32_t sequence_header : 1;       // AVC/AAC 序列头  不是实际的音视频帧
+    uint32_t reserved : 1;
+} FLV_TAG;
+
+typedef struct {
+    FLV_TAG *tags;
+    size_t count;
+    size_t capacity;
+} FLV_TAG_INDEX;
+
+typedef struct {
+    uint64_t offset;                    // 断档后第一个 tag 的偏移
+    uint8_t type;                       // tag 类型
+    uint32_t previous;                  // 上一个同类型 tag 的时间戳
+    uint32_t timestamp;                 // 当前 tag 的时间戳
+} FLV_GAP_EVENT;
+
+// onMetaData 中的一个值  字符串和数组直接指向映射内存  解析过程不分配内存
 typedef struct {
-    uint8_t signature[3];
-    uint8_t version;
-    uint8_t flags;
-    uint32_t header_size;
-} FLV_HEADER;
+    char key[FLV_AMF_MAX_KEY];          // 键  嵌套对象用'.'连接
+    uint8_t type;                       // AMF0 类型
+    bool number_array;                  // Strict Array 的元素全部是 Number  可以按下标直接读取
+    int16_t timezone;                   // Date 时区
+    double number;                      // Number / Boolean / Date(ms) / Reference
+    const uint8_t *data;                // String: 字符串数据  Strict Array: 第一个元素
+    uint32_t length;                    // String: 字符串长度  Strict Array: 元素个数
+} AMF_ENTRY;
 
-#pragma pack(1)
 typedef struct {
-    uint8_t type;
-    uint8_t data_size[3];
-    uint8_t timestamp[3];
-    uint8_t timestamp_ex;
-    uint8_t streamID[3];
-} TAG_HEADER;
+    AMF_ENTRY entries[FLV_AMF_MAX_ENTRIES];
+    int count;
+    int dropped;                        // 超出表容量被丢弃的条目数
+} AMF_TABLE;
 
-static void parse(char *url);
-static uint32_t reverse_bytes(uint8_t *p, size_t c);
+// 基本流输出  iovec 直接指向映射内存  攒满一批再 writev
+typedef struct {
+    int fd;
+    struct iovec iov[FLV_IOV_BATCH];
+    int iov_count;
+    uint8_t headers[FLV_IOV_BATCH][ADTS_HEADER_SIZE];   // ADTS 头不在文件中  放在预分配的槽位里
+    int header_count;
+    uint64_t bytes;                     // 已写入字节数
+    uint64_t units;                     // 已写入的 NALU / AAC 帧个数
+} FLV_ES_WRITER;
+
+// 提取 H.264/AAC 基本流需要的序列头信息
+typedef struct {
+    int nal_length_size;                // NALU 长度前缀字节数  0表示还没有收到 AVCDecoderConfigurationRecord
+    int parameter_set_count;
+    const uint8_t *parameter_sets[FLV_MAX_PARAMETER_SETS];  // SPS/PPS  指向映射内存
+    uint16_t parameter_set_sizes[FLV_MAX_PARAMETER_SETS];
+    int aac_profile;                    // ADTS profile  <0表示还没有收到 AudioSpecificConfig
+    int aac_sample_index;
+    int aac_channels;
+    uint64_t skipped_tags;              // 非 AVC/AAC 或序列头之前的 Tag
+    uint64_t broken_tags;               // 数据不完整的 Tag
+} FLV_ES_CONTEXT;
+
+// follow 模式下跟踪文件追加  Linux 使用 inotify  macOS 使用 kqueue
+typedef struct {
+    int fd;                             // 被跟踪的文件
+    int notify_fd;                      // inotify / kqueue 描述符
+    int watch;                          // inotify watch 描述符
+} FLV_FOLLOWER;
+
+// follow 模式的累计统计  每批新增 Tag 与上一批的差值即为增量
+typedef struct {
+    uint64_t tags[4];                   // audio / video / script / other
+    uint64_t bytes[4];
+    uint64_t keyframes;
+    uint64_t gaps;
+    uint32_t first_timestamp, last_timestamp;   // 音视频 Tag 时间戳范围
+    bool has_timestamp;
+    uint32_t last_type_timestamp[2];    // 音频 / 视频上一个 Tag 的时间戳
+    bool has_last[2];
+} FLV_FOLLOW_STATS;
+
+static volatile sig_atomic_t follow_stopped = 0;
+
+static const uint8_t annexb_start_code[4] = {0x00, 0x00, 0x00, 0x01};
+
+static const char *audio_format_names[16] = {
+    "Linear PCM, platform endian", "ADPCM", "MP3", "Linear PCM, little endian",
+    "Nellymoser 16-kHz mono", "Nellymoser 8-kHz mono", "Nellymoser", "G.711 A-law logarithmic PCM",
+    "G.711 mu-law logarithmic PCM", "reserved", "AAC", "Speex",
+    "UNKNOWN", "UNKNOWN", "MP3 8-Khz", "Device-specific sound"
+};
+static const char *audio_rate_names[4] = {"5.5-kHz", "11-kHz", "22-kHz", "44-kHz"};
+static const char *audio_size_names[2] = {"8Bit", "16Bit"};
+static const char *audio_channel_names[2] = {"Mono", "Stereo"};
+static const char *video_frame_type_names[16] = {
+    "UNKNOWN", "key frame", "inter frame", "disposable inter frame", "generated keyframe", "video info/command frame",
+    "UNKNOWN", "UNKNOWN", "UNKNOWN", "UNKNOWN", "UNKNOWN", "UNKNOWN", "UNKNOWN", "UNKNOWN", "UNKNOWN", "UNKNOWN"
+};
+static const char *video_codec_names[16] = {
+    "UNKNOWN", "JPEG (currently unused)", "Sorenson H.263", "Screen video", "On2 VP6", "On2 VP6 with alpha channel",
+    "Screen video version 2", "AVC", "UNKNOWN", "UNKNOWN", "UNKNOWN", "UNKNOWN", "UNKNOWN", "UNKNOWN", "UNKNOWN", "UNKNOWN"
+};
+
+static void parse(char *url, bool summary, double window, double lookup_time);
+static int map_input_file(const char *url, const uint8_t **data, size_t *size);
+static int check_flv_header(const uint8_t *data, size_t size, uint64_t *body_offset);
+static int walk_flv_tags(const uint8_t *data, size_t size, uint64_t *pos, FLV_TAG_INDEX *index);
+static int append_flv_tag(FLV_TAG_INDEX *index, const FLV_TAG *tag);
+static void free_flv_tag_index(FLV_TAG_INDEX *index);
+static const char *get_tag_type_name(uint8_t type);
+static void print_tag_table(const uint8_t *data, const FLV_TAG_INDEX *index);
+static void print_flv_summary(const uint8_t *data, const FLV_TAG_INDEX *index, size_t file_size, uint64_t tail_bytes, double window, double elapsed);
+static double get_time_seconds(void);
+static int decode_script_tag(const uint8_t *data, const FLV_TAG *tag, char *name, size_t name_size, AMF_TABLE *table);
+static int64_t decode_amf0_value(const uint8_t *p, const uint8_t *end, const char *key, AMF_TABLE *table, int depth);
+static int64_t decode_amf0_pairs(const uint8_t *p, const uint8_t *end, const char *prefix, AMF_TABLE *table, int depth);
+static AMF_ENTRY *add_amf_entry(AMF_TABLE *table, const char *key, uint8_t type);
+static const AMF_ENTRY *find_amf_entry(const AMF_TABLE *table, const char *key);
+static double get_amf_array_number(const AMF_ENTRY *entry, uint32_t i);
+static void print_amf_table(const AMF_TABLE *table, const char *indent);
+static void lookup_keyframe(const uint8_t *data, size_t size, uint64_t body_offset, double time);
+static void extract(char *url, const char *video_url, const char *audio_url);
+static int parse_avc_decoder_configuration(const uint8_t *p, uint32_t size, FLV_ES_CONTEXT *context);
+static int parse_aac_audio_specific_config(const uint8_t *p, uint32_t size, FLV_ES_CONTEXT *context);
+static int extract_video_tag(const uint8_t *payload, uint32_t size, FLV_ES_CONTEXT *context, FLV_ES_WRITER *writer);
+static int extract_audio_tag(const uint8_t *payload, uint32_t size, FLV_ES_CONTEXT *context, FLV_ES_WRITER *writer);
+static int push_iovec(FLV_ES_WRITER *writer, const void *base, size_t length);
+static int flush_writer(FLV_ES_WRITER *writer);
+static void follow(char *url);
+static void update_follow_stats(FLV_FOLLOW_STATS *stats, const FLV_TAG *tag);
+static void print_follow_stats(const FLV_FOLLOW_STATS *stats, const FLV_FOLLOW_STATS *last, double wall_time, double wall_elapsed);
+static int open_follower(FLV_FOLLOWER *follower, const char *url);
+static int wait_follower(FLV_FOLLOWER *follower, int timeout_ms);
+static void close_follower(FLV_FOLLOWER *follower);
+static void on_follow_signal(int signal);
 
 static struct option tool_long_options[] = {
     {"help", no_argument, NULL, '`'}
@@ -94,9 +266,19 @@ static void show_module_help() {
     printf("\n");
     printf("Param:\n\n");
     printf("  -i:   Input File Local Path\n");
+    printf("  -s:   Summary Mode, Print Tag Counts / A/V Bitrate Over Time / Keyframe Interval Histogram / Timestamp Gaps\n");
+    printf("  -w:   Summary Bitrate Window In Seconds, Default Duration / %d\n", FLV_BITRATE_WINDOWS);
+    printf("  -k:   Find The Keyframe At Or Before The Given Second, Use onMetaData keyframes When Present\n");
+    printf("  -v:   Extract H.264 To AnnexB Elementary Stream File\n");
+    printf("  -a:   Extract AAC To ADTS Elementary Stream File\n");
+    printf("  -f:   Follow Mode, Keep Parsing Tags Appended To A Growing File And Print Incremental Stats, Ctrl+C To Stop\n");
     printf("\n");
     printf("Usage:\n\n");
-    printf("  AVTools FLVMediainfo -i input.flv\n\n");
+    printf("  AVTools FLVMediainfo -i input.flv\n");
+    printf("  AVTools FLVMediainfo -i input.flv -s -w 60\n");
+    printf("  AVTools FLVMediainfo -i input.flv -k 3600\n");
+    printf("  AVTools FLVMediainfo -i input.flv -v output.h264 -a output.aac\n");
+    printf("  AVTools FLVMediainfo -i recording.flv -f\n\n");
     printf("Get FLV With FFMpeg From Mp4 File:\n\n");
     printf("   ffmpeg -i video.mp4 -c copy -f flv input.flv\n");
 }
@@ -109,8 +291,14 @@ static void show_module_help() {
 void flv_mediainfo_parse_cmd(int argc, char *argv[]) {
     int option = 0;   // getopt_long的返回值，返回匹配到字符的ascii码，没有匹配到可读参数时返回-1
     char *url = NULL;   // 输入文件路径
+    bool summary = false;   // 是否只输出统计信息
+    double window = 0;   // 码率统计窗口  单位s  0表示自动
+    double lookup_time = -1;   // 查找关键帧的时间  单位s  <0表示不查找
+    char *video_url = NULL;   // H.264 输出路径
+    char *audio_url = NULL;   // AAC 输出路径
+    bool follow_mode = false;   // 是否跟踪文件追加
     
-    while (EOF != (option = getopt_long(argc, argv, "i:", tool_long_options, NULL))) {
+    while (EOF != (option = getopt_long(argc, argv, "i:sw:k:v:a:f", tool_long_options, NULL))) {
         switch (option) {
             case '`':
                 show_module_help();
@@ -119,6 +307,27 @@ void flv_mediainfo_parse_cmd(int argc, char *argv[]) {
             case 'i':
                 url = optarg;
                 break;
+            case 's':
+                summary = true;
+                break;
+            case 'w':
+                window = atof(optarg);
+                break;
+            case 'k':
+                lookup_time = atof(optarg);
+                if (lookup_time < 0) {
+                    lookup_time = 0;
+                }
+                break;
+            case 'v':
+                video_url = optarg;
+                break;
+            case 'a':
+                audio_url = optarg;
+                break;
+            case 'f':
+                follow_mode = true;
+                break;
             case '?':
                 printf("Use 'AVTools %s --help' To Show Detail Usage.\n", argv[1]);
                 return;
@@ -128,210 +337,1591 @@ void flv_mediainfo_parse_cmd(int argc, char *argv[]) {
         }
     }
     
-    if (NULL == url) {
+    if (NULL == url || window < 0) {
         printf("FLVMediaInfo Param Error, Use 'AVTools %s --help' To Show Detail Usage.\n", argv[1]);
         return;
     }
     
-    parse(url);
+    if (video_url || audio_url) {
+        extract(url, video_url, audio_url);
+        return;
+    }
+    
+    if (follow_mode) {
+        follow(url);
+        return;
+    }
+    
+    parse(url, summary, window, lookup_time);
 }
 
 /**
  * Start Parse
- * @param url     flv file path
+ * @param url            flv file path
+ * @param summary      true: 只输出统计信息  false: 逐个输出 Tag
+ * @param window       summary 码率统计窗口  单位s  0表示自动
+ * @param lookup_time  查找该时间之前的关键帧  单位s  <0表示不查找
  */
-static void parse(char *url) {
+static void parse(char *url, bool summary, double window, double lookup_time) {
     
-    FILE *input_file = NULL;
     FILE *myout = stdout;
+    const uint8_t *data = NULL;
+    size_t size = 0;
+    uint64_t pos = 0;
+    uint64_t tail_bytes = 0;
+    FLV_TAG_INDEX index = {};
+    double start_time = 0;
+    
+    // 映射输入文件  只顺序访问一遍 Tag Header  Tag Data 按需访问
+    if (map_input_file(url, &data, &size) < 0) {
+        return;
+    }
+    
+    if (check_flv_header(data, size, &pos) < 0) {
+        printf("Not A FLV File.\n");
+        goto __FAIL;
+    }
     
-    FLV_HEADER flv_header = {};
-    TAG_HEADER tag_header = {};
+    if (lookup_time >= 0) {
+        lookup_keyframe(data, size, pos, lookup_time);
+        goto __FAIL;
+    }
     
-    uint32_t previous_tag_size = 0;
+    if (!summary) {
+        fprintf(myout,"============== FLV Header ==============\n");
+        fprintf(myout,"Signature:  %c %c %c\n", data[0], data[1], data[2]);
+        fprintf(myout,"Version:    0x %X\n", data[3]);
+        fprintf(myout,"Flags  :    0x %X\n", data[4]);
+        fprintf(myout,"HeaderSize: 0x %X\n", FLV_RB32(data + 5));
+        fprintf(myout,"========================================\n");
+    }
     
-    input_file = fopen(url, "rb");
-    if (!input_file) {
-        printf("Failed to open input file!");
+    // 建立 Tag 索引
+    start_time = get_time_seconds();
+    if (walk_flv_tags(data, size, &pos, &index) < 0) {
+        printf("Alloc FLV Tag Index Error.\n");
         goto __FAIL;
     }
     
-    // 读取flv header
-    fread((char *)&flv_header, 1, sizeof(FLV_HEADER), input_file);
+    // 最后一个 Tag 之后只剩 Previous Tag Size 属于正常结尾
+    tail_bytes = size - pos == FLV_PREVIOUS_TAG_SIZE ? 0 : size - pos;
+    
+    if (summary) {
+        print_flv_summary(data, &index, size, tail_bytes, window, get_time_seconds() - start_time);
+    } else {
+        print_tag_table(data, &index);
+        if (tail_bytes > 0) {
+            fprintf(myout, "Incomplete tail: %llu bytes\n", (unsigned long long)tail_bytes);
+        }
+    }
+    
+__FAIL:
+    free_flv_tag_index(&index);
+    
+    if (data) {
+        munmap((void *)data, size);
+    }
+}
+
+/**
+ * 只读映射输入文件
+ * @param url          file path
+ * @param data        输出映射地址
+ * @param size         输出文件大小
+ * @return 0: success  -1: failed
+ */
+static int map_input_file(const char *url, const uint8_t **data, size_t *size) {
+    
+    struct stat st = {};
+    void *addr = NULL;
+    int fd = open(url, O_RDONLY);
+    
+    if (fd < 0) {
+        printf("Failed to open input file!\n");
+        return -1;
+    }
+    
+    if (fstat(fd, &st) < 0 || st.st_size == 0) {
+        printf("Empty Or Unreadable File.\n");
+        close(fd);
+        return -1;
+    }
+    
+    addr = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    // 映射建立后 fd 可以直接关闭
+    close(fd);
+    if (addr == MAP_FAILED) {
+        printf("Map File Error.\n");
+        return -1;
+    }
+    
+    // 顺序扫描  提示内核加大预读
+    madvise(addr, (size_t)st.st_size, MADV_SEQUENTIAL);
+    
+    *data = (const uint8_t *)addr;
+    *size = (size_t)st.st_size;
+    return 0;
+}
+
+/**
+ * 检查 FLV Header
+ * @param data                    文件数据
+ * @param size                     文件大小
+ * @param body_offset          输出 FLV Body 起始偏移  即第一个 Previous Tag Size 的位置
+ * @return 0: success  -1: 不是 FLV 文件
+ */
+static int check_flv_header(const uint8_t *data, size_t size, uint64_t *body_offset) {
+    
+    uint32_t header_size = 0;
+    
+    if (size < FLV_HEADER_SIZE || data[0] != 'F' || data[1] != 'L' || data[2] != 'V') {
+        return -1;
+    }
+    
+    header_size = FLV_RB32(data + 5);
+    if (header_size < FLV_HEADER_SIZE || header_size > size) {
+        return -1;
+    }
     
-    fprintf(myout,"============== FLV Header ==============\n");
-    fprintf(myout,"Signature:  %c %c %c\n", flv_header.signature[0], flv_header.signature[1], flv_header.signature[2]);
-    fprintf(myout,"Version:    0x %X\n", flv_header.version);
-    fprintf(myout,"Flags  :    0x %X\n", flv_header.flags);
-    fprintf(myout,"HeaderSize: 0x %X\n", reverse_bytes((uint8_t *)&flv_header.header_size, sizeof(flv_header.header_size)));
-    fprintf(myout,"========================================\n");
+    *body_offset = header_size;
+    return 0;
+}
+
+/**
+ * 从 pos 开始遍历完整的 Tag  追加到索引中
+ * 只读取每个 Tag 的 Header 和 Data 的前两个字节  不完整的 Tag 留给下一次调用
+ * @param data                    文件数据
+ * @param size                     文件大小
+ * @param pos                      输入输出  下一个 Previous Tag Size 的偏移
+ * @param index                   FLV_TAG_INDEX Instance
+ * @return 追加的 Tag 个数  -1: 内存不足
+ */
+static int walk_flv_tags(const uint8_t *data, size_t size, uint64_t *pos, FLV_TAG_INDEX *index) {
     
-    // 移动指针到header_size之后
-    fseek(input_file, reverse_bytes((uint8_t *)&flv_header.header_size, sizeof(flv_header.header_size)), SEEK_SET);
+    int count = 0;
+    uint64_t offset = *pos;
     
-    do {
-        // getw()函数用于从流中取得整数，其原型如下： int getw(FILE *stream); ... 【返回值】该函数返回从流中读取的整数。 如果文件结束或出错，则返回EOF。
-        // 读取前一个tag大小  4字节
-        previous_tag_size = getw(input_file);
+    while (offset + FLV_PREVIOUS_TAG_SIZE + FLV_TAG_HEADER_SIZE <= size) {
+        const uint8_t *header = data + offset + FLV_PREVIOUS_TAG_SIZE;
+        uint32_t data_size = FLV_RB24(header + 1);
+        uint64_t end = offset + FLV_PREVIOUS_TAG_SIZE + FLV_TAG_HEADER_SIZE + data_size;
+        const uint8_t *payload = header + FLV_TAG_HEADER_SIZE;
+        FLV_TAG tag = {};
+        
+        if (end > size) {
+            break;
+        }
         
-        // 读取tag header
-        fread((char *)&tag_header, 1, sizeof(TAG_HEADER), input_file);
+        tag.offset = offset + FLV_PREVIOUS_TAG_SIZE;
+        // 高3位是保留位和 Filter 标识
+        tag.type = header[0] & 0x1F;
+        tag.data_size = data_size;
+        tag.timestamp = FLV_RB24(header + 4) | ((uint32_t)header[7] << 24);
         
-        uint32_t tag_header_data_size = reverse_bytes(&tag_header.data_size[0], sizeof(tag_header.data_size));
-        uint32_t tag_header_timestamp = reverse_bytes(&tag_header.timestamp[0], sizeof(tag_header.timestamp));
+        if (tag.type == TAG_TYPE_VIDEO && data_size >= 1) {
+            tag.keyframe = (payload[0] >> 4) == 1;
+            // AVC: AVCPacketType 0 表示 AVCDecoderConfigurationRecord
+            tag.sequence_header = (payload[0] & 0x0F) == 7 && data_size >= 2 && payload[1] == 0;
+        } else if (tag.type == TAG_TYPE_AUDIO && data_size >= 2) {
+            // AAC: AACPacketType 0 表示 AudioSpecificConfig
+            tag.sequence_header = (payload[0] >> 4) == 10 && payload[1] == 0;
+        }
         
-        char tag_type_str[10];
-        switch (tag_header.type) {
-            case TAG_TYPE_AUDIO: sprintf(tag_type_str,"AUDIO"); break;
-            case TAG_TYPE_VIDEO: sprintf(tag_type_str,"VIDEO"); break;
-            case TAG_TYPE_SCRIPT: sprintf(tag_type_str,"SCRIPT"); break;
-            default: sprintf(tag_type_str,"UNKNOWN"); break;
+        if (append_flv_tag(index, &tag) < 0) {
+            *pos = offset;
+            return -1;
+        }
+        count++;
+        offset = end;
+    }
+    
+    *pos = offset;
+    return count;
+}
+
+/**
+ * 索引追加一个 Tag  容量不足时倍增
+ * @param index               FLV_TAG_INDEX Instance
+ * @param tag                  Tag 索引项
+ * @return 0: success  -1: failed
+ */
+static int append_flv_tag(FLV_TAG_INDEX *index, const FLV_TAG *tag) {
+    
+    if (index->count == index->capacity) {
+        size_t capacity = index->capacity ? index->capacity * 2 : 4096;
+        FLV_TAG *tags = (FLV_TAG *)realloc(index->tags, capacity * sizeof(FLV_TAG));
+        if (tags == NULL) {
+            return -1;
         }
+        index->tags = tags;
+        index->capacity = capacity;
+    }
+    
+    index->tags[index->count++] = *tag;
+    return 0;
+}
+
+/**
+ * 释放 Tag 索引
+ * @param index               FLV_TAG_INDEX Instance
+ */
+static void free_flv_tag_index(FLV_TAG_INDEX *index) {
+    
+    if (index->tags) {
+        free(index->tags);
+    }
+    index->tags = NULL;
+    index->count = 0;
+    index->capacity = 0;
+}
+
+/**
+ * Tag 类型名称
+ * @param type                Tag 类型
+ * @return 名称
+ */
+static const char *get_tag_type_name(uint8_t type) {
+    
+    switch (type) {
+        case TAG_TYPE_AUDIO: return "AUDIO";
+        case TAG_TYPE_VIDEO: return "VIDEO";
+        case TAG_TYPE_SCRIPT: return "SCRIPT";
+        default: return "UNKNOWN";
+    }
+}
+
+/**
+ * 逐个输出 Tag
+ * @param data                文件数据
+ * @param index               FLV_TAG_INDEX Instance
+ */
+static void print_tag_table(const uint8_t *data, const FLV_TAG_INDEX *index) {
+    
+    FILE *myout = stdout;
+    
+    for (size_t i = 0; i < index->count; i++) {
+        const FLV_TAG *tag = &index->tags[i];
+        const uint8_t *payload = data + tag->offset + FLV_TAG_HEADER_SIZE;
         
-        if (feof(input_file)) break;
+        fprintf(myout,"[%6s] %6d %6d |", get_tag_type_name(tag->type), tag->data_size, tag->timestamp);
         
-        fprintf(myout,"[%6s] %6d %6d |", tag_type_str, tag_header_data_size,tag_header_timestamp);
+        if (tag->type == TAG_TYPE_AUDIO && tag->data_size >= 1) {
+            // 音频编码类型（4bit）+ 采样率（2bit）+ 采样精度（1bit）+ 声道类型（1bit）
+            fprintf(myout, "| %s| %s| %s| %s", audio_format_names[payload[0] >> 4], audio_rate_names[(payload[0] >> 2) & 0x03],
+                    audio_size_names[(payload[0] >> 1) & 0x01], audio_channel_names[payload[0] & 0x01]);
+        } else if (tag->type == TAG_TYPE_VIDEO && tag->data_size >= 1) {
+            // 视频帧类型（4bit）+ 视频编码类型（4bit）
+            fprintf(myout, "| %s| %s", video_frame_type_names[payload[0] >> 4], video_codec_names[payload[0] & 0x0F]);
+        } else if (tag->type == TAG_TYPE_SCRIPT) {
+            // Script Tag 较少  在栈上解析  不影响音视频 Tag 的输出速度
+            AMF_TABLE table;
+            char name[FLV_AMF_MAX_KEY];
+            if (decode_script_tag(data, tag, name, sizeof(name), &table) == 0) {
+                fprintf(myout, "| %s\n", name);
+                print_amf_table(&table, "           ");
+                continue;
+            }
+        }
         
-        // 读取tag data header
-        switch (tag_header.type) {
-            case TAG_TYPE_AUDIO:
-            {
-                uint8_t audio_data_first_byte = fgetc(input_file);
-                uint32_t x = 0;
-                char audio_tag_str[100] = {0};
-                
-                // 读取音频编码类型（4bit）
-                strcat(audio_tag_str, "| ");
-                x = audio_data_first_byte & 0xF0;
-                x = x >> 4;
-                switch (x) {
-                    case 0: strcat(audio_tag_str,"Linear PCM, platform endian"); break;
-                    case 1: strcat(audio_tag_str,"ADPCM"); break;
-                    case 2: strcat(audio_tag_str,"MP3"); break;
-                    case 3: strcat(audio_tag_str,"Linear PCM, little endian"); break;
-                    case 4: strcat(audio_tag_str,"Nellymoser 16-kHz mono"); break;
-                    case 5: strcat(audio_tag_str,"Nellymoser 8-kHz mono"); break;
-                    case 6: strcat(audio_tag_str,"Nellymoser"); break;
-                    case 7: strcat(audio_tag_str,"G.711 A-law logarithmic PCM"); break;
-                    case 8: strcat(audio_tag_str,"G.711 mu-law logarithmic PCM"); break;
-                    case 9: strcat(audio_tag_str,"reserved"); break;
-                    case 10: strcat(audio_tag_str,"AAC"); break;
-                    case 11: strcat(audio_tag_str,"Speex"); break;
-                    case 14: strcat(audio_tag_str,"MP3 8-Khz"); break;
-                    case 15: strcat(audio_tag_str,"Device-specific sound"); break;
-                    default: strcat(audio_tag_str,"UNKNOWN"); break;
-                }
-                
-                // 读取音频采样率（2bit）
-                strcat(audio_tag_str, "| ");
-                x = audio_data_first_byte & 0x0C;
-                x = x >> 2;
-                switch (x) {
-                    case 0: strcat(audio_tag_str,"5.5-kHz"); break;
-                    case 1: strcat(audio_tag_str,"1-kHz"); break;
-                    case 2: strcat(audio_tag_str,"22-kHz"); break;
-                    case 3: strcat(audio_tag_str,"44-kHz"); break;
-                    default: strcat(audio_tag_str,"UNKNOWN"); break;
+        fprintf(myout,"\n");
+    }
+}
+
+/**
+ * 输出统计信息
+ * @param data                文件数据
+ * @param index               FLV_TAG_INDEX Instance
+ * @param file_size          input file size
+ * @param tail_bytes        文件末尾不完整 Tag 的字节数
+ * @param window             码率统计窗口  单位s  0表示自动
+ * @param elapsed           扫描耗时  单位s
+ */
+static void print_flv_summary(const uint8_t *data, const FLV_TAG_INDEX *index, size_t file_size, uint64_t tail_bytes, double window, double elapsed) {
+    
+    FILE *myout = stdout;
+    uint64_t tag_counts[4] = {0};           // audio / video / script / other
+    uint64_t tag_bytes[4] = {0};
+    uint32_t min_timestamp = UINT32_MAX, max_timestamp = 0;
+    uint64_t window_ms = 0;
+    size_t window_count = 0;
+    uint64_t *audio_window_bytes = NULL, *video_window_bytes = NULL;
+    uint64_t keyframe_histogram[FLV_KEYFRAME_BINS] = {0};
+    uint64_t keyframe_count = 0, keyframe_intervals = 0, keyframe_interval_sum = 0;
+    uint32_t min_interval = UINT32_MAX, max_interval = 0;
+    uint32_t last_keyframe = 0;
+    FLV_GAP_EVENT gap_events[FLV_MAX_GAP_EVENTS];
+    uint64_t gap_count = 0;
+    uint32_t last_timestamp[2] = {0};
+    bool has_last[2] = {false, false};
+    double duration = 0;
+    
+    if (index->count == 0) {
+        fprintf(myout, "No FLV Tag Found.\n");
+        return;
+    }
+    
+    // 第一遍  Tag 计数、时间范围、关键帧间隔、时间戳断档
+    for (size_t i = 0; i < index->count; i++) {
+        const FLV_TAG *tag = &index->tags[i];
+        int slot = tag->type == TAG_TYPE_AUDIO ? 0 : tag->type == TAG_TYPE_VIDEO ? 1 : tag->type == TAG_TYPE_SCRIPT ? 2 : 3;
+        
+        tag_counts[slot]++;
+        tag_bytes[slot] += tag->data_size;
+        if (slot > 1 || tag->sequence_header) {
+            continue;
+        }
+        
+        if (tag->timestamp < min_timestamp) {
+            min_timestamp = tag->timestamp;
+        }
+        if (tag->timestamp > max_timestamp) {
+            max_timestamp = tag->timestamp;
+        }
+        
+        // 同类型相邻 tag 时间戳回退或跳变过大
+        if (has_last[slot] && (tag->timestamp < last_timestamp[slot] || tag->timestamp - last_timestamp[slot] > FLV_GAP_THRESHOLD_MS)) {
+            if (gap_count < FLV_MAX_GAP_EVENTS) {
+                gap_events[gap_count].offset = tag->offset;
+                gap_events[gap_count].type = tag->type;
+                gap_events[gap_count].previous = last_timestamp[slot];
+                gap_events[gap_count].timestamp = tag->timestamp;
+            }
+            gap_count++;
+        }
+        last_timestamp[slot] = tag->timestamp;
+        has_last[slot] = true;
+        
+        if (tag->keyframe) {
+            if (keyframe_count > 0 && tag->timestamp >= last_keyframe) {
+                uint32_t interval = tag->timestamp - last_keyframe;
+                int bin = interval / FLV_KEYFRAME_BIN_MS;
+                keyframe_histogram[bin < FLV_KEYFRAME_BINS ? bin : FLV_KEYFRAME_BINS - 1]++;
+                keyframe_interval_sum += interval;
+                keyframe_intervals++;
+                if (interval < min_interval) {
+                    min_interval = interval;
                 }
-                
-                // 读取音频采样精度（1bit）
-                strcat(audio_tag_str, "| ");
-                x = audio_data_first_byte & 0x02;
-                x = x >> 1;
-                switch (x) {
-                    case 0: strcat(audio_tag_str,"8Bit"); break;
-                    case 1: strcat(audio_tag_str,"16Bit"); break;
-                    default: strcat(audio_tag_str,"UNKNOWN"); break;
+                if (interval > max_interval) {
+                    max_interval = interval;
                 }
-                
-                // 读取声道类型（1bit）
-                strcat(audio_tag_str, "| ");
-                x = audio_data_first_byte & 0x01;
-                switch (x) {
-                    case 0: strcat(audio_tag_str,"Mono"); break;
-                    case 1: strcat(audio_tag_str,"Stereo"); break;
-                    default: strcat(audio_tag_str,"UNKNOWN"); break;
+            }
+            last_keyframe = tag->timestamp;
+            keyframe_count++;
+        }
+    }
+    
+    if (min_timestamp > max_timestamp) {
+        min_timestamp = max_timestamp = 0;
+    }
+    duration = (max_timestamp - min_timestamp) / 1000.0;
+    
+    // 第二遍  按时间窗口累计音视频数据量
+    window_ms = window > 0 ? (uint64_t)(window * 1000) : (max_timestamp - min_timestamp) / FLV_BITRATE_WINDOWS;
+    if (window_ms < 1000) {
+        window_ms = 1000;
+    }
+    window_count = (size_t)((max_timestamp - min_timestamp) / window_ms) + 1;
+    audio_window_bytes = (uint64_t *)calloc(window_count, sizeof(uint64_t));
+    video_window_bytes = (uint64_t *)calloc(window_count, sizeof(uint64_t));
+    if (audio_window_bytes && video_window_bytes) {
+        for (size_t i = 0; i < index->count; i++) {
+            const FLV_TAG *tag = &index->tags[i];
+            if ((tag->type != TAG_TYPE_AUDIO && tag->type != TAG_TYPE_VIDEO) || tag->timestamp < min_timestamp || tag->timestamp > max_timestamp) {
+                continue;
+            }
+            size_t slot = (tag->timestamp - min_timestamp) / window_ms;
+            if (tag->type == TAG_TYPE_AUDIO) {
+                audio_window_bytes[slot] += tag->data_size;
+            } else {
+                video_window_bytes[slot] += tag->data_size;
+            }
+        }
+    }
+    
+    fprintf(myout, "============================ FLV Summary =============================\n");
+    fprintf(myout, "Tags:              %llu (audio %llu / video %llu / script %llu / other %llu)\n",
+            (unsigned long long)index->count, (unsigned long long)tag_counts[0], (unsigned long long)tag_counts[1],
+            (unsigned long long)tag_counts[2], (unsigned long long)tag_counts[3]);
+    fprintf(myout, "Payload Bytes:     audio %llu / video %llu / script %llu / other %llu\n",
+            (unsigned long long)tag_bytes[0], (unsigned long long)tag_bytes[1], (unsigned long long)tag_bytes[2], (unsigned long long)tag_bytes[3]);
+    fprintf(myout, "Timestamps:        %u ms - %u ms (%.3f s)\n", min_timestamp, max_timestamp, duration);
+    if (duration > 0) {
+        fprintf(myout, "Average Bitrate:   audio %.2f kbps / video %.2f kbps\n", tag_bytes[0] * 8 / duration / 1000, tag_bytes[1] * 8 / duration / 1000);
+    }
+    if (tail_bytes > 0) {
+        fprintf(myout, "Incomplete Tail:   %llu bytes\n", (unsigned long long)tail_bytes);
+    }
+    
+    fprintf(myout, "Keyframes:         %llu", (unsigned long long)keyframe_count);
+    if (keyframe_intervals > 0) {
+        fprintf(myout, ", interval min %u / avg %.1f / max %u ms", min_interval, (double)keyframe_interval_sum / keyframe_intervals, max_interval);
+    }
+    fprintf(myout, "\n");
+    
+    fprintf(myout, "Timestamp Gaps:    %llu (backwards or > %d ms between tags of the same type)\n", (unsigned long long)gap_count, FLV_GAP_THRESHOLD_MS);
+    for (uint64_t i = 0; i < gap_count && i < FLV_MAX_GAP_EVENTS; i++) {
+        fprintf(myout, "    offset %12llu  %5s  %10u ms -> %10u ms\n", (unsigned long long)gap_events[i].offset,
+                get_tag_type_name(gap_events[i].type), gap_events[i].previous, gap_events[i].timestamp);
+    }
+    if (gap_count > FLV_MAX_GAP_EVENTS) {
+        fprintf(myout, "    ... %llu more\n", (unsigned long long)(gap_count - FLV_MAX_GAP_EVENTS));
+    }
+    
+    if (audio_window_bytes && video_window_bytes) {
+        fprintf(myout, "--------------------- Bitrate Over Time (%llu s window) ---------------------\n", (unsigned long long)(window_ms / 1000));
+        fprintf(myout, "       START (s)  |  AUDIO (kbps)  |  VIDEO (kbps)\n");
+        for (size_t i = 0; i < window_count; i++) {
+            // 最后一个窗口按实际覆盖的时长计算
+            uint64_t span = i + 1 < window_count ? window_ms : (max_timestamp - min_timestamp) - i * window_ms;
+            double seconds = (span > 0 ? span : window_ms) / 1000.0;
+            fprintf(myout, "  %14.3f  |  %12.2f  |  %12.2f\n", (i * window_ms) / 1000.0,
+                    audio_window_bytes[i] * 8 / seconds / 1000, video_window_bytes[i] * 8 / seconds / 1000);
+        }
+    }
+    
+    // 只输出第一个 onMetaData
+    for (size_t i = 0; i < index->count; i++) {
+        AMF_TABLE table;
+        char name[FLV_AMF_MAX_KEY];
+        if (index->tags[i].type == TAG_TYPE_SCRIPT && decode_script_tag(data, &index->tags[i], name, sizeof(name), &table) == 0 && strcmp(name, "onMetaData") == 0) {
+            fprintf(myout, "---------------------------- onMetaData ------------------------------\n");
+            print_amf_table(&table, "  ");
+            break;
+        }
+    }
+    
+    if (keyframe_intervals > 0) {
+        fprintf(myout, "------------------- Keyframe Interval Histogram ----------------------\n");
+        for (int i = 0; i < FLV_KEYFRAME_BINS; i++) {
+            if (keyframe_histogram[i] == 0) {
+                continue;
+            }
+            double percent = keyframe_histogram[i] * 100.0 / keyframe_intervals;
+            char bar[51] = {0};
+            memset(bar, '#', (size_t)(percent / 2));
+            if (i == FLV_KEYFRAME_BINS - 1) {
+                fprintf(myout, "  [%5d,   ...]  %10llu  %6.2f%%  %s\n", i * FLV_KEYFRAME_BIN_MS, (unsigned long long)keyframe_histogram[i], percent, bar);
+            } else {
+                fprintf(myout, "  [%5d, %5d]  %10llu  %6.2f%%  %s\n", i * FLV_KEYFRAME_BIN_MS, (i + 1) * FLV_KEYFRAME_BIN_MS - 1, (unsigned long long)keyframe_histogram[i], percent, bar);
+            }
+        }
+    }
+    
+    fprintf(myout, "----------------------------------------------------------------------\n");
+    if (elapsed > 0) {
+        fprintf(myout, "Scan Speed:        %.0f tags/s, %.2f MB/s (%.3f s)\n", index->count / elapsed, file_size / elapsed / (1024 * 1024), elapsed);
+    }
+    
+    free(audio_window_bytes);
+    free(video_window_bytes);
+}
+
+/**
+ * 获取单调时钟  单位s
+ */
+static double get_time_seconds(void) {
+    
+    struct timespec ts = {};
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/**
+ * 解析 Script Tag  第一个 AMF 值是名称字符串  第二个是参数
+ * @param data                    文件数据
+ * @param tag                      Script Tag
+ * @param name                    输出名称  一般为 onMetaData
+ * @param name_size             name 缓冲区大小
+ * @param table                   输出键值表
+ * @return 0: success  -1: 不是合法的 AMF0 数据
+ */
+static int decode_script_tag(const uint8_t *data, const FLV_TAG *tag, char *name, size_t name_size, AMF_TABLE *table) {
+    
+    const uint8_t *p = data + tag->offset + FLV_TAG_HEADER_SIZE;
+    const uint8_t *end = p + tag->data_size;
+    uint32_t length = 0;
+    
+    table->count = 0;
+    table->dropped = 0;
+    
+    if (end - p < 3 || p[0] != AMF0_STRING) {
+        return -1;
+    }
+    length = ((uint32_t)p[1] << 8) | p[2];
+    if (length > (uint32_t)(end - p - 3)) {
+        return -1;
+    }
+    snprintf(name, name_size, "%.*s", (int)length, (const char *)p + 3);
+    p += 3 + length;
+    
+    if (p < end && decode_amf0_value(p, end, "", table, 0) < 0) {
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * 解析一个 AMF0 值并加入键值表  Object / ECMA Array 展开为带前缀的子键
+ * @param p                         数据起始  指向类型字节
+ * @param end                      数据结束
+ * @param key                      当前值的键
+ * @param table                   键值表
+ * @param depth                   当前嵌套层数
+ * @return 消耗的字节数  -1: 数据不完整或不支持的类型
+ */
+static int64_t decode_amf0_value(const uint8_t *p, const uint8_t *end, const char *key, AMF_TABLE *table, int depth) {
+    
+    const uint8_t *start = p;
+    AMF_ENTRY *entry = NULL;
+    uint8_t type = 0;
+    uint64_t bits = 0;
+    int64_t ret = 0;
+    
+    if (p >= end || depth > FLV_AMF_MAX_DEPTH) {
+        return -1;
+    }
+    type = *p++;
+    
+    switch (type) {
+        case AMF0_NUMBER:
+        case AMF0_DATE:
+            if (end - p < (type == AMF0_DATE ? 10 : 8)) {
+                return -1;
+            }
+            bits = ((uint64_t)FLV_RB32(p) << 32) | FLV_RB32(p + 4);
+            if ((entry = add_amf_entry(table, key, type))) {
+                memcpy(&entry->number, &bits, sizeof(double));
+                if (type == AMF0_DATE) {
+                    entry->timezone = (int16_t)(((uint16_t)p[8] << 8) | p[9]);
                 }
-                fprintf(myout,"%s",audio_tag_str);
-                
-                // 文件seek到Tag末尾
-                fseek(input_file, tag_header_data_size - 1, SEEK_CUR);
-                break;
             }
-                
-            case TAG_TYPE_VIDEO:
-            {
-                uint8_t video_data_first_byte = fgetc(input_file);
-                uint8_t x = 0;
-                char video_tag_str[100] = {0};
-                
-                // 读取视频帧类型（4bit）
-                strcat(video_tag_str, "| ");
-                x = video_data_first_byte & 0xF0;
-                x = x >> 4;
-                switch (x) {
-                    case 1: strcat(video_tag_str,"key frame"); break;
-                    case 2: strcat(video_tag_str,"inter frame"); break;
-                    case 3: strcat(video_tag_str,"disposable inter frame"); break;
-                    case 4: strcat(video_tag_str,"generated keyframe"); break;
-                    case 5: strcat(video_tag_str,"video info/command frame"); break;
-                    default: strcat(video_tag_str,"UNKNOWN"); break;
+            p += type == AMF0_DATE ? 10 : 8;
+            break;
+        
+        case AMF0_BOOLEAN:
+            if (end - p < 1) {
+                return -1;
+            }
+            if ((entry = add_amf_entry(table, key, type))) {
+                entry->number = p[0] ? 1 : 0;
+            }
+            p += 1;
+            break;
+        
+        case AMF0_STRING:
+        case AMF0_LONG_STRING:
+        {
+            int header = type == AMF0_STRING ? 2 : 4;
+            uint32_t length = 0;
+            if (end - p < header) {
+                return -1;
+            }
+            length = type == AMF0_STRING ? (((uint32_t)p[0] << 8) | p[1]) : FLV_RB32(p);
+            p += header;
+            if (length > (uint64_t)(end - p)) {
+                return -1;
+            }
+            if ((entry = add_amf_entry(table, key, AMF0_STRING))) {
+                entry->data = p;
+                entry->length = length;
+            }
+            p += length;
+            break;
+        }
+        
+        case AMF0_NULL:
+        case AMF0_UNDEFINED:
+            add_amf_entry(table, key, type);
+            break;
+        
+        case AMF0_REFERENCE:
+            if (end - p < 2) {
+                return -1;
+            }
+            if ((entry = add_amf_entry(table, key, type))) {
+                entry->number = ((uint32_t)p[0] << 8) | p[1];
+            }
+            p += 2;
+            break;
+        
+        case AMF0_ECMA_ARRAY:
+            // 元素个数只是提示  以 0x000009 结束为准
+            if (end - p < 4) {
+                return -1;
+            }
+            p += 4;
+            /* fall through */
+        case AMF0_OBJECT:
+            if ((ret = decode_amf0_pairs(p, end, key, table, depth + 1)) < 0) {
+                return -1;
+            }
+            p += ret;
+            break;
+        
+        case AMF0_STRICT_ARRAY:
+        {
+            uint32_t count = 0;
+            const uint8_t *elements = NULL;
+            char child[FLV_AMF_MAX_KEY];
+            bool number_array = true;
+            if (end - p < 4) {
+                return -1;
+            }
+            count = FLV_RB32(p);
+            p += 4;
+            elements = p;
+            entry = add_amf_entry(table, key, type);
+            
+            // Number 数组只记录起始位置  其他元素用 key[i] 展开
+            for (uint32_t i = 0; i < count; i++) {
+                if (p < end && *p == AMF0_NUMBER && number_array) {
+                    if (end - p < 9) {
+                        return -1;
+                    }
+                    p += 9;
+                    continue;
                 }
-                
-                // 读取视频编码类型（4bit）
-                strcat(video_tag_str, "| ");
-                x = video_data_first_byte & 0x0F;
-                switch (x) {
-                    case 1: strcat(video_tag_str,"JPEG (currently unused)"); break;
-                    case 2: strcat(video_tag_str,"Sorenson H.263"); break;
-                    case 3: strcat(video_tag_str,"Screen video"); break;
-                    case 4: strcat(video_tag_str,"On2 VP6"); break;
-                    case 5: strcat(video_tag_str,"On2 VP6 with alpha channel"); break;
-                    case 6: strcat(video_tag_str,"Screen video version 2"); break;
-                    case 7: strcat(video_tag_str,"AVC"); break;
-                    default: strcat(video_tag_str,"UNKNOWN"); break;
+                number_array = false;
+                snprintf(child, sizeof(child), "%s[%u]", key, i);
+                if ((ret = decode_amf0_value(p, end, child, table, depth + 1)) < 0) {
+                    return -1;
                 }
-                fprintf(myout,"%s",video_tag_str);
-                
-                // 文件seek到Tag末尾
-                fseek(input_file, tag_header_data_size - 1, SEEK_CUR);
-                break;
+                p += ret;
             }
-                
-            case TAG_TYPE_SCRIPT:
-            {
-                // 暂不做解析
-                // 文件seek到Tag末尾
-                fseek(input_file, tag_header_data_size, SEEK_CUR);
-                break;
+            // 表满时 entry 为 NULL
+            if (entry) {
+                entry->data = elements;
+                entry->length = count;
+                entry->number_array = number_array;
             }
-                
-            default:
-                // 文件seek到Tag末尾
-                fseek(input_file, tag_header_data_size, SEEK_CUR);
-                break;
+            break;
         }
         
-        fprintf(myout,"\n");
+        default:
+            return -1;
+    }
+    
+    return p - start;
+}
+
+/**
+ * 解析 Object / ECMA Array 的名称值对  直到 0x000009 结束标记
+ * @param p                         数据起始  指向第一个名称
+ * @param end                      数据结束
+ * @param prefix                  父对象的键
+ * @param table                   键值表
+ * @param depth                   当前嵌套层数
+ * @return 消耗的字节数  -1: 数据不完整
+ */
+static int64_t decode_amf0_pairs(const uint8_t *p, const uint8_t *end, const char *prefix, AMF_TABLE *table, int depth) {
+    
+    const uint8_t *start = p;
+    char key[FLV_AMF_MAX_KEY];
+    
+    while (end - p >= 3) {
+        uint32_t length = ((uint32_t)p[0] << 8) | p[1];
+        int64_t ret = 0;
+        
+        if (length == 0 && p[2] == AMF0_OBJECT_END) {
+            return p + 3 - start;
+        }
+        p += 2;
+        if (length > (uint64_t)(end - p)) {
+            return -1;
+        }
         
-    } while (!feof(input_file));
+        if (prefix[0]) {
+            snprintf(key, sizeof(key), "%s.%.*s", prefix, (int)length, (const char *)p);
+        } else {
+            snprintf(key, sizeof(key), "%.*s", (int)length, (const char *)p);
+        }
+        p += length;
+        
+        if ((ret = decode_amf0_value(p, end, key, table, depth)) < 0) {
+            return -1;
+        }
+        p += ret;
+    }
     
-__FAIL:
-    if (input_file) {
-        fclose(input_file);
+    // 部分封装器省略结束标记  数据结束也视为对象结束
+    return p - start;
+}
+
+/**
+ * 键值表追加一个条目
+ * @param table                   键值表
+ * @param key                      键
+ * @param type                    AMF0 类型
+ * @return AMF_ENTRY  表满时返回 NULL
+ */
+static AMF_ENTRY *add_amf_entry(AMF_TABLE *table, const char *key, uint8_t type) {
+    
+    AMF_ENTRY *entry = NULL;
+    
+    if (table->count >= FLV_AMF_MAX_ENTRIES) {
+        table->dropped++;
+        return NULL;
     }
+    
+    entry = &table->entries[table->count++];
+    memset(entry, 0, sizeof(AMF_ENTRY));
+    snprintf(entry->key, sizeof(entry->key), "%s", key);
+    entry->type = type;
+    return entry;
 }
 
 /**
- * reverse_bytes - turn a BigEndian byte array into a LittleEndian integer
- * @param p     integer start pointer
- * @param c     bytes of integer
- * @return       LE integer
+ * 按键查找
+ * @param table                   键值表
+ * @param key                      键
+ * @return AMF_ENTRY  没有找到时返回 NULL
  */
-static uint32_t reverse_bytes(uint8_t *p, size_t c) {
-    uint32_t r = 0;
-    for (int i = 0; i < c; i++) {
-        r |= *(p + i) << (((c - 1) * 8) - 8 * i);
+static const AMF_ENTRY *find_amf_entry(const AMF_TABLE *table, const char *key) {
+    
+    for (int i = 0; i < table->count; i++) {
+        if (strcmp(table->entries[i].key, key) == 0) {
+            return &table->entries[i];
+        }
     }
-    return r;
+    return NULL;
+}
+
+/**
+ * 读取 Number 数组的第 i 个元素  每个元素固定 9 字节  直接从映射内存读取
+ * @param entry                   Strict Array 条目  number_array 必须为 true
+ * @param i                         下标
+ * @return 元素值
+ */
+static double get_amf_array_number(const AMF_ENTRY *entry, uint32_t i) {
+    
+    const uint8_t *p = entry->data + (size_t)i * 9 + 1;
+    uint64_t bits = ((uint64_t)FLV_RB32(p) << 32) | FLV_RB32(p + 4);
+    double value = 0;
+    memcpy(&value, &bits, sizeof(double));
+    return value;
+}
+
+/**
+ * 输出键值表
+ * @param table                   键值表
+ * @param indent                  每行缩进
+ */
+static void print_amf_table(const AMF_TABLE *table, const char *indent) {
+    
+    FILE *myout = stdout;
+    
+    for (int i = 0; i < table->count; i++) {
+        const AMF_ENTRY *entry = &table->entries[i];
+        fprintf(myout, "%s%-24s ", indent, entry->key[0] ? entry->key : "(value)");
+        switch (entry->type) {
+            case AMF0_NUMBER: fprintf(myout, "%.15g\n", entry->number); break;
+            case AMF0_BOOLEAN: fprintf(myout, "%s\n", entry->number ? "true" : "false"); break;
+            case AMF0_STRING: fprintf(myout, "\"%.*s\"\n", (int)entry->length, (const char *)entry->data); break;
+            case AMF0_NULL: fprintf(myout, "null\n"); break;
+            case AMF0_UNDEFINED: fprintf(myout, "undefined\n"); break;
+            case AMF0_REFERENCE: fprintf(myout, "reference #%.0f\n", entry->number); break;
+            case AMF0_DATE:
+            {
+                time_t seconds = (time_t)(entry->number / 1000);
+                struct tm tm = {};
+                char buffer[32] = {0};
+                gmtime_r(&seconds, &tm);
+                strftime(buffer, sizeof(buffer), "%Y-%m-%d %H:%M:%S", &tm);
+                fprintf(myout, "%s UTC (tz %d)\n", buffer, entry->timezone);
+                break;
+            }
+            case AMF0_STRICT_ARRAY:
+                if (entry->number_array && entry->length > 0) {
+                    fprintf(myout, "[%u numbers: %.15g ... %.15g]\n", entry->length, get_amf_array_number(entry, 0), get_amf_array_number(entry, entry->length - 1));
+                } else {
+                    fprintf(myout, "[%u items]\n", entry->length);
+                }
+                break;
+            default: fprintf(myout, "\n"); break;
+        }
+    }
+    
+    if (table->dropped > 0) {
+        fprintf(myout, "%s... %d more entries\n", indent, table->dropped);
+    }
+}
+
+/**
+ * 查找指定时间之前最近的关键帧
+ * 优先用 onMetaData 的 keyframes.times / keyframes.filepositions 二分查找  只访问第一个 Tag 和命中的 Tag
+ * 没有关键帧数组或数组与文件不一致时  退回完整的 Tag 遍历
+ * @param data                    文件数据
+ * @param size                     文件大小
+ * @param body_offset          FLV Body 起始偏移
+ * @param time                     查找时间  单位s
+ */
+static void lookup_keyframe(const uint8_t *data, size_t size, uint64_t body_offset, double time) {
+    
+    FILE *myout = stdout;
+    uint64_t pos = body_offset;
+    FLV_TAG_INDEX index = {};
+    AMF_TABLE table;
+    char name[FLV_AMF_MAX_KEY];
+    const AMF_ENTRY *times = NULL, *positions = NULL;
+    double start_time = get_time_seconds();
+    uint64_t first_tag_end = body_offset + FLV_PREVIOUS_TAG_SIZE + FLV_TAG_HEADER_SIZE;
+    
+    // 只解析第一个 Tag  把遍历范围限制在第一个 Tag 结尾
+    if (first_tag_end <= size) {
+        first_tag_end += FLV_RB24(data + body_offset + FLV_PREVIOUS_TAG_SIZE + 1);
+    }
+    if (walk_flv_tags(data, FLV_MIN(size, first_tag_end), &pos, &index) > 0
+        && index.tags[0].type == TAG_TYPE_SCRIPT
+        && decode_script_tag(data, &index.tags[0], name, sizeof(name), &table) == 0) {
+        times = find_amf_entry(&table, "keyframes.times");
+        positions = find_amf_entry(&table, "keyframes.filepositions");
+    }
+    
+    if (times && positions && times->type == AMF0_STRICT_ARRAY && positions->type == AMF0_STRICT_ARRAY
+        && times->number_array && positions->number_array && times->length > 0 && times->length == positions->length) {
+        // 最后一个 times[i] <= time
+        uint32_t low = 0, high = times->length;
+        while (high - low > 1) {
+            uint32_t mid = low + (high - low) / 2;
+            if (get_amf_array_number(times, mid) <= time) {
+                low = mid;
+            } else {
+                high = mid;
+            }
+        }
+        
+        // 命中的偏移必须指向一个视频关键帧 Tag
+        double position = get_amf_array_number(positions, low);
+        if (position >= 0 && position + FLV_TAG_HEADER_SIZE + 1 <= size) {
+            const uint8_t *header = data + (uint64_t)position;
+            if ((header[0] & 0x1F) == TAG_TYPE_VIDEO && (header[FLV_TAG_HEADER_SIZE] >> 4) == 1) {
+                fprintf(myout, "Keyframe At Or Before %.3f s: offset %llu, timestamp %u ms (onMetaData keyframes, %u entries, %.6f s)\n",
+                        time, (unsigned long long)position, FLV_RB24(header + 4) | ((uint32_t)header[7] << 24), times->length, get_time_seconds() - start_time);
+                free_flv_tag_index(&index);
+                return;
+            }
+        }
+        fprintf(myout, "onMetaData keyframes do not match the file, falling back to a full tag scan.\n");
+    }
+    
+    // 完整遍历
+    free_flv_tag_index(&index);
+    pos = body_offset;
+    if (walk_flv_tags(data, size, &pos, &index) < 0) {
+        printf("Alloc FLV Tag Index Error.\n");
+        free_flv_tag_index(&index);
+        return;
+    }
+    
+    const FLV_TAG *found = NULL;
+    for (size_t i = 0; i < index.count; i++) {
+        const FLV_TAG *tag = &index.tags[i];
+        if (tag->type != TAG_TYPE_VIDEO || !tag->keyframe || tag->sequence_header) {
+            continue;
+        }
+        if (tag->timestamp > time * 1000 && found) {
+            break;
+        }
+        found = tag;
+    }
+    
+    if (found) {
+        fprintf(myout, "Keyframe At Or Before %.3f s: offset %llu, timestamp %u ms (tag scan, %zu tags, %.6f s)\n",
+                time, (unsigned long long)found->offset, found->timestamp, index.count, get_time_seconds() - start_time);
+    } else {
+        fprintf(myout, "No Keyframe Found.\n");
+    }
+    free_flv_tag_index(&index);
+}
+
+/**
+ * 提取 H.264 / AAC 基本流
+ * H.264: AVCDecoderConfigurationRecord 转为 AnnexB SPS/PPS  每个关键帧前重复一次  NALU 长度前缀替换为起始码
+ * AAC: 根据 AudioSpecificConfig 为每一帧生成 ADTS 头
+ * 负载不经过拷贝  iovec 直接指向映射内存  一批 iovec 一次 writev
+ * @param url                 flv file path
+ * @param video_url         H.264 输出路径  NULL表示不提取
+ * @param audio_url         AAC 输出路径  NULL表示不提取
+ */
+static void extract(char *url, const char *video_url, const char *audio_url) {
+    
+    FILE *myout = stdout;
+    const uint8_t *data = NULL;
+    size_t size = 0;
+    uint64_t pos = 0;
+    FLV_TAG_INDEX index = {};
+    FLV_ES_CONTEXT context = {};
+    FLV_ES_WRITER *video_writer = NULL, *audio_writer = NULL;
+    double start_time = get_time_seconds();
+    double elapsed = 0;
+    
+    context.aac_profile = -1;
+    
+    if (map_input_file(url, &data, &size) < 0) {
+        return;
+    }
+    
+    if (check_flv_header(data, size, &pos) < 0) {
+        printf("Not A FLV File.\n");
+        goto __FAIL;
+    }
+    
+    if (walk_flv_tags(data, size, &pos, &index) < 0) {
+        printf("Alloc FLV Tag Index Error.\n");
+        goto __FAIL;
+    }
+    
+    // writer 包含 iovec 和 ADTS 头槽位  整个提取过程只分配这一次
+    if (video_url) {
+        video_writer = (FLV_ES_WRITER *)calloc(1, sizeof(FLV_ES_WRITER));
+        if (!video_writer || (video_writer->fd = open(video_url, O_WRONLY | O_CREAT | O_TRUNC, 0644)) < 0) {
+            printf("Failed to open output file %s!\n", video_url);
+            goto __FAIL;
+        }
+    }
+    if (audio_url) {
+        audio_writer = (FLV_ES_WRITER *)calloc(1, sizeof(FLV_ES_WRITER));
+        if (!audio_writer || (audio_writer->fd = open(audio_url, O_WRONLY | O_CREAT | O_TRUNC, 0644)) < 0) {
+            printf("Failed to open output file %s!\n", audio_url);
+            goto __FAIL;
+        }
+    }
+    
+    for (size_t i = 0; i < index.count; i++) {
+        const FLV_TAG *tag = &index.tags[i];
+        const uint8_t *payload = data + tag->offset + FLV_TAG_HEADER_SIZE;
+        int ret = 0;
+        
+        if (tag->type == TAG_TYPE_VIDEO && video_writer) {
+            ret = extract_video_tag(payload, tag->data_size, &context, video_writer);
+        } else if (tag->type == TAG_TYPE_AUDIO && audio_writer) {
+            ret = extract_audio_tag(payload, tag->data_size, &context, audio_writer);
+        }
+        if (ret < 0) {
+            goto __FAIL;
+        }
+    }
+    
+    if ((video_writer && flush_writer(video_writer) < 0) || (audio_writer && flush_writer(audio_writer) < 0)) {
+        goto __FAIL;
+    }
+    
+    elapsed = get_time_seconds() - start_time;
+    fprintf(myout, "============================ FLV Extract =============================\n");
+    if (video_writer) {
+        fprintf(myout, "Video:             %llu NALUs, %llu bytes -> %s\n", (unsigned long long)video_writer->units, (unsigned long long)video_writer->bytes, video_url);
+    }
+    if (audio_writer) {
+        fprintf(myout, "Audio:             %llu frames, %llu bytes -> %s\n", (unsigned long long)audio_writer->units, (unsigned long long)audio_writer->bytes, audio_url);
+    }
+    fprintf(myout, "Skipped Tags:      %llu (unsupported codec or before sequence header)\n", (unsigned long long)context.skipped_tags);
+    fprintf(myout, "Broken Tags:       %llu\n", (unsigned long long)context.broken_tags);
+    if (elapsed > 0) {
+        fprintf(myout, "Speed:             %.2f MB/s (%.3f s)\n", size / elapsed / (1024 * 1024), elapsed);
+    }
+    
+__FAIL:
+    if (video_writer) {
+        if (video_writer->fd > 0) {
+            close(video_writer->fd);
+        }
+        free(video_writer);
+    }
+    
+    if (audio_writer) {
+        if (audio_writer->fd > 0) {
+            close(audio_writer->fd);
+        }
+        free(audio_writer);
+    }
+    
+    free_flv_tag_index(&index);
+    
+    if (data) {
+        munmap((void *)data, size);
+    }
+}
+
+/**
+ * 解析 AVCDecoderConfigurationRecord
+ * configurationVersion(8) + AVCProfileIndication(8) + profile_compatibility(8) + AVCLevelIndication(8)
+ * + reserved(6) + lengthSizeMinusOne(2) + reserved(3) + numOfSequenceParameterSets(5) + [sequenceParameterSetLength(16) + SPS]
+ * + numOfPictureParameterSets(8) + [pictureParameterSetLength(16) + PPS]
+ * @param p                         AVCDecoderConfigurationRecord
+ * @param size                     长度
+ * @param context                 FLV_ES_CONTEXT Instance
+ * @return 0: success  -1: 数据不完整
+ */
+static int parse_avc_decoder_configuration(const uint8_t *p, uint32_t size, FLV_ES_CONTEXT *context) {
+    
+    const uint8_t *end = p + size;
+    int count = 0;
+    
+    if (size < 7 || p[0] != 1) {
+        return -1;
+    }
+    
+    context->nal_length_size = (p[4] & 0x03) + 1;
+    context->parameter_set_count = 0;
+    p += 5;
+    
+    // 先 SPS 后 PPS
+    for (int list = 0; list < 2; list++) {
+        if (p >= end) {
+            return -1;
+        }
+        count = list == 0 ? (*p & 0x1F) : *p;
+        p++;
+        for (int i = 0; i < count; i++) {
+            uint16_t length = 0;
+            if (end - p < 2) {
+                return -1;
+            }
+            length = ((uint16_t)p[0] << 8) | p[1];
+            p += 2;
+            if (length > end - p) {
+                return -1;
+            }
+            if (context->parameter_set_count < FLV_MAX_PARAMETER_SETS) {
+                context->parameter_sets[context->parameter_set_count] = p;
+                context->parameter_set_sizes[context->parameter_set_count] = length;
+                context->parameter_set_count++;
+            }
+            p += length;
+        }
+    }
+    return 0;
+}
+
+/**
+ * 解析 AAC AudioSpecificConfig  得到 ADTS 头需要的 profile、sampling_frequency_index、channel_configuration
+ * @param p                         AudioSpecificConfig
+ * @param size                     长度
+ * @param context                 FLV_ES_CONTEXT Instance
+ * @return 0: success  -1: 无法用 ADTS 描述
+ */
+static int parse_aac_audio_specific_config(const uint8_t *p, uint32_t size, FLV_ES_CONTEXT *context) {
+    
+    int object_type = 0, sample_index = 0, channels = 0;
+    
+    if (size < 2) {
+        return -1;
+    }
+    
+    // audioObjectType(5) + samplingFrequencyIndex(4) + channelConfiguration(4)
+    object_type = p[0] >> 3;
+    sample_index = ((p[0] & 0x07) << 1) | (p[1] >> 7);
+    channels = (p[1] >> 3) & 0x0F;
+    
+    // 扩展 objectType 和显式采样率 ADTS 无法描述
+    if (object_type == 31 || sample_index == 15) {
+        return -1;
+    }
+    
+    // SBR/PS 显式信令时  ADTS 只能描述核心层  按 LC 输出
+    if (object_type == 5 || object_type == 29) {
+        object_type = 2;
+    }
+    if (object_type < 1 || object_type > 4) {
+        return -1;
+    }
+    
+    context->aac_profile = object_type - 1;
+    context->aac_sample_index = sample_index;
+    context->aac_channels = channels;
+    return 0;
+}
+
+/**
+ * 提取一个 Video Tag
+ * FrameType(4) + CodecID(4) + AVCPacketType(8) + CompositionTime(24) + Data
+ * @param payload                 Tag Data
+ * @param size                     Tag Data 长度
+ * @param context                 FLV_ES_CONTEXT Instance
+ * @param writer                  FLV_ES_WRITER Instance
+ * @return 0: success  -1: 写文件失败
+ */
+static int extract_video_tag(const uint8_t *payload, uint32_t size, FLV_ES_CONTEXT *context, FLV_ES_WRITER *writer) {
+    
+    const uint8_t *p = payload + 5;
+    const uint8_t *end = payload + size;
+    bool keyframe = false;
+    
+    if (size < 5 || (payload[0] & 0x0F) != 7) {
+        context->skipped_tags++;
+        return 0;
+    }
+    
+    // AVCPacketType 0: 序列头
+    if (payload[1] == 0) {
+        if (parse_avc_decoder_configuration(p, size - 5, context) < 0) {
+            context->broken_tags++;
+        }
+        return 0;
+    }
+    
+    // AVCPacketType 2: end of sequence
+    if (payload[1] != 1) {
+        return 0;
+    }
+    
+    if (context->nal_length_size == 0) {
+        context->skipped_tags++;
+        return 0;
+    }
+    
+    // 关键帧前插入 SPS/PPS  从任意关键帧开始都可以解码
+    keyframe = (payload[0] >> 4) == 1;
+    if (keyframe) {
+        for (int i = 0; i < context->parameter_set_count; i++) {
+            if (push_iovec(writer, annexb_start_code, sizeof(annexb_start_code)) < 0
+                || push_iovec(writer, context->parameter_sets[i], context->parameter_set_sizes[i]) < 0) {
+                return -1;
+            }
+        }
+    }
+    
+    while (end - p >= context->nal_length_size) {
+        uint32_t length = 0;
+        for (int i = 0; i < context->nal_length_size; i++) {
+            length = (length << 8) | p[i];
+        }
+        p += context->nal_length_size;
+        if (length > (uint32_t)(end - p)) {
+            context->broken_tags++;
+            return 0;
+        }
+        if (length == 0) {
+            continue;
+        }
+        if (push_iovec(writer, annexb_start_code, sizeof(annexb_start_code)) < 0 || push_iovec(writer, p, length) < 0) {
+            return -1;
+        }
+        writer->units++;
+        p += length;
+    }
+    return 0;
+}
+
+/**
+ * 提取一个 Audio Tag
+ * SoundFormat(4) + SoundRate(2) + SoundSize(1) + SoundType(1) + AACPacketType(8) + Data
+ * @param payload                 Tag Data
+ * @param size                     Tag Data 长度
+ * @param context                 FLV_ES_CONTEXT Instance
+ * @param writer                  FLV_ES_WRITER Instance
+ * @return 0: success  -1: 写文件失败
+ */
+static int extract_audio_tag(const uint8_t *payload, uint32_t size, FLV_ES_CONTEXT *context, FLV_ES_WRITER *writer) {
+    
+    uint32_t frame_length = 0;
+    uint8_t *header = NULL;
+    
+    if (size < 2 || (payload[0] >> 4) != 10) {
+        context->skipped_tags++;
+        return 0;
+    }
+    
+    // AACPacketType 0: AudioSpecificConfig
+    if (payload[1] == 0) {
+        if (parse_aac_audio_specific_config(payload + 2, size - 2, context) < 0) {
+            context->aac_profile = -1;
+            context->broken_tags++;
+        }
+        return 0;
+    }
+    
+    if (context->aac_profile < 0 || size == 2) {
+        context->skipped_tags++;
+        return 0;
+    }
+    
+    frame_length = size - 2 + ADTS_HEADER_SIZE;
+    if (frame_length > 0x1FFF) {
+        context->broken_tags++;
+        return 0;
+    }
+    
+    // 槽位用完说明 iovec 也快满了  先写出
+    if (writer->header_count == FLV_IOV_BATCH && flush_writer(writer) < 0) {
+        return -1;
+    }
+    header = writer->headers[writer->header_count++];
+    
+    // syncword(12) ID(1) layer(2) protection_absent(1) profile(2) sampling_frequency_index(4) private_bit(1) channel_configuration(3)
+    // original_copy(1) home(1) copyright_identification_bit(1) copyright_identification_start(1) aac_frame_length(13) adts_buffer_fullness(11) number_of_raw_data_blocks_in_frame(2)
+    header[0] = 0xFF;
+    header[1] = 0xF1;
+    header[2] = (uint8_t)((context->aac_profile << 6) | (context->aac_sample_index << 2) | ((context->aac_channels >> 2) & 0x01));
+    header[3] = (uint8_t)(((context->aac_channels & 0x03) << 6) | (frame_length >> 11));
+    header[4] = (uint8_t)((frame_length >> 3) & 0xFF);
+    header[5] = (uint8_t)(((frame_length & 0x07) << 5) | 0x1F);
+    header[6] = 0xFC;
+    
+    if (push_iovec(writer, header, ADTS_HEADER_SIZE) < 0 || push_iovec(writer, payload + 2, size - 2) < 0) {
+        return -1;
+    }
+    writer->units++;
+    return 0;
+}
+
+/**
+ * 追加一个 iovec  满了就写出
+ * @param writer                  FLV_ES_WRITER Instance
+ * @param base                    数据地址
+ * @param length                  数据长度
+ * @return 0: success  -1: 写文件失败
+ */
+static int push_iovec(FLV_ES_WRITER *writer, const void *base, size_t length) {
+    
+    if (writer->iov_count == FLV_IOV_BATCH && flush_writer(writer) < 0) {
+        return -1;
+    }
+    
+    writer->iov[writer->iov_count].iov_base = (void *)base;
+    writer->iov[writer->iov_count].iov_len = length;
+    writer->iov_count++;
+    writer->bytes += length;
+    return 0;
+}
+
+/**
+ * writev 写出全部 iovec  处理部分写入
+ * ADTS 头槽位被 iovec 引用  写完后才能复用
+ * @param writer                  FLV_ES_WRITER Instance
+ * @return 0: success  -1: 写文件失败
+ */
+static int flush_writer(FLV_ES_WRITER *writer) {
+    
+    struct iovec *iov = writer->iov;
+    int count = writer->iov_count;
+    
+    while (count > 0) {
+        ssize_t written = writev(writer->fd, iov, count);
+        if (written < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            printf("Write Output File Error: %s\n", strerror(errno));
+            return -1;
+        }
+        while (count > 0 && (size_t)written >= iov->iov_len) {
+            written -= iov->iov_len;
+            iov++;
+            count--;
+        }
+        if (count > 0) {
+            iov->iov_base = (uint8_t *)iov->iov_base + written;
+            iov->iov_len -= written;
+        }
+    }
+    
+    writer->iov_count = 0;
+    writer->header_count = 0;
+    return 0;
+}
+
+/**
+ * Follow 模式  文件持续增长时只解析新追加的完整 Tag
+ * 解析位置和索引容量在两次解析之间保留  每批处理完清空索引  内存和 CPU 只和写入速度相关
+ * @param url                 flv file path
+ */
+static void follow(char *url) {
+    
+    FILE *myout = stdout;
+    FLV_FOLLOWER follower = {-1, -1, -1};
+    FLV_TAG_INDEX index = {};
+    FLV_FOLLOW_STATS stats = {}, last = {};
+    struct sigaction action = {}, old_action = {};
+    const uint8_t *data = NULL;
+    size_t size = 0;
+    uint64_t pos = 0;
+    bool header_checked = false;
+    double start_time = get_time_seconds();
+    double last_time = 0;
+    double last_report = 0;             // 第一批是已有内容  不计算写入速度
+    int ret = 0;
+    
+    if (open_follower(&follower, url) < 0) {
+        goto __FAIL;
+    }
+    
+    // Ctrl+C 时跳出等待  输出累计统计
+    follow_stopped = 0;
+    action.sa_handler = on_follow_signal;
+    sigemptyset(&action.sa_mask);
+    sigaction(SIGINT, &action, &old_action);
+    
+    fprintf(myout, "Following %s, Ctrl+C To Stop.\n", url);
+    
+    while (!follow_stopped) {
+        struct stat st = {};
+        
+        last_time = get_time_seconds();
+        if (fstat(follower.fd, &st) < 0) {
+            break;
+        }
+        
+        // 文件被截断  录制重新开始
+        if ((uint64_t)st.st_size < pos) {
+            fprintf(myout, "File truncated, restart from the beginning.\n");
+            memset(&stats, 0, sizeof(stats));
+            memset(&last, 0, sizeof(last));
+            header_checked = false;
+            pos = 0;
+        }
+        
+        if ((size_t)st.st_size > size || ((size_t)st.st_size < size && st.st_size > 0)) {
+            // 重新映射整个文件  只有新追加的部分会被访问
+            if (data) {
+                munmap((void *)data, size);
+                data = NULL;
+            }
+            size = (size_t)st.st_size;
+            data = (const uint8_t *)mmap(NULL, size, PROT_READ, MAP_PRIVATE, follower.fd, 0);
+            if (data == MAP_FAILED) {
+                data = NULL;
+                printf("Map File Error.\n");
+                break;
+            }
+            
+            if (!header_checked && size >= FLV_HEADER_SIZE) {
+                if (check_flv_header(data, size, &pos) < 0) {
+                    printf("Not A FLV File.\n");
+                    break;
+                }
+                header_checked = true;
+            }
+            
+            if (header_checked) {
+                index.count = 0;
+                if (walk_flv_tags(data, size, &pos, &index) < 0) {
+                    printf("Alloc FLV Tag Index Error.\n");
+                    break;
+                }
+                for (size_t i = 0; i < index.count; i++) {
+                    update_follow_stats(&stats, &index.tags[i]);
+                }
+                if (index.count > 0) {
+                    print_follow_stats(&stats, &last, last_time - start_time, last_report > 0 ? last_time - last_report : 0);
+                    last = stats;
+                    last_report = last_time;
+                }
+            }
+        }
+        
+        // 没有通知时也定期检查一次文件大小  兼容不产生通知的文件系统
+        ret = wait_follower(&follower, FLV_FOLLOW_INTERVAL_MS);
+        if (ret < 0) {
+            fprintf(myout, "File deleted or moved, stop following.\n");
+            break;
+        }
+        
+        // 两次解析之间至少间隔 FLV_FOLLOW_INTERVAL_MS  这段时间内的追加合并处理
+        if (ret > 0 && !follow_stopped) {
+            double wait = FLV_FOLLOW_INTERVAL_MS / 1000.0 - (get_time_seconds() - last_time);
+            if (wait > 0) {
+                usleep((useconds_t)(wait * 1000000));
+            }
+        }
+    }
+    
+    fprintf(myout, "============================ FLV Follow Total ========================\n");
+    fprintf(myout, "Tags:              %llu (audio %llu / video %llu / script %llu / other %llu)\n",
+            (unsigned long long)(stats.tags[0] + stats.tags[1] + stats.tags[2] + stats.tags[3]), (unsigned long long)stats.tags[0],
+            (unsigned long long)stats.tags[1], (unsigned long long)stats.tags[2], (unsigned long long)stats.tags[3]);
+    fprintf(myout, "Payload Bytes:     audio %llu / video %llu\n", (unsigned long long)stats.bytes[0], (unsigned long long)stats.bytes[1]);
+    if (stats.has_timestamp) {
+        fprintf(myout, "Timestamps:        %u ms - %u ms\n", stats.first_timestamp, stats.last_timestamp);
+    }
+    fprintf(myout, "Keyframes:         %llu\n", (unsigned long long)stats.keyframes);
+    fprintf(myout, "Timestamp Gaps:    %llu\n", (unsigned long long)stats.gaps);
+    fprintf(myout, "Followed:          %.3f s\n", get_time_seconds() - start_time);
+    
+    sigaction(SIGINT, &old_action, NULL);
+    
+__FAIL:
+    close_follower(&follower);
+    free_flv_tag_index(&index);
+    
+    if (data) {
+        munmap((void *)data, size);
+    }
+}
+
+/**
+ * 累计一个 Tag
+ * @param stats                    FLV_FOLLOW_STATS Instance
+ * @param tag                      新解析的 Tag
+ */
+static void update_follow_stats(FLV_FOLLOW_STATS *stats, const FLV_TAG *tag) {
+    
+    int slot = tag->type == TAG_TYPE_AUDIO ? 0 : tag->type == TAG_TYPE_VIDEO ? 1 : tag->type == TAG_TYPE_SCRIPT ? 2 : 3;
+    
+    stats->tags[slot]++;
+    stats->bytes[slot] += tag->data_size;
+    if (slot > 1 || tag->sequence_header) {
+        return;
+    }
+    
+    if (!stats->has_timestamp) {
+        stats->first_timestamp = tag->timestamp;
+        stats->has_timestamp = true;
+    }
+    if (tag->timestamp > stats->last_timestamp) {
+        stats->last_timestamp = tag->timestamp;
+    }
+    
+    if (stats->has_last[slot] && (tag->timestamp < stats->last_type_timestamp[slot] || tag->timestamp - stats->last_type_timestamp[slot] > FLV_GAP_THRESHOLD_MS)) {
+        stats->gaps++;
+    }
+    stats->last_type_timestamp[slot] = tag->timestamp;
+    stats->has_last[slot] = true;
+    
+    if (tag->keyframe) {
+        stats->keyframes++;
+    }
+}
+
+/**
+ * 输出一批新增 Tag 的统计
+ * @param stats                    当前累计统计
+ * @param last                     上一批结束时的累计统计
+ * @param wall_time             从开始跟踪到现在的时间  单位s
+ * @param wall_elapsed        距上一批的时间  单位s
+ */
+static void print_follow_stats(const FLV_FOLLOW_STATS *stats, const FLV_FOLLOW_STATS *last, double wall_time, double wall_elapsed) {
+    
+    FILE *myout = stdout;
+    uint64_t audio_bytes = stats->bytes[0] - last->bytes[0];
+    uint64_t video_bytes = stats->bytes[1] - last->bytes[1];
+    uint64_t total_bytes = audio_bytes + video_bytes + (stats->bytes[2] - last->bytes[2]) + (stats->bytes[3] - last->bytes[3]);
+    // 码率按这一批覆盖的媒体时长计算
+    double media_time = last->has_timestamp ? (stats->last_timestamp - last->last_timestamp) / 1000.0 : (stats->last_timestamp - stats->first_timestamp) / 1000.0;
+    
+    fprintf(myout, "[%9.1f s] +%llu tags (audio %llu / video %llu), +%.1f KB, ts %u ms, ",
+            wall_time, (unsigned long long)(stats->tags[0] + stats->tags[1] + stats->tags[2] + stats->tags[3] - last->tags[0] - last->tags[1] - last->tags[2] - last->tags[3]),
+            (unsigned long long)(stats->tags[0] - last->tags[0]), (unsigned long long)(stats->tags[1] - last->tags[1]), total_bytes / 1024.0, stats->last_timestamp);
+    if (media_time > 0) {
+        fprintf(myout, "audio %.1f kbps / video %.1f kbps, ", audio_bytes * 8 / media_time / 1000, video_bytes * 8 / media_time / 1000);
+    }
+    fprintf(myout, "keyframes +%llu, gaps +%llu", (unsigned long long)(stats->keyframes - last->keyframes), (unsigned long long)(stats->gaps - last->gaps));
+    if (wall_elapsed > 0) {
+        fprintf(myout, ", ingest %.1f KB/s", total_bytes / 1024.0 / wall_elapsed);
+    }
+    fprintf(myout, "\n");
+    fflush(myout);
+}
+
+/**
+ * 开始跟踪文件
+ * @param follower               FLV_FOLLOWER Instance
+ * @param url                      file path
+ * @return 0: success  -1: failed
+ */
+static int open_follower(FLV_FOLLOWER *follower, const char *url) {
+    
+    follower->fd = open(url, O_RDONLY);
+    if (follower->fd < 0) {
+        printf("Failed to open input file!\n");
+        return -1;
+    }
+    
+#if defined(__linux__)
+    follower->notify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (follower->notify_fd < 0) {
+        printf("inotify_init1 Error: %s\n", strerror(errno));
+        return -1;
+    }
+    follower->watch = inotify_add_watch(follower->notify_fd, url, IN_MODIFY | IN_CLOSE_WRITE | IN_DELETE_SELF | IN_MOVE_SELF);
+    if (follower->watch < 0) {
+        printf("inotify_add_watch Error: %s\n", strerror(errno));
+        return -1;
+    }
+#else
+    struct kevent change;
+    follower->notify_fd = kqueue();
+    if (follower->notify_fd < 0) {
+        printf("kqueue Error: %s\n", strerror(errno));
+        return -1;
+    }
+    // EV_CLEAR: 每次取出事件后重置  多次写入合并为一个事件
+    EV_SET(&change, follower->fd, EVFILT_VNODE, EV_ADD | EV_CLEAR, NOTE_WRITE | NOTE_EXTEND | NOTE_DELETE | NOTE_RENAME, 0, NULL);
+    if (kevent(follower->notify_fd, &change, 1, NULL, 0, NULL) < 0) {
+        printf("kevent Error: %s\n", strerror(errno));
+        return -1;
+    }
+#endif
+    return 0;
+}
+
+/**
+ * 等待文件变化
+ * @param follower               FLV_FOLLOWER Instance
+ * @param timeout_ms           超时时间  单位ms
+ * @return 1: 文件被写入  0: 超时或被信号打断  -1: 文件被删除或移走
+ */
+static int wait_follower(FLV_FOLLOWER *follower, int timeout_ms) {
+    
+#if defined(__linux__)
+    struct pollfd pfd = {follower->notify_fd, POLLIN, 0};
+    char buffer[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+    int changed = 0;
+    ssize_t length = 0;
+    
+    if (poll(&pfd, 1, timeout_ms) <= 0) {
+        return 0;
+    }
+    
+    // 一次取完所有排队的事件
+    while ((length = read(follower->notify_fd, buffer, sizeof(buffer))) > 0) {
+        for (char *p = buffer; p < buffer + length; ) {
+            const struct inotify_event *event = (const struct inotify_event *)p;
+            if (event->mask & (IN_DELETE_SELF | IN_MOVE_SELF | IN_IGNORED)) {
+                return -1;
+            }
+            changed = 1;
+            p += sizeof(struct inotify_event) + event->len;
+        }
+    }
+    return changed;
+#else
+    struct kevent event;
+    struct timespec timeout = {timeout_ms / 1000, (timeout_ms % 1000) * 1000000L};
+    int n = kevent(follower->notify_fd, NULL, 0, &event, 1, &timeout);
+    
+    if (n <= 0) {
+        return 0;
+    }
+    if (event.fflags & (NOTE_DELETE | NOTE_RENAME)) {
+        return -1;
+    }
+    return 1;
+#endif
+}
+
+/**
+ * 停止跟踪
+ * @param follower               FLV_FOLLOWER Instance
+ */
+static void close_follower(FLV_FOLLOWER *follower) {
+    
+    if (follower->notify_fd >= 0) {
+        close(follower->notify_fd);
+        follower->notify_fd = -1;
+    }
+    
+    if (follower->fd >= 0) {
+        close(follower->fd);
+        follower->fd = -1;
+    }
+}
+
+/**
+ * SIGINT 处理  只设置标记  由 follow 循环退出
+ */
+static void on_follow_signal(int signal) {
+    
+    (void)signal;
+    follow_stopped = 1;
 }
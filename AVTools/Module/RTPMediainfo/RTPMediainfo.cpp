@@ -29,20 +29,57 @@
  CSRC (Contributing source)                     可选  CC * 4            在 MCU 混流时使用，表示混流出的新的音视频流的 SSRC 是由哪些源 SSRC 贡献的。
  Extension Header                                      可选                   头部扩展，包含了音视频的一些额外信息，比如视频旋转角度。
  
- *注：程序只分析不含可选字段的 RTP 包。
+ *注：写入 payload 时会跳过 CSRC、头部扩展和 Padding，打印时只分析固定头部。
+
+ UDP 不保证顺序，同一个 SSRC 的包按 Sequence Number 放入抖动缓冲区（环形队列，下标为序列号对容量取模），在重排窗口内等待乱序的包，
+ 超出窗口仍未到达的包记为丢失，然后按顺序写出 payload。到达抖动按 RFC 3550 6.4.1 计算：
+     D(i, j) = (Rj - Ri) - (Sj - Si)      R 为到达时间，S 为 RTP 时间戳，均以 RTP 时钟为单位
+     J(i) = J(i - 1) + (|D(i - 1, i)| - J(i - 1)) / 16
+ 
+ H.264 的 RTP 打包参考 RFC 6184，payload 第一个字节与 NALU Header 格式相同，其中 Type 字段决定打包方式：
+        Type                   打包方式                                     描述
+       1 - 23          Single NAL Unit Packet          一个包就是一个完整的 NALU，写出时在前面加上 start code 即可
+         24                    STAP-A                          多个小 NALU 聚合在一个包中，每个 NALU 前有 2 字节的长度，常用于 SPS/PPS
+         28                     FU-A                             一个大 NALU 被拆分到多个包中，第二个字节为 FU Header：S(1) E(1) R(1) Type(5)
+                                                                           S/E 表示第一个/最后一个分片，NALU Header 由 FU Indicator 的 F/NRI 和 FU Header 的 Type 拼出
+ 同一帧（访问单元）的包 RTP 时间戳相同，最后一个包的 Marker 位为 1。程序把一帧的 NALU 以 AnnexB 格式拼接后整帧写出，
+ FU-A 中间分片丢失时丢弃这个 NALU，其余 NALU 照常写出。
  */
 
 #include "RTPMediainfo.h"
 #include <getopt.h>
 #include <stdlib.h>
 #include <string.h>
+#include <errno.h>
+#include <math.h>
+#include <poll.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
 #include <sys/socket.h>
+#include <sys/uio.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>
 #include "CPrint.h"
 
 #define LOCAL_IP_ADDR "127.0.0.1"
 #define RECV_BUFFER_SIZE 10240
+#define RECV_CONTROL_SIZE 64                    // 每个包的辅助数据  放接收时间戳和内核丢包计数
+#define RECV_DEFAULT_BATCH 64                   // 默认每次系统调用最多接收的包数
+#define RECV_MAX_BATCH 1024
+#define RECV_DEFAULT_SOCKET_BUFFER (4 * 1024 * 1024)
+#define RECV_POLL_TIMEOUT_MS 100
+#define OUTPUT_FILE_BUFFER_SIZE (1024 * 1024)
+#define REPORT_INTERVAL_NS 1000000000LL
+
+#define RTP_MAX_STREAMS 16                      // 最多同时跟踪的 SSRC 数
+#define RTP_DEFAULT_WINDOW 128                  // 默认重排窗口  单位包
+#define RTP_MAX_WINDOW 1024
+#define RTP_MAX_DROPOUT 3000                    // RFC 3550 A.1  序列号向前跳变超过此值视为异常
+#define RTP_MAX_MISORDER 100                    // RFC 3550 A.1  序列号向后跳变超过此值和重排窗口时视为异常
+#define RTP_DEFAULT_CLOCK_RATE 90000
+#define RTP_DEFAULT_H264_PAYLOAD_TYPE 96
+#define H264_FRAME_BUFFER_SIZE (4 * 1024 * 1024)  // 一帧 AnnexB 数据的缓冲区  超过时先写出已有部分
 
 #pragma pack(1)
 typedef struct RTP_FIXED_HEADER {
@@ -72,8 +109,155 @@ typedef struct RTCP_FIXED_HEADER {
     /* Byte 2, 3*/
     unsigned short length;
 } RTCP_FIXED_HEADER;
+#pragma pack()
+
+#if defined(__linux__)
+typedef struct mmsghdr RECV_MESSAGE;
+#else
+// macOS 没有 recvmmsg  使用相同的布局  逐个 recvmsg 直到读空
+typedef struct RECV_MESSAGE {
+    struct msghdr msg_hdr;
+    unsigned int msg_len;
+} RECV_MESSAGE;
+#endif
+
+/**
+ * 批量接收状态  每个包有独立的数据缓冲区、地址和辅助数据缓冲区
+ */
+typedef struct UDP_RECEIVER {
+    int fd;
+    int batch_size;
+    RECV_MESSAGE *messages;
+    struct iovec *iovecs;
+    struct sockaddr_in *addrs;
+    unsigned char *buffers;
+    unsigned char *controls;
+    
+    uint64_t syscalls;                  // 接收系统调用次数
+    uint64_t batches;                   // 收到数据的批次
+    int max_batch;                      // 单批最多的包数
+    uint32_t kernel_drops;              // 内核因接收缓冲区满丢弃的包数  累计值
+    bool drops_supported;               // 平台是否支持 SO_RXQ_OVFL
+} UDP_RECEIVER;
+
+/**
+ * 接收统计  时间单位 ns
+ */
+typedef struct RECV_STATS {
+    uint64_t packets;
+    uint64_t bytes;
+    uint64_t rtp_packets;
+    uint64_t rtcp_packets;
+    uint64_t invalid_packets;           // 长度不足一个固定头
+    uint64_t truncated_packets;         // 超过接收缓冲区被截断
+    uint64_t payload_bytes;             // 写入输出文件的字节数
+    int64_t first_arrival;
+    int64_t last_arrival;
+    int64_t max_arrival_gap;            // 相邻两包最大到达间隔
+} RECV_STATS;
 
-static void parse(short port, const char *output_url);
+/**
+ * 抖动缓冲区中的一个位置  数据区在 RTP_STREAM 创建时一次分配
+ */
+typedef struct RTP_SLOT {
+    int64_t seq;                        // 最近一次放入的扩展序列号  -1 表示从未使用
+    bool present;                       // 包还在等待写出
+    size_t size;
+    unsigned char *data;
+} RTP_SLOT;
+
+/**
+ * H.264 解包状态  一帧的 NALU 拼接在 frame 中  收到 Marker 或时间戳变化时整帧写出
+ */
+typedef struct H264_DEPACKETIZER {
+    unsigned char *frame;               // 第一个 H.264 包到达时分配  之后复用
+    size_t frame_size;
+    long fu_start;                      // 正在组装的 FU-A NALU 在 frame 中的起始位置  -1 表示没有
+    uint32_t timestamp;
+    int last_seq;                       // 上一个包的序列号  用来发现丢包  -1 表示还没有收到包
+    
+    uint64_t frames;
+    uint64_t nals;
+    uint64_t broken_nals;               // 分片不完整被丢弃的 NALU
+    uint64_t unsupported;               // STAP-B、MTAP、FU-B 等不支持的打包方式
+} H264_DEPACKETIZER;
+
+/**
+ * 一个 SSRC 的抖动缓冲区和统计  扩展序列号 = 回绕次数 * 65536 + Sequence Number
+ */
+typedef struct RTP_STREAM {
+    uint32_t ssrc;
+    int payload_type;
+    int clock_rate;
+    
+    int capacity;                       // 环形队列容量  2 的幂  不小于重排窗口
+    int buffered;                       // 等待写出的包数
+    RTP_SLOT *slots;
+    unsigned char *buffers;
+    
+    int64_t next_seq;                   // 下一个要写出的扩展序列号
+    int64_t highest_seq;                // 收到的最大扩展序列号
+    int64_t base_seq;                   // 本段收到的最小扩展序列号  之前的位置跳过时不计丢失  序列号重新同步后更新
+    int bad_seq;                        // RFC 3550 A.1  跳变后期望的下一个序列号  连续两个包确认后重新同步  -1 表示没有
+    
+    // RFC 3550 到达抖动  单位为 RTP 时钟
+    int64_t first_arrival;
+    double last_arrival;
+    uint32_t last_timestamp;
+    bool has_transit;
+    double jitter;
+    double max_jitter;
+    
+    uint64_t received;                  // 不含重复包
+    uint64_t expected_prior;            // 重新同步前各段的期望包数
+    uint64_t lost;                      // 超出重排窗口仍未到达  写出时跳过
+    uint64_t late;                      // 位置已经被跳过后才到达  或序列号跳变过大被丢弃
+    uint64_t duplicates;
+    uint64_t reordered;                 // 在窗口内乱序到达
+    uint64_t resyncs;
+    int64_t max_reorder;                // 最大乱序深度  单位包
+    
+    H264_DEPACKETIZER h264;
+} RTP_STREAM;
+
+/**
+ * 接收会话  逐包处理时需要的输出和统计
+ */
+typedef struct RTP_SESSION {
+    FILE *myout;
+    FILE *output_file;
+    bool summary;
+    int window;
+    int h264_payload_type;
+    RECV_STATS stats;
+    int stream_count;
+    RTP_STREAM *streams[RTP_MAX_STREAMS];
+} RTP_SESSION;
+
+static volatile sig_atomic_t parse_stopped = 0;
+
+static void parse(short port, const char *output_url, int batch_size, int socket_buffer_size, int window, int h264_payload_type, bool summary);
+static UDP_RECEIVER *alloc_udp_receiver(int fd, int batch_size);
+static void free_udp_receiver(UDP_RECEIVER *receiver);
+static int receive_batch(UDP_RECEIVER *receiver);
+static int64_t get_arrival_time(UDP_RECEIVER *receiver, int index);
+static void reset_message(UDP_RECEIVER *receiver, int index);
+static void handle_packet(RTP_SESSION *session, const unsigned char *recv_data, size_t pkt_size, const struct sockaddr_in *remote_addr, int64_t arrival);
+static RTP_STREAM *get_rtp_stream(RTP_SESSION *session, uint32_t ssrc, int payload_type);
+static void free_rtp_stream(RTP_STREAM *stream);
+static void push_rtp_packet(RTP_SESSION *session, RTP_STREAM *stream, const unsigned char *data, size_t size, int64_t arrival);
+static void pop_rtp_packet(RTP_SESSION *session, RTP_STREAM *stream);
+static void flush_rtp_stream(RTP_SESSION *session, RTP_STREAM *stream);
+static void update_rtp_jitter(RTP_STREAM *stream, uint32_t timestamp, int64_t arrival);
+static void write_rtp_payload(RTP_SESSION *session, RTP_STREAM *stream, const unsigned char *data, size_t size);
+static void depacketize_h264(RTP_SESSION *session, RTP_STREAM *stream, const unsigned char *data, const unsigned char *payload, size_t payload_size);
+static void append_h264_data(RTP_SESSION *session, H264_DEPACKETIZER *h264, const unsigned char *data, size_t size);
+static void append_h264_nal(RTP_SESSION *session, H264_DEPACKETIZER *h264, const unsigned char *nal, size_t size);
+static void finish_h264_frame(RTP_SESSION *session, H264_DEPACKETIZER *h264);
+static int get_rtp_clock_rate(int payload_type);
+static void print_recv_summary(const RTP_SESSION *session, const UDP_RECEIVER *receiver);
+static void on_parse_signal(int signal);
+static int64_t get_realtime_ns(void);
 
 static struct option tool_long_options[] = {
     {"help", no_argument, NULL, '`'}
@@ -85,15 +269,26 @@ static struct option tool_long_options[] = {
 static void show_module_help() {
     printf("Support Format:\n\n");
     printf("  - RTP/MPEG2-TS\n");
+    printf("  - RTP/H.264 (RFC 6184 Single NAL Unit, STAP-A, FU-A), Output AnnexB\n");
     printf("\n");
     printf("Param:\n\n");
     printf("  -p:   Listen Port\n");
     printf("  -o:   Output Path\n");
+    printf("  -b:   Receive Batch Size, Max Packets Per Syscall, Default %d, Max %d\n", RECV_DEFAULT_BATCH, RECV_MAX_BATCH);
+    printf("  -r:   Socket Receive Buffer Size In Bytes, Default %d\n", RECV_DEFAULT_SOCKET_BUFFER);
+    printf("  -w:   Reorder Window In Packets, Missing Packets Are Skipped Once This Many Newer Ones Arrive, Default %d, Max %d\n", RTP_DEFAULT_WINDOW, RTP_MAX_WINDOW);
+    printf("  -t:   H.264 Payload Type, Default %d\n", RTP_DEFAULT_H264_PAYLOAD_TYPE);
+    printf("  -s:   Summary Mode, Print Rate And Drops Every Second Instead Of Every Packet, -o Is Optional\n");
     printf("\n");
     printf("Usage:\n\n");
-    printf("  AVTools RTPMediainfo -p 8081 -o output.ts\n\n");
+    printf("  AVTools RTPMediainfo -p 8081 -o output.ts\n");
+    printf("  AVTools RTPMediainfo -p 8081 -o output.ts -s -b 256 -r 16777216\n");
+    printf("  AVTools RTPMediainfo -p 8081 -o output.ts -s -w 512\n");
+    printf("  AVTools RTPMediainfo -p 8081 -o output.h264 -t 96\n\n");
     printf("Push RTP/MPEG2-TS With FFMPEG:\n\n");
-    printf("  ffmpeg -re -i input.ts -f rtp_mpegts udp://127.0.0.1:8081\n");
+    printf("  ffmpeg -re -i input.ts -f rtp_mpegts udp://127.0.0.1:8081\n\n");
+    printf("Push RTP/H.264 With FFMPEG:\n\n");
+    printf("  ffmpeg -re -i input.mp4 -an -c:v copy -f rtp rtp://127.0.0.1:8081\n");
 }
 
 /**
@@ -105,8 +300,13 @@ void rtp_parser_parse_cmd(int argc, char *argv[]) {
     int option = 0;   // getopt_long的返回值，返回匹配到字符的ascii码，没有匹配到可读参数时返回-1
     short port = 8081;   // 默认监听 8081 端口
     const char *output_url = NULL;  // 输出路径
+    int batch_size = RECV_DEFAULT_BATCH;    // 每次系统调用最多接收的包数
+    int socket_buffer_size = RECV_DEFAULT_SOCKET_BUFFER;    // SO_RCVBUF
+    int window = RTP_DEFAULT_WINDOW;    // 重排窗口
+    int h264_payload_type = RTP_DEFAULT_H264_PAYLOAD_TYPE;  // H.264 的动态 payload type
+    bool summary = false;   // 汇总模式  不逐包打印
     
-    while (EOF != (option = getopt_long(argc, argv, "p:o:", tool_long_options, NULL))) {
+    while (EOF != (option = getopt_long(argc, argv, "p:o:b:r:w:t:s", tool_long_options, NULL))) {
         switch (option) {
             case '`':
                 show_module_help();
@@ -118,6 +318,21 @@ void rtp_parser_parse_cmd(int argc, char *argv[]) {
             case 'o':
                 output_url = optarg;
                 break;
+            case 'b':
+                batch_size = atoi(optarg);
+                break;
+            case 'r':
+                socket_buffer_size = atoi(optarg);
+                break;
+            case 'w':
+                window = atoi(optarg);
+                break;
+            case 't':
+                h264_payload_type = atoi(optarg);
+                break;
+            case 's':
+                summary = true;
+                break;
             case '?':
                 printf("Use 'AVTools %s --help' To Show Detail Usage.\n", argv[1]);
                 return;
@@ -127,50 +342,81 @@ void rtp_parser_parse_cmd(int argc, char *argv[]) {
         }
     }
     
-    if (output_url == NULL) {
+    if ((output_url == NULL && !summary) || batch_size <= 0 || batch_size > RECV_MAX_BATCH || socket_buffer_size <= 0 || window <= 0 || window > RTP_MAX_WINDOW || h264_payload_type < 0 || h264_payload_type > 127) {
         printf("RTPMediaInfo Param Error, Use 'AVTools %s --help' To Show Detail Usage.\n", argv[1]);
         return;
     }
     
-    parse(port, output_url);
+    parse(port, output_url, batch_size, socket_buffer_size, window, h264_payload_type, summary);
 }
 
 /**
  * Parse
- * @param port            Listen Port
- * @param output_url    Output File Path
+ * @param port                           Listen Port
+ * @param output_url                   Output File Path  汇总模式下可为 NULL
+ * @param batch_size                   每次系统调用最多接收的包数
+ * @param socket_buffer_size      SO_RCVBUF 大小
+ * @param window                       重排窗口  单位包
+ * @param h264_payload_type     H.264 的 payload type
+ * @param summary                      汇总模式  每秒输出一次速率和丢包
  */
-static void parse(short port, const char *output_url) {
+static void parse(short port, const char *output_url, int batch_size, int socket_buffer_size, int window, int h264_payload_type, bool summary) {
     
-    int udp_server_sock = 0;
+    int udp_server_sock = -1;
     struct sockaddr_in loc_addr = {};
-    struct sockaddr_in remote_addr = {};
-    socklen_t remote_addr_len = 0;
     
     int ret = 0;
-    int index = 0;
+    int on = 1;
+    int actual_buffer_size = 0;
+    socklen_t option_len = sizeof(actual_buffer_size);
     FILE *output_file = NULL;
     FILE *myout = stdout;
     
-    unsigned char *recv_data = NULL;
-    char payload_type_str[10] = {0};
-    
-    RTP_FIXED_HEADER rtp_header = {};
-    RTCP_FIXED_HEADER rtcp_header = {};
-    
-    size_t rtp_header_len = 0;
-    size_t rtcp_header_len = 0;
+    UDP_RECEIVER *receiver = NULL;
+    RTP_SESSION session = {};
+    struct sigaction action = {}, old_action = {};
+    int count = 0;
+    int64_t start_time = 0;
+    int64_t next_report = 0;
+    uint64_t last_packets = 0;
+    uint64_t last_bytes = 0;
+    uint32_t last_drops = 0;
+    uint64_t last_lost = 0;
     
         
     // 创建套接字  指定类型为ipv4 && UDP
     udp_server_sock = socket(AF_INET, SOCK_DGRAM, 0);
-    if (udp_server_sock > 0) {
+    if (udp_server_sock >= 0) {
         printf("UDP Socket Create Success.\n");
     } else {
         printf("UDP Socket Create Failed.\n");
         goto __END;
     }
     
+    // 放大接收缓冲区  Linux 上有 CAP_NET_ADMIN 时可以突破 net.core.rmem_max
+    ret = -1;
+#if defined(__linux__)
+    ret = setsockopt(udp_server_sock, SOL_SOCKET, SO_RCVBUFFORCE, &socket_buffer_size, sizeof(socket_buffer_size));
+#endif
+    if (ret < 0 && setsockopt(udp_server_sock, SOL_SOCKET, SO_RCVBUF, &socket_buffer_size, sizeof(socket_buffer_size)) < 0) {
+        printf("Set Socket Receive Buffer Size Error: %s\n", strerror(errno));
+    }
+    getsockopt(udp_server_sock, SOL_SOCKET, SO_RCVBUF, &actual_buffer_size, &option_len);
+#if defined(__linux__)
+    // Linux 返回值是设置值的两倍  包含内核簿记开销
+    actual_buffer_size /= 2;
+#endif
+    if (actual_buffer_size < socket_buffer_size) {
+        printf("Socket Receive Buffer Is %d Bytes, Less Than %d, Raise net.core.rmem_max Or kern.ipc.maxsockbuf.\n", actual_buffer_size, socket_buffer_size);
+    }
+    
+    // 内核接收时间戳
+#if defined(SO_TIMESTAMPNS)
+    setsockopt(udp_server_sock, SOL_SOCKET, SO_TIMESTAMPNS, &on, sizeof(on));
+#else
+    setsockopt(udp_server_sock, SOL_SOCKET, SO_TIMESTAMP, &on, sizeof(on));
+#endif
+    
     memset(&loc_addr, 0, sizeof(loc_addr));
     // 设置协议族
     loc_addr.sin_family = AF_INET;
@@ -189,80 +435,869 @@ static void parse(short port, const char *output_url) {
     }
     
     // 打开输出文件
-    output_file = fopen(output_url, "wb+");
-    if (!output_file) {
-        printf("Could Not Open Output File.\n");
+    if (output_url) {
+        output_file = fopen(output_url, "wb+");
+        if (!output_file) {
+            printf("Could Not Open Output File.\n");
+            goto __END;
+        }
+        // 每个包的 payload 只有 1KB 左右  用大缓冲区合并写入
+        setvbuf(output_file, NULL, _IOFBF, OUTPUT_FILE_BUFFER_SIZE);
+    }
+    
+    receiver = alloc_udp_receiver(udp_server_sock, batch_size);
+    if (!receiver) {
+        printf("Alloc UDP Receiver Error.\n");
         goto __END;
     }
     
-    printf("Listen %s:%d...\n", LOCAL_IP_ADDR, port);
+    session.myout = myout;
+    session.output_file = output_file;
+    session.summary = summary;
+    session.window = window;
+    session.h264_payload_type = h264_payload_type;
+    
+    // Ctrl+C 时跳出接收循环  输出总计
+    parse_stopped = 0;
+    action.sa_handler = on_parse_signal;
+    sigemptyset(&action.sa_mask);
+    sigaction(SIGINT, &action, &old_action);
+    
+    printf("Listen %s:%d, Batch %d, Receive Buffer %d Bytes, Reorder Window %d, Ctrl+C To Stop...\n", LOCAL_IP_ADDR, port, batch_size, actual_buffer_size, window);
+    
+    start_time = get_realtime_ns();
+    next_report = start_time + REPORT_INTERVAL_NS;
+    
+    while (!parse_stopped) {
+        // 上一批收满说明缓冲区里还有数据  直接接着读
+        if (count < receiver->batch_size) {
+            struct pollfd pfd = {udp_server_sock, POLLIN, 0};
+            ret = poll(&pfd, 1, RECV_POLL_TIMEOUT_MS);
+            if (ret < 0 && errno != EINTR) {
+                printf("Poll UDP Socket Error: %s\n", strerror(errno));
+                break;
+            }
+        }
+        
+        count = receive_batch(receiver);
+        if (count < 0) {
+            printf("Receive UDP Packet Error: %s\n", strerror(errno));
+            break;
+        }
+        
+        for (int i = 0; i < count; i++) {
+            const struct msghdr *message = &receiver->messages[i].msg_hdr;
+            size_t pkt_size = receiver->messages[i].msg_len;
+            
+            if (message->msg_flags & MSG_TRUNC) {
+                session.stats.truncated_packets++;
+                pkt_size = RECV_BUFFER_SIZE;
+            }
+            handle_packet(&session, receiver->buffers + (size_t)i * RECV_BUFFER_SIZE, pkt_size, &receiver->addrs[i], get_arrival_time(receiver, i));
+            reset_message(receiver, i);
+        }
+        
+        if (summary) {
+            int64_t now = get_realtime_ns();
+            if (now >= next_report) {
+                double seconds = (now - next_report + REPORT_INTERVAL_NS) / 1e9;
+                uint64_t lost = 0;
+                for (int i = 0; i < session.stream_count; i++) {
+                    lost += session.streams[i]->lost;
+                }
+                fprintf(myout, "[%8.1f s] %8.0f pkt/s, %8.2f Mbps, Drops +%u, Lost +%llu\n", (now - start_time) / 1e9, (session.stats.packets - last_packets) / seconds, (session.stats.bytes - last_bytes) * 8 / seconds / 1000000, receiver->kernel_drops - last_drops, (unsigned long long)(lost - last_lost));
+                fflush(myout);
+                last_packets = session.stats.packets;
+                last_bytes = session.stats.bytes;
+                last_drops = receiver->kernel_drops;
+                last_lost = lost;
+                next_report = now + REPORT_INTERVAL_NS;
+            }
+        }
+    }
+    
+    sigaction(SIGINT, &old_action, NULL);
     
-    bzero(&remote_addr, sizeof(remote_addr));
-    remote_addr_len = sizeof(sockaddr_in);
-    recv_data = (unsigned char *)calloc(RECV_BUFFER_SIZE, sizeof(unsigned char));
+    // 写出还在等待乱序包的数据
+    for (int i = 0; i < session.stream_count; i++) {
+        flush_rtp_stream(&session, session.streams[i]);
+    }
+    print_recv_summary(&session, receiver);
+    
+__END:
+    if (udp_server_sock >= 0) {
+        shutdown(udp_server_sock, 0);
+        close(udp_server_sock);
+        printf("UDP Socket Shut Down.\n");
+    }
+    
+    if (output_file) {
+        fclose(output_file);
+    }
+    
+    free_udp_receiver(receiver);
+    for (int i = 0; i < session.stream_count; i++) {
+        free_rtp_stream(session.streams[i]);
+    }
+}
+
+/**
+ * 分配批量接收状态  每个包一个 iovec、地址和辅助数据缓冲区  接收时无需再分配内存
+ * @param fd                          UDP Socket
+ * @param batch_size            每次最多接收的包数
+ * @return UDP_RECEIVER Instance  失败返回 NULL
+ */
+static UDP_RECEIVER *alloc_udp_receiver(int fd, int batch_size) {
+    
+    UDP_RECEIVER *receiver = (UDP_RECEIVER *)calloc(1, sizeof(UDP_RECEIVER));
+    if (!receiver) {
+        return NULL;
+    }
+    
+    receiver->fd = fd;
+    receiver->batch_size = batch_size;
+    receiver->messages = (RECV_MESSAGE *)calloc(batch_size, sizeof(RECV_MESSAGE));
+    receiver->iovecs = (struct iovec *)calloc(batch_size, sizeof(struct iovec));
+    receiver->addrs = (struct sockaddr_in *)calloc(batch_size, sizeof(struct sockaddr_in));
+    receiver->buffers = (unsigned char *)malloc((size_t)batch_size * RECV_BUFFER_SIZE);
+    receiver->controls = (unsigned char *)calloc(batch_size, RECV_CONTROL_SIZE);
+    if (!receiver->messages || !receiver->iovecs || !receiver->addrs || !receiver->buffers || !receiver->controls) {
+        free_udp_receiver(receiver);
+        return NULL;
+    }
+    
+    for (int i = 0; i < batch_size; i++) {
+        receiver->iovecs[i].iov_base = receiver->buffers + (size_t)i * RECV_BUFFER_SIZE;
+        receiver->iovecs[i].iov_len = RECV_BUFFER_SIZE;
+        receiver->messages[i].msg_hdr.msg_iov = &receiver->iovecs[i];
+        receiver->messages[i].msg_hdr.msg_iovlen = 1;
+        reset_message(receiver, i);
+    }
+    
+    // 内核丢包计数  每个包的辅助数据里带上 socket 累计丢弃的包数
+#if defined(SO_RXQ_OVFL)
+    int on = 1;
+    receiver->drops_supported = setsockopt(fd, SOL_SOCKET, SO_RXQ_OVFL, &on, sizeof(on)) == 0;
+#endif
+    return receiver;
+}
+
+/**
+ * 释放批量接收状态
+ * @param receiver                UDP_RECEIVER Instance
+ */
+static void free_udp_receiver(UDP_RECEIVER *receiver) {
+    
+    if (!receiver) {
+        return;
+    }
+    free(receiver->messages);
+    free(receiver->iovecs);
+    free(receiver->addrs);
+    free(receiver->buffers);
+    free(receiver->controls);
+    free(receiver);
+}
+
+/**
+ * 非阻塞接收一批包  Linux 上一次 recvmmsg  其他平台逐个 recvmsg 直到读空或收满
+ * @param receiver                UDP_RECEIVER Instance
+ * @return 收到的包数  没有数据返回 0  出错返回 -1
+ */
+static int receive_batch(UDP_RECEIVER *receiver) {
+    
+    int count = 0;
+    
+#if defined(__linux__)
+    count = recvmmsg(receiver->fd, receiver->messages, receiver->batch_size, MSG_DONTWAIT, NULL);
+    receiver->syscalls++;
+    if (count < 0) {
+        return (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) ? 0 : -1;
+    }
+#else
+    while (count < receiver->batch_size) {
+        ssize_t received = recvmsg(receiver->fd, &receiver->messages[count].msg_hdr, MSG_DONTWAIT);
+        receiver->syscalls++;
+        if (received < 0) {
+            if (count == 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+                return -1;
+            }
+            break;
+        }
+        receiver->messages[count].msg_len = (unsigned int)received;
+        count++;
+    }
+#endif
+    
+    if (count > 0) {
+        receiver->batches++;
+        if (count > receiver->max_batch) {
+            receiver->max_batch = count;
+        }
+    }
+    return count;
+}
+
+/**
+ * 取出包的内核接收时间  同时更新内核丢包计数
+ * @param receiver                UDP_RECEIVER Instance
+ * @param index                     包在本批中的序号
+ * @return 接收时间  单位ns  没有内核时间戳时用当前时间
+ */
+static int64_t get_arrival_time(UDP_RECEIVER *receiver, int index) {
+    
+    struct msghdr *message = &receiver->messages[index].msg_hdr;
+    int64_t arrival = -1;
+    
+    for (struct cmsghdr *cmsg = CMSG_FIRSTHDR(message); cmsg; cmsg = CMSG_NXTHDR(message, cmsg)) {
+        if (cmsg->cmsg_level != SOL_SOCKET) {
+            continue;
+        }
+#if defined(SO_TIMESTAMPNS)
+        if (cmsg->cmsg_type == SCM_TIMESTAMPNS) {
+            struct timespec ts;
+            memcpy(&ts, CMSG_DATA(cmsg), sizeof(ts));
+            arrival = ts.tv_sec * 1000000000LL + ts.tv_nsec;
+        }
+#else
+        if (cmsg->cmsg_type == SCM_TIMESTAMP) {
+            struct timeval tv;
+            memcpy(&tv, CMSG_DATA(cmsg), sizeof(tv));
+            arrival = tv.tv_sec * 1000000000LL + tv.tv_usec * 1000LL;
+        }
+#endif
+#if defined(SO_RXQ_OVFL)
+        if (cmsg->cmsg_type == SO_RXQ_OVFL) {
+            uint32_t drops;
+            memcpy(&drops, CMSG_DATA(cmsg), sizeof(drops));
+            receiver->kernel_drops = drops;
+        }
+#endif
+    }
+    
+    return arrival >= 0 ? arrival : get_realtime_ns();
+}
+
+/**
+ * 恢复 msghdr 中会被内核改写的长度字段  为下一次接收做准备
+ * @param receiver                UDP_RECEIVER Instance
+ * @param index                     包在本批中的序号
+ */
+static void reset_message(UDP_RECEIVER *receiver, int index) {
+    
+    struct msghdr *message = &receiver->messages[index].msg_hdr;
+    
+    message->msg_name = &receiver->addrs[index];
+    message->msg_namelen = sizeof(struct sockaddr_in);
+    message->msg_control = receiver->controls + (size_t)index * RECV_CONTROL_SIZE;
+    message->msg_controllen = RECV_CONTROL_SIZE;
+    message->msg_flags = 0;
+}
+
+/**
+ * 处理一个 UDP 包  打印包信息  RTP 包放入所属 SSRC 的抖动缓冲区
+ * @param session                   RTP_SESSION Instance
+ * @param recv_data               包数据
+ * @param pkt_size                 包大小
+ * @param remote_addr          发送端地址
+ * @param arrival                   接收时间  单位ns
+ */
+static void handle_packet(RTP_SESSION *session, const unsigned char *recv_data, size_t pkt_size, const struct sockaddr_in *remote_addr, int64_t arrival) {
+    
+    RECV_STATS *stats = &session->stats;
+    FILE *myout = session->myout;
+    char payload_type_str[16] = {0};
+    
+    RTP_FIXED_HEADER rtp_header = {};
+    RTCP_FIXED_HEADER rtcp_header = {};
+    RTP_STREAM *stream = NULL;
+    
+    size_t rtp_header_len = sizeof(RTP_FIXED_HEADER);
+    size_t rtcp_header_len = sizeof(RTCP_FIXED_HEADER);
+    
+    if (stats->packets > 0 && arrival - stats->last_arrival > stats->max_arrival_gap) {
+        stats->max_arrival_gap = arrival - stats->last_arrival;
+    }
+    if (stats->packets == 0) {
+        stats->first_arrival = arrival;
+    }
+    stats->last_arrival = arrival;
+    stats->packets++;
+    stats->bytes += pkt_size;
+    
+    if (pkt_size < rtcp_header_len) {
+        stats->invalid_packets++;
+        return;
+    }
     
-    while (1) {
-        // 接受 UDP 数据   每次读取一个 RTP 包
-        ssize_t pkt_size = recvfrom(udp_server_sock, recv_data, RECV_BUFFER_SIZE, 0, (struct sockaddr *)&remote_addr, &remote_addr_len);
-        if (pkt_size > 0) {
 #if 1 /*1: dump rtp payload  0: dump rtp packet*/
-            if (recv_data[1] == 0xc8 || recv_data[1] == 0xc9) {
-                // RTCP Header
-                rtcp_header_len = sizeof(RTCP_FIXED_HEADER);
-                memcpy((void *)&rtcp_header, recv_data, rtcp_header_len);
+    if (recv_data[1] == 0xc8 || recv_data[1] == 0xc9) {
+        // RTCP Header
+        memcpy((void *)&rtcp_header, recv_data, rtcp_header_len);
+        stats->rtcp_packets++;
                 
-                switch (rtcp_header.PT) {
-                    case 200: sprintf(payload_type_str, "SR"); break;
-                    case 201: sprintf(payload_type_str, "RR"); break;
-                    default: sprintf(payload_type_str, "Other(%d)", rtp_header.PT); break;
-                }
+        if (session->summary) {
+            return;
+        }
+        switch (rtcp_header.PT) {
+            case 200: sprintf(payload_type_str, "SR"); break;
+            case 201: sprintf(payload_type_str, "RR"); break;
+            default: sprintf(payload_type_str, "Other(%d)", rtcp_header.PT); break;
+        }
                 
-                fprintf(myout, "[RTCP Pkt] %5d| %15s:%5hu| %10s| %10u| %5d| %5zd|\n", index, inet_ntoa(remote_addr.sin_addr), ntohs(remote_addr.sin_port), payload_type_str, ntohl(rtp_header.Timestamp), ntohs(rtp_header.Seq_No), pkt_size);
-            } else {
-                // RTP Header
-                rtp_header_len = sizeof(RTP_FIXED_HEADER);
-                memcpy((void *)&rtp_header, recv_data, rtp_header_len);
+        fprintf(myout, "[RTCP Pkt] %5llu| %15s:%5hu| %10s| %10u| %5d| %5zd|\n", (unsigned long long)stats->packets - 1, inet_ntoa(remote_addr->sin_addr), ntohs(remote_addr->sin_port), payload_type_str, ntohl(rtp_header.Timestamp), ntohs(rtp_header.Seq_No), pkt_size);
+    } else {
+        if (pkt_size < rtp_header_len) {
+            stats->invalid_packets++;
+            return;
+        }
+        // RTP Header
+        memcpy((void *)&rtp_header, recv_data, rtp_header_len);
+        if (rtp_header.Version != 2) {
+            stats->invalid_packets++;
+            return;
+        }
+        stats->rtp_packets++;
                 
-                // RFC3551
-                switch (rtp_header.PT) {
-                    case 18: sprintf(payload_type_str, "Audio"); break;
-                    case 31: sprintf(payload_type_str, "H.261"); break;
-                    case 32: sprintf(payload_type_str, "MPV"); break;
-                    case 33: sprintf(payload_type_str, "MP2T"); break;
-                    case 34: sprintf(payload_type_str, "H.263"); break;
-                    case 96: sprintf(payload_type_str, "H.264"); break;
-                    default: sprintf(payload_type_str, "Other(%d)", rtp_header.PT); break;
-                }
+        if (!session->summary) {
+            // RFC3551
+            switch (rtp_header.PT) {
+                case 18: sprintf(payload_type_str, "Audio"); break;
+                case 31: sprintf(payload_type_str, "H.261"); break;
+                case 32: sprintf(payload_type_str, "MPV"); break;
+                case 33: sprintf(payload_type_str, "MP2T"); break;
+                case 34: sprintf(payload_type_str, "H.263"); break;
+                default: sprintf(payload_type_str, "Other(%d)", rtp_header.PT); break;
+            }
+            if (rtp_header.PT == session->h264_payload_type) {
+                sprintf(payload_type_str, "H.264");
+            }
                 
-                fprintf(myout, "[RTP Pkt]  %5d| %15s:%5hu| %10s| %10u| %5d| %5zd|\n", index, inet_ntoa(remote_addr.sin_addr), ntohs(remote_addr.sin_port), payload_type_str, ntohl(rtp_header.Timestamp), ntohs(rtp_header.Seq_No), pkt_size);
+            fprintf(myout, "[RTP Pkt]  %5llu| %15s:%5hu| %10s| %10u| %5d| %5zd|\n", (unsigned long long)stats->packets - 1, inet_ntoa(remote_addr->sin_addr), ntohs(remote_addr->sin_port), payload_type_str, ntohl(rtp_header.Timestamp), ntohs(rtp_header.Seq_No), pkt_size);
+        }
                 
-                // RTP Data
-                // 这里只当 payload type 为 MP2T 时写入本地   H264 和 AAC 在 RTP 中的打包不是 NALU 和 ADTS 的方式  需特殊解析后才能播放  暂不处理
-                if (rtp_header.PT == 33) {
-                    unsigned char *rtp_data = recv_data + rtp_header_len;
-                    size_t rtp_data_size = pkt_size - rtp_header_len;
-                    fwrite(rtp_data, rtp_data_size, 1, output_file);
-                }
-            }
+        // RTP Data
+        // 按 SSRC 放入抖动缓冲区  按序列号顺序写出 payload
+        stream = get_rtp_stream(session, ntohl(rtp_header.SSRC), rtp_header.PT);
+        if (!stream) {
+            stats->invalid_packets++;
+            return;
+        }
+        push_rtp_packet(session, stream, recv_data, pkt_size, arrival);
+    }
 #else
-            fprintf(myout, "[UDP Pkt] %5d| %5zd|\n", index, pkt_size);
-            fwrite(recv_data, pkt_size, 1, output_file);
+    if (!session->summary) {
+        fprintf(myout, "[UDP Pkt] %5llu| %5zd|\n", (unsigned long long)stats->packets - 1, pkt_size);
+    }
+    if (session->output_file) {
+        fwrite(recv_data, pkt_size, 1, session->output_file);
+        stats->payload_bytes += pkt_size;
+    }
 #endif
-            index++;
+}
+
+/**
+ * 查找 SSRC 对应的流  第一次出现时创建抖动缓冲区
+ * @param session                   RTP_SESSION Instance
+ * @param ssrc                         SSRC
+ * @param payload_type          Payload Type  用来确定 RTP 时钟频率
+ * @return RTP_STREAM Instance  SSRC 过多或分配失败返回 NULL
+ */
+static RTP_STREAM *get_rtp_stream(RTP_SESSION *session, uint32_t ssrc, int payload_type) {
+    
+    RTP_STREAM *stream = NULL;
+    
+    for (int i = 0; i < session->stream_count; i++) {
+        if (session->streams[i]->ssrc == ssrc) {
+            return session->streams[i];
         }
     }
+    if (session->stream_count >= RTP_MAX_STREAMS) {
+        return NULL;
+    }
     
-__END:
-    if (udp_server_sock > 0) {
-        shutdown(udp_server_sock, 0);
-        printf("UDP Socket Shut Down.\n");
+    stream = (RTP_STREAM *)calloc(1, sizeof(RTP_STREAM));
+    if (!stream) {
+        return NULL;
+    }
+    // 容量取 2 的幂  序列号取模只需要位与
+    stream->capacity = 1;
+    while (stream->capacity < session->window) {
+        stream->capacity <<= 1;
+    }
+    stream->slots = (RTP_SLOT *)calloc(stream->capacity, sizeof(RTP_SLOT));
+    stream->buffers = (unsigned char *)malloc((size_t)stream->capacity * RECV_BUFFER_SIZE);
+    if (!stream->slots || !stream->buffers) {
+        printf("Alloc Jitter Buffer For SSRC 0x%08X Error.\n", ssrc);
+        free_rtp_stream(stream);
+        return NULL;
+    }
+    for (int i = 0; i < stream->capacity; i++) {
+        stream->slots[i].seq = -1;
+        stream->slots[i].data = stream->buffers + (size_t)i * RECV_BUFFER_SIZE;
     }
     
-    if (output_file) {
-        fclose(output_file);
+    stream->ssrc = ssrc;
+    stream->payload_type = payload_type;
+    stream->clock_rate = get_rtp_clock_rate(payload_type);
+    stream->next_seq = -1;
+    stream->bad_seq = -1;
+    stream->h264.fu_start = -1;
+    stream->h264.last_seq = -1;
+    
+    session->streams[session->stream_count++] = stream;
+    return stream;
+}
+
+/**
+ * 释放流
+ * @param stream                     RTP_STREAM Instance
+ */
+static void free_rtp_stream(RTP_STREAM *stream) {
+    
+    if (!stream) {
+        return;
+    }
+    free(stream->slots);
+    free(stream->buffers);
+    free(stream->h264.frame);
+    free(stream);
+}
+
+/**
+ * 把 RTP 包放入抖动缓冲区  写出所有已经连续的包
+ * 顺序到达的包直接写出  只有乱序时才拷贝到环形队列
+ * @param session                   RTP_SESSION Instance
+ * @param stream                     RTP_STREAM Instance
+ * @param data                         RTP 包  含头部
+ * @param size                          包大小
+ * @param arrival                     接收时间  单位ns
+ */
+static void push_rtp_packet(RTP_SESSION *session, RTP_STREAM *stream, const unsigned char *data, size_t size, int64_t arrival) {
+    
+    uint16_t seq = (uint16_t)((data[2] << 8) | data[3]);
+    uint32_t timestamp = ((uint32_t)data[4] << 24) | (data[5] << 16) | (data[6] << 8) | data[7];
+    int mask = stream->capacity - 1;
+    int delta = 0;
+    int64_t ext = 0;
+    RTP_SLOT *slot = NULL;
+    // 重排窗口内的乱序包不能当作跳变丢弃
+    int max_misorder = session->window > RTP_MAX_MISORDER ? session->window : RTP_MAX_MISORDER;
+    
+    // 第一个包  从第二个回绕周期开始编号  稍早发出但晚到的包不会得到负的序列号
+    // 第一个包不一定是最早发出的  写出位置从它之前一个窗口开始  窗口填满前先不写出
+    if (stream->next_seq < 0) {
+        stream->base_seq = stream->highest_seq = 65536 + seq;
+        stream->next_seq = stream->highest_seq - session->window + 1;
+    }
+    
+    // 与收到的最大序列号比较  16 位差值自动处理回绕
+    delta = (int16_t)(seq - (uint16_t)stream->highest_seq);
+    ext = stream->highest_seq + delta;
+    
+    // 序列号大幅跳变  可能是发送端重启  RFC 3550 A.1: 连续两个包确认后重新同步  否则丢弃
+    if (delta > RTP_MAX_DROPOUT || delta < -max_misorder) {
+        if (seq != stream->bad_seq) {
+            stream->bad_seq = (seq + 1) & 0xFFFF;
+            stream->late++;
+            return;
+        }
+        flush_rtp_stream(session, stream);
+        stream->expected_prior += stream->highest_seq - stream->base_seq + 1;
+        ext = (stream->next_seq & ~0xFFFFLL) + seq;
+        if (ext < stream->next_seq) {
+            ext += 65536;
+        }
+        stream->base_seq = stream->next_seq = stream->highest_seq = ext;
+        stream->has_transit = false;
+        stream->resyncs++;
+    }
+    stream->bad_seq = -1;
+    
+    slot = &stream->slots[ext & mask];
+    // 已经写出或跳过  位置里还是这个序列号说明是重复包
+    if (ext < stream->next_seq) {
+        if (slot->seq == ext) {
+            stream->duplicates++;
+        } else {
+            stream->late++;
+        }
+        return;
+    }
+    if (slot->present && slot->seq == ext) {
+        stream->duplicates++;
+        return;
+    }
+    
+    stream->received++;
+    update_rtp_jitter(stream, timestamp, arrival);
+    if (ext < stream->base_seq) {
+        stream->base_seq = ext;
+    }
+    
+    if (ext < stream->highest_seq) {
+        stream->reordered++;
+        if (stream->highest_seq - ext > stream->max_reorder) {
+            stream->max_reorder = stream->highest_seq - ext;
+        }
+    } else {
+        stream->highest_seq = ext;
+    }
+    
+    // 超出重排窗口  写出或跳过最旧的位置  新包一定落在窗口内
+    while (stream->highest_seq - stream->next_seq >= session->window) {
+        pop_rtp_packet(session, stream);
+    }
+    
+    if (ext == stream->next_seq) {
+        write_rtp_payload(session, stream, data, size);
+        slot->seq = ext;
+        stream->next_seq++;
+    } else {
+        memcpy(slot->data, data, size);
+        slot->size = size;
+        slot->seq = ext;
+        slot->present = true;
+        stream->buffered++;
+    }
+    
+    // 写出已经连续的包
+    while (stream->buffered > 0) {
+        slot = &stream->slots[stream->next_seq & mask];
+        if (!slot->present || slot->seq != stream->next_seq) {
+            break;
+        }
+        pop_rtp_packet(session, stream);
+    }
+}
+
+/**
+ * 写出下一个序列号的包  包没有到达时跳过  第一个收到的包之前的位置不计丢失
+ * @param session                   RTP_SESSION Instance
+ * @param stream                     RTP_STREAM Instance
+ */
+static void pop_rtp_packet(RTP_SESSION *session, RTP_STREAM *stream) {
+    
+    RTP_SLOT *slot = &stream->slots[stream->next_seq & (stream->capacity - 1)];
+    
+    if (slot->present && slot->seq == stream->next_seq) {
+        write_rtp_payload(session, stream, slot->data, slot->size);
+        slot->present = false;
+        stream->buffered--;
+    } else if (stream->next_seq >= stream->base_seq) {
+        stream->lost++;
+    }
+    stream->next_seq++;
+}
+
+/**
+ * 写出缓冲区中所有的包  中间缺少的包记为丢失  H.264 未结束的帧一并写出
+ * @param session                   RTP_SESSION Instance
+ * @param stream                     RTP_STREAM Instance
+ */
+static void flush_rtp_stream(RTP_SESSION *session, RTP_STREAM *stream) {
+    
+    while (stream->buffered > 0) {
+        pop_rtp_packet(session, stream);
+    }
+    finish_h264_frame(session, &stream->h264);
+}
+
+/**
+ * RFC 3550 6.4.1 到达抖动  按到达顺序计算  乱序包同样参与
+ * @param stream                     RTP_STREAM Instance
+ * @param timestamp               RTP 时间戳
+ * @param arrival                     接收时间  单位ns
+ */
+static void update_rtp_jitter(RTP_STREAM *stream, uint32_t timestamp, int64_t arrival) {
+    
+    double arrival_units = 0;
+    
+    if (!stream->has_transit) {
+        stream->first_arrival = arrival;
+        stream->has_transit = true;
+    } else {
+        // 到达时间换算为 RTP 时钟单位  时间戳差值按 32 位有符号数处理回绕
+        arrival_units = (arrival - stream->first_arrival) * (double)stream->clock_rate / 1e9;
+        double d = (arrival_units - stream->last_arrival) - (int32_t)(timestamp - stream->last_timestamp);
+        stream->jitter += (fabs(d) - stream->jitter) / 16;
+        if (stream->jitter > stream->max_jitter) {
+            stream->max_jitter = stream->jitter;
+        }
+    }
+    stream->last_arrival = arrival_units;
+    stream->last_timestamp = timestamp;
+}
+
+/**
+ * 按顺序写出 RTP 包的 payload  跳过 CSRC、头部扩展和 Padding
+ * @param session                   RTP_SESSION Instance
+ * @param stream                     RTP_STREAM Instance
+ * @param data                         RTP 包  含头部
+ * @param size                          包大小
+ */
+static void write_rtp_payload(RTP_SESSION *session, RTP_STREAM *stream, const unsigned char *data, size_t size) {
+    
+    size_t offset = sizeof(RTP_FIXED_HEADER) + (data[0] & 0x0F) * 4;
+    size_t padding = 0;
+    int payload_type = data[1] & 0x7F;
+    
+    // 头部扩展  4 字节的 profile 和长度  长度以 4 字节为单位
+    if ((data[0] & 0x10) && offset + 4 <= size) {
+        offset += 4 + ((data[offset + 2] << 8) | data[offset + 3]) * 4;
+    }
+    // Padding 最后一个字节是 Padding 的长度
+    if ((data[0] & 0x20) && size > 0) {
+        padding = data[size - 1];
+    }
+    if (offset + padding > size) {
+        session->stats.invalid_packets++;
+        return;
+    }
+    
+    if (!session->output_file) {
+        return;
+    }
+    // MP2T 直接写入本地  H264 在 RTP 中的打包不是 AnnexB 的方式  需解包后才能播放  AAC 暂不处理
+    if (payload_type == 33) {
+        fwrite(data + offset, size - offset - padding, 1, session->output_file);
+        session->stats.payload_bytes += size - offset - padding;
+    } else if (payload_type == session->h264_payload_type) {
+        depacketize_h264(session, stream, data, data + offset, size - offset - padding);
+    }
+}
+
+/**
+ * RFC 6184 H.264 解包  包已经由抖动缓冲区排好序  序列号不连续说明中间丢包
+ * @param session                   RTP_SESSION Instance
+ * @param stream                     RTP_STREAM Instance
+ * @param data                         RTP 包  含头部
+ * @param payload                   RTP payload
+ * @param payload_size           payload 大小
+ */
+static void depacketize_h264(RTP_SESSION *session, RTP_STREAM *stream, const unsigned char *data, const unsigned char *payload, size_t payload_size) {
+    
+    H264_DEPACKETIZER *h264 = &stream->h264;
+    bool marker = (data[1] & 0x80) != 0;
+    int seq = (data[2] << 8) | data[3];
+    uint32_t timestamp = ((uint32_t)data[4] << 24) | (data[5] << 16) | (data[6] << 8) | data[7];
+    int nal_type = 0;
+    
+    if (!h264->frame) {
+        h264->frame = (unsigned char *)malloc(H264_FRAME_BUFFER_SIZE);
+        if (!h264->frame) {
+            printf("Alloc H.264 Frame Buffer For SSRC 0x%08X Error.\n", stream->ssrc);
+            return;
+        }
+    }
+    
+    // 时间戳变化说明上一帧的 Marker 包丢了  先写出上一帧
+    if (h264->frame_size > 0 && timestamp != h264->timestamp) {
+        finish_h264_frame(session, h264);
+    }
+    // 中间丢包  正在组装的 FU-A 缺少分片  丢弃这个 NALU
+    if (h264->last_seq >= 0 && seq != ((h264->last_seq + 1) & 0xFFFF) && h264->fu_start >= 0) {
+        h264->frame_size = h264->fu_start;
+        h264->fu_start = -1;
+        h264->broken_nals++;
+    }
+    h264->last_seq = seq;
+    h264->timestamp = timestamp;
+    
+    if (payload_size < 1) {
+        return;
+    }
+    nal_type = payload[0] & 0x1F;
+    
+    if (nal_type >= 1 && nal_type <= 23) {
+        // Single NAL Unit Packet
+        append_h264_nal(session, h264, payload, payload_size);
+    } else if (nal_type == 24) {
+        // STAP-A: STAP-A NAL HDR (1) + [NALU Size (2) + NALU] * n
+        size_t pos = 1;
+        while (pos + 2 <= payload_size) {
+            size_t nal_size = (payload[pos] << 8) | payload[pos + 1];
+            pos += 2;
+            if (nal_size == 0 || pos + nal_size > payload_size) {
+                h264->broken_nals++;
+                break;
+            }
+            append_h264_nal(session, h264, payload + pos, nal_size);
+            pos += nal_size;
+        }
+    } else if (nal_type == 28) {
+        // FU-A: FU Indicator (1) + FU Header (1) + Fragment
+        if (payload_size < 2) {
+            h264->broken_nals++;
+            return;
+        }
+        unsigned char fu_header = payload[1];
+        if (fu_header & 0x80) {
+            // 上一个 NALU 没有收到结束分片
+            if (h264->fu_start >= 0) {
+                h264->frame_size = h264->fu_start;
+                h264->broken_nals++;
+            }
+            unsigned char nal_header = (payload[0] & 0xE0) | (fu_header & 0x1F);
+            h264->fu_start = (long)h264->frame_size;
+            append_h264_nal(session, h264, &nal_header, 1);
+        }
+        // 没有开始分片的 NALU 无法恢复  跳过后续分片
+        if (h264->fu_start >= 0) {
+            append_h264_data(session, h264, payload + 2, payload_size - 2);
+            if (fu_header & 0x40) {
+                h264->fu_start = -1;
+            }
+        }
+    } else {
+        h264->unsupported++;
+    }
+    
+    if (marker) {
+        finish_h264_frame(session, h264);
+    }
+}
+
+/**
+ * 追加数据到当前帧  缓冲区放不下时先写出已有部分  AnnexB 是字节流  分开写不影响解码
+ * @param session                   RTP_SESSION Instance
+ * @param h264                         H264_DEPACKETIZER Instance
+ * @param data                         数据
+ * @param size                          数据大小  不超过一个 UDP 包
+ */
+static void append_h264_data(RTP_SESSION *session, H264_DEPACKETIZER *h264, const unsigned char *data, size_t size) {
+    
+    if (h264->frame_size + size > H264_FRAME_BUFFER_SIZE) {
+        fwrite(h264->frame, h264->frame_size, 1, session->output_file);
+        session->stats.payload_bytes += h264->frame_size;
+        h264->frame_size = 0;
+        // 已写出的 NALU 头部无法撤回  之后按新位置继续组装
+        if (h264->fu_start >= 0) {
+            h264->fu_start = 0;
+        }
+    }
+    memcpy(h264->frame + h264->frame_size, data, size);
+    h264->frame_size += size;
+}
+
+/**
+ * 追加一个 NALU  前面加上 4 字节的 start code
+ * @param session                   RTP_SESSION Instance
+ * @param h264                         H264_DEPACKETIZER Instance
+ * @param nal                           NALU  含 NALU Header
+ * @param size                          NALU 大小
+ */
+static void append_h264_nal(RTP_SESSION *session, H264_DEPACKETIZER *h264, const unsigned char *nal, size_t size) {
+    
+    static const unsigned char start_code[4] = {0x00, 0x00, 0x00, 0x01};
+    
+    append_h264_data(session, h264, start_code, sizeof(start_code));
+    append_h264_data(session, h264, nal, size);
+    h264->nals++;
+}
+
+/**
+ * 写出当前帧  未完成的 FU-A NALU 丢弃
+ * @param session                   RTP_SESSION Instance
+ * @param h264                         H264_DEPACKETIZER Instance
+ */
+static void finish_h264_frame(RTP_SESSION *session, H264_DEPACKETIZER *h264) {
+    
+    if (h264->fu_start >= 0) {
+        h264->frame_size = h264->fu_start;
+        h264->fu_start = -1;
+        h264->broken_nals++;
+    }
+    if (h264->frame_size == 0) {
+        return;
+    }
+    fwrite(h264->frame, h264->frame_size, 1, session->output_file);
+    session->stats.payload_bytes += h264->frame_size;
+    h264->frame_size = 0;
+    h264->frames++;
+}
+
+/**
+ * RTP 时钟频率  静态类型参考 RFC 3551  动态类型按视频的 90kHz
+ * @param payload_type          Payload Type
+ * @return 时钟频率  单位Hz
+ */
+static int get_rtp_clock_rate(int payload_type) {
+    
+    switch (payload_type) {
+        case 6: return 16000;
+        case 10:
+        case 11: return 44100;
+        case 16: return 11025;
+        case 17: return 22050;
+        default: break;
+    }
+    return payload_type < 25 && payload_type != 14 ? 8000 : RTP_DEFAULT_CLOCK_RATE;
+}
+
+/**
+ * 打印接收总计和每个 SSRC 的统计
+ * @param session                   RTP_SESSION Instance
+ * @param receiver                 UDP_RECEIVER Instance
+ */
+static void print_recv_summary(const RTP_SESSION *session, const UDP_RECEIVER *receiver) {
+    
+    FILE *myout = session->myout;
+    const RECV_STATS *stats = &session->stats;
+    double seconds = stats->packets > 1 ? (stats->last_arrival - stats->first_arrival) / 1e9 : 0;
+    
+    fprintf(myout, "\n");
+    fprintf(myout, "Packets:           %llu (RTP %llu, RTCP %llu, Invalid %llu, Truncated %llu)\n", (unsigned long long)stats->packets, (unsigned long long)stats->rtp_packets, (unsigned long long)stats->rtcp_packets, (unsigned long long)stats->invalid_packets, (unsigned long long)stats->truncated_packets);
+    fprintf(myout, "Bytes:             %llu, Payload Written %llu\n", (unsigned long long)stats->bytes, (unsigned long long)stats->payload_bytes);
+    if (seconds > 0) {
+        fprintf(myout, "Rate:              %.0f pkt/s, %.2f Mbps Over %.3f s\n", (stats->packets - 1) / seconds, stats->bytes * 8 / seconds / 1000000, seconds);
+    }
+    fprintf(myout, "Max Arrival Gap:   %.3f ms\n", stats->max_arrival_gap / 1e6);
+    fprintf(myout, "Syscalls:          %llu, %.1f Packets Per Batch, Max %d\n", (unsigned long long)receiver->syscalls, receiver->batches ? (double)stats->packets / receiver->batches : 0, receiver->max_batch);
+    if (receiver->drops_supported) {
+        fprintf(myout, "Kernel Drops:      %u\n", receiver->kernel_drops);
+    } else {
+        fprintf(myout, "Kernel Drops:      Not Supported On This Platform\n");
     }
     
-    if (recv_data) {
-        free(recv_data);
+    if (session->stream_count == 0) {
+        return;
+    }
+    // Expected 按 RFC 3550 A.3 由序列号范围计算  Lost 是超出重排窗口后被跳过的包  Late 是跳过后才到达的包
+    fprintf(myout, "\n%-10s| %4s| %6s| %10s| %10s| %8s| %8s| %8s| %10s| %8s| %6s| %10s| %10s|\n", "SSRC", "PT", "Clock", "Received", "Expected", "Lost", "Late", "Dup", "Reordered", "MaxDepth", "Resync", "Jitter(ms)", "MaxJit(ms)");
+    for (int i = 0; i < session->stream_count; i++) {
+        const RTP_STREAM *stream = session->streams[i];
+        uint64_t expected = stream->expected_prior + (stream->next_seq >= 0 ? stream->highest_seq - stream->base_seq + 1 : 0);
+        
+        fprintf(myout, "0x%08X| %4d| %6d| %10llu| %10llu| %8llu| %8llu| %8llu| %10llu| %8lld| %6llu| %10.3f| %10.3f|\n", stream->ssrc, stream->payload_type, stream->clock_rate, (unsigned long long)stream->received, (unsigned long long)expected, (unsigned long long)stream->lost, (unsigned long long)stream->late, (unsigned long long)stream->duplicates, (unsigned long long)stream->reordered, (long long)stream->max_reorder, (unsigned long long)stream->resyncs, stream->jitter * 1000 / stream->clock_rate, stream->max_jitter * 1000 / stream->clock_rate);
+    }
+    
+    // H.264 解包统计  Broken 是分片丢失被丢弃的 NALU
+    for (int i = 0; i < session->stream_count; i++) {
+        const H264_DEPACKETIZER *h264 = &session->streams[i]->h264;
+        if (!h264->frame) {
+            continue;
+        }
+        fprintf(myout, "\nH.264 0x%08X: %llu Frames, %llu NALUs, %llu Broken, %llu Unsupported\n", session->streams[i]->ssrc, (unsigned long long)h264->frames, (unsigned long long)h264->nals, (unsigned long long)h264->broken_nals, (unsigned long long)h264->unsupported);
     }
 }
+    
+/**
+ * SIGINT 处理  只设置标记  由接收循环退出
+ */
+static void on_parse_signal(int signal) {
+    
+    (void)signal;
+    parse_stopped = 1;
+}
+    
+/**
+ * 获取系统时间  与内核接收时间戳同一时钟  单位ns
+ */
+static int64_t get_realtime_ns(void) {
+    
+    struct timespec ts = {};
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+    
\ No newline at end of file
@@ -227,12 +227,280 @@
 #include <string.h>
 #include <unistd.h>
 #include <getopt.h>
+#include <errno.h>
+#include <signal.h>
+#include <stdint.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <poll.h>
+#include <math.h>
+#include <thread>
+#include <vector>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+#if defined(__linux__)
+#include <sys/inotify.h>
+#else
+#include <sys/event.h>
+#endif
 
 extern "C" {
 #include "TSParser.h"
 }
 
+#define TS_FOLLOW_INTERVAL_MS   1000             // follow 模式两次解析之间的最小间隔  写入很碎时合并成一批处理
+#define TS_BENCHMARK_ROUNDS     5                // PID 查找 benchmark 每种方式重复遍历文件的次数
+#define TS_SYNC_LOCK_COUNT      5                // 连续这么多个包的同步字节都正确才认为重新同步
+#define TS_MAX_SYNC_EVENTS      16               // 最多记录的同步丢失事件个数
+#define TS_DETECT_PACKETS       32               // 检测包长时最多检查的连续包数
+#define TS_DETECT_RANGE         (64 * 1024)      // 检测包长时在文件开头查找同步字节的范围
+#define TS_FOLLOW_DETECT_SIZE   (TS_DETECT_PACKETS * 204)    // follow 模式文件至少这么大时才检测包长  数据太少时不能区分
+#define M2TS_HEADER_SIZE        4                // M2TS TP_extra_header  2bit copy_permission_indicator + 30bit arrival_time_stamp
+#define M2TS_ATS_MASK           0x3FFFFFFF
+#define TS_MIN_CHUNK_PACKETS    1024             // 并行统计时每段最少的包数
+#define TS_PRESCAN_STEP         (1024 * 1024)    // 并行统计预扫描 PAT/PMT 时每次扫描的字节数
+#define TS_WARMUP_SIZE          (4 * 1024 * 1024)    // 并行统计时每段先扫描前一段最后这么多字节  拿到这一段开始时的 PAT/PMT
+#define TS_IOV_BATCH            512              // 提取基本流时每个 PID 每次 writev 的 iovec 数量
+#define TS_MAX_PATH             1024
+#define TS_PTS_BUFFER_SIZE      (64 * 1024)      // PTS sidecar 的 stdio 缓冲区
+#define TR_CLOCK_HZ             27000000LL       // TR 101 290 检查的时间单位  与 PCR 相同
+#define TR_PAT_INTERVAL         (TR_CLOCK_HZ / 2)            // PAT/PMT 最大间隔 500ms
+#define TR_PID_TIMEOUT          (TR_CLOCK_HZ * 5)            // PMT 中引用的 PID 最长消失时间  TR 101 290 由用户指定  这里取 5s
+#define TR_PCR_INTERVAL         (TR_CLOCK_HZ / 25)           // PCR 最大间隔 40ms
+#define TR_PCR_JUMP             (TR_CLOCK_HZ / 10)           // 没有 discontinuity_indicator 时两个 PCR 最大间隔 100ms
+#define TR_PCR_MAX_ERROR        13.5                         // PCR 精度 ±500ns  即 13.5 个 27MHz 时钟
+#define TR_PTS_INTERVAL         (TR_CLOCK_HZ * 7 / 10)       // PTS 最大间隔 700ms
+#define TR_SWEEP_INTERVAL       (TR_CLOCK_HZ / 10)           // 每 100ms 检查一次一直没有到达的 PID
+#define TR_SYNC_LOSS_COUNT      2                // 连续这么多个同步字节错误认为失步
+#define TR_UDP_BUFFER_SIZE      (10 * 1024)      // 批量接收时每个 UDP 包的缓冲区  巨帧也能完整收下  更长的包被截断
+#define TR_RECV_BATCH           64               // 每次系统调用最多接收的 UDP 包数
+#define TR_DRAIN_TIME           0.1              // 一次最多连续接收这么长时间  单位s  之后先检查超时和输出
+#define TR_UDP_RCVBUF           (4 * 1024 * 1024)    // socket 接收缓冲区  1Gbps 下约 30ms
+#define TR_REPORT_INTERVAL      1.0              // 直播输入每秒输出一行新增错误
+#define TR_PID_TRACKED          0x01             // PMT 中引用的 PID  检查 PID_error
+#define TR_PID_PSI              0x02             // PAT/PMT PID  检查 section 间隔
+#define TR_PID_HAS_PCR          0x04
+#define TR_PID_HAS_PTS          0x08
+#define TR_PID_LATE_PACKET      0x10             // 以下四项表示这次超时已经计数  再次到达时清除
+#define TR_PID_LATE_SECTION     0x20
+#define TR_PID_LATE_PCR         0x40
+#define TR_PID_LATE_PTS         0x80
+
+// follow 模式下跟踪文件追加  Linux 使用 inotify  macOS 使用 kqueue
+typedef struct {
+    int fd;                             // 被跟踪的文件
+    int notify_fd;                      // inotify / kqueue 描述符
+    int watch;                          // inotify watch 描述符
+} TS_FOLLOWER;
+
+// follow 模式的累计统计  每批与上一批的差值即为增量  每个 PID 的统计在 TSParser 中
+typedef struct {
+    uint64_t packets;
+    uint64_t cc_errors;
+    uint64_t resyncs;                   // 同步字节丢失后重新找到 0x47 的次数
+    uint64_t skipped_bytes;             // 重新同步时跳过的字节数
+    uint32_t pid_count;                 // 出现过的 PID 个数
+} TS_FOLLOW_STATS;
+
+// 包格式  188 字节的 TS 包前面可能有 M2TS 的4字节时间戳  后面可能有 DVB 的16字节 Reed-Solomon 校验
+typedef struct {
+    size_t stride;                      // 每个包在文件中占用的字节数
+    size_t header;                      // 同步字节之前的字节数
+    const char *name;
+} TS_PACKET_FORMAT;
+
+// 同步状态和同步丢失记录
+typedef struct {
+    uint64_t packets;                   // 交给 handler 的包数
+    uint64_t lost_sync;                 // 同步丢失次数
+    uint64_t skipped_bytes;             // 重新同步时跳过的字节数
+    uint64_t tail_bytes;                // 文件末尾不足一个包的字节数
+    uint64_t events[TS_MAX_SYNC_EVENTS][2];    // 同步丢失位置  重新同步位置
+    uint64_t ats_count;                 // M2TS arrival_time_stamp 个数  27MHz  30bit 回绕
+    uint32_t first_ats, last_ats;
+    uint64_t ats_elapsed;               // 展开回绕后第一个到最后一个时间戳的差值
+    uint32_t max_ats_delta;             // 相邻包最大到达间隔
+    uint64_t ats_wraps;
+} TS_SYNC_STATS;
+
+typedef void (*TS_PACKET_HANDLER)(TSParser *parser, const uint8_t *packet);
+
+// 并行统计的一段  [begin, limit) 内开始的包都属于这一段  最后一个包可以越过 limit
+typedef struct {
+    size_t begin;
+    size_t limit;
+    size_t end;                         // 扫描结束的位置  即下一段应该开始的位置
+    TSParser *parser;
+    TSParser *initial;                  // 开始统计时的 PAT/PMT 状态  与前一段结束时不同则需要重新统计
+    TS_SYNC_STATS sync;
+} TS_CHUNK;
+
+// 单个 PID 的基本流输出  iovec 直接指向映射内存中每个 TS 包的负载  攒满一批再 writev
+typedef struct {
+    int fd;
+    FILE *pts_file;                     // PTS sidecar  NULL表示不输出
+    struct iovec iov[TS_IOV_BATCH];
+    int iov_count;
+    uint32_t stream_type;
+    bool started;                       // 已经收到 PES 头  之后的负载属于当前 PES
+    uint64_t remaining;                 // 当前 PES 剩余的负载字节数  PES_packet_length 为0时不限
+    uint64_t pes_offset;                // 当前 PES 负载在输出文件中的位置
+    int64_t pts, dts;                   // 当前 PES 的时间戳  -1表示没有
+    uint64_t bytes;                     // 已写入字节数
+    uint64_t units;                     // 已写入的 PES 个数
+    uint64_t dropped;                   // PES 头不完整  没有起始码或者 CC 错误被丢弃的 PES 个数
+    char path[TS_MAX_PATH];
+} TS_ES_WRITER;
+
+// extract 模式的状态  通过 TSParser 的 mUserData 传给每个包的 handler
+typedef struct {
+    const char *prefix;                 // 输出路径前缀
+    bool all;                           // 提取 PMT 中的所有流
+    bool pts_sidecar;
+    bool selected[TS_PID_COUNT];
+    TS_ES_WRITER *writers[TS_PID_COUNT];    // 收到第一个 PES 头时创建
+    bool failed;                        // 写文件失败  停止提取
+} TS_EXTRACTOR;
+
+// TR 101 290 检查项  前 TR_PRIORITY1_COUNT 项为第一优先级  CAT_error 没有实现
+enum {
+    TR_SYNC_LOSS,
+    TR_SYNC_BYTE,
+    TR_PAT,
+    TR_CC,
+    TR_PMT,
+    TR_PID,
+    TR_TRANSPORT,
+    TR_CRC,
+    TR_PCR_REPETITION,
+    TR_PCR_DISCONTINUITY,
+    TR_PCR_ACCURACY,
+    TR_PTS,
+    TR_CHECK_COUNT
+};
+#define TR_PRIORITY1_COUNT      6
+
+// TR 101 290 每个 PID 的检查状态  定长  时间单位都是 27MHz  -1 表示还没有出现过
+typedef struct {
+    int64_t last_packet;
+    int64_t last_section;
+    int64_t last_pts;
+    int64_t last_pcr_time;
+    uint8_t flags;
+} TR_PID_STATE;
+
+// TR 101 290 检查状态  通过 TSParser 的 mUserData 传给每个包的 handler
+typedef struct {
+    TSParser *parser;                   // 统计模式的 parser  负责 PAT/PMT 重组和 CRC  CC 错误也用它的统计
+    TR_PID_STATE *pids;                 // TS_PID_COUNT 项
+    uint64_t counts[TR_CHECK_COUNT];
+    int64_t first_time[TR_CHECK_COUNT];     // 第一次出错的时间  -1 表示没有出错
+    uint32_t first_pid[TR_CHECK_COUNT];     // 第一次出错的 PID  TS_PID_COUNT 表示和 PID 无关
+    bool live;                          // 直播输入  时间为包的到达时间
+    int64_t now;                        // 当前包的时间  -1 表示时钟还没有建立
+    int64_t next_sweep;
+    uint32_t clock_pid;                 // 文件输入用第一个出现 PCR 的 PID 作为时钟  TS_PID_COUNT 表示还没有
+    int64_t clock_time;
+    int64_t clock_pcr;
+    uint64_t clock_packet;
+    double clock_ticks_per_packet;
+    uint32_t bad_sync;                  // 直播输入连续同步字节错误的包数
+    uint32_t good_sync;                 // 失步后连续同步字节正确的包数
+    bool sync_lost;
+    double max_pcr_error;               // PCR 精度的最大偏差  27MHz
+    uint64_t bytes;
+} TR_CHECKER;
+
+#if defined(__linux__)
+typedef struct mmsghdr RECV_MESSAGE;
+#else
+// macOS 没有 recvmmsg  使用相同的布局  逐个 recvmsg 直到读空
+typedef struct {
+    struct msghdr msg_hdr;
+    unsigned int msg_len;
+} RECV_MESSAGE;
+#endif
+
+static const TS_PACKET_FORMAT ts_packet_formats[] = {
+    {188, 0, "MPEG-TS"},
+    {192, M2TS_HEADER_SIZE, "M2TS (4-byte arrival timestamp prefix)"},
+    {204, 0, "DVB (16-byte Reed-Solomon trailer)"},
+};
+
+static const char *tr_check_names[TR_CHECK_COUNT] = {
+    "1.1 TS_sync_loss",
+    "1.2 Sync_byte_error",
+    "1.3 PAT_error",
+    "1.4 Continuity_count_error",
+    "1.5 PMT_error",
+    "1.6 PID_error",
+    "2.1 Transport_error",
+    "2.2 CRC_error",
+    "2.3a PCR_repetition_error",
+    "2.3b PCR_discontinuity_indicator_error",
+    "2.4 PCR_accuracy_error",
+    "2.5 PTS_error",
+};
+
+static volatile sig_atomic_t follow_stopped = 0;
+
 static void parse(char *url);
+static void follow(char *url);
+static uint64_t walk_ts_packets(const uint8_t *data, size_t size, uint64_t pos, const TS_PACKET_FORMAT *format, TSParser *parser, TS_SYNC_STATS *sync, TS_FOLLOW_STATS *stats);
+static void print_follow_stats(const TS_FOLLOW_STATS *stats, const TS_FOLLOW_STATS *last, const TS_PACKET_FORMAT *format, double wall_time, double wall_elapsed);
+static void print_pid_table(const TSPIDStats *pids);
+static int open_follower(TS_FOLLOWER *follower, const char *url);
+static int wait_follower(TS_FOLLOWER *follower, int timeout_ms);
+static void close_follower(TS_FOLLOWER *follower);
+static void on_follow_signal(int signal);
+static double get_time_seconds(void);
+static int map_input_file(const char *url, const uint8_t **data, size_t *size);
+static void benchmark_pid_lookup(char *url);
+static void summary(char *url, int thread_count, bool analysis);
+static TSParser *alloc_stats_parser(void);
+static void free_stats_parser(TSParser *parser);
+static bool is_program_state_complete(const TSParser *parser);
+static void merge_sync_stats(TS_SYNC_STATS *sync, const TS_SYNC_STATS *next);
+static void print_ts_summary(const TSParser *parser, size_t file_size, const TS_PACKET_FORMAT *format, const TS_SYNC_STATS *sync, double elapsed, bool analysis);
+static void print_pcr_analysis(const TSParser *parser);
+static void print_histogram_header(const char *title, double first, uint32_t bins);
+static const TS_PACKET_FORMAT *detect_packet_format(const uint8_t *data, size_t size);
+static size_t scan_ts_buffer(const uint8_t *data, size_t size, size_t begin, size_t limit, const TS_PACKET_FORMAT *format, TSParser *parser, TS_PACKET_HANDLER handler, TS_SYNC_STATS *sync, bool verbose);
+static size_t count_synced_packets(const uint8_t *data, size_t count, size_t stride);
+static size_t find_sync_lock(const uint8_t *data, size_t size, size_t pos, const TS_PACKET_FORMAT *format);
+static void update_arrival_time(TS_SYNC_STATS *sync, const uint8_t *header);
+static void print_sync_stats(const TS_PACKET_FORMAT *format, const TS_SYNC_STATS *sync);
+static void parse_verbose_packet(TSParser *parser, const uint8_t *packet);
+static const char *get_stream_type_name(uint32_t stream_type);
+static const char *get_stream_file_extension(uint32_t stream_type);
+static void extract(char *url, const char *pids, const char *prefix, bool pts_sidecar);
+static void extract_packet(TSParser *parser, const uint8_t *packet);
+static TS_ES_WRITER *open_es_writer(TS_EXTRACTOR *extractor, const TSParser *parser, uint32_t pid);
+static int extract_pes_payload(TS_ES_WRITER *writer, const uint8_t *payload, size_t size, bool unit_start);
+static void finish_pes(TS_ES_WRITER *writer);
+static int drop_pes(TS_ES_WRITER *writer);
+static int push_iovec(TS_ES_WRITER *writer, const void *base, size_t length);
+static int flush_writer(TS_ES_WRITER *writer);
+static void tr_check_file(char *url);
+static void tr_check_live(char *url);
+static TR_CHECKER *alloc_tr_checker(bool live);
+static void free_tr_checker(TR_CHECKER *checker);
+static void tr_check_packet(TSParser *parser, const uint8_t *packet);
+static void update_tr_clock(TR_CHECKER *checker, uint32_t pid, int64_t pcr, bool has_pcr, uint64_t index);
+static void tr_sweep(TR_CHECKER *checker);
+static void tr_report_error(TR_CHECKER *checker, int check, uint32_t pid);
+static void tr_check_datagram(TR_CHECKER *checker, const uint8_t *data, size_t size);
+static int tr_receive_batch(int fd, RECV_MESSAGE *messages, int count);
+static int open_udp_input(const char *url);
+static void print_tr_report(const TR_CHECKER *checker, double elapsed);
 
 static struct option tool_long_options[] = {
     {"help", no_argument, NULL, '`'}
@@ -243,13 +511,34 @@ static struct option tool_long_options[] = {
  */
 static void show_module_help() {
     printf("Support Format:\n\n");
-    printf("  - MPEG-TS\n");
+    printf("  - MPEG-TS (188 Bytes)\n");
+    printf("  - M2TS (192 Bytes, 4-Byte Arrival Timestamp Prefix)\n");
+    printf("  - DVB With Reed-Solomon (204 Bytes)\n");
+    printf("  - Live MPEG-TS Over UDP / RTP (TR 101 290 Check Only)\n");
     printf("\n");
     printf("Param:\n\n");
-    printf("  -i:   Input File Local Path\n");
+    printf("  -i:   Input File Local Path, Or udp://[address]:port / rtp://[address]:port For Live TR 101 290 Check\n");
+    printf("  -s:   Summary Only, Parse Silently And Print Per-PID Statistics At The End\n");
+    printf("  -f:   Follow A Growing File, Print Stats Of Newly Appended Packets Until Ctrl+C\n");
+    printf("  -B:   Benchmark PID Lookup, Dispatch Table vs Program/Stream List Walk\n");
+    printf("  -j:   Summary With Multiple Threads, Split The File Into Packet-Aligned Chunks, 0 For Number Of CPU Cores, Implies -s\n");
+    printf("  -x:   Extract PES Payload Of The Given PIDs To Elementary Stream Files, Comma Separated (e.g. 0x100,0x101), 'all' For Every Stream In PMT\n");
+    printf("  -o:   Extract Output Path Prefix, Files Are Named <prefix>_<PID>.<h264|aac|...>, Default Input Path Without Extension\n");
+    printf("  -t:   Extract With PTS Sidecar <output>.pts, One Line Per PES: Offset Size PTS DTS (90kHz, -1 For None)\n");
+    printf("  -a:   PCR Analysis, Implies -s: Instantaneous Mux Rate, PCR Jitter And Drift Histograms, PTS/DTS - PCR Buffer Levels Per PID\n");
+    printf("  -r:   TR 101 290 Priority 1/2 Check, Live Input Prints New Errors Every Second And The Report On Ctrl+C\n");
     printf("\n");
     printf("Usage:\n\n");
-    printf("  AVTools TSMediainfo -i input.ts\n\n");
+    printf("  AVTools TSMediainfo -i input.ts\n");
+    printf("  AVTools TSMediainfo -i input.ts -s\n");
+    printf("  AVTools TSMediainfo -i archive.ts -s -j 8\n");
+    printf("  AVTools TSMediainfo -i input.ts -a\n");
+    printf("  AVTools TSMediainfo -i input.ts -x all -o output -t\n");
+    printf("  AVTools TSMediainfo -i input.ts -x 0x100,0x101\n");
+    printf("  AVTools TSMediainfo -i input.ts -r\n");
+    printf("  AVTools TSMediainfo -i udp://239.1.1.1:1234 -r\n");
+    printf("  AVTools TSMediainfo -i recording.ts -f\n");
+    printf("  AVTools TSMediainfo -i multi_program.ts -B\n\n");
     printf("Get TS With FFMpeg From Mp4 File:\n\n");
     printf("   ffmpeg -i input.mp4 -codec: copy -bsf:v h264_mp4toannexb -start_number 0 -hls_time 10 -hls_list_size 0 -f hls output.m3u8\n");
 }
@@ -263,8 +552,17 @@ void ts_mediainfo_parse_cmd(int argc, char *argv[]) {
     
     int option = 0;   // getopt_long的返回值，返回匹配到字符的ascii码，没有匹配到可读参数时返回-1
     char *url = NULL;   // 输入文件路径
+    bool follow_mode = false;   // 跟踪持续增长的文件
+    bool benchmark = false;   // PID 查找 benchmark
+    bool summary_mode = false;   // 只输出统计
+    bool analysis = false;   // 统计时输出 PCR 分析
+    int thread_count = 1;   // 统计模式线程数
+    char *extract_pids = NULL;   // 提取的 PID 列表
+    char *extract_prefix = NULL;   // 提取输出路径前缀
+    bool pts_sidecar = false;   // 提取时输出 PTS sidecar
+    bool tr_mode = false;   // TR 101 290 检查
     
-    while (EOF != (option = getopt_long(argc, argv, "i:", tool_long_options, NULL))) {
+    while (EOF != (option = getopt_long(argc, argv, "i:sfBj:x:o:tra", tool_long_options, NULL))) {
         switch (option) {
             case '`':
                 show_module_help();
@@ -273,6 +571,35 @@ void ts_mediainfo_parse_cmd(int argc, char *argv[]) {
             case 'i':
                 url = optarg;
                 break;
+            case 's':
+                summary_mode = true;
+                break;
+            case 'f':
+                follow_mode = true;
+                break;
+            case 'B':
+                benchmark = true;
+                break;
+            case 'j':
+                thread_count = atoi(optarg);
+                summary_mode = true;
+                break;
+            case 'x':
+                extract_pids = optarg;
+                break;
+            case 'o':
+                extract_prefix = optarg;
+                break;
+            case 't':
+                pts_sidecar = true;
+                break;
+            case 'r':
+                tr_mode = true;
+                break;
+            case 'a':
+                analysis = true;
+                summary_mode = true;
+                break;
             case '?':
                 printf("Use 'AVTools %s --help' To Show Detail Usage.\n", argv[1]);
                 return;
@@ -287,44 +614,2393 @@ void ts_mediainfo_parse_cmd(int argc, char *argv[]) {
         return;
     }
     
+    // 直播输入只支持 TR 101 290 检查
+    if (strncmp(url, "udp://", 6) == 0 || strncmp(url, "rtp://", 6) == 0) {
+        tr_check_live(url);
+        return;
+    }
+    
+    if (tr_mode) {
+        tr_check_file(url);
+        return;
+    }
+    
+    if (follow_mode) {
+        follow(url);
+        return;
+    }
+    
+    if (benchmark) {
+        benchmark_pid_lookup(url);
+        return;
+    }
+    
+    if (extract_pids) {
+        extract(url, extract_pids, extract_prefix, pts_sidecar);
+        return;
+    }
+    
+    if (summary_mode) {
+        summary(url, thread_count, analysis);
+        return;
+    }
+    
     parse(url);
 }
 
 /**
  * Start Parse
- * @param url     flv file path
+ * @param url     ts file path
  */
 static void parse(char *url) {
     
-    FILE *input_file = NULL;
-    size_t bytes_read = 0;
-    uint8_t packet_buffer[TS_PACKET_SIZE];
-    int n_packets = 0;
+    const uint8_t *data = NULL;
+    size_t size = 0;
+    TS_SYNC_STATS sync = {};
+    const TS_PACKET_FORMAT *format = NULL;
+    double start_time = get_time_seconds();
+    double elapsed = 0;
 
-    TSParser tsParser;
-    memset(&tsParser, 0, sizeof(TSParser));
+    TSParser *tsParser = (TSParser *)calloc(1, sizeof(TSParser));
+    if (!tsParser) {
+        printf("Alloc TSParser Error.\n");
+        return;
+    }
 
-    input_file = fopen(url, "rb");
-    if(!input_file) {
-        printf("Error opening the stream\nSyntax: tsunpacket FileToParse.ts\n");
+    // 整个文件映射后按块扫描  不再每个包 fread 一次
+    if (map_input_file(url, &data, &size) < 0) {
+        free(tsParser);
         return;
     }
 
-    while(1) {
-        bytes_read = fread(packet_buffer, 1, TS_PACKET_SIZE, input_file);
-        if(packet_buffer[0] == TS_DISCONTINUITY) {
-            printf("Discontinuity detected!\n");
-        } else if (bytes_read < TS_PACKET_SIZE) {
-            printf("End of file!\n");
+    format = detect_packet_format(data, size);
+    scan_ts_buffer(data, size, 0, size, format, tsParser, parse_verbose_packet, &sync, true);
+    elapsed = get_time_seconds() - start_time;
+
+    printf("End of file!\n");
+    printf("Number of packets found: %llu\n", (unsigned long long)sync.packets);
+    print_sync_stats(format, &sync);
+    if (elapsed > 0) {
+        printf("Throughput: %.2f MB/s (%.3f s)\n", size / elapsed / (1024 * 1024), elapsed);
+    }
+
+    // 每个流的 PES 重组缓冲区  容量随实际出现的最大 PES 按分级增长
+    for (TSPointersListItem *programItem = tsParser->mPrograms.mHead; programItem != NULL; programItem = programItem->mNext) {
+        for (TSPointersListItem *streamItem = ((TSProgram *)programItem->mData)->mStreams.mHead; streamItem != NULL; streamItem = streamItem->mNext) {
+            TSStream *stream = (TSStream *)streamItem->mData;
+            printf("PID 0x%04x: max PES %zu bytes, buffer %zu KB, dropped %llu\n", stream->mElementaryPID, stream->mMaxPESSize,
+                   stream->mBufferCapacity / 1024, (unsigned long long)stream->mDroppedPES);
+        }
+    }
+
+    munmap((void *)data, size);
+    freeParserResources(tsParser);
+    free(tsParser);
+}
+
+/**
+ * 逐字段输出模式的包处理
+ * @param parser               TSParser Instance
+ * @param packet               TS Packet
+ */
+static void parse_verbose_packet(TSParser *parser, const uint8_t *packet) {
+    
+    parseTSPacket(parser, (uint8_t *)packet, TS_PACKET_SIZE);
+}
+
+/**
+ * 根据同步字节的周期检测包格式  每种格式从文件开头第一个可能的同步位置开始数连续同步的包数  取最多的一种
+ * @param data                    文件数据
+ * @param size                     文件大小
+ * @return 包格式  都不满足时按 188 字节处理
+ */
+static const TS_PACKET_FORMAT *detect_packet_format(const uint8_t *data, size_t size) {
+    
+    const TS_PACKET_FORMAT *best = &ts_packet_formats[0];
+    size_t best_count = 0;
+    size_t range = size < TS_DETECT_RANGE ? size : TS_DETECT_RANGE;
+    
+    for (size_t i = 0; i < sizeof(ts_packet_formats) / sizeof(ts_packet_formats[0]); i++) {
+        const TS_PACKET_FORMAT *format = &ts_packet_formats[i];
+        
+        for (size_t pos = format->header; pos + TS_PACKET_SIZE <= range; pos++) {
+            const uint8_t *hit = (const uint8_t *)memchr(data + pos, TS_SYNC, range - pos);
+            if (hit == NULL) {
+                break;
+            }
+            pos = hit - data;
+            
+            // 包的起始位置  同步字节前面还有 header
+            size_t available = (size - (pos - format->header)) / format->stride;
+            size_t count = count_synced_packets(data + pos, available < TS_DETECT_PACKETS ? available : TS_DETECT_PACKETS, format->stride);
+            // 包数相同时优先前面的格式  即 188
+            if (count > best_count) {
+                best = format;
+                best_count = count;
+            }
+            // 偶然出现的 0x47 只能连上很少几个包  继续找下一个
+            if (count >= TS_SYNC_LOCK_COUNT || count == available) {
+                break;
+            }
+        }
+    }
+    return best;
+}
+
+/**
+ * 扫描一段连续的 TS 数据  同步时按 16 个包一组校验同步字节后逐包交给 handler
+ * 同步丢失后逐字节查找  连续 TS_SYNC_LOCK_COUNT 个包同步字节正确才重新锁定
+ * M2TS/DVB 格式直接把包内 188 字节的位置交给 handler  不拷贝
+ * 只处理 [begin, limit) 内开始的包  从 begin 开始与整个文件连续扫描到 begin 时的处理相同  可以分段并行
+ * @param data                    TS 数据
+ * @param size                     数据大小
+ * @param begin                   开始位置  为0时先查找文件开头的同步位置
+ * @param limit                    结束位置
+ * @param format                 包格式
+ * @param parser                  TSParser Instance
+ * @param handler                每个包的处理函数
+ * @param sync                     同步统计
+ * @param verbose               同步丢失时是否立即输出
+ * @return 扫描结束的位置  不小于 limit 时为下一段应该开始的位置
+ */
+static size_t scan_ts_buffer(const uint8_t *data, size_t size, size_t begin, size_t limit, const TS_PACKET_FORMAT *format, TSParser *parser, TS_PACKET_HANDLER handler, TS_SYNC_STATS *sync, bool verbose) {
+    
+    const size_t stride = format->stride;
+    const size_t header = format->header;
+    size_t pos = begin == 0 ? find_sync_lock(data, size, 0, format) : begin;
+    
+    // 文件开头不是同步字节  也算一次同步丢失
+    if (begin == 0 && pos != 0) {
+        if (sync->lost_sync < TS_MAX_SYNC_EVENTS) {
+            sync->events[sync->lost_sync][0] = 0;
+            sync->events[sync->lost_sync][1] = pos;
+        }
+        sync->lost_sync++;
+        sync->skipped_bytes += pos;
+        if (verbose) {
+            printf("Sync not found at file start, locked at offset %zu.\n", pos);
+        }
+    }
+    
+    while (pos < limit && pos + stride <= size) {
+        size_t available = (size - pos) / stride;
+        size_t remaining = (limit - pos + stride - 1) / stride;
+        size_t count = count_synced_packets(data + pos + header, available < remaining ? available : remaining, stride);
+        
+        if (header == M2TS_HEADER_SIZE) {
+            for (size_t i = 0; i < count; i++) {
+                update_arrival_time(sync, data + pos + i * stride);
+                handler(parser, data + pos + i * stride + header);
+            }
+        } else {
+            for (size_t i = 0; i < count; i++) {
+                handler(parser, data + pos + i * stride);
+            }
+        }
+        sync->packets += count;
+        pos += count * stride;
+        if (pos >= limit || pos + stride > size) {
+            break;
+        }
+        
+        // 同步丢失  重新查找
+        size_t next = find_sync_lock(data, size, pos, format);
+        if (sync->lost_sync < TS_MAX_SYNC_EVENTS) {
+            sync->events[sync->lost_sync][0] = pos;
+            sync->events[sync->lost_sync][1] = next;
+        }
+        sync->lost_sync++;
+        sync->skipped_bytes += next - pos;
+        if (verbose) {
+            if (next < size) {
+                printf("Sync lost at offset %zu, resynced at offset %zu (%zu bytes skipped).\n", pos, next, next - pos);
+            } else {
+                printf("Sync lost at offset %zu, no sync found until end of file.\n", pos);
+            }
+        }
+        pos = next;
+    }
+    
+    if (pos < size && pos + stride > size) {
+        sync->tail_bytes = size - pos;
+    }
+    return pos;
+}
+
+/**
+ * 从 data 开始连续多少个包的同步字节是 0x47
+ * SSE2/NEON 下每次取 16 个包的同步字节一起比较
+ * @param data                    第一个包的同步字节位置
+ * @param count                   最多检查的包数
+ * @param stride                  包长
+ * @return 连续同步的包数
+ */
+static size_t count_synced_packets(const uint8_t *data, size_t count, size_t stride) {
+    
+    size_t i = 0;
+    
+#if defined(__SSE2__)
+    const __m128i sync_byte = _mm_set1_epi8(TS_SYNC);
+    for (; i + 16 <= count; i += 16) {
+        const uint8_t *p = data + i * stride;
+        __m128i bytes = _mm_setr_epi8(p[0], p[stride], p[2 * stride], p[3 * stride], p[4 * stride], p[5 * stride], p[6 * stride], p[7 * stride],
+                                      p[8 * stride], p[9 * stride], p[10 * stride], p[11 * stride], p[12 * stride], p[13 * stride], p[14 * stride], p[15 * stride]);
+        int mask = _mm_movemask_epi8(_mm_cmpeq_epi8(bytes, sync_byte));
+        if (mask != 0xFFFF) {
+            return i + __builtin_ctz(~mask);
+        }
+    }
+#elif defined(__ARM_NEON)
+    const uint8x16_t sync_byte = vdupq_n_u8(TS_SYNC);
+    uint8_t lanes[16];
+    for (; i + 16 <= count; i += 16) {
+        const uint8_t *p = data + i * stride;
+        for (int k = 0; k < 16; k++) {
+            lanes[k] = p[k * stride];
+        }
+        uint8x16_t hit = vceqq_u8(vld1q_u8(lanes), sync_byte);
+        // 每个字节压缩为4bit  得到64bit掩码
+        uint64_t mask = vget_lane_u64(vreinterpret_u64_u8(vshrn_n_u16(vreinterpretq_u16_u8(hit), 4)), 0);
+        if (mask != UINT64_MAX) {
+            return i + (__builtin_ctzll(~mask) >> 2);
+        }
+    }
+#endif
+    
+    for (; i < count; i++) {
+        if (data[i * stride] != TS_SYNC) {
+            return i;
+        }
+    }
+    return count;
+}
+
+/**
+ * 从 pos 开始查找同步位置  要求连续 TS_SYNC_LOCK_COUNT 个包的同步字节都是 0x47  文件末尾剩余的包不足时要求剩余的都同步
+ * @param data                    TS 数据
+ * @param size                     数据大小
+ * @param pos                      开始位置
+ * @param format                 包格式
+ * @return 同步包的起始位置  M2TS 为时间戳的位置  找不到时返回 size
+ */
+static size_t find_sync_lock(const uint8_t *data, size_t size, size_t pos, const TS_PACKET_FORMAT *format) {
+    
+    // pos 指向同步字节  包的起始位置为 pos - header
+    for (pos += format->header; pos - format->header + format->stride <= size; pos++) {
+        // 先用 memchr 快速跳到下一个 0x47
+        const uint8_t *hit = (const uint8_t *)memchr(data + pos, TS_SYNC, size - pos);
+        if (hit == NULL) {
+            return size;
+        }
+        pos = hit - data;
+        if (pos - format->header + format->stride > size) {
+            return size;
+        }
+        
+        size_t available = (size - (pos - format->header)) / format->stride;
+        size_t needed = available < TS_SYNC_LOCK_COUNT ? available : TS_SYNC_LOCK_COUNT;
+        if (count_synced_packets(data + pos, needed, format->stride) == needed) {
+            return pos - format->header;
+        }
+    }
+    return size;
+}
+
+/**
+ * 累计 M2TS arrival_time_stamp
+ * @param sync                     同步统计
+ * @param header                  TP_extra_header
+ */
+static void update_arrival_time(TS_SYNC_STATS *sync, const uint8_t *header) {
+    
+    uint32_t ats = (((uint32_t)header[0] << 24) | (header[1] << 16) | (header[2] << 8) | header[3]) & M2TS_ATS_MASK;
+    
+    if (sync->ats_count > 0) {
+        // 按 30bit 取模  回绕时差值依然正确
+        uint32_t delta = (ats - sync->last_ats) & M2TS_ATS_MASK;
+        if (ats < sync->last_ats) {
+            sync->ats_wraps++;
+        }
+        if (delta > sync->max_ats_delta) {
+            sync->max_ats_delta = delta;
+        }
+        sync->ats_elapsed += delta;
+    } else {
+        sync->first_ats = ats;
+    }
+    sync->last_ats = ats;
+    sync->ats_count++;
+}
+
+/**
+ * 输出同步统计
+ * @param format                 包格式
+ * @param sync                     同步统计
+ */
+static void print_sync_stats(const TS_PACKET_FORMAT *format, const TS_SYNC_STATS *sync) {
+    
+    FILE *myout = stdout;
+    
+    fprintf(myout, "Packet Format:     %zu bytes, %s\n", format->stride, format->name);
+    fprintf(myout, "Lost Sync:         %llu (%llu bytes skipped)\n", (unsigned long long)sync->lost_sync, (unsigned long long)sync->skipped_bytes);
+    for (uint64_t i = 0; i < sync->lost_sync && i < TS_MAX_SYNC_EVENTS; i++) {
+        fprintf(myout, "    offset %12llu -> %12llu\n", (unsigned long long)sync->events[i][0], (unsigned long long)sync->events[i][1]);
+    }
+    if (sync->lost_sync > TS_MAX_SYNC_EVENTS) {
+        fprintf(myout, "    ... %llu more\n", (unsigned long long)(sync->lost_sync - TS_MAX_SYNC_EVENTS));
+    }
+    if (sync->tail_bytes > 0) {
+        fprintf(myout, "Incomplete Tail:   %llu bytes\n", (unsigned long long)sync->tail_bytes);
+    }
+    if (sync->ats_count > 1) {
+        double elapsed = sync->ats_elapsed / 27000000.0;
+        fprintf(myout, "Arrival Time:      first %u / last %u (27MHz), span %.3f s, wraps %llu, max gap %.3f ms\n",
+                sync->first_ats, sync->last_ats, elapsed, (unsigned long long)sync->ats_wraps, sync->max_ats_delta / 27000.0);
+        if (elapsed > 0) {
+            // 第一个包到最后一个包之间的数据量 / 到达时间跨度
+            fprintf(myout, "Arrival Rate:      %.2f kbps\n", (sync->ats_count - 1) * TS_PACKET_SIZE * 8 / elapsed / 1000);
+        }
+    }
+}
+
+/**
+ * Follow 模式  文件持续增长时只解析新追加的完整 TS Packet
+ * 与统计模式使用同样的 parseTSPacketStats 和同步规则  TSParser 和同步状态在两次解析之间保留  CPU 只和写入速度相关
+ * @param url     ts file path
+ */
+static void follow(char *url) {
+    
+    FILE *myout = stdout;
+    TS_FOLLOWER follower = {-1, -1, -1};
+    TSParser *parser = NULL;
+    TS_SYNC_STATS sync = {};
+    TS_FOLLOW_STATS stats = {}, last = {};
+    struct sigaction action = {}, old_action = {};
+    const TS_PACKET_FORMAT *format = NULL;     // 文件足够大之后检测
+    const uint8_t *data = NULL;
+    size_t size = 0;
+    uint64_t pos = 0;
+    double start_time = get_time_seconds();
+    double last_time = 0;
+    double last_report = 0;             // 第一批是已有内容  不计算写入速度
+    int ret = 0;
+    
+    parser = alloc_stats_parser();
+    if (!parser) {
+        printf("Alloc TSParser Error.\n");
+        return;
+    }
+    
+    if (open_follower(&follower, url) < 0) {
+        goto __FAIL;
+    }
+    
+    // Ctrl+C 时跳出等待  输出累计统计
+    follow_stopped = 0;
+    action.sa_handler = on_follow_signal;
+    sigemptyset(&action.sa_mask);
+    sigaction(SIGINT, &action, &old_action);
+    
+    fprintf(myout, "Following %s, Ctrl+C To Stop.\n", url);
+    
+    while (!follow_stopped) {
+        struct stat st = {};
+        
+        last_time = get_time_seconds();
+        if (fstat(follower.fd, &st) < 0) {
             break;
-        } else if(packet_buffer[0] == TS_SYNC) {
-            parseTSPacket(&tsParser, packet_buffer, bytes_read);
-            n_packets++;
         }
+        
+        // 文件被截断  录制重新开始
+        if ((uint64_t)st.st_size < pos) {
+            fprintf(myout, "File truncated, restart from the beginning.\n");
+            free_stats_parser(parser);
+            parser = alloc_stats_parser();
+            if (!parser) {
+                printf("Alloc TSParser Error.\n");
+                break;
+            }
+            memset(&sync, 0, sizeof(sync));
+            memset(&stats, 0, sizeof(stats));
+            memset(&last, 0, sizeof(last));
+            format = NULL;
+            pos = 0;
+        }
+        
+        if ((size_t)st.st_size != size && st.st_size > 0) {
+            // 重新映射整个文件  只有新追加的部分会被访问
+            if (data) {
+                munmap((void *)data, size);
+                data = NULL;
+            }
+            size = (size_t)st.st_size;
+            data = (const uint8_t *)mmap(NULL, size, PROT_READ, MAP_PRIVATE, follower.fd, 0);
+            if (data == MAP_FAILED) {
+                data = NULL;
+                printf("Map File Error.\n");
+                break;
+            }
+            
+            if (!format && size >= TS_FOLLOW_DETECT_SIZE) {
+                format = detect_packet_format(data, size);
+                fprintf(myout, "Packet Format:     %zu bytes, %s\n", format->stride, format->name);
+            }
+            if (format) {
+                pos = walk_ts_packets(data, size, pos, format, parser, &sync, &stats);
+            }
+            if (stats.packets != last.packets) {
+                print_follow_stats(&stats, &last, format, last_time - start_time, last_report > 0 ? last_time - last_report : 0);
+                last = stats;
+                last_report = last_time;
+            }
+        }
+        
+        // 没有通知时也定期检查一次文件大小  兼容不产生通知的文件系统
+        ret = wait_follower(&follower, TS_FOLLOW_INTERVAL_MS);
+        if (ret < 0) {
+            fprintf(myout, "File deleted or moved, stop following.\n");
+            break;
+        }
+        
+        // 两次解析之间至少间隔 TS_FOLLOW_INTERVAL_MS  这段时间内的追加合并处理
+        if (ret > 0 && !follow_stopped) {
+            double wait = TS_FOLLOW_INTERVAL_MS / 1000.0 - (get_time_seconds() - last_time);
+            if (wait > 0) {
+                usleep((useconds_t)(wait * 1000000));
+            }
+        }
+    }
+    
+    // 文件一直没有长到 TS_FOLLOW_DETECT_SIZE  用已有的数据检测
+    if (!format && data && parser) {
+        format = detect_packet_format(data, size);
+        pos = walk_ts_packets(data, size, pos, format, parser, &sync, &stats);
+    }
+    
+    fprintf(myout, "============================ TS Follow Total =========================\n");
+    fprintf(myout, "Packets:           %llu (%.1f KB)\n", (unsigned long long)stats.packets, format ? stats.packets * format->stride / 1024.0 : 0);
+    fprintf(myout, "CC Errors:         %llu\n", (unsigned long long)stats.cc_errors);
+    fprintf(myout, "Resyncs:           %llu (%llu bytes skipped)\n", (unsigned long long)stats.resyncs, (unsigned long long)stats.skipped_bytes);
+    fprintf(myout, "Followed:          %.3f s\n", get_time_seconds() - start_time);
+    if (parser) {
+        print_pid_table(parser->mPIDStats);
+    }
+    
+    sigaction(SIGINT, &old_action, NULL);
+    
+__FAIL:
+    close_follower(&follower);
+    free_stats_parser(parser);
+    
+    if (data) {
+        munmap((void *)data, size);
+    }
+}
+
+/**
+ * 从 pos 开始用 scan_ts_buffer 解析所有完整的 TS Packet  不足一个包的尾部留到下一次
+ * @param data                    文件数据
+ * @param size                     文件大小
+ * @param pos                      开始位置  M2TS 为时间戳的位置
+ * @param format                 包格式
+ * @param parser                  统计模式的 TSParser  CC 错误由 parseTSPacketStats 统计
+ * @param sync                     同步统计
+ * @param stats                    累计统计  从 parser 和 sync 汇总
+ * @return 下一次解析的开始位置
+ */
+static uint64_t walk_ts_packets(const uint8_t *data, size_t size, uint64_t pos, const TS_PACKET_FORMAT *format, TSParser *parser, TS_SYNC_STATS *sync, TS_FOLLOW_STATS *stats) {
+    
+    pos = scan_ts_buffer(data, size, pos, size, format, parser, parseTSPacketStats, sync, false);
+    
+    stats->packets = parser->mPacketCount;
+    stats->cc_errors = 0;
+    stats->pid_count = 0;
+    for (uint32_t pid = 0; pid < TS_PID_COUNT; pid++) {
+        stats->cc_errors += parser->mPIDStats[pid].mCCErrors;
+        stats->pid_count += parser->mPIDStats[pid].mPackets > 0;
+    }
+    stats->resyncs = sync->lost_sync;
+    stats->skipped_bytes = sync->skipped_bytes;
+    return pos;
+}
+
+/**
+ * 输出一批新增 Packet 的统计
+ * @param stats                    当前累计统计
+ * @param last                     上一批结束时的累计统计
+ * @param format                 包格式
+ * @param wall_time             从开始跟踪到现在的时间  单位s
+ * @param wall_elapsed        距上一批的时间  单位s
+ */
+static void print_follow_stats(const TS_FOLLOW_STATS *stats, const TS_FOLLOW_STATS *last, const TS_PACKET_FORMAT *format, double wall_time, double wall_elapsed) {
+    
+    FILE *myout = stdout;
+    uint64_t packets = stats->packets - last->packets;
+    double kbytes = packets * format->stride / 1024.0;
+    
+    fprintf(myout, "[%9.1f s] +%llu packets, +%.1f KB, pids %u, cc errors +%llu, resyncs +%llu",
+            wall_time, (unsigned long long)packets, kbytes, stats->pid_count,
+            (unsigned long long)(stats->cc_errors - last->cc_errors), (unsigned long long)(stats->resyncs - last->resyncs));
+    if (wall_elapsed > 0) {
+        fprintf(myout, ", ingest %.1f KB/s", kbytes / wall_elapsed);
+    }
+    fprintf(myout, "\n");
+    fflush(myout);
+}
+
+/**
+ * 输出每个 PID 的统计
+ * @param pids                     PID 统计表  TS_PID_COUNT 项
+ */
+static void print_pid_table(const TSPIDStats *pids) {
+    
+    FILE *myout = stdout;
+    
+    fprintf(myout, "+--------+------------+------------+------------+\n");
+    fprintf(myout, "|  PID   |  Packets   | Unit Start | CC Errors  |\n");
+    fprintf(myout, "+--------+------------+------------+------------+\n");
+    for (uint32_t pid = 0; pid < TS_PID_COUNT; pid++) {
+        if (pids[pid].mPackets == 0) {
+            continue;
+        }
+        fprintf(myout, "| 0x%04X | %10llu | %10llu | %10llu |\n", pid, (unsigned long long)pids[pid].mPackets,
+                (unsigned long long)pids[pid].mUnitStarts, (unsigned long long)pids[pid].mCCErrors);
+    }
+    fprintf(myout, "+--------+------------+------------+------------+\n");
+}
+
+/**
+ * 开始跟踪文件
+ * @param follower               TS_FOLLOWER Instance
+ * @param url                      file path
+ * @return 0: success  -1: failed
+ */
+static int open_follower(TS_FOLLOWER *follower, const char *url) {
+    
+    follower->fd = open(url, O_RDONLY);
+    if (follower->fd < 0) {
+        printf("Failed to open input file!\n");
+        return -1;
+    }
+    
+#if defined(__linux__)
+    follower->notify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (follower->notify_fd < 0) {
+        printf("inotify_init1 Error: %s\n", strerror(errno));
+        return -1;
+    }
+    follower->watch = inotify_add_watch(follower->notify_fd, url, IN_MODIFY | IN_CLOSE_WRITE | IN_DELETE_SELF | IN_MOVE_SELF);
+    if (follower->watch < 0) {
+        printf("inotify_add_watch Error: %s\n", strerror(errno));
+        return -1;
+    }
+#else
+    struct kevent change;
+    follower->notify_fd = kqueue();
+    if (follower->notify_fd < 0) {
+        printf("kqueue Error: %s\n", strerror(errno));
+        return -1;
+    }
+    // EV_CLEAR: 每次取出事件后重置  多次写入合并为一个事件
+    EV_SET(&change, follower->fd, EVFILT_VNODE, EV_ADD | EV_CLEAR, NOTE_WRITE | NOTE_EXTEND | NOTE_DELETE | NOTE_RENAME, 0, NULL);
+    if (kevent(follower->notify_fd, &change, 1, NULL, 0, NULL) < 0) {
+        printf("kevent Error: %s\n", strerror(errno));
+        return -1;
+    }
+#endif
+    return 0;
+}
+
+/**
+ * 等待文件变化
+ * @param follower               TS_FOLLOWER Instance
+ * @param timeout_ms           超时时间  单位ms
+ * @return 1: 文件被写入  0: 超时或被信号打断  -1: 文件被删除或移走
+ */
+static int wait_follower(TS_FOLLOWER *follower, int timeout_ms) {
+    
+#if defined(__linux__)
+    struct pollfd pfd = {follower->notify_fd, POLLIN, 0};
+    char buffer[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+    int changed = 0;
+    ssize_t length = 0;
+    
+    if (poll(&pfd, 1, timeout_ms) <= 0) {
+        return 0;
+    }
+    
+    // 一次取完所有排队的事件
+    while ((length = read(follower->notify_fd, buffer, sizeof(buffer))) > 0) {
+        for (char *p = buffer; p < buffer + length; ) {
+            const struct inotify_event *event = (const struct inotify_event *)p;
+            if (event->mask & (IN_DELETE_SELF | IN_MOVE_SELF | IN_IGNORED)) {
+                return -1;
+            }
+            changed = 1;
+            p += sizeof(struct inotify_event) + event->len;
+        }
+    }
+    return changed;
+#else
+    struct kevent event;
+    struct timespec timeout = {timeout_ms / 1000, (timeout_ms % 1000) * 1000000L};
+    int n = kevent(follower->notify_fd, NULL, 0, &event, 1, &timeout);
+    
+    if (n <= 0) {
+        return 0;
+    }
+    if (event.fflags & (NOTE_DELETE | NOTE_RENAME)) {
+        return -1;
+    }
+    return 1;
+#endif
+}
+
+/**
+ * 停止跟踪
+ * @param follower               TS_FOLLOWER Instance
+ */
+static void close_follower(TS_FOLLOWER *follower) {
+    
+    if (follower->notify_fd >= 0) {
+        close(follower->notify_fd);
+        follower->notify_fd = -1;
     }
+    
+    if (follower->fd >= 0) {
+        close(follower->fd);
+        follower->fd = -1;
+    }
+}
+
+/**
+ * SIGINT 处理  只设置标记  由 follow 循环退出
+ */
+static void on_follow_signal(int signal) {
+    
+    (void)signal;
+    follow_stopped = 1;
+}
+
+/**
+ * 获取单调时钟  单位s
+ */
+static double get_time_seconds(void) {
+    
+    struct timespec ts = {};
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
 
-    printf("Number of packets found: %d\n", n_packets);
+/**
+ * 只读映射输入文件
+ * @param url          file path
+ * @param data        输出映射地址
+ * @param size         输出文件大小
+ * @return 0: success  -1: failed
+ */
+static int map_input_file(const char *url, const uint8_t **data, size_t *size) {
+    
+    struct stat st = {};
+    void *addr = NULL;
+    int fd = open(url, O_RDONLY);
+    
+    if (fd < 0) {
+        printf("Failed to open input file!\n");
+        return -1;
+    }
+    
+    if (fstat(fd, &st) < 0 || st.st_size == 0) {
+        printf("Empty Or Unreadable File.\n");
+        close(fd);
+        return -1;
+    }
+    
+    addr = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    // 映射建立后 fd 可以直接关闭
+    close(fd);
+    if (addr == MAP_FAILED) {
+        printf("Map File Error.\n");
+        return -1;
+    }
+    
+    // 顺序扫描  提示内核加大预读
+    madvise(addr, (size_t)st.st_size, MADV_SEQUENTIAL);
+    
+    *data = (const uint8_t *)addr;
+    *size = (size_t)st.st_size;
+    return 0;
+}
 
-    fclose(input_file);
-    freeParserResources(&tsParser);
+/**
+ * PID 查找 benchmark
+ * 先用 TSParser 解析 PAT/PMT 建立节目和流  然后对文件中每个包分别用原来的链表遍历和 PID 分派表查找处理对象
+ * 只计查找本身  PES 解析和输出不计入
+ * @param url     ts file path
+ */
+static void benchmark_pid_lookup(char *url) {
+    
+    FILE *myout = stdout;
+    const uint8_t *data = NULL;
+    size_t size = 0;
+    size_t packet_count = 0;
+    const TS_PACKET_FORMAT *format = NULL;
+    size_t begin = 0, stride = 0, header = 0;
+    TSParser *parser = NULL;
+    TSPointersListItem *item = NULL;
+    uint32_t program_count = 0, stream_count = 0, pending_pmt = 0;
+    uintptr_t list_check = 0, table_check = 0;
+    double list_time = 0, table_time = 0;
+    
+    if (map_input_file(url, &data, &size) < 0) {
+        return;
+    }
+    
+    parser = (TSParser *)calloc(1, sizeof(TSParser));
+    if (!parser) {
+        printf("Alloc TSParser Error.\n");
+        goto __END;
+    }
+    
+    // 从第一个同步位置开始按包长遍历  只比较查找  不处理中间的同步丢失
+    format = detect_packet_format(data, size);
+    stride = format->stride;
+    header = format->header;
+    begin = find_sync_lock(data, size, 0, format);
+    
+    // 只解析 PAT/PMT  所有节目的 PMT 都收到后停止
+    for (size_t pos = begin; pos + stride <= size; pos += stride) {
+        const uint8_t *p = data + pos + header;
+        uint32_t pid = ((p[1] & 0x1F) << 8) | p[2];
+        
+        if (p[0] != TS_SYNC) {
+            continue;
+        }
+        if (pid == 0 || parser->mPIDTable[pid].mType == TS_PID_PMT) {
+            parseTSPacket(parser, (uint8_t *)p, TS_PACKET_SIZE);
+        }
+        
+        pending_pmt = 0;
+        for (item = parser->mPrograms.mHead; item != NULL; item = item->mNext) {
+            pending_pmt += ((TSProgram *)item->mData)->mVersion == 0;
+        }
+        if (parser->mPATVersion != 0 && pending_pmt == 0) {
+            break;
+        }
+    }
+    
+    for (item = parser->mPrograms.mHead; item != NULL; item = item->mNext) {
+        program_count++;
+        for (TSPointersListItem *stream = ((TSProgram *)item->mData)->mStreams.mHead; stream != NULL; stream = stream->mNext) {
+            stream_count++;
+        }
+    }
+    if (program_count == 0) {
+        printf("No PAT/PMT Found.\n");
+        goto __END;
+    }
+    
+    // 先完整读一遍  让文件页进入 page cache  两种方式都在热数据上比较
+    for (size_t pos = begin; pos + stride <= size; pos += stride) {
+        list_check += data[pos + header + 1];
+    }
+    list_check = 0;
+    
+    for (int round = 0; round < TS_BENCHMARK_ROUNDS; round++) {
+        double start_time = get_time_seconds();
+        
+        // 原来的方式  每个包遍历节目链表  再遍历每个节目的流链表
+        for (size_t pos = begin; pos + stride <= size; pos += stride) {
+            const uint8_t *p = data + pos + header;
+            uint32_t pid = ((p[1] & 0x1F) << 8) | p[2];
+            
+            for (item = parser->mPrograms.mHead; item != NULL; item = item->mNext) {
+                TSProgram *program = (TSProgram *)item->mData;
+                if (pid == program->mProgramMapPID) {
+                    list_check += (uintptr_t)program;
+                    break;
+                }
+                TSStream *stream = getStreamByPID(program, pid);
+                if (stream != NULL) {
+                    list_check += (uintptr_t)stream;
+                    break;
+                }
+            }
+        }
+        list_time += get_time_seconds() - start_time;
+        
+        start_time = get_time_seconds();
+        for (size_t pos = begin; pos + stride <= size; pos += stride) {
+            const uint8_t *p = data + pos + header;
+            uint32_t pid = ((p[1] & 0x1F) << 8) | p[2];
+            
+            table_check += (uintptr_t)parser->mPIDTable[pid].mTarget;
+        }
+        table_time += get_time_seconds() - start_time;
+    }
+    
+    packet_count = (size - begin) / stride;
+    
+    fprintf(myout, "============================ PID Lookup Benchmark ====================\n");
+    fprintf(myout, "Packet Format:     %zu bytes, %s\n", format->stride, format->name);
+    fprintf(myout, "Programs:          %u\n", program_count);
+    fprintf(myout, "Streams:           %u\n", stream_count);
+    fprintf(myout, "Packets:           %zu x %d rounds\n", packet_count, TS_BENCHMARK_ROUNDS);
+    fprintf(myout, "+----------------+--------------+------------------+\n");
+    fprintf(myout, "|     Lookup     |   Time (s)   |    Packets/s     |\n");
+    fprintf(myout, "+----------------+--------------+------------------+\n");
+    fprintf(myout, "| List Walk      | %12.4f | %16.0f |\n", list_time, list_time > 0 ? packet_count * TS_BENCHMARK_ROUNDS / list_time : 0);
+    fprintf(myout, "| PID Table      | %12.4f | %16.0f |\n", table_time, table_time > 0 ? packet_count * TS_BENCHMARK_ROUNDS / table_time : 0);
+    fprintf(myout, "+----------------+--------------+------------------+\n");
+    if (list_check != table_check) {
+        // 两种方式查到的对象应当完全一致
+        fprintf(myout, "Lookup Result Mismatch!\n");
+    }
+    
+__END:
+    if (parser) {
+        freeParserResources(parser);
+        free(parser);
+    }
+    munmap((void *)data, size);
+}
+
+/**
+ * 统计模式  映射整个文件  逐包累计统计  不输出每个字段
+ * 多线程时从第一个同步位置开始按包长对齐把文件分成多段  每段一个 TSParser 并行统计  最后按顺序合并
+ * 除第一段外各段以文件开头预扫描得到的 PAT/PMT 为基础  再扫描前一段的最后一部分更新 PAT/PMT 后开始统计
+ * 全部完成后检查每段开始的位置和 PAT/PMT 是否与前一段结束时一致
+ * 不一致时  比如分段边界附近同步丢失或 PAT/PMT 有更新  以前一段的结果重新统计这一段  合并结果与单线程完全相同
+ * PCR 抖动和漂移的拟合依赖之前所有的 PCR  多线程时每段各自拟合  缓冲时间在每段的前两个 PCR 之前不统计  这几项与单线程不完全相同
+ * @param url                       ts file path
+ * @param thread_count        线程数  0 表示 CPU 核数
+ * @param analysis              输出 PCR 分析
+ */
+static void summary(char *url, int thread_count, bool analysis) {
+    
+    const uint8_t *data = NULL;
+    size_t size = 0;
+    TS_SYNC_STATS sync = {};
+    const TS_PACKET_FORMAT *format = NULL;
+    TS_CHUNK *chunks = NULL;
+    TSParser *prescan = NULL;
+    TSParser *parser = NULL;
+    std::vector<std::thread> workers;
+    size_t chunk_count = 1, lock = 0, packets = 0, rescanned = 0;
+    uint64_t packet_offset = 0;
+    double start_time = get_time_seconds();
+    
+    if (map_input_file(url, &data, &size) < 0) {
+        return;
+    }
+    
+    format = detect_packet_format(data, size);
+    if (thread_count <= 0) {
+        thread_count = (int)std::thread::hardware_concurrency();
+    }
+    if (thread_count > 1) {
+        lock = find_sync_lock(data, size, 0, format);
+        packets = lock < size ? (size - lock) / format->stride : 0;
+        // 每段至少 TS_MIN_CHUNK_PACKETS 个包  文件太小时不分段
+        chunk_count = packets / TS_MIN_CHUNK_PACKETS;
+        if (chunk_count > (size_t)thread_count) {
+            chunk_count = thread_count;
+        }
+        if (chunk_count < 1) {
+            chunk_count = 1;
+        }
+    }
+    
+    chunks = (TS_CHUNK *)calloc(chunk_count, sizeof(TS_CHUNK));
+    if (!chunks) {
+        printf("Alloc TSParser Error.\n");
+        goto __END;
+    }
+    for (size_t i = 0; i < chunk_count; i++) {
+        chunks[i].parser = alloc_stats_parser();
+        chunks[i].initial = (TSParser *)calloc(1, sizeof(TSParser));
+        if (!chunks[i].parser || !chunks[i].initial) {
+            printf("Alloc TSParser Error.\n");
+            goto __END;
+        }
+        // 第一段从文件开头开始  由 scan_ts_buffer 查找第一个同步位置  其他段从边界之后第一个同步位置开始
+        // 中间有垃圾数据导致包的位置整体偏移时  边界不在包的开头
+        chunks[i].begin = i == 0 ? 0 : find_sync_lock(data, size, lock + packets * i / chunk_count * format->stride, format);
+        chunks[i].limit = i + 1 == chunk_count ? size : lock + packets * (i + 1) / chunk_count * format->stride;
+    }
+    
+    if (chunk_count > 1) {
+        TS_SYNC_STATS prescan_sync = {};
+        
+        // 预扫描文件开头  拿到 PAT 和所有 PMT 为止  最多扫描第一段
+        prescan = alloc_stats_parser();
+        if (!prescan) {
+            printf("Alloc TSParser Error.\n");
+            goto __END;
+        }
+        for (size_t pos = 0; pos < chunks[1].begin && !is_program_state_complete(prescan); ) {
+            size_t limit = pos + TS_PRESCAN_STEP < chunks[1].begin ? pos + TS_PRESCAN_STEP : chunks[1].begin;
+            pos = scan_ts_buffer(data, size, pos, limit, format, prescan, parseTSPacketStats, &prescan_sync, false);
+        }
+        for (size_t i = 1; i < chunk_count; i++) {
+            copyProgramState(chunks[i].parser, prescan);
+        }
+    }
+    
+    for (size_t i = 0; i < chunk_count; i++) {
+        workers.emplace_back([data, size, format, chunks, i]() {
+            TS_CHUNK *chunk = &chunks[i];
+            
+            if (i > 0) {
+                TS_SYNC_STATS warmup_sync = {};
+                size_t warmup = chunks[i - 1].begin;
+                
+                // 预热只为了更新 PAT/PMT  统计数据丢弃
+                if (chunk->begin - warmup > TS_WARMUP_SIZE) {
+                    warmup = chunk->begin - TS_WARMUP_SIZE / format->stride * format->stride;
+                }
+                scan_ts_buffer(data, size, warmup, chunk->begin, format, chunk->parser, parseTSPacketStats, &warmup_sync, false);
+                memset(chunk->parser->mPIDStats, 0, TS_PID_COUNT * sizeof(TSPIDStats));
+                chunk->parser->mPacketCount = 0;
+                chunk->parser->mCCErrorCount = 0;
+                copyProgramState(chunk->initial, chunk->parser);
+            }
+            chunk->end = scan_ts_buffer(data, size, chunk->begin, chunk->limit, format, chunk->parser, parseTSPacketStats, &chunk->sync, false);
+        });
+    }
+    for (size_t i = 0; i < workers.size(); i++) {
+        workers[i].join();
+    }
+    
+    // 按顺序检查  重新统计的段结束状态也可能变化  后面的段依次与之比较
+    for (size_t i = 1; i < chunk_count; i++) {
+        TS_CHUNK *chunk = &chunks[i];
+        
+        if (chunk->begin == chunks[i - 1].end && compareProgramState(chunks[i - 1].parser, chunk->initial) == 0) {
+            continue;
+        }
+        memset(chunk->parser->mPIDStats, 0, TS_PID_COUNT * sizeof(TSPIDStats));
+        memset(&chunk->sync, 0, sizeof(chunk->sync));
+        chunk->parser->mPacketCount = 0;
+        chunk->parser->mCCErrorCount = 0;
+        copyProgramState(chunk->parser, chunks[i - 1].parser);
+        copyServiceState(chunk->parser, chunks[i - 1].parser);
+        chunk->begin = chunks[i - 1].end;
+        chunk->end = scan_ts_buffer(data, size, chunk->begin, chunk->limit, format, chunk->parser, parseTSPacketStats, &chunk->sync, false);
+        rescanned++;
+    }
+    
+    // 合并到第一段  节目信息以最后一段结束时为准
+    sync = chunks[0].sync;
+    packet_offset = chunks[0].parser->mPacketCount;
+    for (size_t i = 1; i < chunk_count; i++) {
+        for (uint32_t pid = 0; pid < TS_PID_COUNT; pid++) {
+            mergePIDStats(&chunks[0].parser->mPIDStats[pid], &chunks[i].parser->mPIDStats[pid], packet_offset);
+        }
+        merge_sync_stats(&sync, &chunks[i].sync);
+        packet_offset += chunks[i].parser->mPacketCount;
+    }
+    parser = chunks[chunk_count - 1].parser;
+    if (chunk_count > 1) {
+        TSPIDStats *stats = parser->mPIDStats;
+        parser->mPIDStats = chunks[0].parser->mPIDStats;
+        chunks[0].parser->mPIDStats = stats;
+    }
+    parser->mPacketCount = packet_offset;
+    // 各段只带自己预热和扫描范围内的 SDT  业务列表取最后一个收到过 SDT 的段
+    for (size_t i = chunk_count - 1; i > 0 && parser->mSDTVersion == 0; i--) {
+        copyServiceState(parser, chunks[i - 1].parser);
+    }
+    
+    print_ts_summary(parser, size, format, &sync, get_time_seconds() - start_time, analysis);
+    if (chunk_count > 1) {
+        printf("Parallel Scan:     %zu chunks, %zu re-scanned\n", chunk_count, rescanned);
+        if (analysis) {
+            printf("PCR Analysis:      jitter, drift and buffer levels restart per chunk, run without -j for exact figures\n");
+        }
+    }
+    
+__END:
+    if (chunks) {
+        for (size_t i = 0; i < chunk_count; i++) {
+            free_stats_parser(chunks[i].parser);
+            if (chunks[i].initial) {
+                freeParserResources(chunks[i].initial);
+                free(chunks[i].initial);
+            }
+        }
+        free(chunks);
+    }
+    free_stats_parser(prescan);
+    munmap((void *)data, size);
+}
+
+/**
+ * 分配统计模式的 TSParser
+ * @return TSParser Instance  失败返回 NULL
+ */
+static TSParser *alloc_stats_parser(void) {
+    
+    TSParser *parser = (TSParser *)calloc(1, sizeof(TSParser));
+    if (parser) {
+        parser->mPIDStats = (TSPIDStats *)calloc(TS_PID_COUNT, sizeof(TSPIDStats));
+        if (!parser->mPIDStats) {
+            free(parser);
+            parser = NULL;
+        }
+    }
+    return parser;
+}
+
+/**
+ * 释放统计模式的 TSParser
+ * @param parser                  TSParser Instance  可以为 NULL
+ */
+static void free_stats_parser(TSParser *parser) {
+    
+    if (parser) {
+        free(parser->mPIDStats);
+        freeParserResources(parser);
+        free(parser);
+    }
+}
+
+/**
+ * PAT 和其中所有节目的 PMT 是否都已经收到
+ * @param parser                  TSParser Instance
+ */
+static bool is_program_state_complete(const TSParser *parser) {
+    
+    if (parser->mPATVersion == 0) {
+        return false;
+    }
+    for (TSPointersListItem *programItem = parser->mPrograms.mHead; programItem != NULL; programItem = programItem->mNext) {
+        if (((const TSProgram *)programItem->mData)->mVersion == 0) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/**
+ * 合并相邻两段的同步统计  结果与两段连续扫描一致
+ * @param sync                     前一段的统计  合并结果也写在这里
+ * @param next                     紧接着的后一段的统计
+ */
+static void merge_sync_stats(TS_SYNC_STATS *sync, const TS_SYNC_STATS *next) {
+    
+    for (uint64_t i = 0; i < next->lost_sync && sync->lost_sync + i < TS_MAX_SYNC_EVENTS; i++) {
+        sync->events[sync->lost_sync + i][0] = next->events[i][0];
+        sync->events[sync->lost_sync + i][1] = next->events[i][1];
+    }
+    sync->packets += next->packets;
+    sync->lost_sync += next->lost_sync;
+    sync->skipped_bytes += next->skipped_bytes;
+    if (next->tail_bytes > 0) {
+        sync->tail_bytes = next->tail_bytes;
+    }
+    
+    if (next->ats_count == 0) {
+        return;
+    }
+    if (sync->ats_count > 0) {
+        // 分段边界两侧两个包的到达间隔
+        uint32_t delta = (next->first_ats - sync->last_ats) & M2TS_ATS_MASK;
+        if (next->first_ats < sync->last_ats) {
+            sync->ats_wraps++;
+        }
+        if (delta > sync->max_ats_delta) {
+            sync->max_ats_delta = delta;
+        }
+        sync->ats_elapsed += delta;
+    } else {
+        sync->first_ats = next->first_ats;
+    }
+    if (next->max_ats_delta > sync->max_ats_delta) {
+        sync->max_ats_delta = next->max_ats_delta;
+    }
+    sync->ats_elapsed += next->ats_elapsed;
+    sync->ats_wraps += next->ats_wraps;
+    sync->last_ats = next->last_ats;
+    sync->ats_count += next->ats_count;
+}
+
+/**
+ * 输出统计结果
+ * @param parser                  统计完成的 TSParser
+ * @param file_size              文件大小
+ * @param format                 包格式
+ * @param sync                     同步统计
+ * @param elapsed               解析耗时  单位s
+ * @param analysis              输出 PCR 分析
+ */
+static void print_ts_summary(const TSParser *parser, size_t file_size, const TS_PACKET_FORMAT *format, const TS_SYNC_STATS *sync, double elapsed, bool analysis) {
+    
+    FILE *myout = stdout;
+    const TSPIDStats *stats = parser->mPIDStats;
+    const TSPIDStats *reference = NULL;
+    uint64_t cc_errors = 0, error_packets = 0, crc_errors = 0;
+    double mux_rate = 0, duration = 0;
+    
+    if (parser->mPacketCount == 0) {
+        fprintf(myout, "No TS Packet Found.\n");
+        return;
+    }
+    
+    // 以 PCR 最多的 PID 作为时间基准  复用码率 = 两个 PCR 之间的字节数 / PCR 差值
+    for (uint32_t pid = 0; pid < TS_PID_COUNT; pid++) {
+        cc_errors += stats[pid].mCCErrors;
+        error_packets += stats[pid].mErrorPackets;
+        crc_errors += stats[pid].mCRCErrors;
+        if (stats[pid].mPCRCount >= 2 && stats[pid].mLastPCR > stats[pid].mFirstPCR && (!reference || stats[pid].mPCRCount > reference->mPCRCount)) {
+            reference = &stats[pid];
+        }
+    }
+    if (reference) {
+        mux_rate = (reference->mLastPCRPacket - reference->mFirstPCRPacket) * TS_PACKET_SIZE * 8.0 / ((reference->mLastPCR - reference->mFirstPCR) / 27000000.0);
+        duration = parser->mPacketCount * TS_PACKET_SIZE * 8.0 / mux_rate;
+    } else {
+        // 没有 PCR 时用 PTS 跨度最大的流估算时长
+        for (uint32_t pid = 0; pid < TS_PID_COUNT; pid++) {
+            if (stats[pid].mHasPTS && (stats[pid].mMaxPTS - stats[pid].mMinPTS) / 90000.0 > duration) {
+                duration = (stats[pid].mMaxPTS - stats[pid].mMinPTS) / 90000.0;
+            }
+        }
+    }
+    
+    fprintf(myout, "============================ TS Summary ==============================\n");
+    fprintf(myout, "File Size:         %zu bytes\n", file_size);
+    fprintf(myout, "Packets:           %llu\n", (unsigned long long)parser->mPacketCount);
+    if (duration > 0) {
+        fprintf(myout, "Duration:          %.3f s (%s)\n", duration, reference ? "PCR" : "PTS");
+    }
+    if (mux_rate > 0) {
+        fprintf(myout, "Mux Rate:          %.2f kbps\n", mux_rate / 1000);
+    }
+    fprintf(myout, "CC Errors:         %llu\n", (unsigned long long)cc_errors);
+    fprintf(myout, "Error Packets:     %llu (transport_error_indicator)\n", (unsigned long long)error_packets);
+    fprintf(myout, "PSI CRC Errors:    %llu\n", (unsigned long long)crc_errors);
+    print_sync_stats(format, sync);
+    
+    for (TSPointersListItem *programItem = parser->mPrograms.mHead; programItem != NULL; programItem = programItem->mNext) {
+        const TSProgram *program = (const TSProgram *)programItem->mData;
+        fprintf(myout, "Program %-5u      PMT PID 0x%04x, PCR PID 0x%04x\n", program->mProgramNumber, program->mProgramMapPID, program->mPCRPID);
+        // SDT 中 service_id 与 program_number 相同的服务
+        for (TSPointersListItem *serviceItem = parser->mServices.mHead; serviceItem != NULL; serviceItem = serviceItem->mNext) {
+            const TSService *service = (const TSService *)serviceItem->mData;
+            if (service->mServiceID == program->mProgramNumber) {
+                fprintf(myout, "    Service        \"%s\" (%s), service_type 0x%02x\n", service->mServiceName, service->mProviderName, service->mServiceType);
+            }
+        }
+        for (TSPointersListItem *streamItem = program->mStreams.mHead; streamItem != NULL; streamItem = streamItem->mNext) {
+            const TSStream *stream = (const TSStream *)streamItem->mData;
+            fprintf(myout, "    PID 0x%04x     stream_type 0x%02x %s\n", stream->mElementaryPID, stream->mStreamType, get_stream_type_name(stream->mStreamType));
+        }
+    }
+    
+    fprintf(myout, "+--------+--------------+------------+----------+------------+--------------+\n");
+    fprintf(myout, "|  PID   |     Type     |  Packets   | CC Error | PES / Sect |    kbps      |\n");
+    fprintf(myout, "+--------+--------------+------------+----------+------------+--------------+\n");
+    for (uint32_t pid = 0; pid < TS_PID_COUNT; pid++) {
+        const char *type = "Unknown";
+        
+        if (stats[pid].mPackets == 0) {
+            continue;
+        }
+        if (pid == 0) {
+            type = "PAT";
+        } else if (pid == TS_NULL_PID) {
+            type = "NULL";
+        } else if (pid == TS_SDT_PID && parser->mPIDTable[pid].mType == TS_PID_NONE) {
+            type = "SDT";
+        } else if (parser->mPIDTable[pid].mType == TS_PID_PMT) {
+            type = "PMT";
+        } else if (parser->mPIDTable[pid].mType == TS_PID_STREAM) {
+            type = get_stream_type_name(((const TSStream *)parser->mPIDTable[pid].mTarget)->mStreamType);
+        }
+        // PSI 的 PID 显示重组完成的 section 个数  一个包里可能有多个 section
+        fprintf(myout, "| 0x%04x | %-12s | %10llu | %8llu | %10llu | %12.2f |\n", pid, type, (unsigned long long)stats[pid].mPackets,
+                (unsigned long long)stats[pid].mCCErrors, (unsigned long long)(stats[pid].mSections ? stats[pid].mSections : stats[pid].mUnitStarts),
+                duration > 0 ? stats[pid].mPackets * TS_PACKET_SIZE * 8.0 / duration / 1000 : 0);
+    }
+    fprintf(myout, "+--------+--------------+------------+----------+------------+--------------+\n");
+    
+    fprintf(myout, "---------------------------- PTS / DTS (s) ---------------------------\n");
+    fprintf(myout, "    PID   |   PTS First   |   PTS Last    |   DTS First   |   DTS Last\n");
+    for (uint32_t pid = 0; pid < TS_PID_COUNT; pid++) {
+        if (!stats[pid].mHasPTS) {
+            continue;
+        }
+        fprintf(myout, "  0x%04x  | %13.3f | %13.3f |", pid, stats[pid].mMinPTS / 90000.0, stats[pid].mMaxPTS / 90000.0);
+        if (stats[pid].mHasDTS) {
+            fprintf(myout, " %13.3f | %13.3f\n", stats[pid].mMinDTS / 90000.0, stats[pid].mMaxDTS / 90000.0);
+        } else {
+            fprintf(myout, " %13s | %13s\n", "-", "-");
+        }
+    }
+    
+    fprintf(myout, "---------------------------- PCR Interval (ms) -----------------------\n");
+    fprintf(myout, "    PID   |    Count    |    Min    |    Avg    |    Max\n");
+    for (uint32_t pid = 0; pid < TS_PID_COUNT; pid++) {
+        if (stats[pid].mPCRIntervals == 0) {
+            continue;
+        }
+        fprintf(myout, "  0x%04x  | %11llu | %9.3f | %9.3f | %9.3f\n", pid, (unsigned long long)stats[pid].mPCRCount,
+                stats[pid].mMinPCRInterval / 27000.0, (double)stats[pid].mPCRIntervalSum / stats[pid].mPCRIntervals / 27000.0,
+                stats[pid].mMaxPCRInterval / 27000.0);
+    }
+    
+    if (analysis) {
+        print_pcr_analysis(parser);
+    }
+    
+    fprintf(myout, "----------------------------------------------------------------------\n");
+    if (elapsed > 0) {
+        fprintf(myout, "Scan Speed:        %.0f packets/s, %.2f MB/s (%.3f s)\n", parser->mPacketCount / elapsed, file_size / elapsed / (1024 * 1024), elapsed);
+    }
+}
+
+/**
+ * 输出 PCR 分析  每个 PCR PID 的瞬时复用码率  PCR 抖动和漂移直方图  每个流的 PTS/DTS 与 PCR 之差即解码器缓冲时间
+ * 抖动为 PCR 相对包序号拟合直线的偏差  漂移为每 1s 的码率相对拟合斜率的偏差  都假定固定码率复用
+ * @param parser                  统计完成的 TSParser
+ */
+static void print_pcr_analysis(const TSParser *parser) {
+    
+    FILE *myout = stdout;
+    const TSPIDStats *stats = parser->mPIDStats;
+    
+    fprintf(myout, "---------------------------- PCR Mux Rate (kbps) ---------------------\n");
+    fprintf(myout, "    PID   |    Min     |    Avg     |    Max     |  Jitter ns | Drift ppm |  RAP  | Disc\n");
+    for (uint32_t pid = 0; pid < TS_PID_COUNT; pid++) {
+        if (stats[pid].mPCRIntervals == 0) {
+            continue;
+        }
+        fprintf(myout, "  0x%04x  | %10.2f | %10.2f | %10.2f | %10.0f | %9.3f | %5llu | %4llu\n", pid,
+                stats[pid].mMinMuxRate / 1000,
+                stats[pid].mLastPCR > stats[pid].mFirstPCR ? (stats[pid].mLastPCRPacket - stats[pid].mFirstPCRPacket) * TS_PACKET_SIZE * 8.0 * TS_PCR_HZ / (stats[pid].mLastPCR - stats[pid].mFirstPCR) / 1000 : 0,
+                stats[pid].mMaxMuxRate / 1000, stats[pid].mMaxPCRJitter * 1000000000.0 / TS_PCR_HZ, stats[pid].mMaxPCRDrift,
+                (unsigned long long)stats[pid].mRandomAccessPoints, (unsigned long long)stats[pid].mDiscontinuities);
+    }
+    
+    print_histogram_header("PCR Jitter (ns)", TS_JITTER_BIN_NS, TS_JITTER_BINS);
+    for (uint32_t pid = 0; pid < TS_PID_COUNT; pid++) {
+        if (stats[pid].mPCRJitterCount == 0) {
+            continue;
+        }
+        fprintf(myout, "  0x%04x  |", pid);
+        for (uint32_t bin = 0; bin < TS_JITTER_BINS; bin++) {
+            fprintf(myout, " %7llu", (unsigned long long)stats[pid].mJitterHistogram[bin]);
+        }
+        fprintf(myout, "\n");
+    }
+    
+    print_histogram_header("PCR Drift (ppm / 1s)", TS_DRIFT_BIN_PPM, TS_DRIFT_BINS);
+    for (uint32_t pid = 0; pid < TS_PID_COUNT; pid++) {
+        uint64_t windows = 0;
+        for (uint32_t bin = 0; bin < TS_DRIFT_BINS; bin++) {
+            windows += stats[pid].mDriftHistogram[bin];
+        }
+        if (windows == 0) {
+            continue;
+        }
+        fprintf(myout, "  0x%04x  |", pid);
+        for (uint32_t bin = 0; bin < TS_DRIFT_BINS; bin++) {
+            fprintf(myout, " %7llu", (unsigned long long)stats[pid].mDriftHistogram[bin]);
+        }
+        fprintf(myout, "\n");
+    }
+    
+    // 缓冲时间为负说明 PES 到达时已经过了解码时间
+    fprintf(myout, "---------------------------- PTS/DTS - PCR Buffer (ms) ---------------\n");
+    fprintf(myout, "    PID   |    Count    |    Min    |    Avg    |    Max    |   Late\n");
+    for (uint32_t pid = 0; pid < TS_PID_COUNT; pid++) {
+        if (stats[pid].mBufferLevels == 0) {
+            continue;
+        }
+        fprintf(myout, "  0x%04x  | %11llu | %9.3f | %9.3f | %9.3f | %6llu\n", pid, (unsigned long long)stats[pid].mBufferLevels,
+                stats[pid].mMinBufferLevel / 27000.0, (double)stats[pid].mBufferLevelSum / stats[pid].mBufferLevels / 27000.0,
+                stats[pid].mMaxBufferLevel / 27000.0, (unsigned long long)stats[pid].mLateUnits);
+    }
+}
+
+/**
+ * 输出直方图的标题和区间  第 k 个区间上限为 first * 2^k  最后一个区间没有上限
+ * @param title                     标题
+ * @param first                     第一个区间的上限
+ * @param bins                      区间个数
+ */
+static void print_histogram_header(const char *title, double first, uint32_t bins) {
+    
+    FILE *myout = stdout;
+    char label[16];
+    int dashes = 40 - (int)strlen(title);
+    
+    fprintf(myout, "---------------------------- %s %.*s\n", title, dashes > 0 ? dashes : 0, "----------------------------------------");
+    fprintf(myout, "    PID   |");
+    for (uint32_t bin = 0; bin < bins; bin++) {
+        snprintf(label, sizeof(label), bin < bins - 1 ? "<%g" : ">=%g", bin < bins - 1 ? first : first / 2);
+        fprintf(myout, " %7s", label);
+        first *= 2;
+    }
+    fprintf(myout, "\n");
+}
+
+/**
+ * 提取基本流  每个选中的 PID 的 PES 负载去掉 PES 头后写入各自的文件
+ * 负载不经过拷贝  iovec 直接指向映射内存中每个 TS 包的负载  每个 PID 攒满一批 iovec 一次 writev
+ * @param url                       ts file path
+ * @param pids                      逗号分隔的 PID 列表  all 表示 PMT 中的所有流
+ * @param prefix                   输出路径前缀  NULL 表示输入文件路径去掉扩展名
+ * @param pts_sidecar          每个输出文件旁边写一个 .pts 文件  每个 PES 一行
+ */
+static void extract(char *url, const char *pids, const char *prefix, bool pts_sidecar) {
+    
+    FILE *myout = stdout;
+    const uint8_t *data = NULL;
+    size_t size = 0;
+    TS_SYNC_STATS sync = {};
+    const TS_PACKET_FORMAT *format = NULL;
+    TS_EXTRACTOR *extractor = NULL;
+    TSParser *parser = NULL;
+    char default_prefix[TS_MAX_PATH];
+    char list[TS_MAX_PATH];
+    char *token = NULL, *saveptr = NULL;
+    uint32_t outputs = 0;
+    double start_time = get_time_seconds();
+    double elapsed = 0;
+    
+    // writer 在收到第一个 PES 头时才分配  extractor 只保存选中的 PID 和 writer 指针
+    extractor = (TS_EXTRACTOR *)calloc(1, sizeof(TS_EXTRACTOR));
+    if (!extractor) {
+        printf("Alloc Extractor Error.\n");
+        return;
+    }
+    
+    snprintf(list, sizeof(list), "%s", pids);
+    for (token = strtok_r(list, ",", &saveptr); token != NULL; token = strtok_r(NULL, ",", &saveptr)) {
+        char *end = NULL;
+        unsigned long pid;
+        
+        if (strcmp(token, "all") == 0) {
+            extractor->all = true;
+            continue;
+        }
+        pid = strtoul(token, &end, 0);
+        if (end == token || *end != '\0' || pid >= TS_PID_COUNT) {
+            printf("Invalid PID '%s', Use 'all' Or Comma Separated PIDs Such As 0x100,0x101.\n", token);
+            free(extractor);
+            return;
+        }
+        extractor->selected[pid] = true;
+    }
+    
+    if (!prefix) {
+        const char *slash = strrchr(url, '/');
+        const char *dot = strrchr(url, '.');
+        size_t length = dot && (!slash || dot > slash) ? (size_t)(dot - url) : strlen(url);
+        snprintf(default_prefix, sizeof(default_prefix), "%.*s", (int)length, url);
+        prefix = default_prefix;
+    }
+    extractor->prefix = prefix;
+    extractor->pts_sidecar = pts_sidecar;
+    
+    if (map_input_file(url, &data, &size) < 0) {
+        free(extractor);
+        return;
+    }
+    
+    // 统计模式的 parser 负责 PAT/PMT 和每个 PID 的 CC 统计
+    parser = alloc_stats_parser();
+    if (!parser) {
+        printf("Alloc TSParser Error.\n");
+        goto __END;
+    }
+    parser->mUserData = extractor;
+    
+    format = detect_packet_format(data, size);
+    scan_ts_buffer(data, size, 0, size, format, parser, extract_packet, &sync, false);
+    
+    // iovec 指向映射内存  解除映射前全部写出
+    for (uint32_t pid = 0; pid < TS_PID_COUNT; pid++) {
+        TS_ES_WRITER *writer = extractor->writers[pid];
+        if (writer) {
+            finish_pes(writer);
+            if (!extractor->failed && flush_writer(writer) < 0) {
+                extractor->failed = true;
+            }
+        }
+    }
+    if (extractor->failed) {
+        goto __END;
+    }
+    
+    elapsed = get_time_seconds() - start_time;
+    fprintf(myout, "============================ TS Extract ==============================\n");
+    for (uint32_t pid = 0; pid < TS_PID_COUNT; pid++) {
+        const TS_ES_WRITER *writer = extractor->writers[pid];
+        if (writer) {
+            fprintf(myout, "PID 0x%04x         %s, %llu PES, %llu bytes, %llu dropped, %llu CC errors -> %s\n", pid, get_stream_type_name(writer->stream_type),
+                    (unsigned long long)writer->units, (unsigned long long)writer->bytes, (unsigned long long)writer->dropped,
+                    (unsigned long long)parser->mPIDStats[pid].mCCErrors, writer->path);
+            outputs++;
+        } else if (extractor->selected[pid]) {
+            fprintf(myout, "PID 0x%04x         no PES found\n", pid);
+        }
+    }
+    if (outputs == 0 && extractor->all) {
+        fprintf(myout, "No PES Stream Found In PMT.\n");
+    }
+    print_sync_stats(format, &sync);
+    if (elapsed > 0) {
+        fprintf(myout, "Speed:             %.2f MB/s (%.3f s)\n", size / elapsed / (1024 * 1024), elapsed);
+    }
+    
+__END:
+    for (uint32_t pid = 0; pid < TS_PID_COUNT; pid++) {
+        TS_ES_WRITER *writer = extractor->writers[pid];
+        if (writer) {
+            if (writer->fd >= 0) {
+                close(writer->fd);
+            }
+            if (writer->pts_file) {
+                fclose(writer->pts_file);
+            }
+            free(writer);
+        }
+    }
+    free(extractor);
+    free_stats_parser(parser);
+    munmap((void *)data, size);
+}
+
+/**
+ * extract 模式每个包的处理函数  先更新 PAT/PMT 和 PID 统计  选中的 PID 的负载交给对应的 writer
+ * 重复发送的包只写一次  CC 错误说明前面丢了包  正在输出的 PES 不完整  整个丢弃
+ * @param parser                  TSParser Instance  mUserData 为 TS_EXTRACTOR
+ * @param packet                 188 字节的 TS 包
+ */
+static void extract_packet(TSParser *parser, const uint8_t *packet) {
+    
+    TS_EXTRACTOR *extractor = (TS_EXTRACTOR *)parser->mUserData;
+    uint32_t pid = ((packet[1] & 0x1F) << 8) | packet[2];
+    bool unit_start = packet[1] & 0x40;
+    const uint8_t *payload = packet + 4;
+    const uint8_t *end = packet + TS_PACKET_SIZE;
+    TSPIDStats *stats = &parser->mPIDStats[pid];
+    // CC 与前一个带负载的包相同  是重复发送  由 parseTSPacketStats 更新之前判断
+    bool duplicate = stats->mHasCC && (packet[3] & 0x0F) == stats->mLastCC;
+    bool discontinuity = false;
+    uint64_t cc_errors = stats->mCCErrors;
+    TS_ES_WRITER *writer;
+    
+    parseTSPacketStats(parser, packet);
+    
+    // 没有负载  transport_error_indicator 置1  或者加扰的包不写入
+    if (extractor->failed || !(packet[3] & 0x10) || (packet[1] & 0x80) || (packet[3] & 0xC0)) {
+        return;
+    }
+    if (!extractor->selected[pid] && !(extractor->all && parser->mPIDTable[pid].mType == TS_PID_STREAM)) {
+        return;
+    }
+    if (packet[3] & 0x20) {
+        discontinuity = packet[4] > 0 && (packet[5] & 0x80);
+        payload += 1 + packet[4];
+    }
+    if (payload >= end || (duplicate && !discontinuity)) {
+        return;
+    }
+    
+    writer = extractor->writers[pid];
+    if (writer && stats->mCCErrors != cc_errors && drop_pes(writer) < 0) {
+        extractor->failed = true;
+        return;
+    }
+    if (!writer) {
+        // 从第一个 PES 开始写  之前的半个 PES 丢弃
+        if (!unit_start) {
+            return;
+        }
+        writer = open_es_writer(extractor, parser, pid);
+        if (!writer) {
+            extractor->failed = true;
+            return;
+        }
+        extractor->writers[pid] = writer;
+    }
+    if (extract_pes_payload(writer, payload, end - payload, unit_start) < 0) {
+        extractor->failed = true;
+    }
+}
+
+/**
+ * 创建 PID 的基本流输出  文件名为 <prefix>_<PID>.<扩展名>
+ * @param extractor             TS_EXTRACTOR Instance
+ * @param parser                  TSParser Instance  用于查 stream_type
+ * @param pid                       PID
+ * @return TS_ES_WRITER Instance  失败返回 NULL
+ */
+static TS_ES_WRITER *open_es_writer(TS_EXTRACTOR *extractor, const TSParser *parser, uint32_t pid) {
+    
+    TS_ES_WRITER *writer = (TS_ES_WRITER *)calloc(1, sizeof(TS_ES_WRITER));
+    char pts_path[TS_MAX_PATH + 4];
+    
+    if (!writer) {
+        printf("Alloc Writer Error.\n");
+        return NULL;
+    }
+    if (parser->mPIDTable[pid].mType == TS_PID_STREAM) {
+        writer->stream_type = ((const TSStream *)parser->mPIDTable[pid].mTarget)->mStreamType;
+    }
+    snprintf(writer->path, sizeof(writer->path), "%s_0x%04x.%s", extractor->prefix, pid, get_stream_file_extension(writer->stream_type));
+    
+    writer->fd = open(writer->path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (writer->fd < 0) {
+        printf("Failed to open output file %s!\n", writer->path);
+        free(writer);
+        return NULL;
+    }
+    
+    if (extractor->pts_sidecar) {
+        snprintf(pts_path, sizeof(pts_path), "%s.pts", writer->path);
+        writer->pts_file = fopen(pts_path, "w");
+        if (!writer->pts_file) {
+            printf("Failed to open output file %s!\n", pts_path);
+            close(writer->fd);
+            free(writer);
+            return NULL;
+        }
+        // 每个 PES 一行  放大缓冲区减少写调用
+        setvbuf(writer->pts_file, NULL, _IOFBF, TS_PTS_BUFFER_SIZE);
+        fprintf(writer->pts_file, "# offset size pts dts (90kHz, -1 = none)\n");
+    }
+    return writer;
+}
+
+/**
+ * 写入一个 TS 包的负载  PES 开始的包去掉 PES 头  记录 PTS/DTS
+ * @param writer                  TS_ES_WRITER Instance
+ * @param payload                TS 包负载  指向映射内存
+ * @param size                     负载大小
+ * @param unit_start            payload_unit_start_indicator
+ * @return 0: success  -1: 写文件失败
+ */
+static int extract_pes_payload(TS_ES_WRITER *writer, const uint8_t *payload, size_t size, bool unit_start) {
+    
+    if (unit_start) {
+        uint32_t stream_id;
+        uint32_t PES_packet_length;
+        size_t header = 6;
+        
+        finish_pes(writer);
+        writer->started = false;
+        if (size < 6 || payload[0] != 0x00 || payload[1] != 0x00 || payload[2] != 0x01) {
+            writer->dropped++;
+            return 0;
+        }
+        stream_id = payload[3];
+        PES_packet_length = (payload[4] << 8) | payload[5];
+        writer->pts = -1;
+        writer->dts = -1;
+        
+        // 这些 stream_id 没有 optional PES header
+        if (stream_id != 0xbc && stream_id != 0xbe && stream_id != 0xbf && stream_id != 0xf0
+            && stream_id != 0xf1 && stream_id != 0xff && stream_id != 0xf2 && stream_id != 0xf8) {
+            // 整个 PES 头都在第一个包里才写  否则无法去掉 PES 头
+            if (size < 9 || size < 9 + (size_t)payload[8]) {
+                writer->dropped++;
+                return 0;
+            }
+            header = 9 + payload[8];
+            if ((payload[7] & 0x80) && header >= 14) {
+                writer->pts = ((int64_t)((payload[9] >> 1) & 0x07) << 30) | (payload[10] << 22) | ((payload[11] >> 1) << 15) | (payload[12] << 7) | (payload[13] >> 1);
+            }
+            if ((payload[7] & 0xC0) == 0xC0 && header >= 19) {
+                writer->dts = ((int64_t)((payload[14] >> 1) & 0x07) << 30) | (payload[15] << 22) | ((payload[16] >> 1) << 15) | (payload[17] << 7) | (payload[18] >> 1);
+            }
+        }
+        
+        // PES_packet_length 为0时长度不限  一直到下一个 PES 开始
+        if (PES_packet_length == 0) {
+            writer->remaining = UINT64_MAX;
+        } else {
+            writer->remaining = 6 + PES_packet_length > header ? 6 + PES_packet_length - header : 0;
+        }
+        writer->pes_offset = writer->bytes;
+        writer->started = true;
+        writer->units++;
+        payload += header;
+        size -= header;
+    }
+    
+    if (!writer->started) {
+        return 0;
+    }
+    if (size > writer->remaining) {
+        size = writer->remaining;
+    }
+    if (writer->remaining != UINT64_MAX) {
+        writer->remaining -= size;
+    }
+    if (size == 0) {
+        return 0;
+    }
+    return push_iovec(writer, payload, size);
+}
+
+/**
+ * 当前 PES 结束  写一行 PTS sidecar
+ * @param writer                  TS_ES_WRITER Instance
+ */
+static void finish_pes(TS_ES_WRITER *writer) {
+    
+    if (writer->started && writer->pts_file) {
+        fprintf(writer->pts_file, "%llu %llu %lld %lld\n", (unsigned long long)writer->pes_offset, (unsigned long long)(writer->bytes - writer->pes_offset),
+                (long long)writer->pts, (long long)writer->dts);
+    }
+    writer->started = false;
+}
+
+/**
+ * 丢弃正在输出的 PES  还没写出的 iovec 直接去掉  已经写到文件的部分截断
+ * 已经收完的 PES 不受影响  之后的负载在下一个 PES 开始前都不写
+ * @param writer                  TS_ES_WRITER Instance
+ * @return 0: success  -1: 截断文件失败
+ */
+static int drop_pes(TS_ES_WRITER *writer) {
+    
+    if (!writer->started || writer->remaining == 0) {
+        return 0;
+    }
+    writer->started = false;
+    writer->units--;
+    writer->dropped++;
+    
+    // 当前 PES 的数据都在 iovec 的最后
+    while (writer->iov_count > 0 && writer->bytes > writer->pes_offset) {
+        struct iovec *iov = &writer->iov[writer->iov_count - 1];
+        uint64_t extra = writer->bytes - writer->pes_offset;
+        
+        if (iov->iov_len > extra) {
+            iov->iov_len -= extra;
+            writer->bytes = writer->pes_offset;
+        } else {
+            writer->bytes -= iov->iov_len;
+            writer->iov_count--;
+        }
+    }
+    if (writer->bytes > writer->pes_offset) {
+        if (lseek(writer->fd, (off_t)writer->pes_offset, SEEK_SET) < 0 || ftruncate(writer->fd, (off_t)writer->pes_offset) < 0) {
+            printf("Truncate Output File %s Error: %s\n", writer->path, strerror(errno));
+            return -1;
+        }
+        writer->bytes = writer->pes_offset;
+    }
+    return 0;
+}
+
+/**
+ * 追加一个 iovec  满了就写出
+ * @param writer                  TS_ES_WRITER Instance
+ * @param base                    数据地址
+ * @param length                  数据长度
+ * @return 0: success  -1: 写文件失败
+ */
+static int push_iovec(TS_ES_WRITER *writer, const void *base, size_t length) {
+    
+    if (writer->iov_count == TS_IOV_BATCH && flush_writer(writer) < 0) {
+        return -1;
+    }
+    
+    writer->iov[writer->iov_count].iov_base = (void *)base;
+    writer->iov[writer->iov_count].iov_len = length;
+    writer->iov_count++;
+    writer->bytes += length;
+    return 0;
+}
+
+/**
+ * writev 写出全部 iovec  处理部分写入
+ * @param writer                  TS_ES_WRITER Instance
+ * @return 0: success  -1: 写文件失败
+ */
+static int flush_writer(TS_ES_WRITER *writer) {
+    
+    struct iovec *iov = writer->iov;
+    int count = writer->iov_count;
+    
+    while (count > 0) {
+        ssize_t written = writev(writer->fd, iov, count);
+        if (written < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            printf("Write Output File %s Error: %s\n", writer->path, strerror(errno));
+            return -1;
+        }
+        while (count > 0 && (size_t)written >= iov->iov_len) {
+            written -= iov->iov_len;
+            iov++;
+            count--;
+        }
+        if (count > 0) {
+            iov->iov_base = (uint8_t *)iov->iov_base + written;
+            iov->iov_len -= written;
+        }
+    }
+    
+    writer->iov_count = 0;
+    return 0;
+}
+
+/**
+ * stream_type 名称
+ * @param stream_type     PMT 中的 stream_type
+ */
+static const char *get_stream_type_name(uint32_t stream_type) {
+    
+    switch (stream_type) {
+        case 0x01: return "MPEG-1 Video";
+        case 0x02: return "MPEG-2 Video";
+        case 0x03: return "MPEG-1 Audio";
+        case 0x04: return "MPEG-2 Audio";
+        case 0x06: return "Private PES";
+        case 0x0f: return "AAC ADTS";
+        case 0x11: return "AAC LATM";
+        case 0x15: return "Metadata";
+        case 0x1b: return "H.264";
+        case 0x24: return "HEVC";
+        case 0x81: return "AC-3";
+        case 0x87: return "E-AC-3";
+        default: return "Unknown";
+    }
+}
+
+/**
+ * 提取基本流时输出文件的扩展名
+ * @param stream_type          PMT 中的 stream_type
+ */
+static const char *get_stream_file_extension(uint32_t stream_type) {
+    
+    switch (stream_type) {
+        case 0x01:
+        case 0x02: return "m2v";
+        case 0x03:
+        case 0x04: return "mpa";
+        case 0x0f: return "aac";
+        case 0x11: return "latm";
+        case 0x1b: return "h264";
+        case 0x24: return "h265";
+        case 0x81: return "ac3";
+        case 0x87: return "eac3";
+        default: return "es";
+    }
+}
+
+/**
+ * TR 101 290 第一/第二优先级检查  本地文件
+ * 文件没有到达时间  时间由第一个出现的 PCR PID 的 PCR 按包数内插得到  没有 PCR 时不做间隔类检查
+ * @param url                       ts file path
+ */
+static void tr_check_file(char *url) {
+    
+    const uint8_t *data = NULL;
+    size_t size = 0;
+    TS_SYNC_STATS sync = {};
+    const TS_PACKET_FORMAT *format = NULL;
+    TR_CHECKER *checker = NULL;
+    double start_time = get_time_seconds();
+    
+    if (map_input_file(url, &data, &size) < 0) {
+        return;
+    }
+    
+    checker = alloc_tr_checker(false);
+    if (!checker) {
+        printf("Alloc TR 101 290 Checker Error.\n");
+        munmap((void *)data, size);
+        return;
+    }
+    
+    format = detect_packet_format(data, size);
+    scan_ts_buffer(data, size, 0, size, format, checker->parser, tr_check_packet, &sync, false);
+    if (checker->now >= 0) {
+        tr_sweep(checker);
+    }
+    
+    // 文件的同步由 scan_ts_buffer 处理  每次同步丢失算一次失步  跳过的每个包位置算一次同步字节错误
+    checker->counts[TR_SYNC_LOSS] += sync.lost_sync;
+    checker->counts[TR_SYNC_BYTE] += (sync.skipped_bytes + format->stride - 1) / format->stride > sync.lost_sync ? (sync.skipped_bytes + format->stride - 1) / format->stride : sync.lost_sync;
+    
+    print_tr_report(checker, get_time_seconds() - start_time);
+    print_sync_stats(format, &sync);
+    
+    free_tr_checker(checker);
+    munmap((void *)data, size);
+}
+
+/**
+ * TR 101 290 第一/第二优先级检查  UDP/RTP 直播输入  每秒输出一行新增错误  Ctrl+C 结束后输出总计
+ * 时间使用每批 UDP 包的接收时间  没有数据时也按时检查 PAT/PMT/PID 超时
+ * 一批最多 TR_RECV_BATCH 个包  连续接收不超过 TR_DRAIN_TIME  码率很高时也能按时检查超时和输出
+ * @param url                       udp://[address]:port 或 rtp://[address]:port
+ */
+static void tr_check_live(char *url) {
+    
+    FILE *myout = stdout;
+    TR_CHECKER *checker = NULL;
+    uint8_t *buffer = NULL;
+    RECV_MESSAGE messages[TR_RECV_BATCH] = {};
+    struct iovec iovecs[TR_RECV_BATCH];
+    struct sigaction action = {}, old_action = {};
+    uint64_t last_counts[TR_CHECK_COUNT] = {};
+    uint64_t last_bytes = 0;
+    double start_time = get_time_seconds();
+    double next_report = start_time + TR_REPORT_INTERVAL;
+    int fd = -1;
+    
+    fd = open_udp_input(url);
+    if (fd < 0) {
+        return;
+    }
+    
+    checker = alloc_tr_checker(true);
+    buffer = (uint8_t *)malloc((size_t)TR_RECV_BATCH * TR_UDP_BUFFER_SIZE);
+    if (!checker || !buffer) {
+        printf("Alloc TR 101 290 Checker Error.\n");
+        goto __END;
+    }
+    for (int i = 0; i < TR_RECV_BATCH; i++) {
+        iovecs[i].iov_base = buffer + (size_t)i * TR_UDP_BUFFER_SIZE;
+        iovecs[i].iov_len = TR_UDP_BUFFER_SIZE;
+        messages[i].msg_hdr.msg_iov = &iovecs[i];
+        messages[i].msg_hdr.msg_iovlen = 1;
+    }
+    
+    // Ctrl+C 时跳出等待  输出总计
+    follow_stopped = 0;
+    action.sa_handler = on_follow_signal;
+    sigemptyset(&action.sa_mask);
+    sigaction(SIGINT, &action, &old_action);
+    
+    fprintf(myout, "Monitoring %s, Ctrl+C To Stop.\n", url);
+    
+    while (!follow_stopped) {
+        struct pollfd pfd = {fd, POLLIN, 0};
+        int ret = poll(&pfd, 1, (int)(TR_SWEEP_INTERVAL * 1000 / TR_CLOCK_HZ));
+        double now = get_time_seconds();
+        
+        if (ret < 0 && errno != EINTR) {
+            printf("Poll UDP Socket Error: %s\n", strerror(errno));
+            break;
+        }
+        // 批量读空接收缓冲区  持续有数据时最多接收 TR_DRAIN_TIME
+        while (ret > 0) {
+            int count = tr_receive_batch(fd, messages, TR_RECV_BATCH);
+            double received = get_time_seconds();
+            if (count <= 0) {
+                break;
+            }
+            checker->now = (int64_t)((received - start_time) * TR_CLOCK_HZ);
+            for (int i = 0; i < count; i++) {
+                size_t length = messages[i].msg_len;
+                if (messages[i].msg_hdr.msg_flags & MSG_TRUNC) {
+                    length = TR_UDP_BUFFER_SIZE;
+                }
+                tr_check_datagram(checker, buffer + (size_t)i * TR_UDP_BUFFER_SIZE, length);
+            }
+            if (received - now >= TR_DRAIN_TIME) {
+                break;
+            }
+        }
+        
+        // 输入中断时也要检查超时  接收之后时间已经过去  重新取  时钟不能回退
+        now = get_time_seconds();
+        checker->now = (int64_t)((now - start_time) * TR_CLOCK_HZ);
+        if (checker->now >= checker->next_sweep) {
+            tr_sweep(checker);
+        }
+        
+        if (now >= next_report) {
+            fprintf(myout, "[%8.1f s] %8.2f Mbps", now - start_time, (checker->bytes - last_bytes) * 8 / (now - next_report + TR_REPORT_INTERVAL) / 1000000);
+            for (int check = 0; check < TR_CHECK_COUNT; check++) {
+                if (checker->counts[check] != last_counts[check]) {
+                    fprintf(myout, ", %s +%llu", tr_check_names[check], (unsigned long long)(checker->counts[check] - last_counts[check]));
+                    last_counts[check] = checker->counts[check];
+                }
+            }
+            fprintf(myout, "\n");
+            fflush(myout);
+            last_bytes = checker->bytes;
+            next_report = now + TR_REPORT_INTERVAL;
+        }
+    }
+    
+    sigaction(SIGINT, &old_action, NULL);
+    print_tr_report(checker, get_time_seconds() - start_time);
+    
+__END:
+    free(buffer);
+    free_tr_checker(checker);
+    close(fd);
+}
+
+/**
+ * 分配 TR 101 290 检查状态  统计模式的 TSParser 负责 PAT/PMT 和 section CRC  CC 错误也直接用它的统计
+ * @param live                      是否为直播输入  直播输入的时间由调用者设置
+ * @return TR_CHECKER Instance  失败返回 NULL
+ */
+static TR_CHECKER *alloc_tr_checker(bool live) {
+    
+    TR_CHECKER *checker = (TR_CHECKER *)calloc(1, sizeof(TR_CHECKER));
+    if (!checker) {
+        return NULL;
+    }
+    checker->parser = alloc_stats_parser();
+    checker->pids = (TR_PID_STATE *)calloc(TS_PID_COUNT, sizeof(TR_PID_STATE));
+    if (!checker->parser || !checker->pids) {
+        free_tr_checker(checker);
+        return NULL;
+    }
+    checker->parser->mUserData = checker;
+    
+    // 时间为 -1 表示还没有出现过
+    for (uint32_t pid = 0; pid < TS_PID_COUNT; pid++) {
+        TR_PID_STATE *state = &checker->pids[pid];
+        state->last_packet = state->last_section = state->last_pts = state->last_pcr_time = -1;
+    }
+    for (int check = 0; check < TR_CHECK_COUNT; check++) {
+        checker->first_time[check] = -1;
+    }
+    checker->live = live;
+    checker->now = live ? 0 : -1;
+    checker->clock_pid = TS_PID_COUNT;
+    return checker;
+}
+
+/**
+ * 释放 TR 101 290 检查状态
+ * @param checker                 TR_CHECKER Instance  可以为 NULL
+ */
+static void free_tr_checker(TR_CHECKER *checker) {
+    
+    if (checker) {
+        free_stats_parser(checker->parser);
+        free(checker->pids);
+        free(checker);
+    }
+}
+
+/**
+ * TR 101 290 每个包的检查  每个 PID 的状态定长  每个包的开销为 O(1)
+ * CC/CRC/PCR 由 parseTSPacketStats 统计  这里比较调用前后的统计得到这个包的结果
+ * 重复包的 PCR 不计入统计  has_pcr 为 false  不做 PCR 间隔和不连续的检查
+ * 间隔类的检查在包到达时检查一次  再由 tr_sweep 定期检查一直没有到达的情况  每次超时只计一次
+ * @param parser                  TSParser Instance  mUserData 为 TR_CHECKER
+ * @param packet                 188 字节的 TS 包
+ */
+static void tr_check_packet(TSParser *parser, const uint8_t *packet) {
+    
+    TR_CHECKER *checker = (TR_CHECKER *)parser->mUserData;
+    uint32_t pid = ((packet[1] & 0x1F) << 8) | packet[2];
+    bool unit_start = packet[1] & 0x40;
+    bool scrambled = packet[3] & 0xC0;
+    bool discontinuity, has_pcr;
+    const uint8_t *payload = packet + 4;
+    const uint8_t *end = packet + TS_PACKET_SIZE;
+    TR_PID_STATE *state = &checker->pids[pid];
+    TSPIDStats *stats = &parser->mPIDStats[pid];
+    uint64_t index = parser->mPacketCount;
+    uint64_t cc_errors = stats->mCCErrors;
+    uint64_t sections = stats->mSections;
+    uint64_t crc_errors = stats->mCRCErrors;
+    uint64_t pcr_count = stats->mPCRCount;
+    uint64_t jitter_count = stats->mPCRJitterCount;
+    uint64_t discontinuities = stats->mDiscontinuities;
+    int64_t last_pcr = stats->mLastPCR;
+    int64_t now;
+    
+    if (packet[3] & 0x20) {
+        payload += 1 + packet[4];
+    }
+    
+    parseTSPacketStats(parser, packet);
+    checker->bytes += TS_PACKET_SIZE;
+    has_pcr = stats->mPCRCount != pcr_count;
+    discontinuity = stats->mDiscontinuities != discontinuities;
+    if (!checker->live) {
+        update_tr_clock(checker, pid, stats->mLastPCR, has_pcr && !discontinuity, index);
+    }
+    
+    // 不需要时间的检查
+    if (packet[1] & 0x80) {
+        tr_report_error(checker, TR_TRANSPORT, pid);
+    }
+    if (stats->mCCErrors != cc_errors) {
+        tr_report_error(checker, TR_CC, pid);
+    }
+    if (stats->mCRCErrors != crc_errors) {
+        tr_report_error(checker, TR_CRC, pid);
+    }
+    if (pid == 0) {
+        // PID 0 加扰  或者 PID 0 上的 section 不是 PAT
+        if (scrambled || (unit_start && payload < end && payload + 1 + payload[0] < end && payload[1 + payload[0]] != 0x00)) {
+            tr_report_error(checker, TR_PAT, pid);
+        }
+    } else if (scrambled && parser->mPIDTable[pid].mType == TS_PID_PMT) {
+        tr_report_error(checker, TR_PMT, pid);
+    }
+    
+    now = checker->now;
+    if (now < 0) {
+        return;
+    }
+    
+    // PID_error  PMT 中引用的 PID 超时
+    if ((state->flags & (TR_PID_TRACKED | TR_PID_LATE_PACKET)) == TR_PID_TRACKED && now - state->last_packet > TR_PID_TIMEOUT) {
+        tr_report_error(checker, TR_PID, pid);
+    }
+    state->last_packet = now;
+    state->flags &= ~TR_PID_LATE_PACKET;
+    
+    // PAT/PMT 间隔  CRC 错误的 section 不算
+    if (stats->mSections - sections > stats->mCRCErrors - crc_errors) {
+        if ((state->flags & (TR_PID_PSI | TR_PID_LATE_SECTION)) == TR_PID_PSI && now - state->last_section > TR_PAT_INTERVAL) {
+            tr_report_error(checker, pid == 0 ? TR_PAT : TR_PMT, pid);
+        }
+        state->last_section = now;
+        state->flags &= ~TR_PID_LATE_SECTION;
+    }
+    
+    if (has_pcr) {
+        if (pcr_count > 0 && !discontinuity) {
+            int64_t delta = stats->mLastPCR - last_pcr;
+            // PCR 33bit base 回绕
+            if (delta < -TS_PCR_WRAP / 2) {
+                delta += TS_PCR_WRAP;
+            }
+            if (delta <= 0 || delta > TR_PCR_JUMP) {
+                tr_report_error(checker, TR_PCR_DISCONTINUITY, pid);
+            }
+            if (delta > TR_PCR_INTERVAL && !(state->flags & TR_PID_LATE_PCR)) {
+                tr_report_error(checker, TR_PCR_REPETITION, pid);
+            }
+        }
+        // PCR 精度  统计中 PCR 相对包序号拟合的偏差  固定码率下拟合直线即理想 PCR
+        // 任何 PID 丢包后拟合重新开始  重新积累 TS_PCR_FIT_MIN 个 PCR 之前 mPCRJitterCount 不变  不检查
+        if (stats->mPCRJitterCount != jitter_count) {
+            double error = fabs(stats->mLastPCRJitter);
+            if (error > checker->max_pcr_error) {
+                checker->max_pcr_error = error;
+            }
+            if (error > TR_PCR_MAX_ERROR) {
+                tr_report_error(checker, TR_PCR_ACCURACY, pid);
+            }
+        }
+        state->last_pcr_time = now;
+        state->flags |= TR_PID_HAS_PCR;
+        state->flags &= ~TR_PID_LATE_PCR;
+    }
+    
+    // PTS 间隔  只检查带 optional PES header 的 PES
+    if (unit_start && payload + 14 <= end && payload[0] == 0x00 && payload[1] == 0x00 && payload[2] == 0x01
+        && (payload[6] & 0xC0) == 0x80 && (payload[7] & 0x80) && parser->mPIDTable[pid].mType == TS_PID_STREAM) {
+        if ((state->flags & (TR_PID_HAS_PTS | TR_PID_LATE_PTS)) == TR_PID_HAS_PTS && now - state->last_pts > TR_PTS_INTERVAL) {
+            tr_report_error(checker, TR_PTS, pid);
+        }
+        state->last_pts = now;
+        state->flags |= TR_PID_HAS_PTS;
+        state->flags &= ~TR_PID_LATE_PTS;
+    }
+    
+    if (now >= checker->next_sweep) {
+        tr_sweep(checker);
+    }
+}
+
+/**
+ * 文件输入的时钟  以第一个出现 PCR 的 PID 为准  两个 PCR 之间按包数线性内插
+ * PCR 跳变或 discontinuity_indicator 置1时按之前的码率继续走  时钟保持单调
+ * @param checker                 TR_CHECKER Instance
+ * @param pid                       当前包的 PID
+ * @param pcr                       当前包的 PCR
+ * @param has_pcr                当前包有连续的 PCR
+ * @param index                   当前包的序号
+ */
+static void update_tr_clock(TR_CHECKER *checker, uint32_t pid, int64_t pcr, bool has_pcr, uint64_t index) {
+    
+    if (has_pcr && checker->clock_pid == TS_PID_COUNT) {
+        checker->clock_pid = pid;
+        checker->clock_time = 0;
+        checker->clock_pcr = pcr;
+        checker->clock_packet = index;
+    } else if (has_pcr && pid == checker->clock_pid) {
+        int64_t delta = pcr - checker->clock_pcr;
+        uint64_t packets = index - checker->clock_packet;
+        if (delta < -TS_PCR_WRAP / 2) {
+            delta += TS_PCR_WRAP;
+        }
+        if (delta > 0 && delta <= TR_PCR_JUMP && packets > 0) {
+            checker->clock_ticks_per_packet = (double)delta / packets;
+            checker->clock_time += delta;
+        } else {
+            checker->clock_time += (int64_t)(packets * checker->clock_ticks_per_packet);
+        }
+        checker->clock_pcr = pcr;
+        checker->clock_packet = index;
+    }
+    if (checker->clock_pid < TS_PID_COUNT) {
+        checker->now = checker->clock_time + (int64_t)((index - checker->clock_packet) * checker->clock_ticks_per_packet);
+    }
+}
+
+/**
+ * 定期检查一直没有到达的 PAT/PMT/PID/PCR/PTS  并按当前的 PAT/PMT 更新需要检查的 PID
+ * @param checker                 TR_CHECKER Instance
+ */
+static void tr_sweep(TR_CHECKER *checker) {
+    
+    const TSParser *parser = checker->parser;
+    TR_PID_STATE *pids = checker->pids;
+    int64_t now = checker->now;
+    
+    checker->next_sweep = now + TR_SWEEP_INTERVAL;
+    // 收到第一个包之后才开始计时
+    if (parser->mPacketCount == 0) {
+        return;
+    }
+    
+    // PAT/PMT 可能已经变化  重新标记需要检查的 PID  新加入的从现在开始计时
+    for (uint32_t pid = 0; pid < TS_PID_COUNT; pid++) {
+        pids[pid].flags &= ~(TR_PID_PSI | TR_PID_TRACKED);
+    }
+    pids[0].flags |= TR_PID_PSI;
+    for (TSPointersListItem *programItem = parser->mPrograms.mHead; programItem != NULL; programItem = programItem->mNext) {
+        const TSProgram *program = (const TSProgram *)programItem->mData;
+        pids[program->mProgramMapPID].flags |= TR_PID_PSI;
+        for (TSPointersListItem *streamItem = program->mStreams.mHead; streamItem != NULL; streamItem = streamItem->mNext) {
+            pids[((const TSStream *)streamItem->mData)->mElementaryPID].flags |= TR_PID_TRACKED;
+        }
+    }
+    
+    for (uint32_t pid = 0; pid < TS_PID_COUNT; pid++) {
+        TR_PID_STATE *state = &pids[pid];
+        
+        if (state->flags & TR_PID_PSI) {
+            if (state->last_section < 0) {
+                state->last_section = now;
+            } else if (!(state->flags & TR_PID_LATE_SECTION) && now - state->last_section > TR_PAT_INTERVAL) {
+                tr_report_error(checker, pid == 0 ? TR_PAT : TR_PMT, pid);
+                state->flags |= TR_PID_LATE_SECTION;
+            }
+        }
+        if (state->flags & TR_PID_TRACKED) {
+            if (state->last_packet < 0) {
+                state->last_packet = now;
+            } else if (!(state->flags & TR_PID_LATE_PACKET) && now - state->last_packet > TR_PID_TIMEOUT) {
+                tr_report_error(checker, TR_PID, pid);
+                state->flags |= TR_PID_LATE_PACKET;
+            }
+        }
+        // PCR 间隔在 PCR 到达时按 PCR 值精确检查  这里只检查直播输入 PCR 停止到达  按到达时间超过 100ms 才计数  避免网络抖动误报
+        if (checker->live && (state->flags & (TR_PID_HAS_PCR | TR_PID_LATE_PCR)) == TR_PID_HAS_PCR && now - state->last_pcr_time > TR_PCR_JUMP) {
+            tr_report_error(checker, TR_PCR_REPETITION, pid);
+            state->flags |= TR_PID_LATE_PCR;
+        }
+        if ((state->flags & (TR_PID_HAS_PTS | TR_PID_LATE_PTS)) == TR_PID_HAS_PTS && now - state->last_pts > TR_PTS_INTERVAL) {
+            tr_report_error(checker, TR_PTS, pid);
+            state->flags |= TR_PID_LATE_PTS;
+        }
+    }
+}
+
+/**
+ * 记录一次错误
+ * @param checker                 TR_CHECKER Instance
+ * @param check                   检查项
+ * @param pid                       出错的 PID  TS_PID_COUNT 表示没有 PID
+ */
+static void tr_report_error(TR_CHECKER *checker, int check, uint32_t pid) {
+    
+    if (checker->counts[check]++ == 0) {
+        checker->first_time[check] = checker->now;
+        checker->first_pid[check] = pid;
+    }
+}
+
+/**
+ * 检查一个 UDP 包  RTP 封装时先去掉 RTP 头  每 188 字节一个 TS 包
+ * 连续 TR_SYNC_LOSS_COUNT 个同步字节错误为失步  之后连续 TS_SYNC_LOCK_COUNT 个正确才恢复  失步期间的包不检查
+ * @param checker                 TR_CHECKER Instance
+ * @param data                    UDP 负载
+ * @param size                     UDP 负载大小
+ */
+static void tr_check_datagram(TR_CHECKER *checker, const uint8_t *data, size_t size) {
+    
+    // RTP version 2  第一个字节不会是 0x47
+    if (size >= 12 && data[0] != TS_SYNC && (data[0] & 0xC0) == 0x80) {
+        size_t header = 12 + (data[0] & 0x0F) * 4;
+        if ((data[0] & 0x10) && size >= header + 4) {
+            header += 4 + ((data[header + 2] << 8) | data[header + 3]) * 4;
+        }
+        if (header > size) {
+            tr_report_error(checker, TR_SYNC_BYTE, TS_PID_COUNT);
+            return;
+        }
+        data += header;
+        size -= header;
+    }
+    
+    for (; size >= TS_PACKET_SIZE; data += TS_PACKET_SIZE, size -= TS_PACKET_SIZE) {
+        if (data[0] != TS_SYNC) {
+            tr_report_error(checker, TR_SYNC_BYTE, TS_PID_COUNT);
+            checker->good_sync = 0;
+            if (++checker->bad_sync >= TR_SYNC_LOSS_COUNT && !checker->sync_lost) {
+                checker->sync_lost = true;
+                tr_report_error(checker, TR_SYNC_LOSS, TS_PID_COUNT);
+            }
+            continue;
+        }
+        checker->bad_sync = 0;
+        if (checker->sync_lost) {
+            if (++checker->good_sync < TS_SYNC_LOCK_COUNT) {
+                continue;
+            }
+            checker->sync_lost = false;
+        }
+        tr_check_packet(checker->parser, data);
+    }
+    // UDP 负载不是整数个 TS 包
+    if (size > 0) {
+        tr_report_error(checker, TR_SYNC_BYTE, TS_PID_COUNT);
+    }
+}
+
+/**
+ * 非阻塞接收一批 UDP 包  Linux 上一次 recvmmsg  其他平台逐个 recvmsg 直到读空或收满
+ * @param fd                          UDP Socket
+ * @param messages              已经设置好接收缓冲区的消息
+ * @param count                   最多接收的包数
+ * @return 收到的包数  没有数据返回 0  出错返回 -1
+ */
+static int tr_receive_batch(int fd, RECV_MESSAGE *messages, int count) {
+    
+    int received = 0;
+    
+#if defined(__linux__)
+    received = recvmmsg(fd, messages, count, MSG_DONTWAIT, NULL);
+    if (received < 0) {
+        return (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) ? 0 : -1;
+    }
+#else
+    while (received < count) {
+        ssize_t length = recvmsg(fd, &messages[received].msg_hdr, MSG_DONTWAIT);
+        if (length < 0) {
+            if (received == 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+                return -1;
+            }
+            break;
+        }
+        messages[received].msg_len = (unsigned int)length;
+        received++;
+    }
+#endif
+    return received;
+}
+
+/**
+ * 打开 UDP 输入  组播地址加入组播组  放大接收缓冲区
+ * @param url                       udp://[address]:port 或 rtp://[address]:port  address 为空时监听所有地址
+ * @return socket  失败返回 -1
+ */
+static int open_udp_input(const char *url) {
+    
+    const char *host = strstr(url, "://") + 3;
+    const char *colon = strrchr(host, ':');
+    char address[64] = {};
+    struct sockaddr_in local_addr = {};
+    struct in_addr group = {};
+    int port = 0;
+    int fd = -1;
+    int on = 1;
+    int buffer_size = TR_UDP_RCVBUF;
+    
+    if (!colon || (port = atoi(colon + 1)) <= 0 || port > 65535 || (size_t)(colon - host) >= sizeof(address)) {
+        printf("Invalid Input URL %s, Use udp://[address]:port Or rtp://[address]:port.\n", url);
+        return -1;
+    }
+    // 兼容 udp://@239.1.1.1:1234 的写法
+    if (*host == '@') {
+        host++;
+    }
+    memcpy(address, host, colon - host);
+    if (address[0] != '\0' && inet_pton(AF_INET, address, &group) != 1) {
+        printf("Invalid Address %s.\n", address);
+        return -1;
+    }
+    
+    fd = socket(AF_INET, SOCK_DGRAM, 0);
+    if (fd < 0) {
+        printf("Create UDP Socket Error: %s\n", strerror(errno));
+        return -1;
+    }
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+    if (setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &buffer_size, sizeof(buffer_size)) < 0) {
+        printf("Set UDP Receive Buffer Size Error: %s\n", strerror(errno));
+    }
+    
+    local_addr.sin_family = AF_INET;
+    local_addr.sin_port = htons(port);
+    local_addr.sin_addr.s_addr = group.s_addr;
+    if (bind(fd, (const struct sockaddr *)&local_addr, sizeof(local_addr)) < 0) {
+        printf("Bind UDP Port %d Error: %s\n", port, strerror(errno));
+        close(fd);
+        return -1;
+    }
+    
+    if (IN_MULTICAST(ntohl(group.s_addr))) {
+        struct ip_mreq mreq = {};
+        mreq.imr_multiaddr = group;
+        mreq.imr_interface.s_addr = htonl(INADDR_ANY);
+        if (setsockopt(fd, IPPROTO_IP, IP_ADD_MEMBERSHIP, &mreq, sizeof(mreq)) < 0) {
+            printf("Join Multicast Group %s Error: %s\n", address, strerror(errno));
+            close(fd);
+            return -1;
+        }
+    }
+    return fd;
+}
+
+/**
+ * 输出 TR 101 290 检查结果
+ * @param checker                 TR_CHECKER Instance
+ * @param elapsed               检查耗时  单位s
+ */
+static void print_tr_report(const TR_CHECKER *checker, double elapsed) {
+    
+    FILE *myout = stdout;
+    
+    fprintf(myout, "========================= TR 101 290 Report ==========================\n");
+    fprintf(myout, "Packets:           %llu\n", (unsigned long long)checker->parser->mPacketCount);
+    if (checker->now >= 0) {
+        fprintf(myout, "Duration:          %.3f s (%s)\n", checker->now / (double)TR_CLOCK_HZ, checker->live ? "arrival time" : "PCR clock");
+    } else {
+        fprintf(myout, "Duration:          unknown, no PCR found, interval checks skipped\n");
+    }
+    for (int check = 0; check < TR_CHECK_COUNT; check++) {
+        if (check == 0 || check == TR_PRIORITY1_COUNT) {
+            fprintf(myout, "Priority %d:\n", check == 0 ? 1 : 2);
+        }
+        fprintf(myout, "    %-40s %10llu", tr_check_names[check], (unsigned long long)checker->counts[check]);
+        if (checker->first_time[check] >= 0 && checker->first_pid[check] < TS_PID_COUNT) {
+            fprintf(myout, "   first at %.3f s on PID 0x%04x", checker->first_time[check] / (double)TR_CLOCK_HZ, checker->first_pid[check]);
+        } else if (checker->first_time[check] >= 0) {
+            fprintf(myout, "   first at %.3f s", checker->first_time[check] / (double)TR_CLOCK_HZ);
+        }
+        fprintf(myout, "\n");
+    }
+    fprintf(myout, "PCR Accuracy:      max %.0f ns\n", checker->max_pcr_error * 1000000000.0 / TR_CLOCK_HZ);
+    if (elapsed > 0 && !checker->live) {
+        fprintf(myout, "Check Speed:       %.0f packets/s, %.2f Mbps (%.3f s)\n", checker->parser->mPacketCount / elapsed, checker->bytes * 8 / elapsed / 1000000, elapsed);
+    }
 }
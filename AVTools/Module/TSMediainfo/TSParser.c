@@ -21,10 +21,16 @@
 #include <fcntl.h>
 #include <string.h>
 #include <sys/types.h>
+#include <pthread.h>
+#include <math.h>
 
 #include "TSParser.h"
 #include "CPrint.h"
 
+static void copyDVBString(char *dst, const uint8_t *src, size_t length);
+static void updatePCRFit(TSPIDStats *stats, double x, double y);
+static uint32_t getHistogramBin(double value, double first, uint32_t bins);
+
 /**
  * Parse TS Packet
  * @param parser               TSParser Instance
@@ -85,72 +91,814 @@ void parseTSPacket(TSParser *parser, uint8_t *packet_buffer, size_t packet_size)
 
     // 根据PID解析TS Packet Payload
 	if(adaptation_field_control == 1 || adaptation_field_control == 3) {
-		parseProgramId(parser, &bitReader, pid, payload_unit_start_indicator);
+		parseProgramId(parser, &bitReader, pid, payload_unit_start_indicator, continuity_counter);
 	}
 }
 
 /**
- * Parse TS Packet Adaptation Field
+ * 统计模式解析 TS Packet  不输出  直接按字节读取包头  只解析 PAT/PMT 和 PES 头  结果累计到 parser->mPIDStats
+ * @param parser               TSParser Instance  mPIDStats 不能为 NULL
+ * @param packet               TS Packet  TS_PACKET_SIZE 字节  已确认同步字节
+ */
+void parseTSPacketStats(TSParser *parser, const uint8_t *packet) {
+    
+    uint32_t pid = ((packet[1] & 0x1F) << 8) | packet[2];
+    uint32_t payload_unit_start_indicator = packet[1] & 0x40;
+    uint32_t adaptation_field_control = (packet[3] >> 4) & 0x03;
+    uint32_t continuity_counter = packet[3] & 0x0F;
+    uint32_t discontinuity_indicator = 0;
+    uint32_t duplicate = 0;
+    int64_t pcr = -1;
+    const uint8_t *payload = packet + 4;
+    const uint8_t *end = packet + TS_PACKET_SIZE;
+    TSPIDStats *stats = &parser->mPIDStats[pid];
+    TSPIDEntry *entry;
+    uint64_t index = parser->mPacketCount++;
+    
+    stats->mPackets++;
+    if (packet[1] & 0x80) {
+        stats->mErrorPackets++;
+    }
+    if (packet[3] & 0xC0) {
+        stats->mScrambledPackets++;
+    }
+    
+    // Adaptation Field  只读取 discontinuity_indicator 和 PCR
+    if (adaptation_field_control & 0x02) {
+        uint32_t adaptation_field_length = packet[4];
+        payload = packet + 5 + adaptation_field_length;
+        if (payload > end) {
+            payload = end;
+        }
+        if (adaptation_field_length > 0) {
+            discontinuity_indicator = packet[5] & 0x80;
+            if (discontinuity_indicator) {
+                stats->mDiscontinuities++;
+            }
+            if (packet[5] & 0x40) {
+                stats->mRandomAccessPoints++;
+            }
+            if ((packet[5] & 0x10) && adaptation_field_length >= 7) {
+                const uint8_t *p = packet + 6;
+                // PCR = program_clock_reference_base(33bit) * 300 + program_clock_reference_extension(9bit)
+                int64_t base = ((int64_t)p[0] << 25) | ((int64_t)p[1] << 17) | ((int64_t)p[2] << 9) | ((int64_t)p[3] << 1) | (p[4] >> 7);
+                pcr = base * 300 + (((p[4] & 0x01) << 8) | p[5]);
+            }
+        }
+    }
+    
+    // 只有带负载的包 continuity_counter 才递增  允许重复发送一次  discontinuity_indicator 置1时不检查
+    if ((adaptation_field_control & 0x01) && pid != TS_NULL_PID) {
+        duplicate = stats->mHasCC && !discontinuity_indicator && continuity_counter == stats->mLastCC;
+        if (stats->mHasCC && !discontinuity_indicator && continuity_counter != stats->mLastCC && continuity_counter != ((stats->mLastCC + 1) & 0x0F)) {
+            stats->mCCErrors++;
+            parser->mCCErrorCount++;
+        }
+        if (!stats->mHasCC) {
+            stats->mFirstCC = continuity_counter;
+            stats->mFirstCCDiscontinuity = discontinuity_indicator != 0;
+        }
+        stats->mLastCC = continuity_counter;
+        stats->mHasCC = 1;
+    }
+    
+    // 先检查 CC  这个包之前丢了包时  PCR 拟合也要重新开始  重复包的 PCR 不是新的采样点  不参与统计
+    if (pcr >= 0 && !duplicate) {
+        updatePCRStats(stats, pcr, discontinuity_indicator, parser->mCCErrorCount, index);
+    }
+    if (!(adaptation_field_control & 0x01)) {
+        return;
+    }
+    if (payload >= end) {
+        return;
+    }
+    if (payload_unit_start_indicator) {
+        stats->mUnitStarts++;
+    }
+    
+    // PSI 按 section 重组  完整的 section 交给 parseSectionStats
+    if (pid == 0) {
+        pushSectionData(parser, &parser->mPATSection, pid, payload, end - payload, payload_unit_start_indicator, continuity_counter, parseSectionStats);
+        return;
+    }
+    
+    entry = &parser->mPIDTable[pid];
+    if (entry->mType == TS_PID_STREAM) {
+        // PES 头一般都在第一个包里  不需要重组
+        if (payload_unit_start_indicator) {
+            int64_t timestamp = parsePESHeaderStats(stats, payload, end - payload);
+            if (timestamp >= 0) {
+                updateBufferLevel(parser, stats, (const TSStream *)entry->mTarget, timestamp, index);
+            }
+        }
+    } else if (entry->mType == TS_PID_PMT) {
+        pushSectionData(parser, &((TSProgram *)entry->mTarget)->mSection, pid, payload, end - payload, payload_unit_start_indicator, continuity_counter, parseSectionStats);
+    } else if (pid == TS_SDT_PID) {
+        pushSectionData(parser, &parser->mSDTSection, pid, payload, end - payload, payload_unit_start_indicator, continuity_counter, parseSectionStats);
+    }
+}
+
+/**
+ * 统计模式处理重组完成的 PSI section
+ * @param parser               TSParser Instance
+ * @param pid                    section 所在的 PID
+ * @param section             section 数据  从 table_id 开始
+ * @param size                  section 大小
+ * @param crcValid           CRC 是否正确
+ */
+void parseSectionStats(TSParser *parser, uint32_t pid, const uint8_t *section, size_t size, uint32_t crcValid) {
+    
+    TSPIDStats *stats = &parser->mPIDStats[pid];
+    TSProgram *program;
+    
+    stats->mSections++;
+    if (!crcValid) {
+        stats->mCRCErrors++;
+        return;
+    }
+    
+    if (pid == 0) {
+        parseProgramAssociationSection(parser, section, size);
+    } else if (parser->mPIDTable[pid].mType == TS_PID_PMT) {
+        // 多个节目共用 PMT PID 时按 program_number 找到对应的节目
+        program = size >= 5 ? getProgramByNumber(parser, pid, (section[3] << 8) | section[4]) : NULL;
+        if (program != NULL) {
+            parseProgramMapSection(parser, program, section, size);
+        }
+    } else if (pid == TS_SDT_PID) {
+        parseServiceDescriptionSection(parser, section, size);
+    }
+}
+
+/**
+ * 统计模式解析 PAT section  与当前 PAT 的 CRC 相同时直接返回
+ * @param parser               TSParser Instance
+ * @param section             section 数据  从 table_id 开始  CRC 已校验
+ * @param size                  section 大小
+ */
+void parseProgramAssociationSection(TSParser *parser, const uint8_t *section, size_t size) {
+    
+    uint32_t section_length;
+    uint32_t version_number;
+    uint32_t crc;
+    const uint8_t *p;
+    const uint8_t *end;
+    
+    if (size < 12 || section[0] != 0x00) {
+        return;
+    }
+    section_length = ((section[1] & 0x0F) << 8) | section[2];
+    version_number = (section[5] >> 1) & 0x1F;
+    // current_next_indicator 为0的表还未生效
+    if (section_length < 9 || 3 + section_length > size || !(section[5] & 0x01)) {
+        return;
+    }
+    // 重复发送的 PAT  CRC 相同内容一定相同  version_number 没变但内容变了也重建
+    crc = ((uint32_t)section[section_length - 1] << 24) | (section[section_length] << 16) | (section[section_length + 1] << 8) | section[section_length + 2];
+    if (parser->mPATVersion != 0 && parser->mPATCRC == crc) {
+        return;
+    }
+    
+    freePrograms(parser);
+    parser->mPATVersion = version_number + 1;
+    parser->mPATCRC = crc;
+    
+    end = section + 3 + section_length - 4;
+    for (p = section + 8; p + 4 <= end; p += 4) {
+        uint32_t program_number = (p[0] << 8) | p[1];
+        // program_number = 0时是NIT的PID
+        if (program_number != 0) {
+            addProgram(parser, program_number, ((p[2] & 0x1F) << 8) | p[3]);
+        }
+    }
+    rebuildPIDTable(parser);
+}
+
+/**
+ * 统计模式解析 PMT section  与当前 PMT 的 CRC 相同时直接返回
+ * @param parser               TSParser Instance
+ * @param program             TSProgram Instance  program_number 与 section 中的一致
+ * @param section             section 数据  从 table_id 开始  CRC 已校验
+ * @param size                  section 大小
+ */
+void parseProgramMapSection(TSParser *parser, TSProgram *program, const uint8_t *section, size_t size) {
+    
+    uint32_t section_length;
+    uint32_t version_number;
+    uint32_t program_info_length;
+    uint32_t crc;
+    const uint8_t *p;
+    const uint8_t *end;
+    
+    if (size < 12 || section[0] != 0x02) {
+        return;
+    }
+    section_length = ((section[1] & 0x0F) << 8) | section[2];
+    version_number = (section[5] >> 1) & 0x1F;
+    program_info_length = ((section[10] & 0x0F) << 8) | section[11];
+    if (section_length < 13 || 3 + section_length > size || !(section[5] & 0x01) || 12 + program_info_length > 3 + section_length - 4) {
+        return;
+    }
+    crc = ((uint32_t)section[section_length - 1] << 24) | (section[section_length] << 16) | (section[section_length + 1] << 8) | section[section_length + 2];
+    if (program->mVersion != 0 && program->mCRC == crc) {
+        return;
+    }
+    
+    freeProgramResources(parser, program);
+    program->mVersion = version_number + 1;
+    program->mCRC = crc;
+    program->mPCRPID = ((section[8] & 0x1F) << 8) | section[9];
+    
+    end = section + 3 + section_length - 4;
+    for (p = section + 12 + program_info_length; p + 5 <= end; p += 5 + (((p[3] & 0x0F) << 8) | p[4])) {
+        uint32_t elementaryPID = ((p[1] & 0x1F) << 8) | p[2];
+        if (getStreamByPID(program, elementaryPID) == NULL) {
+            addStream(program, elementaryPID, p[0]);
+        }
+    }
+    rebuildPIDTable(parser);
+}
+
+/**
+ * 解析 SDT section  记录每个服务的 service_descriptor  同一版本每个 section_number 的 CRC 不变时直接返回
+ * 只处理 actual_transport_stream 的 SDT  table_id 0x46 的 other_transport_stream 忽略
+ * @param parser               TSParser Instance
+ * @param section             section 数据  从 table_id 开始  CRC 已校验
+ * @param size                  section 大小
+ */
+void parseServiceDescriptionSection(TSParser *parser, const uint8_t *section, size_t size) {
+    
+    uint32_t section_length;
+    uint32_t version_number;
+    uint32_t section_number;
+    uint64_t crc;
+    const uint8_t *p;
+    const uint8_t *end;
+    
+    if (size < 15 || section[0] != 0x42) {
+        return;
+    }
+    section_length = ((section[1] & 0x0F) << 8) | section[2];
+    version_number = (section[5] >> 1) & 0x1F;
+    section_number = section[6];
+    if (section_length < 12 || 3 + section_length > size || !(section[5] & 0x01)) {
+        return;
+    }
+    // bit32 置1表示这个 section_number 已经收到过
+    crc = (1ULL << 32) | ((uint32_t)section[section_length - 1] << 24) | (section[section_length] << 16) | (section[section_length + 1] << 8) | section[section_length + 2];
+    if (parser->mSDTVersion != version_number + 1) {
+        freeServices(parser);
+        memset(parser->mSDTCRC, 0, sizeof(parser->mSDTCRC));
+        parser->mSDTVersion = version_number + 1;
+    } else if (parser->mSDTCRC[section_number] == crc) {
+        return;
+    }
+    parser->mSDTCRC[section_number] = crc;
+    
+    end = section + 3 + section_length - 4;
+    for (p = section + 11; p + 5 <= end; ) {
+        uint32_t service_id = (p[0] << 8) | p[1];
+        const uint8_t *descriptor = p + 5;
+        const uint8_t *descriptorEnd = descriptor + (((p[3] & 0x0F) << 8) | p[4]);
+        
+        if (descriptorEnd > end) {
+            break;
+        }
+        for (; descriptor + 2 <= descriptorEnd && descriptor + 2 + descriptor[1] <= descriptorEnd; descriptor += 2 + descriptor[1]) {
+            // service_descriptor  service_type + provider_name + service_name
+            const uint8_t *q = descriptor + 2;
+            const uint8_t *qEnd = q + descriptor[1];
+            if (descriptor[0] != 0x48 || descriptor[1] < 3 || q + 3 + q[1] > qEnd || q + 3 + q[1] + q[2 + q[1]] > qEnd) {
+                continue;
+            }
+            addService(parser, service_id, q[0], q + 2, q[1], q + 3 + q[1], q[2 + q[1]]);
+        }
+        p = descriptorEnd;
+    }
+}
+
+/**
+ * 统计模式读取 PES 头中的 PTS/DTS
+ * @param stats                 PID 统计
+ * @param data                  PES 数据  从 packet_start_code_prefix 开始
+ * @param size                   可用数据大小
+ * @return 解码时间戳  有 DTS 时为 DTS  否则为 PTS  都没有时返回 -1  单位 90kHz
+ */
+int64_t parsePESHeaderStats(TSPIDStats *stats, const uint8_t *data, size_t size) {
+    
+    uint32_t stream_id;
+    uint32_t PTS_DTS_flags;
+    int64_t PTS, DTS;
+    
+    if (size < 9 || data[0] != 0x00 || data[1] != 0x00 || data[2] != 0x01) {
+        return -1;
+    }
+    stream_id = data[3];
+    if (stream_id == 0xbc || stream_id == 0xbe || stream_id == 0xbf || stream_id == 0xf0
+        || stream_id == 0xf1 || stream_id == 0xff || stream_id == 0xf2 || stream_id == 0xf8) {
+        return -1;
+    }
+    
+    PTS_DTS_flags = data[7] >> 6;
+    if ((PTS_DTS_flags & 0x02) && size >= 14) {
+        PTS = ((int64_t)((data[9] >> 1) & 0x07) << 30) | (data[10] << 22) | ((data[11] >> 1) << 15) | (data[12] << 7) | (data[13] >> 1);
+        if (!stats->mHasPTS || PTS < stats->mMinPTS) {
+            stats->mMinPTS = PTS;
+        }
+        if (!stats->mHasPTS || PTS > stats->mMaxPTS) {
+            stats->mMaxPTS = PTS;
+        }
+        stats->mHasPTS = 1;
+        
+        if (PTS_DTS_flags == 3 && size >= 19) {
+            DTS = ((int64_t)((data[14] >> 1) & 0x07) << 30) | (data[15] << 22) | ((data[16] >> 1) << 15) | (data[17] << 7) | (data[18] >> 1);
+            if (!stats->mHasDTS || DTS < stats->mMinDTS) {
+                stats->mMinDTS = DTS;
+            }
+            if (!stats->mHasDTS || DTS > stats->mMaxDTS) {
+                stats->mMaxDTS = DTS;
+            }
+            stats->mHasDTS = 1;
+            return DTS;
+        }
+        return PTS;
+    }
+    return -1;
+}
+
+/**
+ * 统计模式累计一个 PCR  PCR 间隔和瞬时复用码率  并更新 PCR 拟合
+ * 拟合在 discontinuity_indicator 置1  PCR 回退  间隔超过 TS_PCR_MAX_GAP 或者与上一个 PCR 之间有包丢失时重新开始
+ * 有包丢失时两个 PCR 之间的包数不准  这一次的复用码率也不统计
+ * @param stats                                PCR 所在 PID 的统计
+ * @param pcr                                    PCR  27MHz
+ * @param discontinuity_indicator      PCR 所在包的 discontinuity_indicator
+ * @param ccErrors                            到这个包为止所有 PID 的 CC 错误个数
+ * @param index                                PCR 所在包的序号
+ */
+void updatePCRStats(TSPIDStats *stats, int64_t pcr, uint32_t discontinuity_indicator, uint64_t ccErrors, uint64_t index) {
+    
+    int64_t delta = pcr - stats->mLastPCR;
+    uint32_t lost = ccErrors != stats->mPCRFitCCErrors;
+    
+    stats->mPCRFitCCErrors = ccErrors;
+    if (stats->mPCRCount == 0) {
+        stats->mFirstPCR = pcr;
+        stats->mFirstPCRPacket = index;
+        stats->mFirstPCRDiscontinuity = discontinuity_indicator != 0;
+    } else if (!discontinuity_indicator && pcr > stats->mLastPCR) {
+        int64_t interval = pcr - stats->mLastPCR;
+        // 两个 PCR 之间所有 PID 的包都算在复用码率里
+        double rate = (index - stats->mLastPCRPacket) * TS_PACKET_SIZE * 8.0 * TS_PCR_HZ / interval;
+        if (stats->mPCRIntervals == 0 || interval < stats->mMinPCRInterval) {
+            stats->mMinPCRInterval = interval;
+        }
+        if (interval > stats->mMaxPCRInterval) {
+            stats->mMaxPCRInterval = interval;
+        }
+        stats->mPCRIntervalSum += interval;
+        stats->mPCRIntervals++;
+        if (!lost && (stats->mMinMuxRate == 0 || rate < stats->mMinMuxRate)) {
+            stats->mMinMuxRate = rate;
+        }
+        if (!lost && rate > stats->mMaxMuxRate) {
+            stats->mMaxMuxRate = rate;
+        }
+    }
+    
+    if (delta < -TS_PCR_WRAP / 2) {
+        delta += TS_PCR_WRAP;
+    }
+    if (stats->mPCRCount > 0 && !discontinuity_indicator && !lost && delta > 0 && delta <= TS_PCR_MAX_GAP) {
+        stats->mPCRFitSpan += delta;
+        stats->mPCRTicksPerPacket = (double)delta / (index - stats->mLastPCRPacket);
+    } else {
+        stats->mPCRTicksPerPacket = 0;
+        stats->mPCRFitOrigin = index;
+        stats->mPCRFitSpan = 0;
+        stats->mPCRFitCount = 0;
+        stats->mDriftWindowPacket = 0;
+        stats->mDriftWindowSpan = 0;
+    }
+    updatePCRFit(stats, (double)(index - stats->mPCRFitOrigin), (double)stats->mPCRFitSpan);
+    
+    stats->mLastPCR = pcr;
+    stats->mLastPCRPacket = index;
+    stats->mPCRCount++;
+}
+
+/**
+ * PCR 拟合加入一个点  用增量的均值和协方差  每个 PID 的状态定长
+ * 加入之前先用已有的拟合直线推算这个 PCR  偏差即 PCR 抖动  每 TS_DRIFT_WINDOW 比较一次窗口内的码率与拟合斜率  即 PCR 漂移
+ * @param stats                 PCR 所在 PID 的统计
+ * @param x                      距拟合起点的包数
+ * @param y                      距拟合起点的 PCR 增量
+ */
+static void updatePCRFit(TSPIDStats *stats, double x, double y) {
+    
+    double dx = x - stats->mPCRFitMeanX;
+    
+    if (stats->mPCRFitCount >= TS_PCR_FIT_MIN && stats->mPCRFitCXX > 0) {
+        double slope = stats->mPCRFitCXY / stats->mPCRFitCXX;
+        double jitter = y - stats->mPCRFitMeanY - slope * dx;
+        
+        stats->mLastPCRJitter = jitter;
+        if (fabs(jitter) > stats->mMaxPCRJitter) {
+            stats->mMaxPCRJitter = fabs(jitter);
+        }
+        stats->mJitterHistogram[getHistogramBin(fabs(jitter) * 1000000000.0 / TS_PCR_HZ, TS_JITTER_BIN_NS, TS_JITTER_BINS)]++;
+        stats->mPCRJitterCount++;
+        
+        if (y - stats->mDriftWindowSpan >= TS_DRIFT_WINDOW && x > stats->mDriftWindowPacket) {
+            double drift = fabs((y - stats->mDriftWindowSpan) / (x - stats->mDriftWindowPacket) / slope - 1) * 1000000;
+            if (drift > stats->mMaxPCRDrift) {
+                stats->mMaxPCRDrift = drift;
+            }
+            stats->mDriftHistogram[getHistogramBin(drift, TS_DRIFT_BIN_PPM, TS_DRIFT_BINS)]++;
+            stats->mDriftWindowPacket = (uint64_t)x;
+            stats->mDriftWindowSpan = (int64_t)y;
+        }
+    }
+    
+    if (stats->mPCRFitCount++ == 0) {
+        stats->mPCRFitMeanX = x;
+        stats->mPCRFitMeanY = y;
+        stats->mPCRFitCXX = stats->mPCRFitCXY = 0;
+        return;
+    }
+    stats->mPCRFitMeanX += dx / stats->mPCRFitCount;
+    stats->mPCRFitMeanY += (y - stats->mPCRFitMeanY) / stats->mPCRFitCount;
+    stats->mPCRFitCXX += dx * (x - stats->mPCRFitMeanX);
+    stats->mPCRFitCXY += dx * (y - stats->mPCRFitMeanY);
+}
+
+/**
+ * 直方图区间  第 k 个区间上限为 first * 2^k  最后一个区间没有上限
+ * @param value               数值
+ * @param first                 第一个区间的上限
+ * @param bins                  区间个数
+ * @return 区间序号
+ */
+static uint32_t getHistogramBin(double value, double first, uint32_t bins) {
+    
+    uint32_t bin = 0;
+    while (bin < bins - 1 && value >= first) {
+        first *= 2;
+        bin++;
+    }
+    return bin;
+}
+
+/**
+ * 统计模式累计 PES 的缓冲时间  按最近一个 PCR 间隔的码率把最近一个 PCR 推算到当前包  与解码时间戳相减
+ * 可变码率时局部码率比整体拟合的斜率准确  还没有两个连续的 PCR 时不统计
+ * @param parser               TSParser Instance
+ * @param stats                 PES 所在 PID 的统计
+ * @param stream               PES 所在的流
+ * @param timestamp          解码时间戳  90kHz
+ * @param index                 PES 头所在包的序号
+ */
+void updateBufferLevel(TSParser *parser, TSPIDStats *stats, const TSStream *stream, int64_t timestamp, uint64_t index) {
+    
+    const TSPIDStats *clock = &parser->mPIDStats[stream->mProgram->mPCRPID & (TS_PID_COUNT - 1)];
+    int64_t level;
+    
+    if (clock->mPCRTicksPerPacket <= 0) {
+        return;
+    }
+    level = timestamp * 300 - clock->mLastPCR - (int64_t)((index - clock->mLastPCRPacket) * clock->mPCRTicksPerPacket);
+    // 时间戳回绕
+    level %= TS_PCR_WRAP;
+    if (level > TS_PCR_WRAP / 2) {
+        level -= TS_PCR_WRAP;
+    } else if (level < -TS_PCR_WRAP / 2) {
+        level += TS_PCR_WRAP;
+    }
+    
+    if (stats->mBufferLevels == 0 || level < stats->mMinBufferLevel) {
+        stats->mMinBufferLevel = level;
+    }
+    if (stats->mBufferLevels == 0 || level > stats->mMaxBufferLevel) {
+        stats->mMaxBufferLevel = level;
+    }
+    stats->mBufferLevelSum += level;
+    stats->mBufferLevels++;
+    if (level < 0) {
+        stats->mLateUnits++;
+    }
+}
+
+/**
+ * 合并相邻两段的 PID 统计  结果与两段连续统计一致  分段边界处的 CC 和 PCR 间隔按 next 的第一个包补上
+ * PCR 抖动和漂移的拟合依赖之前所有的 PCR  每段各自拟合  缓冲时间在每段的前两个 PCR 之前不统计  这几项与连续统计不完全一致
+ * @param stats                 前一段的统计  合并结果也写在这里
+ * @param next                   紧接着的后一段的统计
+ * @param packetOffset       后一段第一个包在整个文件中的序号
+ */
+void mergePIDStats(TSPIDStats *stats, const TSPIDStats *next, uint64_t packetOffset) {
+    
+    stats->mPackets += next->mPackets;
+    stats->mCCErrors += next->mCCErrors;
+    stats->mErrorPackets += next->mErrorPackets;
+    stats->mScrambledPackets += next->mScrambledPackets;
+    stats->mUnitStarts += next->mUnitStarts;
+    stats->mSections += next->mSections;
+    stats->mCRCErrors += next->mCRCErrors;
+    stats->mDiscontinuities += next->mDiscontinuities;
+    stats->mRandomAccessPoints += next->mRandomAccessPoints;
+    
+    if (next->mBufferLevels > 0) {
+        if (stats->mBufferLevels == 0 || next->mMinBufferLevel < stats->mMinBufferLevel) {
+            stats->mMinBufferLevel = next->mMinBufferLevel;
+        }
+        if (stats->mBufferLevels == 0 || next->mMaxBufferLevel > stats->mMaxBufferLevel) {
+            stats->mMaxBufferLevel = next->mMaxBufferLevel;
+        }
+        stats->mBufferLevelSum += next->mBufferLevelSum;
+        stats->mBufferLevels += next->mBufferLevels;
+        stats->mLateUnits += next->mLateUnits;
+    }
+    
+    if (next->mHasCC) {
+        if (!stats->mHasCC) {
+            stats->mFirstCC = next->mFirstCC;
+            stats->mFirstCCDiscontinuity = next->mFirstCCDiscontinuity;
+        } else if (!next->mFirstCCDiscontinuity && next->mFirstCC != stats->mLastCC && next->mFirstCC != ((stats->mLastCC + 1) & 0x0F)) {
+            stats->mCCErrors++;
+        }
+        stats->mLastCC = next->mLastCC;
+        stats->mHasCC = 1;
+    }
+    
+    if (next->mHasPTS) {
+        if (!stats->mHasPTS || next->mMinPTS < stats->mMinPTS) {
+            stats->mMinPTS = next->mMinPTS;
+        }
+        if (!stats->mHasPTS || next->mMaxPTS > stats->mMaxPTS) {
+            stats->mMaxPTS = next->mMaxPTS;
+        }
+        stats->mHasPTS = 1;
+    }
+    if (next->mHasDTS) {
+        if (!stats->mHasDTS || next->mMinDTS < stats->mMinDTS) {
+            stats->mMinDTS = next->mMinDTS;
+        }
+        if (!stats->mHasDTS || next->mMaxDTS > stats->mMaxDTS) {
+            stats->mMaxDTS = next->mMaxDTS;
+        }
+        stats->mHasDTS = 1;
+    }
+    
+    if (next->mPCRCount == 0) {
+        return;
+    }
+    if (stats->mPCRCount == 0) {
+        stats->mFirstPCR = next->mFirstPCR;
+        stats->mFirstPCRPacket = next->mFirstPCRPacket + packetOffset;
+        stats->mFirstPCRDiscontinuity = next->mFirstPCRDiscontinuity;
+    } else if (!next->mFirstPCRDiscontinuity && next->mFirstPCR > stats->mLastPCR) {
+        // 边界两侧的两个 PCR 之间的间隔
+        int64_t interval = next->mFirstPCR - stats->mLastPCR;
+        double rate = (next->mFirstPCRPacket + packetOffset - stats->mLastPCRPacket) * TS_PACKET_SIZE * 8.0 * TS_PCR_HZ / interval;
+        if (stats->mMinMuxRate == 0 || rate < stats->mMinMuxRate) {
+            stats->mMinMuxRate = rate;
+        }
+        if (rate > stats->mMaxMuxRate) {
+            stats->mMaxMuxRate = rate;
+        }
+        if (stats->mPCRIntervals == 0 || interval < stats->mMinPCRInterval) {
+            stats->mMinPCRInterval = interval;
+        }
+        if (interval > stats->mMaxPCRInterval) {
+            stats->mMaxPCRInterval = interval;
+        }
+        stats->mPCRIntervalSum += interval;
+        stats->mPCRIntervals++;
+    }
+    if (next->mPCRIntervals > 0) {
+        if (stats->mPCRIntervals == 0 || next->mMinPCRInterval < stats->mMinPCRInterval) {
+            stats->mMinPCRInterval = next->mMinPCRInterval;
+        }
+        if (next->mMaxPCRInterval > stats->mMaxPCRInterval) {
+            stats->mMaxPCRInterval = next->mMaxPCRInterval;
+        }
+        stats->mPCRIntervalSum += next->mPCRIntervalSum;
+        stats->mPCRIntervals += next->mPCRIntervals;
+        if (stats->mMinMuxRate == 0 || next->mMinMuxRate < stats->mMinMuxRate) {
+            stats->mMinMuxRate = next->mMinMuxRate;
+        }
+        if (next->mMaxMuxRate > stats->mMaxMuxRate) {
+            stats->mMaxMuxRate = next->mMaxMuxRate;
+        }
+    }
+    
+    // PCR 拟合每段各自开始  抖动和漂移的直方图直接相加  拟合状态以后一段为准
+    for (uint32_t bin = 0; bin < TS_JITTER_BINS; bin++) {
+        stats->mJitterHistogram[bin] += next->mJitterHistogram[bin];
+    }
+    for (uint32_t bin = 0; bin < TS_DRIFT_BINS; bin++) {
+        stats->mDriftHistogram[bin] += next->mDriftHistogram[bin];
+    }
+    stats->mPCRJitterCount += next->mPCRJitterCount;
+    if (next->mMaxPCRJitter > stats->mMaxPCRJitter) {
+        stats->mMaxPCRJitter = next->mMaxPCRJitter;
+    }
+    if (next->mMaxPCRDrift > stats->mMaxPCRDrift) {
+        stats->mMaxPCRDrift = next->mMaxPCRDrift;
+    }
+    stats->mPCRFitOrigin = next->mPCRFitOrigin + packetOffset;
+    stats->mPCRFitSpan = next->mPCRFitSpan;
+    stats->mPCRFitCount = next->mPCRFitCount;
+    stats->mPCRFitMeanX = next->mPCRFitMeanX;
+    stats->mPCRFitMeanY = next->mPCRFitMeanY;
+    stats->mPCRFitCXX = next->mPCRFitCXX;
+    stats->mPCRFitCXY = next->mPCRFitCXY;
+    stats->mLastPCRJitter = next->mLastPCRJitter;
+    stats->mPCRTicksPerPacket = next->mPCRTicksPerPacket;
+    stats->mDriftWindowPacket = next->mDriftWindowPacket;
+    stats->mDriftWindowSpan = next->mDriftWindowSpan;
+    
+    stats->mLastPCR = next->mLastPCR;
+    stats->mLastPCRPacket = next->mLastPCRPacket + packetOffset;
+    stats->mPCRCount += next->mPCRCount;
+}
+
+/**
+ * Parse TS Packet Adaptation Field  读取标志位  PCR/OPCR 和 splice_countdown  其余字段和填充字节跳过
  * @param parser           TSParser Instance
- * @param bitReader       TSParser Instance
+ * @param bitReader       ABitReader Instance
  */
 void parseAdaptationField(TSParser *parser, ABitReader *bitReader) {
+    
     uint32_t adaptation_field_length = getBits(bitReader, 8);
-    if (adaptation_field_length > 0) {
-        skipBits(bitReader, adaptation_field_length * 8);
+    uint32_t remaining = adaptation_field_length;
+    uint32_t discontinuity_indicator, random_access_indicator, elementary_stream_priority_indicator;
+    uint32_t PCR_flag, OPCR_flag, splicing_point_flag, transport_private_data_flag, adaptation_field_extension_flag;
+    
+    color_print(COLOR_FT_WHITE, COLOR_BG_NONE, "==================== Start Parsing Adaptation Field ====================\n");
+    printf("Adaptation Field Length: %u\n", adaptation_field_length);
+    if (adaptation_field_length == 0) {
+        color_print(COLOR_FT_WHITE, COLOR_BG_NONE, "===================== End Parsing Adaptation Field =====================\n\n");
+        return;
+    }
+    
+    discontinuity_indicator = getBits(bitReader, 1);
+    random_access_indicator = getBits(bitReader, 1);
+    elementary_stream_priority_indicator = getBits(bitReader, 1);
+    PCR_flag = getBits(bitReader, 1);
+    OPCR_flag = getBits(bitReader, 1);
+    splicing_point_flag = getBits(bitReader, 1);
+    transport_private_data_flag = getBits(bitReader, 1);
+    adaptation_field_extension_flag = getBits(bitReader, 1);
+    remaining--;
+    printf("Discontinuity Indicator: %u\n", discontinuity_indicator);
+    printf("Random Access Indicator: %u\n", random_access_indicator);
+    printf("Elementary Stream Priority Indicator: %u\n", elementary_stream_priority_indicator);
+    
+    // PCR/OPCR = base(33bit) * 300 + extension(9bit)  中间 6bit 保留
+    if (PCR_flag && remaining >= 6) {
+        int64_t base = ((int64_t)getBits(bitReader, 1) << 32) | getBits(bitReader, 32);
+        uint32_t extension;
+        skipBits(bitReader, 6);
+        extension = getBits(bitReader, 9);
+        remaining -= 6;
+        printf("PCR: %lld (base %lld, extension %u, %.6f s)\n", (long long)(base * 300 + extension), (long long)base, extension, (base * 300 + extension) / (double)TS_PCR_HZ);
+    }
+    if (OPCR_flag && remaining >= 6) {
+        int64_t base = ((int64_t)getBits(bitReader, 1) << 32) | getBits(bitReader, 32);
+        uint32_t extension;
+        skipBits(bitReader, 6);
+        extension = getBits(bitReader, 9);
+        remaining -= 6;
+        printf("OPCR: %lld (%.6f s)\n", (long long)(base * 300 + extension), (base * 300 + extension) / (double)TS_PCR_HZ);
+    }
+    if (splicing_point_flag && remaining >= 1) {
+        printf("Splice Countdown: %d\n", (int8_t)getBits(bitReader, 8));
+        remaining--;
     }
+    if (transport_private_data_flag && remaining >= 1) {
+        uint32_t transport_private_data_length = getBits(bitReader, 8);
+        remaining--;
+        printf("Transport Private Data Length: %u\n", transport_private_data_length);
+        if (transport_private_data_length > remaining) {
+            transport_private_data_length = remaining;
+        }
+        skipBits(bitReader, transport_private_data_length * 8);
+        remaining -= transport_private_data_length;
+    }
+    if (adaptation_field_extension_flag && remaining >= 1) {
+        printf("Adaptation Field Extension Length: %u\n", getBits(bitReader, 8));
+        remaining--;
+    }
+    
+    // 扩展字段和填充字节
+    if (remaining > 0) {
+        skipBits(bitReader, remaining * 8);
+    }
+    color_print(COLOR_FT_WHITE, COLOR_BG_NONE, "===================== End Parsing Adaptation Field =====================\n\n");
 }
 
 /**
- * Parse TS Packet Program Id
+ * Parse Program Id  PAT/PMT/SDT 按 section 重组  完整后由 parseSection 解析
  * @param parser                                      TSParser Instance
- * @param bitReader                                  TSParser Instance
- * @param pid                                           Program Id
- * @param payload_unit_start_indicator        Payload Unit Start Indicator In TS Packet Header
+ * @param bitReader                                  ABitReader Instance
+ * @param pid                                            Program Id
+ * @param payload_unit_start_indicator       Payload Unit Start Indicator In TS Packet Header
+ * @param continuity_counter                    Continuity Counter In TS Packet Header
  */
-void parseProgramId(TSParser *parser, ABitReader *bitReader, uint32_t pid, uint32_t payload_unit_start_indicator) {
+void parseProgramId(TSParser *parser, ABitReader *bitReader, uint32_t pid, uint32_t payload_unit_start_indicator, uint32_t continuity_counter) {
     
-	int handled = 0;
-	TSPointersListItem *listItem;
-	TSProgram *pProgram;
+	TSPIDEntry *entry;
+    // 承载PSI的TS Packet Header的payload_unit_start_indicator为1时  载荷首字节承载pointer_field  由 pushSectionData 处理
+    const uint8_t *payload = getBitReaderData(bitReader);
+    size_t payloadSize = numBitsLeft(bitReader) / 8;
 
 	if (pid == 0) {
-        // 如果承载PSI的TS Packet Header的payload_unit_start_indicator为1  则载荷首字节承载pointer_field  PSI数据在 pointer_field 指示大小之后 因此需要跳过
-        if (payload_unit_start_indicator) {
-            uint32_t skip = getBits(bitReader, 8);
-            skipBits(bitReader, skip * 8);
-        }
-        // 解析PAT
-        parseProgramAssociationTable(parser, bitReader);
+        pushSectionData(parser, &parser->mPATSection, pid, payload, payloadSize, payload_unit_start_indicator, continuity_counter, parseSection);
         return;
     }
 
-    for (listItem = parser->mPrograms.mHead; listItem != NULL; listItem = listItem->mNext) {
-        pProgram = (TSProgram *)listItem->mData;
-        if(pid == pProgram->mProgramMapPID) {
-            // 跳过pointer_field
-            if(payload_unit_start_indicator) {
-                uint32_t skip = getBits(bitReader, 8);
-                skipBits(bitReader, skip * 8);
-            }
-            // 解析PMT
-            parseProgramMapTable(parser, pProgram, bitReader);
-            handled = 1;
+    // 直接按 PID 查表  不再逐个遍历节目和流的链表
+    entry = &parser->mPIDTable[pid & (TS_PID_COUNT - 1)];
+    switch (entry->mType) {
+        case TS_PID_PMT:
+            pushSectionData(parser, &((TSProgram *)entry->mTarget)->mSection, pid, payload, payloadSize, payload_unit_start_indicator, continuity_counter, parseSection);
             break;
-        } else {
+        case TS_PID_STREAM:
             // 解析PES
-            TSStream *pStream = getStreamByPID(pProgram, pid);
-            if(pStream != NULL) {
-                parseStream(pStream, payload_unit_start_indicator, bitReader);
-                handled = 1;
+            parseStream(parser, (TSStream *)entry->mTarget, payload_unit_start_indicator, bitReader);
+            break;
+        default:
+            if (pid == TS_SDT_PID) {
+                pushSectionData(parser, &parser->mSDTSection, pid, payload, payloadSize, payload_unit_start_indicator, continuity_counter, parseSection);
                 break;
             }
-        }
+            printf("PID 0x%04x not handled.\n\n", pid);
+            break;
     }
+}
 
-	if (!handled) {
-		printf("PID 0x%04x not handled.\n\n", pid);
-	}
+/**
+ * Parse Section  CRC 错误的丢弃  CRC 与当前表相同的重复发送直接跳过
+ * @param parser                 TSParser Instance
+ * @param pid                       section 所在的 PID
+ * @param section                section 数据  从 table_id 开始
+ * @param size                     section 大小
+ * @param crcValid              CRC 是否正确
+ */
+void parseSection(TSParser *parser, uint32_t pid, const uint8_t *section, size_t size, uint32_t crcValid) {
+    
+    ABitReader bitReader;
+    TSProgram *program = NULL;
+    TSPIDStats *stats = parser->mPIDStats ? &parser->mPIDStats[pid] : NULL;
+    uint32_t version_number;
+    uint32_t crc;
+    
+    if (stats) {
+        stats->mSections++;
+    }
+    // 没有 CRC 的短格式 section 不是 PAT/PMT/SDT
+    if (size < 12 || !(section[1] & 0x80)) {
+        printf("Section on PID 0x%04x (table_id 0x%02x) not handled.\n\n", pid, section[0]);
+        return;
+    }
+    version_number = (section[5] >> 1) & 0x1F;
+    crc = ((uint32_t)section[size - 4] << 24) | (section[size - 3] << 16) | (section[size - 2] << 8) | section[size - 1];
+    if (!crcValid) {
+        if (stats) {
+            stats->mCRCErrors++;
+        }
+        printf("Section on PID 0x%04x (table_id 0x%02x) CRC error, CRC field 0x%08x, dropped.\n\n", pid, section[0], crc);
+        return;
+    }
+    
+    if (pid == 0) {
+        if (parser->mPATVersion == version_number + 1 && parser->mPATCRC == crc) {
+            printf("PAT repeated, CRC 0x%08x, skipped.\n\n", crc);
+            return;
+        }
+        initABitReader(&bitReader, (uint8_t *)section, size);
+        parseProgramAssociationTable(parser, &bitReader);
+    } else if (parser->mPIDTable[pid].mType == TS_PID_PMT) {
+        program = getProgramByNumber(parser, pid, (section[3] << 8) | section[4]);
+        if (program == NULL) {
+            printf("PMT on PID 0x%04x for unknown program_number %u, ignored.\n\n", pid, (section[3] << 8) | section[4]);
+            return;
+        }
+        if (program->mVersion == version_number + 1 && program->mCRC == crc) {
+            printf("PMT of program %u repeated, CRC 0x%08x, skipped.\n\n", program->mProgramNumber, crc);
+            return;
+        }
+        initABitReader(&bitReader, (uint8_t *)section, size);
+        parseProgramMapTable(parser, program, &bitReader);
+    } else if (pid == TS_SDT_PID) {
+        if (parser->mSDTVersion == version_number + 1 && parser->mSDTCRC[section[6]] == ((1ULL << 32) | crc)) {
+            printf("SDT section %u repeated, CRC 0x%08x, skipped.\n\n", section[6], crc);
+            return;
+        }
+        initABitReader(&bitReader, (uint8_t *)section, size);
+        parseServiceDescriptionTable(parser, &bitReader);
+    }
 }
 
 /**
@@ -163,6 +911,10 @@ void parseProgramAssociationTable(TSParser *parser, ABitReader *bitReader) {
     color_print(COLOR_FT_YELLOW, COLOR_BG_NONE, "========================== Start Parsing PAT ===========================\n");
     
     size_t i = 0;
+    // parseSection 保证 bitReader 里是一个完整的 section  CRC 是最后4字节
+    const uint8_t *section = getBitReaderData(bitReader);
+    size_t sectionSize = numBitsLeft(bitReader) / 8;
+    uint32_t crc = ((uint32_t)section[sectionSize - 4] << 24) | (section[sectionSize - 3] << 16) | (section[sectionSize - 2] << 8) | section[sectionSize - 1];
     uint32_t table_id = getBits(bitReader, 8);
     printf("  table_id = %u\n", table_id);
     
@@ -176,14 +928,31 @@ void parseProgramAssociationTable(TSParser *parser, ABitReader *bitReader) {
     
     printf("  transport_stream_id = %u\n", getBits(bitReader, 16));
     printf("  reserved = %u\n", getBits(bitReader, 2));
-    printf("  version_number = %u\n", getBits(bitReader, 5));
-    printf("  current_next_indicator = %u\n", getBits(bitReader, 1));
+    
+    uint32_t version_number = getBits(bitReader, 5);
+    printf("  version_number = %u\n", version_number);
+    uint32_t current_next_indicator = getBits(bitReader, 1);
+    printf("  current_next_indicator = %u\n", current_next_indicator);
     printf("  section_number = %u\n", getBits(bitReader, 8));
     printf("  last_section_number = %u\n", getBits(bitReader, 8));
     
+    // section_length 小于 9 时 numProgramBytes 会下溢
+    if (table_id != 0x00 || section_length < 9 || 3 + section_length > sectionSize) {
+        printf("  Invalid PAT, skipped.\n");
+        color_print(COLOR_FT_YELLOW, COLOR_BG_NONE, "=========================== End Parsing PAT ============================\n\n");
+        return;
+    }
     size_t numProgramBytes = (section_length - 5 /* header */ - 4 /* crc */);
     printf("  numProgramBytes = %ld\n", numProgramBytes);
     
+    // 只有版本或 CRC 变化才重建节目列表  节目可能增删  清空后等待各 PMT 重新到达  current_next_indicator 为0的表还未生效
+    uint32_t changed = current_next_indicator && (parser->mPATVersion != version_number + 1 || parser->mPATCRC != crc);
+    if (changed) {
+        freePrograms(parser);
+        parser->mPATVersion = version_number + 1;
+        parser->mPATCRC = crc;
+    }
+    
     for (i = 0; i < numProgramBytes / 4; ++i) {
         uint32_t program_number = getBits(bitReader, 16);
         printf("    program_number = %u\n", program_number);
@@ -194,37 +963,79 @@ void parseProgramAssociationTable(TSParser *parser, ABitReader *bitReader) {
         } else {
             unsigned programMapPID = getBits(bitReader, 13);
             printf("    program_map_PID = 0x%04x\n", programMapPID);
-            addProgram(parser, programMapPID);
+            if (changed) {
+                addProgram(parser, program_number, programMapPID);
+            }
         }
     }
     printf("  CRC = 0x%08x\n", getBits(bitReader, 32));
     
+    if (changed) {
+        rebuildPIDTable(parser);
+    }
+    
     color_print(COLOR_FT_YELLOW, COLOR_BG_NONE, "=========================== End Parsing PAT ============================\n\n");
 }
 
 /**
  * Parse Stream
+ * @param parser                                     TSParser Instance
  * @param stream                                    TSStream Instance
  * @param payload_unit_start_indicator       Payload Unit Start Indicator In TS Packet Header
  * @param bitReader                                ABitReader Instance
  */
-void parseStream(TSStream *stream, uint32_t payload_unit_start_indicator, ABitReader *bitReader) {
+void parseStream(TSParser *parser, TSStream *stream, uint32_t payload_unit_start_indicator, ABitReader *bitReader) {
+    
+    uint8_t *payload = getBitReaderData(bitReader);
+    size_t payloadSize = numBitsLeft(bitReader) / 8;
     
-	size_t payloadSizeBits = 0;
 	if (payload_unit_start_indicator) {
 		if(stream->mPayloadStarted) {
 			flushStreamData(stream);
 		}
 		stream->mPayloadStarted = 1;
+        
+        // 整个 PES 都在这一个 TS Packet 内(一般是音频)  直接在包内解析  不拷贝到重组缓冲区
+        if (payloadSize >= 6 && payload[0] == 0x00 && payload[1] == 0x00 && payload[2] == 0x01) {
+            size_t PES_packet_length = (payload[4] << 8) | payload[5];
+            if (PES_packet_length != 0 && 6 + PES_packet_length <= payloadSize) {
+                ABitReader pesReader;
+                initABitReader(&pesReader, payload, 6 + PES_packet_length);
+                if (6 + PES_packet_length > stream->mMaxPESSize) {
+                    stream->mMaxPESSize = 6 + PES_packet_length;
+                }
+                parsePES(stream, &pesReader);
+                stream->mPayloadStarted = 0;
+                return;
+            }
+        }
 	}
     
     if (!stream->mPayloadStarted) {
         return;
     }
     
-    payloadSizeBits = numBitsLeft(bitReader);
-    memcpy(stream->mBuffer + stream->mBufferSize, getBitReaderData(bitReader), payloadSizeBits / 8);
-    stream->mBufferSize += (payloadSizeBits / 8);
+    // 缓冲区不够时换大一级  超过最大分级的 PES 丢弃  等待下一个 PES 开始
+    if (stream->mBufferSize + payloadSize > stream->mBufferCapacity) {
+        size_t capacity = 0;
+        uint8_t *buffer = acquirePESBuffer(parser, stream->mBufferSize + payloadSize, &capacity);
+        if (buffer == NULL) {
+            printf("PES on PID 0x%04x exceeds %d bytes, dropped.\n", stream->mElementaryPID, TS_PES_MAX_BUFFER);
+            stream->mDroppedPES++;
+            stream->mBufferSize = 0;
+            stream->mPayloadStarted = 0;
+            return;
+        }
+        if (stream->mBufferSize > 0) {
+            memcpy(buffer, stream->mBuffer, stream->mBufferSize);
+        }
+        releasePESBuffer(parser, stream->mBuffer, stream->mBufferCapacity);
+        stream->mBuffer = buffer;
+        stream->mBufferCapacity = capacity;
+    }
+    
+    memcpy(stream->mBuffer + stream->mBufferSize, payload, payloadSize);
+    stream->mBufferSize += payloadSize;
 }
 
 /**
@@ -234,11 +1045,70 @@ void parseStream(TSStream *stream, uint32_t payload_unit_start_indicator, ABitRe
 void flushStreamData(TSStream *stream) {
     
 	ABitReader bitReader;
-	initABitReader(&bitReader, (uint8_t *)stream->mBuffer, stream->mBufferSize);
+	initABitReader(&bitReader, stream->mBuffer, stream->mBufferSize);
+	if (stream->mBufferSize > stream->mMaxPESSize) {
+		stream->mMaxPESSize = stream->mBufferSize;
+	}
 	parsePES(stream, &bitReader);
 	stream->mBufferSize = 0;
 }
 
+/**
+ * Acquire PES Buffer From Pool
+ * @param parser                 TSParser Instance
+ * @param size                    需要的大小
+ * @param capacity              输出实际容量  即所在分级的大小
+ * @return 缓冲区  超过 TS_PES_MAX_BUFFER 或分配失败时返回 NULL
+ */
+uint8_t *acquirePESBuffer(TSParser *parser, size_t size, size_t *capacity) {
+    
+    size_t index = 0;
+    size_t classSize = TS_PES_MIN_BUFFER;
+    uint8_t *buffer;
+    
+    while (classSize < size && index < TS_PES_BUFFER_CLASSES - 1) {
+        classSize <<= 1;
+        index++;
+    }
+    if (classSize < size) {
+        return NULL;
+    }
+    
+    // 优先复用同一分级的空闲缓冲区
+    buffer = parser->mFreeBuffers[index];
+    if (buffer != NULL) {
+        memcpy(&parser->mFreeBuffers[index], buffer, sizeof(uint8_t *));
+    } else {
+        buffer = (uint8_t *)malloc(classSize);
+        if (buffer == NULL) {
+            return NULL;
+        }
+    }
+    
+    *capacity = classSize;
+    return buffer;
+}
+
+/**
+ * Release PES Buffer Into Pool
+ * @param parser                 TSParser Instance
+ * @param buffer                 acquirePESBuffer 返回的缓冲区  可以为 NULL
+ * @param capacity              缓冲区容量
+ */
+void releasePESBuffer(TSParser *parser, uint8_t *buffer, size_t capacity) {
+    
+    size_t index = 0;
+    
+    if (buffer == NULL) {
+        return;
+    }
+    while (((size_t)TS_PES_MIN_BUFFER << index) < capacity) {
+        index++;
+    }
+    memcpy(buffer, &parser->mFreeBuffers[index], sizeof(uint8_t *));
+    parser->mFreeBuffers[index] = buffer;
+}
+
 /**
  * Parse PES                                            https://blog.csdn.net/u013354805/article/details/51591229
  * @param stream                                    TSStream Instance
@@ -248,6 +1118,12 @@ void parsePES(TSStream *stream, ABitReader *bitReader) {
     
     color_print(COLOR_FT_DARK_GREEN, COLOR_BG_NONE, "======================= Start Parsing Former PES =======================\n");
     
+    // 不足一个 PES 头或者 optional header 不完整时不解析  ABitReader 读越界会卡死
+    if (numBitsLeft(bitReader) < 9 * 8) {
+        color_print(COLOR_FT_DARK_GREEN, COLOR_BG_NONE, "======================== End Parsing Former PES ========================\n\n");
+        return;
+    }
+    
     // packet_start_code_prefix  0x000001
     getBits(bitReader, 24);
     
@@ -284,6 +1160,11 @@ void parsePES(TSStream *stream, ABitReader *bitReader) {
         
         PES_header_data_length = getBits(bitReader, 8);
         optional_bytes_remaining = PES_header_data_length;
+        if (numBitsLeft(bitReader) < PES_header_data_length * 8 || PES_header_data_length < 5 * (PTS_DTS_flags >> 1) + 5 * (PTS_DTS_flags == 3) + 6 * ESCR_flag + 3 * ES_rate_flag) {
+            printf("  Truncated PES header, skipped.\n");
+            color_print(COLOR_FT_DARK_GREEN, COLOR_BG_NONE, "======================== End Parsing Former PES ========================\n\n");
+            return;
+        }
         
         if (PTS_DTS_flags == 2 || PTS_DTS_flags == 3) {
             skipBits(bitReader, 4);
@@ -316,6 +1197,13 @@ void parsePES(TSStream *stream, ABitReader *bitReader) {
         // ES data follows.
         if (PES_packet_length != 0) {
             uint32_t dataLength = PES_packet_length - 3 - PES_header_data_length;
+            // PES 被截断时只交出实际收到的数据
+            if (PES_packet_length < 3 + PES_header_data_length) {
+                dataLength = 0;
+            }
+            if (dataLength > numBitsLeft(bitReader) / 8) {
+                dataLength = (uint32_t)(numBitsLeft(bitReader) / 8);
+            }
             onPayloadData(stream, PTS_DTS_flags, PTS, DTS, getBitReaderData(bitReader), dataLength);
             skipBits(bitReader, dataLength * 8);
         } else {
@@ -323,12 +1211,8 @@ void parsePES(TSStream *stream, ABitReader *bitReader) {
             onPayloadData(stream, PTS_DTS_flags, PTS, DTS, getBitReaderData(bitReader), numBitsLeft(bitReader) / 8);
             payloadSizeBits = numBitsLeft(bitReader);
         }
-    } else if (stream_id == 0xbe) {
-        // padding_stream
-        skipBits(bitReader, PES_packet_length * 8);
-    } else {
-        skipBits(bitReader, PES_packet_length * 8);
     }
+    // padding_stream 等没有 PES 扩展头的流  后面没有需要读取的内容  不用跳过
     
     color_print(COLOR_FT_DARK_GREEN, COLOR_BG_NONE, "======================== End Parsing Former PES ========================\n\n");
 }
@@ -368,12 +1252,14 @@ void onPayloadData(TSStream *stream, uint32_t PTS_DTS_flag, uint64_t PTS, uint64
 /**
  * Add Program Into Parser Program List
  * @param parser                                      TSParser Instance
+ * @param programNumber                          Program Number
  * @param programMapPID                          Program Map Id
  */
-void addProgram(TSParser *parser, uint32_t programMapPID) {
+void addProgram(TSParser *parser, uint32_t programNumber, uint32_t programMapPID) {
     
 	TSProgram *program = (TSProgram *)malloc(sizeof(TSProgram));
 	memset(program, 0, sizeof(TSProgram));
+	program->mProgramNumber = programNumber;
 	program->mProgramMapPID = programMapPID;
 	addItemToList(&parser->mPrograms, program);
 }
@@ -393,11 +1279,61 @@ void addStream(TSProgram *program, uint32_t elementaryPID, uint32_t streamType)
 	stream->mElementaryPID = elementaryPID;
 	stream->mStreamType = streamType;
 
-	printf("  Add Stream. PID: %d, Stream Type: %d (%X)\n", elementaryPID, streamType, streamType);
-
 	addItemToList(&program->mStreams, stream);
 }
 
+/**
+ * 复制 DVB 字符串  跳过开头的字符表选择字节  控制字符替换为空格
+ * @param dst                       输出  至少 TS_MAX_SERVICE_NAME 字节
+ * @param src                       DVB 字符串
+ * @param length                  字符串长度  最大 255
+ */
+static void copyDVBString(char *dst, const uint8_t *src, size_t length) {
+    
+    size_t i = 0;
+    size_t n = 0;
+    
+    // 0x10 后面还有2字节的 ISO/IEC 8859 编号  其他小于 0x20 的字节只有1字节
+    if (length > 0 && src[0] < 0x20) {
+        i = src[0] == 0x10 ? 3 : 1;
+    }
+    for (; i < length && n + 1 < TS_MAX_SERVICE_NAME; i++) {
+        // 0x80-0x9F 是 DVB 的控制码  比如 0x86/0x87 强调开关  0x8A 换行
+        if (src[i] < 0x20 || (src[i] >= 0x80 && src[i] < 0xA0)) {
+            if (src[i] == 0x8A) {
+                dst[n++] = ' ';
+            }
+            continue;
+        }
+        dst[n++] = (char)src[i];
+    }
+    dst[n] = '\0';
+}
+
+/**
+ * Add Service Into Parser Service List  已有的服务更新名字
+ * @param parser                                      TSParser Instance
+ * @param serviceID                                  service_id
+ * @param serviceType                              service_type
+ * @param provider                                   service_provider_name
+ * @param providerLength                         service_provider_name 长度
+ * @param name                                        service_name
+ * @param nameLength                              service_name 长度
+ */
+void addService(TSParser *parser, uint32_t serviceID, uint32_t serviceType, const uint8_t *provider, size_t providerLength, const uint8_t *name, size_t nameLength) {
+    
+    TSService *service = getServiceByID(parser, serviceID);
+    if (service == NULL) {
+        service = (TSService *)malloc(sizeof(TSService));
+        memset(service, 0, sizeof(TSService));
+        service->mServiceID = serviceID;
+        addItemToList(&parser->mServices, service);
+    }
+    service->mServiceType = serviceType;
+    copyDVBString(service->mProviderName, provider, providerLength);
+    copyDVBString(service->mServiceName, name, nameLength);
+}
+
 /**
  * Add Item Into List
  * @param list                         list
@@ -437,6 +1373,181 @@ TSStream *getStreamByPID(TSProgram *program, uint32_t pid) {
 	return NULL;
 }
 
+/**
+ * Get TSProgram With Program Number  多个节目可以共用同一个 PMT PID
+ * @param parser                 TSParser Instance
+ * @param programMapPID   PMT 所在的 PID
+ * @param programNumber   Program Number
+ */
+TSProgram *getProgramByNumber(TSParser *parser, uint32_t programMapPID, uint32_t programNumber) {
+    
+    TSPointersListItem *programItem;
+    for (programItem = parser->mPrograms.mHead; programItem != NULL; programItem = programItem->mNext) {
+        TSProgram *program = (TSProgram *)programItem->mData;
+        if (program->mProgramMapPID == programMapPID && program->mProgramNumber == programNumber) {
+            return program;
+        }
+    }
+    return NULL;
+}
+
+/**
+ * Get TSService With Service Id
+ * @param parser                 TSParser Instance
+ * @param serviceID             service_id  与 program_number 相同
+ */
+TSService *getServiceByID(TSParser *parser, uint32_t serviceID) {
+    
+    TSPointersListItem *serviceItem;
+    for (serviceItem = parser->mServices.mHead; serviceItem != NULL; serviceItem = serviceItem->mNext) {
+        TSService *service = (TSService *)serviceItem->mData;
+        if (service->mServiceID == serviceID) {
+            return service;
+        }
+    }
+    return NULL;
+}
+
+/**
+ * Rebuild PID Dispatch Table From Program List
+ * @param parser                 TSParser Instance
+ */
+void rebuildPIDTable(TSParser *parser) {
+    
+    TSPointersListItem *programItem;
+    TSPointersListItem *streamItem;
+    
+    memset(parser->mPIDTable, 0, sizeof(parser->mPIDTable));
+    for (programItem = parser->mPrograms.mHead; programItem != NULL; programItem = programItem->mNext) {
+        TSProgram *program = (TSProgram *)programItem->mData;
+        for (streamItem = program->mStreams.mHead; streamItem != NULL; streamItem = streamItem->mNext) {
+            TSStream *stream = (TSStream *)streamItem->mData;
+            if (parser->mPIDTable[stream->mElementaryPID].mType == TS_PID_NONE) {
+                parser->mPIDTable[stream->mElementaryPID].mType = TS_PID_STREAM;
+                parser->mPIDTable[stream->mElementaryPID].mTarget = stream;
+            }
+        }
+    }
+    
+    // 与原来的遍历顺序一致  PMT PID 优先于同 PID 的流
+    for (programItem = parser->mPrograms.mHead; programItem != NULL; programItem = programItem->mNext) {
+        TSProgram *program = (TSProgram *)programItem->mData;
+        parser->mPIDTable[program->mProgramMapPID].mType = TS_PID_PMT;
+        parser->mPIDTable[program->mProgramMapPID].mTarget = program;
+    }
+}
+
+/**
+ * 复制 PAT/PMT 解析结果  统计模式下节目和流的状态只由 PAT/PMT 决定  复制后与 source 处理同样的包结果相同
+ * @param parser                 TSParser Instance  原有的节目会被释放
+ * @param source                复制来源
+ */
+void copyProgramState(TSParser *parser, const TSParser *source) {
+    
+    TSPointersListItem *programItem;
+    TSPointersListItem *streamItem;
+    
+    freePrograms(parser);
+    parser->mPATVersion = source->mPATVersion;
+    parser->mPATCRC = source->mPATCRC;
+    parser->mPATSection = source->mPATSection;
+    for (programItem = source->mPrograms.mHead; programItem != NULL; programItem = programItem->mNext) {
+        const TSProgram *program = (const TSProgram *)programItem->mData;
+        TSProgram *copy;
+        
+        addProgram(parser, program->mProgramNumber, program->mProgramMapPID);
+        copy = (TSProgram *)parser->mPrograms.mTail->mData;
+        copy->mPCRPID = program->mPCRPID;
+        copy->mVersion = program->mVersion;
+        copy->mCRC = program->mCRC;
+        copy->mSection = program->mSection;
+        for (streamItem = program->mStreams.mHead; streamItem != NULL; streamItem = streamItem->mNext) {
+            const TSStream *stream = (const TSStream *)streamItem->mData;
+            addStream(copy, stream->mElementaryPID, stream->mStreamType);
+        }
+    }
+    // SDT 的重组状态影响 section 统计  解析结果由 copyServiceState 复制
+    parser->mSDTSection = source->mSDTSection;
+    rebuildPIDTable(parser);
+}
+
+/**
+ * 复制 SDT 解析结果  业务列表不影响包的统计  分段统计时单独合并
+ * @param parser                 TSParser Instance  原有的业务会被释放
+ * @param source                复制来源
+ */
+void copyServiceState(TSParser *parser, const TSParser *source) {
+    
+    TSPointersListItem *serviceItem;
+    
+    freeServices(parser);
+    for (serviceItem = source->mServices.mHead; serviceItem != NULL; serviceItem = serviceItem->mNext) {
+        TSService *copy = (TSService *)malloc(sizeof(TSService));
+        memcpy(copy, serviceItem->mData, sizeof(TSService));
+        addItemToList(&parser->mServices, copy);
+    }
+    parser->mSDTVersion = source->mSDTVersion;
+    memcpy(parser->mSDTCRC, source->mSDTCRC, sizeof(parser->mSDTCRC));
+}
+
+/**
+ * 比较两个 section 的重组状态
+ * @param section                TSSection Instance
+ * @param other                  TSSection Instance
+ * @return 相同返回0  不同返回1
+ */
+static int compareSectionState(const TSSection *section, const TSSection *other) {
+    
+    if (section->mSize != other->mSize || section->mHasCC != other->mHasCC || section->mLastCC != other->mLastCC) {
+        return 1;
+    }
+    return memcmp(section->mData, other->mData, section->mSize) != 0;
+}
+
+/**
+ * 比较两个 parser 的 PAT/PMT 解析结果
+ * SDT 只影响业务列表  不比较版本和业务  只在有未完成的 SDT section 时比较重组状态  否则边界处的 section 个数会不同
+ * @param parser                 TSParser Instance
+ * @param other                  TSParser Instance
+ * @return 相同返回0  不同返回1
+ */
+int compareProgramState(const TSParser *parser, const TSParser *other) {
+    
+    const TSPointersListItem *programItem = parser->mPrograms.mHead;
+    const TSPointersListItem *otherProgramItem = other->mPrograms.mHead;
+    
+    if (parser->mPATVersion != other->mPATVersion || parser->mPATCRC != other->mPATCRC || compareSectionState(&parser->mPATSection, &other->mPATSection)) {
+        return 1;
+    }
+    if ((parser->mSDTSection.mSize != 0 || other->mSDTSection.mSize != 0)
+        && (parser->mSDTSection.mSize != other->mSDTSection.mSize || memcmp(parser->mSDTSection.mData, other->mSDTSection.mData, parser->mSDTSection.mSize) != 0)) {
+        return 1;
+    }
+    for (; programItem != NULL && otherProgramItem != NULL; programItem = programItem->mNext, otherProgramItem = otherProgramItem->mNext) {
+        const TSProgram *program = (const TSProgram *)programItem->mData;
+        const TSProgram *otherProgram = (const TSProgram *)otherProgramItem->mData;
+        const TSPointersListItem *streamItem = program->mStreams.mHead;
+        const TSPointersListItem *otherStreamItem = otherProgram->mStreams.mHead;
+        
+        if (program->mProgramNumber != otherProgram->mProgramNumber || program->mProgramMapPID != otherProgram->mProgramMapPID
+            || program->mPCRPID != otherProgram->mPCRPID || program->mVersion != otherProgram->mVersion
+            || program->mCRC != otherProgram->mCRC || compareSectionState(&program->mSection, &otherProgram->mSection)) {
+            return 1;
+        }
+        for (; streamItem != NULL && otherStreamItem != NULL; streamItem = streamItem->mNext, otherStreamItem = otherStreamItem->mNext) {
+            const TSStream *stream = (const TSStream *)streamItem->mData;
+            const TSStream *otherStream = (const TSStream *)otherStreamItem->mData;
+            if (stream->mElementaryPID != otherStream->mElementaryPID || stream->mStreamType != otherStream->mStreamType) {
+                return 1;
+            }
+        }
+        if (streamItem != NULL || otherStreamItem != NULL) {
+            return 1;
+        }
+    }
+    return programItem != NULL || otherProgramItem != NULL;
+}
+
 /**
  * Parse Program Map Table
  * @param parser                             TSParser Instance
@@ -456,6 +1567,14 @@ void parseProgramMapTable(TSParser *parser, TSProgram *program, ABitReader *bitR
     uint32_t elementaryPID;
     uint32_t ES_info_length;
     uint32_t info_bytes_remaining;
+    uint32_t version_number;
+    uint32_t current_next_indicator;
+    uint32_t changed;
+    uint32_t PCR_PID;
+    // parseSection 保证 bitReader 里是一个完整的 section  CRC 是最后4字节
+    const uint8_t *section = getBitReaderData(bitReader);
+    size_t sectionSize = numBitsLeft(bitReader) / 8;
+    uint32_t crc = ((uint32_t)section[sectionSize - 4] << 24) | (section[sectionSize - 3] << 16) | (section[sectionSize - 2] << 8) | section[sectionSize - 1];
     
     table_id = getBits(bitReader, 8);
     printf("  table_id = %u\n", table_id);
@@ -469,17 +1588,29 @@ void parseProgramMapTable(TSParser *parser, TSProgram *program, ABitReader *bitR
     printf("  section_length = %u\n", section_length);
     printf("  program_number = %u\n", getBits(bitReader, 16));
     printf("  reserved = %u\n", getBits(bitReader, 2));
-    printf("  version_number = %u\n", getBits(bitReader, 5));
-    printf("  current_next_indicator = %u\n", getBits(bitReader, 1));
+    
+    version_number = getBits(bitReader, 5);
+    printf("  version_number = %u\n", version_number);
+    current_next_indicator = getBits(bitReader, 1);
+    printf("  current_next_indicator = %u\n", current_next_indicator);
     printf("  section_number = %u\n", getBits(bitReader, 8));
     printf("  last_section_number = %u\n", getBits(bitReader, 8));
     printf("  reserved = %u\n", getBits(bitReader, 3));
-    printf("  PCR_PID = 0x%04x\n", getBits(bitReader, 13));
+    
+    PCR_PID = getBits(bitReader, 13);
+    printf("  PCR_PID = 0x%04x\n", PCR_PID);
     printf("  reserved = %u\n", getBits(bitReader, 4));
     
     program_info_length = getBits(bitReader, 12);
     printf("  program_info_length = %u\n", program_info_length);
     
+    // 长度不合法时 infoBytesRemaining 会下溢
+    if (table_id != 0x02 || section_length < 13 || 3 + section_length > sectionSize || 9 + program_info_length + 4 > section_length) {
+        printf("  Invalid PMT, skipped.\n");
+        color_print(COLOR_FT_PURPLE, COLOR_BG_NONE, "=========================== End Parsing PMT ============================\n\n");
+        return;
+    }
+    
     skipBits(bitReader, program_info_length * 8);  // skip descriptors
     
     // infoBytesRemaining is the number of bytes that make up the
@@ -487,7 +1618,16 @@ void parseProgramMapTable(TSParser *parser, TSProgram *program, ABitReader *bitR
     // final CRC.
     infoBytesRemaining = section_length - 9 - program_info_length - 4;
     
-    while (infoBytesRemaining > 0) {
+    // PMT 版本或 CRC 变化时流可能增删  清空后按新的 PMT 重新添加
+    changed = current_next_indicator && (program->mVersion != version_number + 1 || program->mCRC != crc);
+    if (changed) {
+        freeProgramResources(parser, program);
+        program->mVersion = version_number + 1;
+        program->mCRC = crc;
+        program->mPCRPID = PCR_PID;
+    }
+    
+    while (infoBytesRemaining >= 5) {
         streamType = getBits(bitReader, 8);
         printf("    stream_type = 0x%02x\n", streamType);
         printf("    reserved = %u\n", getBits(bitReader, 3));
@@ -498,6 +1638,9 @@ void parseProgramMapTable(TSParser *parser, TSProgram *program, ABitReader *bitR
         
         ES_info_length = getBits(bitReader, 12);
         printf("    ES_info_length = %u\n", ES_info_length);
+        if (5 + ES_info_length > infoBytesRemaining) {
+            break;
+        }
         
         info_bytes_remaining = ES_info_length;
         while (info_bytes_remaining >= 2) {
@@ -506,27 +1649,269 @@ void parseProgramMapTable(TSParser *parser, TSProgram *program, ABitReader *bitR
             
             descLength = getBits(bitReader, 8);
             printf("      len = %u\n", descLength);
+            // 描述符长度越界时截断到 ES_info 结尾
+            if (descLength + 2 > info_bytes_remaining) {
+                descLength = info_bytes_remaining - 2;
+            }
             
             skipBits(bitReader, descLength * 8);
             info_bytes_remaining -= descLength + 2;
         }
         
-        if(getStreamByPID(program, elementaryPID) == NULL)
+        if(changed && getStreamByPID(program, elementaryPID) == NULL) {
+            printf("  Add Stream. PID: %d, Stream Type: %d (%X)\n", elementaryPID, streamType, streamType);
             addStream(program, elementaryPID, streamType);
+        }
         
         infoBytesRemaining -= 5 + ES_info_length;
     }
     
     printf("  CRC = 0x%08x\n", getBits(bitReader, 32));
+    
+    if (changed) {
+        rebuildPIDTable(parser);
+    }
    
     color_print(COLOR_FT_PURPLE, COLOR_BG_NONE, "=========================== End Parsing PMT ============================\n\n");
 }
 
 /**
- * Free Program Resources
+ * Parse Service Description Table  输出每个服务的 service_descriptor  服务列表由 parseServiceDescriptionSection 更新
+ * @param parser                             TSParser Instance
+ * @param bitReader                         ABitReader Instance  一个完整的 section
+ */
+void parseServiceDescriptionTable(TSParser *parser, ABitReader *bitReader) {
+    
+    color_print(COLOR_FT_DARK_GREEN, COLOR_BG_NONE, "========================== Start Parsing SDT ===========================\n");
+    
+    const uint8_t *section = getBitReaderData(bitReader);
+    size_t sectionSize = numBitsLeft(bitReader) / 8;
+    uint32_t table_id = getBits(bitReader, 8);
+    printf("  table_id = 0x%02x\n", table_id);
+    printf("  section_syntax_indicator = %u\n", getBits(bitReader, 1));
+    printf("  reserved_future_use = %u\n", getBits(bitReader, 1));
+    printf("  reserved = %u\n", getBits(bitReader, 2));
+    
+    uint32_t section_length = getBits(bitReader, 12);
+    printf("  section_length = %u\n", section_length);
+    printf("  transport_stream_id = %u\n", getBits(bitReader, 16));
+    printf("  reserved = %u\n", getBits(bitReader, 2));
+    printf("  version_number = %u\n", getBits(bitReader, 5));
+    printf("  current_next_indicator = %u\n", getBits(bitReader, 1));
+    printf("  section_number = %u\n", getBits(bitReader, 8));
+    printf("  last_section_number = %u\n", getBits(bitReader, 8));
+    printf("  original_network_id = %u\n", getBits(bitReader, 16));
+    printf("  reserved_future_use = %u\n", getBits(bitReader, 8));
+    
+    // table_id 0x46 是 other_transport_stream  不解析服务
+    if (table_id != 0x42 || section_length < 12 || 3 + section_length > sectionSize) {
+        printf("  SDT other transport stream or invalid, skipped.\n");
+        color_print(COLOR_FT_DARK_GREEN, COLOR_BG_NONE, "=========================== End Parsing SDT ============================\n\n");
+        return;
+    }
+    
+    size_t serviceBytesRemaining = section_length - 8 - 4;
+    while (serviceBytesRemaining >= 5) {
+        printf("    service_id = %u\n", getBits(bitReader, 16));
+        printf("    reserved_future_use = %u\n", getBits(bitReader, 6));
+        printf("    EIT_schedule_flag = %u\n", getBits(bitReader, 1));
+        printf("    EIT_present_following_flag = %u\n", getBits(bitReader, 1));
+        printf("    running_status = %u\n", getBits(bitReader, 3));
+        printf("    free_CA_mode = %u\n", getBits(bitReader, 1));
+        
+        uint32_t descriptors_loop_length = getBits(bitReader, 12);
+        printf("    descriptors_loop_length = %u\n", descriptors_loop_length);
+        if (5 + descriptors_loop_length > serviceBytesRemaining) {
+            break;
+        }
+        
+        size_t descBytesRemaining = descriptors_loop_length;
+        while (descBytesRemaining >= 2) {
+            const uint8_t *descriptor = getBitReaderData(bitReader);
+            uint32_t tag = getBits(bitReader, 8);
+            uint32_t descLength = getBits(bitReader, 8);
+            printf("      tag = 0x%02x\n", tag);
+            printf("      len = %u\n", descLength);
+            // 描述符长度越界时截断到描述符循环结尾
+            if (descLength + 2 > descBytesRemaining) {
+                descLength = (uint32_t)descBytesRemaining - 2;
+            }
+            
+            // service_descriptor  service_type + provider_name + service_name
+            if (tag == 0x48 && descLength >= 3 && 2u + descriptor[3] < descLength && 3u + descriptor[3] + descriptor[4 + descriptor[3]] <= descLength) {
+                char provider[TS_MAX_SERVICE_NAME];
+                char name[TS_MAX_SERVICE_NAME];
+                copyDVBString(provider, descriptor + 4, descriptor[3]);
+                copyDVBString(name, descriptor + 5 + descriptor[3], descriptor[4 + descriptor[3]]);
+                printf("      service_type = 0x%02x\n", descriptor[2]);
+                printf("      service_provider_name = %s\n", provider);
+                printf("      service_name = %s\n", name);
+            }
+            
+            skipBits(bitReader, descLength * 8);
+            descBytesRemaining -= descLength + 2;
+        }
+        skipBits(bitReader, descBytesRemaining * 8);
+        serviceBytesRemaining -= 5 + descriptors_loop_length;
+    }
+    printf("  CRC = 0x%02x%02x%02x%02x\n", section[section_length - 1], section[section_length], section[section_length + 1], section[section_length + 2]);
+    
+    parseServiceDescriptionSection(parser, section, sectionSize);
+    
+    color_print(COLOR_FT_DARK_GREEN, COLOR_BG_NONE, "=========================== End Parsing SDT ============================\n\n");
+}
+
+/**
+ * 向 section 追加数据  凑齐一个完整的 section 后交给 handler
+ * @param parser                 TSParser Instance
+ * @param section                TSSection Instance
+ * @param pid                       section 所在的 PID
+ * @param data                    数据
+ * @param size                     数据大小
+ * @param handler               section 处理函数
+ * @return 使用的字节数  section 长度不合法时丢弃未完成的 section 并返回 size
+ */
+static size_t appendSectionData(TSParser *parser, TSSection *section, uint32_t pid, const uint8_t *data, size_t size, TSSectionHandler handler) {
+    
+    size_t used = 0;
+    size_t length;
+    size_t copy;
+    
+    // 先收齐3字节的 section 头才能知道 section 长度
+    if (section->mSize < 3) {
+        copy = 3 - section->mSize < size ? 3 - section->mSize : size;
+        memcpy(section->mData + section->mSize, data, copy);
+        section->mSize += copy;
+        used += copy;
+        if (section->mSize < 3) {
+            return used;
+        }
+    }
+    
+    length = 3 + (((section->mData[1] & 0x0F) << 8) | section->mData[2]);
+    if (length > TS_MAX_SECTION_SIZE) {
+        section->mSize = 0;
+        return size;
+    }
+    copy = length - section->mSize < size - used ? length - section->mSize : size - used;
+    memcpy(section->mData + section->mSize, data + used, copy);
+    section->mSize += copy;
+    used += copy;
+    
+    if (section->mSize == length) {
+        // 长格式 section 整体(包括 CRC_32)的 CRC 为0
+        uint32_t crcValid = !(section->mData[1] & 0x80) || (length >= 12 && crc32MPEG2(section->mData, length) == 0);
+        section->mSize = 0;
+        handler(parser, pid, section->mData, length, crcValid);
+    }
+    return used;
+}
+
+/**
+ * 按 TS 包的载荷重组 PSI section  CC 不连续时丢弃未完成的 section  重复包忽略
+ * @param parser                                      TSParser Instance
+ * @param section                                     TSSection Instance
+ * @param pid                                            section 所在的 PID
+ * @param payload                                    TS 包载荷
+ * @param size                                          载荷大小
+ * @param payload_unit_start_indicator       为1时载荷首字节是 pointer_field
+ * @param continuity_counter                    Continuity Counter In TS Packet Header
+ * @param handler                                    完整 section 的处理函数
+ */
+void pushSectionData(TSParser *parser, TSSection *section, uint32_t pid, const uint8_t *payload, size_t size, uint32_t payload_unit_start_indicator, uint32_t continuity_counter, TSSectionHandler handler) {
+    
+    size_t pos = 0;
+    
+    if (section->mHasCC) {
+        if (continuity_counter == section->mLastCC) {
+            return;
+        }
+        if (continuity_counter != ((section->mLastCC + 1) & 0x0F)) {
+            section->mSize = 0;
+        }
+    }
+    section->mLastCC = continuity_counter;
+    section->mHasCC = 1;
+    
+    if (!payload_unit_start_indicator) {
+        // 没有开始的 section 时  载荷是丢失了开头的 section 的后半部分
+        if (section->mSize > 0) {
+            appendSectionData(parser, section, pid, payload, size, handler);
+        }
+        return;
+    }
+    
+    if (size == 0 || 1 + (size_t)payload[0] > size) {
+        section->mSize = 0;
+        return;
+    }
+    // pointer_field 之前是上一个 section 的结尾
+    if (section->mSize > 0) {
+        appendSectionData(parser, section, pid, payload + 1, payload[0], handler);
+        section->mSize = 0;
+    }
+    
+    // 一个包里可以有多个 section  table_id 为 0xFF 表示后面都是填充
+    for (pos = 1 + payload[0]; pos < size && payload[pos] != 0xFF; ) {
+        pos += appendSectionData(parser, section, pid, payload + pos, size - pos, handler);
+        if (section->mSize > 0) {
+            break;
+        }
+    }
+}
+
+static uint32_t crc32Table[8][256];
+static pthread_once_t crc32TableOnce = PTHREAD_ONCE_INIT;
+
+/**
+ * 生成 slice-by-8 查找表  crc32Table[k][i] 为字节 i 后面再跟 k 个0字节的 CRC
+ */
+static void initCRC32Table(void) {
+    
+    uint32_t i, j, k;
+    
+    for (i = 0; i < 256; i++) {
+        uint32_t crc = i << 24;
+        for (j = 0; j < 8; j++) {
+            crc = (crc & 0x80000000) ? (crc << 1) ^ 0x04C11DB7 : crc << 1;
+        }
+        crc32Table[0][i] = crc;
+    }
+    for (k = 1; k < 8; k++) {
+        for (i = 0; i < 256; i++) {
+            crc32Table[k][i] = (crc32Table[k - 1][i] << 8) ^ crc32Table[0][crc32Table[k - 1][i] >> 24];
+        }
+    }
+}
+
+/**
+ * CRC32/MPEG-2  多项式 0x04C11DB7  初值 0xFFFFFFFF  不反转  每次处理8字节
+ * @param data                    数据
+ * @param size                     数据大小
+ * @return CRC  对包括 CRC_32 字段的整个 section 计算时正确的 section 结果为0
+ */
+uint32_t crc32MPEG2(const uint8_t *data, size_t size) {
+    
+    uint32_t crc = 0xFFFFFFFF;
+    
+    pthread_once(&crc32TableOnce, initCRC32Table);
+    for (; size >= 8; data += 8, size -= 8) {
+        crc ^= ((uint32_t)data[0] << 24) | (data[1] << 16) | (data[2] << 8) | data[3];
+        crc = crc32Table[7][crc >> 24] ^ crc32Table[6][(crc >> 16) & 0xFF] ^ crc32Table[5][(crc >> 8) & 0xFF] ^ crc32Table[4][crc & 0xFF]
+            ^ crc32Table[3][data[4]] ^ crc32Table[2][data[5]] ^ crc32Table[1][data[6]] ^ crc32Table[0][data[7]];
+    }
+    for (; size > 0; data++, size--) {
+        crc = (crc << 8) ^ crc32Table[0][(crc >> 24) ^ *data];
+    }
+    return crc;
+}
+
+/**
+ * Free Program Resources  PES 缓冲区归还缓冲池
+ * @param parser                        TSParser Instance
  * @param program                      TSProgram Instance
  */
-void freeProgramResources(TSProgram *program) {
+void freeProgramResources(TSParser *parser, TSProgram *program) {
 	// Free Streams
 	TSPointersListItem *item;
 	TSStream *pStream;
@@ -536,17 +1921,19 @@ void freeProgramResources(TSProgram *program) {
 
 		if(item->mData != NULL) {
 			pStream = (TSStream *)item->mData;
+			releasePESBuffer(parser, pStream->mBuffer, pStream->mBufferCapacity);
 			free(pStream);
 		}
 		free(item);
 	}
+	program->mStreams.mTail = NULL;
 }
 
 /**
- * Free Parser Resources
+ * Free All Programs  PAT 版本变化时调用  缓冲池保留给新的节目复用
  * @param parser                      TSParser Instance
  */
-void freeParserResources(TSParser *parser) {
+void freePrograms(TSParser *parser) {
 	// Free Programs
 	TSPointersListItem *item;
 	TSProgram *pProgram;
@@ -556,9 +1943,48 @@ void freeParserResources(TSParser *parser) {
 
 		if(item->mData != NULL) {
 			pProgram = (TSProgram *)item->mData;
-			freeProgramResources(pProgram);
+			freeProgramResources(parser, pProgram);
 			free(pProgram);
 		}
 		free(item);
 	}
+	parser->mPrograms.mTail = NULL;
+	memset(parser->mPIDTable, 0, sizeof(parser->mPIDTable));
+}
+
+/**
+ * Free All Services  SDT 版本变化时调用
+ * @param parser                      TSParser Instance
+ */
+void freeServices(TSParser *parser) {
+    
+    TSPointersListItem *item;
+    while (parser->mServices.mHead != NULL) {
+        item = parser->mServices.mHead;
+        parser->mServices.mHead = item->mNext;
+        free(item->mData);
+        free(item);
+    }
+    parser->mServices.mTail = NULL;
+}
+
+/**
+ * Free Parser Resources
+ * @param parser                      TSParser Instance
+ */
+void freeParserResources(TSParser *parser) {
+    
+    size_t i;
+    uint8_t *buffer;
+    
+    freePrograms(parser);
+    freeServices(parser);
+    
+    // 释放缓冲池
+    for (i = 0; i < TS_PES_BUFFER_CLASSES; i++) {
+        while ((buffer = parser->mFreeBuffers[i]) != NULL) {
+            memcpy(&parser->mFreeBuffers[i], buffer, sizeof(uint8_t *));
+            free(buffer);
+        }
+    }
 }
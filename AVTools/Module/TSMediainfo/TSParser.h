@@ -28,6 +28,32 @@
 #define TS_STREAM_VIDEO	  0x1b
 #define TS_STREAM_AUDIO   0x0f
 
+#define TS_PES_MIN_BUFFER        (4 * 1024)           // PES 缓冲区最小分级
+#define TS_PES_BUFFER_CLASSES    13                   // 4KB 起按2倍分级  最大 16MB
+#define TS_PES_MAX_BUFFER        (TS_PES_MIN_BUFFER << (TS_PES_BUFFER_CLASSES - 1))
+
+#define TS_PID_COUNT      8192    // PID 为 13 位
+#define TS_NULL_PID       0x1FFF
+#define TS_SDT_PID        0x11
+
+#define TS_PCR_HZ                27000000LL    // PCR 时钟 27MHz
+#define TS_PCR_WRAP              ((int64_t)300 << 33)    // PCR base 33bit 回绕
+#define TS_PCR_MAX_GAP           (TS_PCR_HZ / 10)        // 没有 discontinuity_indicator 时两个 PCR 的最大间隔  超过认为时基不连续
+#define TS_PCR_FIT_MIN           10                      // 拟合至少这么多个 PCR 后才统计 PCR 抖动
+#define TS_DRIFT_WINDOW          TS_PCR_HZ               // 每 1s 的 PCR 计算一次漂移
+#define TS_JITTER_BINS           8                       // PCR 抖动直方图  第 k 个区间上限为 TS_JITTER_BIN_NS * 2^k  最后一个区间没有上限
+#define TS_JITTER_BIN_NS         62.5
+#define TS_DRIFT_BINS            8                       // PCR 漂移直方图  第 k 个区间上限为 TS_DRIFT_BIN_PPM * 2^k
+#define TS_DRIFT_BIN_PPM         0.5
+
+#define TS_MAX_SECTION_SIZE      4096      // private_section 最大 4096 字节  PAT/PMT 不超过 1024 字节
+#define TS_MAX_SERVICE_NAME      256
+
+// PID 分派表中的类型  PID 0 固定为 PAT  不在表中
+#define TS_PID_NONE       0
+#define TS_PID_PMT        1
+#define TS_PID_STREAM     2
+
 // Linked lists structure
 typedef struct TSPointersListItem {
 	void *mData;
@@ -39,44 +65,168 @@ typedef struct TSSPointersList {
 	TSPointersListItem *mTail;
 } TSPointersList;
 
+// PSI section 重组  一个 section 可以跨多个 TS 包  一个 TS 包里也可以有多个 section
+typedef struct TSSection {
+	uint8_t mData[TS_MAX_SECTION_SIZE];
+	size_t mSize;              // 已收到的字节数  0 表示没有未完成的 section
+	uint8_t mLastCC;
+	uint8_t mHasCC;
+} TSSection;
+
+// 完整的 section  crcValid 为 CRC32/MPEG-2 校验结果
+struct TSParser;
+typedef void (*TSSectionHandler)(struct TSParser *parser, uint32_t pid, const uint8_t *section, size_t size, uint32_t crcValid);
+
 // Programs (one TS file could have 1 or more programs)
 typedef struct TSProgram {
+	uint32_t mProgramNumber;
 	uint32_t mProgramMapPID;
+	uint32_t mPCRPID;
+	uint32_t mVersion;    // PMT version_number + 1  0 表示还没收到 PMT
+	uint32_t mCRC;        // 当前 PMT 的 CRC  重复发送的 PMT CRC 相同时直接跳过
 	TSPointersList mStreams;
+	TSSection mSection;   // PMT PID 上的 section 重组  多个节目共用 PMT PID 时只用查表得到的那个节目的
 } TSProgram;
 
+// SDT 中的服务  service_id 与 PAT 中的 program_number 对应
+typedef struct TSService {
+	uint32_t mServiceID;
+	uint32_t mServiceType;
+	char mProviderName[TS_MAX_SERVICE_NAME];
+	char mServiceName[TS_MAX_SERVICE_NAME];
+} TSService;
+
 // Streams (one program could have one or more streams)
 typedef struct TSStream {
 	TSProgram *mProgram;
 	uint32_t mElementaryPID;
 	uint32_t mStreamType;
 	uint32_t mPayloadStarted;
-	char mBuffer[128*1024];
-	int mBufferSize;
+	uint8_t *mBuffer;          // PES 重组缓冲区  从 parser 的缓冲池按分级取得  不够时换大一级  PES 之间复用
+	size_t mBufferSize;
+	size_t mBufferCapacity;
+	size_t mMaxPESSize;        // 出现过的最大 PES
+	uint64_t mDroppedPES;      // 超过 TS_PES_MAX_BUFFER 被丢弃的 PES 个数
 } TSStream;
 
+// 统计模式下每个 PID 的累计数据  时间戳单位 PTS/DTS 90kHz  PCR 27MHz
+typedef struct TSPIDStats {
+	uint64_t mPackets;
+	uint64_t mCCErrors;
+	uint64_t mErrorPackets;          // transport_error_indicator 置1的包数
+	uint64_t mScrambledPackets;
+	uint64_t mUnitStarts;            // payload_unit_start_indicator 置1的包数  即 PES 或 PSI section 个数
+	int64_t mMinPTS, mMaxPTS;
+	int64_t mMinDTS, mMaxDTS;
+	uint64_t mPCRCount;
+	int64_t mFirstPCR, mLastPCR;
+	uint64_t mFirstPCRPacket, mLastPCRPacket;    // PCR 所在包在整个文件中的序号  用于计算复用码率
+	int64_t mMinPCRInterval, mMaxPCRInterval;
+	int64_t mPCRIntervalSum;
+	uint64_t mPCRIntervals;
+	uint8_t mLastCC;
+	uint8_t mHasCC;
+	uint8_t mHasPTS;
+	uint8_t mHasDTS;
+	uint8_t mFirstCC;                 // 以下三项用于分段统计合并时检查分段边界处的 CC 和 PCR 间隔
+	uint8_t mFirstCCDiscontinuity;
+	uint8_t mFirstPCRDiscontinuity;
+	uint64_t mSections;              // 重组完成的 PSI section 个数
+	uint64_t mCRCErrors;             // CRC 校验失败的 section 个数
+	uint64_t mDiscontinuities;       // discontinuity_indicator 置1的包数
+	uint64_t mRandomAccessPoints;    // random_access_indicator 置1的包数
+	double mMinMuxRate, mMaxMuxRate;    // 相邻两个 PCR 之间的瞬时复用码率  bit/s
+	double mPCRTicksPerPacket;       // 最近两个连续的 PCR 之间每个包的 PCR 增量  0 表示还不知道
+	// PCR 相对包序号做最小二乘拟合  固定码率下拟合直线即理想 PCR  从上一次 PCR 不连续处开始  x 为包数  y 为 PCR 增量
+	uint64_t mPCRFitOrigin;          // 拟合起点 PCR 所在包的序号
+	uint64_t mPCRFitCCErrors;        // 最近一个 PCR 时 parser 的 mCCErrorCount  不同表示期间有包丢失  包序号不再准确
+	int64_t mPCRFitSpan;             // 拟合起点到最近一个 PCR 的增量
+	uint64_t mPCRFitCount;
+	double mPCRFitMeanX, mPCRFitMeanY;
+	double mPCRFitCXX, mPCRFitCXY;
+	double mLastPCRJitter;           // 最近一个 PCR 相对拟合直线的偏差  27MHz
+	double mMaxPCRJitter;            // 绝对值最大的偏差
+	uint64_t mPCRJitterCount;
+	uint64_t mJitterHistogram[TS_JITTER_BINS];
+	uint64_t mDriftWindowPacket;     // 当前漂移窗口起点  与拟合起点的距离
+	int64_t mDriftWindowSpan;
+	double mMaxPCRDrift;             // 每个窗口的码率相对拟合斜率的偏差  绝对值最大的  ppm
+	uint64_t mDriftHistogram[TS_DRIFT_BINS];
+	// PES 头到达时 DTS(没有时用 PTS) 与节目当前 PCR 的差  即在解码器缓冲区中停留的时间  单位 27MHz
+	int64_t mMinBufferLevel, mMaxBufferLevel;
+	int64_t mBufferLevelSum;
+	uint64_t mBufferLevels;
+	uint64_t mLateUnits;             // 到达时已经过了解码时间的 PES 个数
+} TSPIDStats;
+
+// PID 分派表项  mTarget 按 mType 指向 TSProgram 或 TSStream
+typedef struct TSPIDEntry {
+	uint32_t mType;
+	void *mTarget;
+} TSPIDEntry;
+
 // Parser. Keeps a reference to the list of programs
 typedef struct TSParser {
 	TSPointersList mPrograms;
+	uint32_t mPATVersion;                     // PAT version_number + 1  0 表示还没收到 PAT
+	uint32_t mPATCRC;                         // 当前 PAT 的 CRC  重复发送的 PAT CRC 相同时直接跳过
+	TSSection mPATSection;
+	TSPointersList mServices;                 // SDT actual_transport_stream 中的服务
+	uint32_t mSDTVersion;                     // SDT version_number + 1  版本变化时清空服务列表
+	uint64_t mSDTCRC[256];                    // 每个 section_number 最近一次的 CRC  bit32 置1表示已收到
+	TSSection mSDTSection;
+	TSPIDEntry mPIDTable[TS_PID_COUNT];       // 每个包按 PID 直接查表  PAT/PMT 版本变化时重建
+	uint8_t *mFreeBuffers[TS_PES_BUFFER_CLASSES];    // 每个分级空闲 PES 缓冲区链表  缓冲区头部保存下一个的指针
+	TSPIDStats *mPIDStats;                    // 统计模式  TS_PID_COUNT 项  由调用者分配
+	uint64_t mPacketCount;                    // 统计模式已处理的包数
+	uint64_t mCCErrorCount;                   // 统计模式所有 PID 的 CC 错误个数  PCR 拟合以包序号为 x  任何 PID 丢包都要重新拟合
+	void *mUserData;                          // 调用者的私有数据  TSParser 不使用
 } TSParser;
 
 void parseTSPacket(TSParser *parser, uint8_t *packet_buffer, size_t packet_size);
+void parseTSPacketStats(TSParser *parser, const uint8_t *packet);
+void parseProgramAssociationSection(TSParser *parser, const uint8_t *section, size_t size);
+void parseProgramMapSection(TSParser *parser, TSProgram *program, const uint8_t *section, size_t size);
+void parseServiceDescriptionSection(TSParser *parser, const uint8_t *section, size_t size);
+void parseSectionStats(TSParser *parser, uint32_t pid, const uint8_t *section, size_t size, uint32_t crcValid);
+int64_t parsePESHeaderStats(TSPIDStats *stats, const uint8_t *data, size_t size);
+void mergePIDStats(TSPIDStats *stats, const TSPIDStats *next, uint64_t packetOffset);
 void parseAdaptationField(TSParser *parser, ABitReader *bitReader);
-void parseProgramId(TSParser *parser, ABitReader *bitReader, uint32_t pid, uint32_t payload_unit_start_indicator);
+void updatePCRStats(TSPIDStats *stats, int64_t pcr, uint32_t discontinuity_indicator, uint64_t ccErrors, uint64_t index);
+void updateBufferLevel(TSParser *parser, TSPIDStats *stats, const TSStream *stream, int64_t timestamp, uint64_t index);
+void parseProgramId(TSParser *parser, ABitReader *bitReader, uint32_t pid, uint32_t payload_unit_start_indicator, uint32_t continuity_counter);
+void parseSection(TSParser *parser, uint32_t pid, const uint8_t *section, size_t size, uint32_t crcValid);
 void parseProgramAssociationTable(TSParser *parser, ABitReader *bitReader);
 void parseProgramMapTable(TSParser *parser, TSProgram *program, ABitReader *bitReader);
-void parseStream(TSStream *stream, uint32_t payload_unit_start_indicator, ABitReader *bitReader);
+void parseServiceDescriptionTable(TSParser *parser, ABitReader *bitReader);
+void parseStream(TSParser *parser, TSStream *stream, uint32_t payload_unit_start_indicator, ABitReader *bitReader);
 void parsePES(TSStream *stream, ABitReader *bitReader);
 int64_t parseTSTimestamp(ABitReader *bitReader);
 
-void addProgram(TSParser *parser, uint32_t programMapPID);
+void addProgram(TSParser *parser, uint32_t programNumber, uint32_t programMapPID);
 void addStream(TSProgram *program, uint32_t elementaryPID, uint32_t streamType);
+void addService(TSParser *parser, uint32_t serviceID, uint32_t serviceType, const uint8_t *provider, size_t providerLength, const uint8_t *name, size_t nameLength);
+
+void pushSectionData(TSParser *parser, TSSection *section, uint32_t pid, const uint8_t *payload, size_t size, uint32_t payload_unit_start_indicator, uint32_t continuity_counter, TSSectionHandler handler);
+uint32_t crc32MPEG2(const uint8_t *data, size_t size);
 
 TSStream *getStreamByPID(TSProgram *program, uint32_t pid);
+TSProgram *getProgramByNumber(TSParser *parser, uint32_t programMapPID, uint32_t programNumber);
+TSService *getServiceByID(TSParser *parser, uint32_t serviceID);
+void rebuildPIDTable(TSParser *parser);
+void copyProgramState(TSParser *parser, const TSParser *source);
+void copyServiceState(TSParser *parser, const TSParser *source);
+int compareProgramState(const TSParser *parser, const TSParser *other);
 
 void flushStreamData(TSStream *stream);
 void onPayloadData(TSStream *stream, uint32_t PTS_DTS_flag, uint64_t PTS, uint64_t DTS, uint8_t *data, size_t size);
 
+uint8_t *acquirePESBuffer(TSParser *parser, size_t size, size_t *capacity);
+void releasePESBuffer(TSParser *parser, uint8_t *buffer, size_t capacity);
+
+void freeProgramResources(TSParser *parser, TSProgram *program);
+void freePrograms(TSParser *parser);
+void freeServices(TSParser *parser);
 void freeParserResources(TSParser *parser);
 
 void addItemToList(TSPointersList *list, void *data);
@@ -80,6 +80,10 @@ uint32_t getBits(ABitReader *bitReader, size_t n) {
         // 如果已读缓冲区没有数据  重新读取
         if (bitReader->mNumBitsLeft == 0) {
             fillReservoir(bitReader);
+            // 数据已经读完  剩余位按0返回  否则 m 一直为0 死循环
+            if (bitReader->mNumBitsLeft == 0) {
+                return n >= 32 ? 0 : result << n;
+            }
         }
         
         size_t m = n;